@@ -0,0 +1,147 @@
+/**
+* @file bench_lame.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief Microbenchmark of lame alone, without reading or writing files, per block size.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <lame.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define		SAMPLE_RATE			44100		//!< Sample rate of the samples encoded
+#define		DEFAULT_SECONDS		10			//!< Length of the samples encoded per measurement
+
+int g_i_json = 0;						//!< 1: Print JSON instead of a table
+int g_i_results = 0;					//!< Results printed so far
+
+// Samples per lame_encode_buffer call. 2048 is what wave_to_mp3 hands over for 16 bit stereo.
+int g_pi_block_samples[] = {576, 1152, 2048, 4096, 8192, 16384};
+
+double get_seconds()
+{
+	timespec s_time;
+	clock_gettime(CLOCK_MONOTONIC, &s_time);
+	return s_time.tv_sec + s_time.tv_nsec*1e-9;
+}
+
+/**
+*	Encode the samples once, with the settings of lame_pool.
+*	@return Time taken in seconds.
+*/
+double encode(short **ppi_pcm, int i_samples, int i_channels, int i_quality, int i_block_samples, long *pl_mp3_bytes)
+{
+	int i_mp3_buffer_size = (int)(1.25 * i_block_samples) + 7200;	// Worst case, as documented by lame
+	unsigned char *pc_mp3_buffer = new unsigned char[i_mp3_buffer_size];
+
+	double d_start = get_seconds();
+	lame_t lame = lame_init();
+	lame_set_in_samplerate(lame, SAMPLE_RATE);
+	lame_set_num_channels(lame, i_channels);
+	lame_set_VBR(lame, vbr_default);
+	lame_set_VBR_q(lame, i_quality);
+	if(lame_init_params(lame) < 0)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot initialize lame encoder.\n", __FILE__,  __LINE__);
+		exit(1);
+	}
+
+	long l_mp3_bytes = 0;
+	for(int i=0;i<i_samples;i+=i_block_samples)
+	{
+		int i_block = (i_samples - i < i_block_samples) ? i_samples - i : i_block_samples;
+		int i_bytes = lame_encode_buffer(lame, ppi_pcm[0] + i, (i_channels == 2) ? ppi_pcm[1] + i : NULL, i_block,
+			pc_mp3_buffer, i_mp3_buffer_size);
+		if(i_bytes < 0)
+		{
+			fprintf(stderr, "File %s Line %d: ERROR lame returned %d.\n", __FILE__,  __LINE__, i_bytes);
+			exit(1);
+		}
+		l_mp3_bytes += i_bytes;
+	}
+	l_mp3_bytes += lame_encode_flush(lame, pc_mp3_buffer, i_mp3_buffer_size);
+	lame_close(lame);
+	double d_seconds = get_seconds() - d_start;
+
+	delete [] pc_mp3_buffer;
+	*pl_mp3_bytes = l_mp3_bytes;
+	return d_seconds;
+}
+
+void show_usage(char *pc_prog_name)
+{
+	fprintf(stderr, "\nUsage: %s [-q quality] [-s seconds] [-j] [-h]\n", pc_prog_name);
+	fprintf(stderr, "-q quality:   MP3 quality, 0: highest (default), 9: lowest.\n");
+	fprintf(stderr, "-s seconds:   length of the samples encoded per measurement (default %d).\n", DEFAULT_SECONDS);
+	fprintf(stderr, "-j:           print the results as JSON.\n");
+	fprintf(stderr, "-h:           show this help\n\n");
+}
+
+int main(int argc, char **argv)
+{
+	int i_quality = 0;
+	int i_seconds = DEFAULT_SECONDS;
+
+	for(int i=1;i<argc;i++)
+	{
+		if(strcmp(argv[i], "-q") == 0 && i+1 < argc)
+			i_quality = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-s") == 0 && i+1 < argc)
+			i_seconds = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-j") == 0)
+			g_i_json = 1;
+		else
+		{
+			show_usage(argv[0]);
+			return 1;
+		}
+	}
+	if(i_seconds < 1 || i_quality < 0 || i_quality > 9)
+	{
+		show_usage(argv[0]);
+		return 1;
+	}
+
+	// A sine on each channel with some noise, so that the encoder has to work
+	int i_samples = SAMPLE_RATE * i_seconds;
+	short *ppi_pcm[2];
+	unsigned int ui_noise = 1;
+	for(int c=0;c<2;c++)
+	{
+		ppi_pcm[c] = new short[i_samples];
+		for(int i=0;i<i_samples;i++)
+		{
+			ui_noise = ui_noise * 1664525 + 1013904223;
+			ppi_pcm[c][i] = (short)(16000 * sin(2 * M_PI * (440 + 110*c) * i / SAMPLE_RATE) + ((int)ui_noise >> 20));
+		}
+	}
+
+	if(g_i_json)
+		printf("{\"bench\": \"lame\", \"quality\": %d, \"seconds\": %d, \"results\": [", i_quality, i_seconds);
+	for(int i_channels=1;i_channels<=2;i_channels++)
+	{
+		for(size_t b=0;b<sizeof(g_pi_block_samples)/sizeof(g_pi_block_samples[0]);b++)
+		{
+			long l_mp3_bytes;
+			double d_seconds = encode(ppi_pcm, i_samples, i_channels, i_quality, g_pi_block_samples[b], &l_mp3_bytes);
+			double d_ns_per_sample = d_seconds * 1e9 / i_samples;
+			if(g_i_json)
+				printf("%s\n    {\"name\": \"lame_encode_buffer\", \"channels\": %d, \"block_samples\": %d, "
+					"\"ns_per_sample\": %.3f, \"x_realtime\": %.3f, \"mp3_bytes\": %ld}", g_i_results ? "," : "",
+					i_channels, g_pi_block_samples[b], d_ns_per_sample, i_seconds / d_seconds, l_mp3_bytes);
+			else
+				printf("%d ch %6d samples per call %10.3f ns_per_sample %9.3f x_realtime %9ld mp3 bytes\n", i_channels,
+					g_pi_block_samples[b], d_ns_per_sample, i_seconds / d_seconds, l_mp3_bytes);
+			g_i_results++;
+		}
+	}
+	if(g_i_json)
+		printf("\n]}\n");
+
+	delete [] ppi_pcm[0];
+	delete [] ppi_pcm[1];
+	return 0;
+}
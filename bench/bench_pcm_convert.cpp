@@ -0,0 +1,139 @@
+/**
+* @file bench_pcm_convert.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief Microbenchmark of the PCM conversion kernels, checked against the scalar ones.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <pcm_convert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define		BLOCK_SAMPLES		4093		//!< Samples converted at once, odd so that the kernels run their tails
+#define		MIN_BENCH_SECONDS	0.2			//!< Every measurement is repeated for at least this long
+
+int g_i_json = 0;						//!< 1: Print JSON instead of a table
+int g_i_results = 0;					//!< Results printed so far
+
+double get_seconds()
+{
+	timespec s_time;
+	clock_gettime(CLOCK_MONOTONIC, &s_time);
+	return s_time.tv_sec + s_time.tv_nsec*1e-9;
+}
+
+/**
+*	Time a kernel and compare what it writes with the scalar kernel.
+*	@return 0: Same output as the scalar kernel, otherwise: different.
+*/
+int bench_kernel(int i_bytes, int i_channels, int i_out_bytes, pcm_isa e_isa, const unsigned char *pc_src)
+{
+	pcm_convert_func p_convert = pcm_get_convert_func(i_bytes, i_channels, i_out_bytes, e_isa);
+	pcm_convert_func p_scalar = pcm_get_convert_func(i_bytes, i_channels, i_out_bytes, PCM_ISA_SCALAR);
+
+	// Guard bytes after every output, which no kernel may touch
+	int i_dst_bytes = BLOCK_SAMPLES * i_out_bytes + 64;
+	unsigned char *ppc_dst[2], *ppc_ref[2];
+	for(int c=0;c<2;c++)
+	{
+		ppc_dst[c] = new unsigned char[i_dst_bytes];
+		ppc_ref[c] = new unsigned char[i_dst_bytes];
+		memset(ppc_dst[c], 0xA5, i_dst_bytes);
+		memset(ppc_ref[c], 0xA5, i_dst_bytes);
+	}
+
+	p_scalar(pc_src, (void **)ppc_ref, BLOCK_SAMPLES);
+	p_convert(pc_src, (void **)ppc_dst, BLOCK_SAMPLES);
+	int i_mismatch = 0;
+	for(int c=0;c<2;c++)
+		i_mismatch |= memcmp(ppc_dst[c], ppc_ref[c], i_dst_bytes);
+
+	long l_samples = 0;
+	double d_start = get_seconds(), d_seconds;
+	do
+	{
+		for(int i=0;i<100;i++)
+			p_convert(pc_src, (void **)ppc_dst, BLOCK_SAMPLES);
+		l_samples += 100 * BLOCK_SAMPLES;
+	}
+	while((d_seconds = get_seconds() - d_start) < MIN_BENCH_SECONDS);
+
+	double d_ns_per_sample = d_seconds * 1e9 / l_samples;
+	double d_mb_per_s = l_samples * i_bytes * i_channels / d_seconds / 1e6;
+	const char *pc_out = (i_out_bytes == sizeof(short)) ? "short" : "int";
+	if(g_i_json)
+		printf("%s\n    {\"name\": \"pcm_convert\", \"bits\": %d, \"channels\": %d, \"out\": \"%s\", \"isa\": \"%s\", "
+			"\"ns_per_sample\": %.3f, \"mb_per_s\": %.3f, \"matches_scalar\": %s}", g_i_results ? "," : "",
+			i_bytes*8, i_channels, pc_out, pcm_get_isa_name(e_isa), d_ns_per_sample, d_mb_per_s, i_mismatch ? "false" : "true");
+	else
+		printf("%2d bit %d ch to %-5s %-7s %10.3f ns_per_sample %12.3f mb_per_s %s\n", i_bytes*8, i_channels, pc_out,
+			pcm_get_isa_name(e_isa), d_ns_per_sample, d_mb_per_s, i_mismatch ? "MISMATCH" : "ok");
+	g_i_results++;
+
+	for(int c=0;c<2;c++)
+	{
+		delete [] ppc_dst[c];
+		delete [] ppc_ref[c];
+	}
+	return i_mismatch;
+}
+
+void show_usage(char *pc_prog_name)
+{
+	fprintf(stderr, "\nUsage: %s [-j] [-h]\n", pc_prog_name);
+	fprintf(stderr, "-j:           print the results as JSON.\n");
+	fprintf(stderr, "-h:           show this help\n\n");
+	fprintf(stderr, "Times every kernel the CPU runs, and exits with 1 if one does not write\n");
+	fprintf(stderr, "the same samples as the scalar kernel.\n\n");
+}
+
+int main(int argc, char **argv)
+{
+	for(int i=1;i<argc;i++)
+	{
+		if(strcmp(argv[i], "-j") == 0)
+			g_i_json = 1;
+		else
+		{
+			show_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	// Random bytes, so that every bit of every sample is checked
+	unsigned char *pc_src = new unsigned char[BLOCK_SAMPLES * 4 * 2];
+	unsigned int ui_random = 1;
+	for(int i=0;i<BLOCK_SAMPLES * 4 * 2;i++)
+	{
+		ui_random = ui_random * 1664525 + 1013904223;
+		pc_src[i] = ui_random >> 24;
+	}
+
+	if(g_i_json)
+		printf("{\"bench\": \"pcm_convert\", \"best_isa\": \"%s\", \"results\": [", pcm_get_isa_name(pcm_get_best_isa()));
+	int i_mismatches = 0;
+	for(int i_bytes=2;i_bytes<=4;i_bytes++)
+	{
+		for(int i_channels=1;i_channels<=2;i_channels++)
+		{
+			for(int i_out_bytes=sizeof(short);i_out_bytes<=(int)sizeof(int);i_out_bytes+=sizeof(int)-sizeof(short))
+			{
+				for(int i_isa=PCM_ISA_SCALAR;i_isa<=pcm_get_best_isa();i_isa++)
+				{
+					// Only the instruction sets with a kernel of their own for this format
+					if(i_isa > PCM_ISA_SCALAR && pcm_get_convert_func(i_bytes, i_channels, i_out_bytes, (pcm_isa)i_isa) ==
+						pcm_get_convert_func(i_bytes, i_channels, i_out_bytes, (pcm_isa)(i_isa-1)))
+						continue;
+					i_mismatches += bench_kernel(i_bytes, i_channels, i_out_bytes, (pcm_isa)i_isa, pc_src) != 0;
+				}
+			}
+		}
+	}
+	if(g_i_json)
+		printf("\n]}\n");
+
+	delete [] pc_src;
+	return i_mismatches ? 1 : 0;
+}
@@ -0,0 +1,286 @@
+/**
+* @file bench_wave_read.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief Microbenchmark of reading wave files, per format, and of parsing their headers.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <wave_read.h>
+#include <wav2mp3.h>
+#include <buffer_arena.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+
+#define		SAMPLE_RATE			44100		//!< Sample rate of the fixtures
+#define		DEFAULT_SECONDS		30			//!< Length of the fixtures, long enough to be mapped
+#define		READ_SAMPLES		2048		//!< Samples per fill_wave_buffer, as the encoder reads 16 bit stereo
+#define		MIN_BENCH_SECONDS	0.2			//!< Every measurement is repeated for at least this long
+
+/**
+*	Read a whole wave file of one format.
+*	@return Samples (per channel) read.
+*/
+typedef long (*read_func)(wave_read *pc_wave_read, char *pc_wave_file, void **ppv_pcm);
+
+/**
+*	Format read by the benchmark.
+*/
+typedef struct _bench_format
+{
+	int			i_bytes;				//!< Bytes per sample
+	int			i_channels;				//!< Number of channels
+	int			i_out_bytes;			//!< sizeof(short) or sizeof(int)
+	read_func	p_read;					//!< Reads a file of this format
+} bench_format;
+
+int g_i_json = 0;						//!< 1: Print JSON instead of a table
+int g_i_results = 0;					//!< Results printed so far
+
+double get_seconds()
+{
+	timespec s_time;
+	clock_gettime(CLOCK_MONOTONIC, &s_time);
+	return s_time.tv_sec + s_time.tv_nsec*1e-9;
+}
+
+template <int BYTES, int CHANNELS, typename T>
+long read_file(wave_read *pc_wave_read, char *pc_wave_file, void **ppv_pcm)
+{
+	pc_wave_read->init(pc_wave_file, READ_SAMPLES * BYTES * CHANNELS);
+	long l_samples = 0;
+	int i_bytes;
+	while((i_bytes = pc_wave_read->fill_wave_buffer<BYTES, CHANNELS, T>((T **)ppv_pcm, READ_SAMPLES)) > 0)
+		l_samples += i_bytes / (BYTES * CHANNELS);
+	return l_samples;
+}
+
+bench_format g_s_formats[] = {
+	{2, 1, sizeof(short), read_file<2, 1, short>},
+	{2, 2, sizeof(short), read_file<2, 2, short>},
+	{3, 1, sizeof(int), read_file<3, 1, int>},
+	{3, 2, sizeof(int), read_file<3, 2, int>},
+	{4, 1, sizeof(int), read_file<4, 1, int>},
+	{4, 2, sizeof(int), read_file<4, 2, int>},
+	{3, 2, sizeof(short), read_file<3, 2, short>},
+	{4, 2, sizeof(short), read_file<4, 2, short>},
+};
+
+/**
+*	Write a wave file of a sine with some noise, so that no two samples are alike.
+*/
+void make_fixture(const char *pc_wave_file, int i_bytes, int i_channels, int i_seconds)
+{
+	int i_samples = SAMPLE_RATE * i_seconds;
+	int i_block_align = i_bytes * i_channels;
+	wave_header s_header;
+	memcpy(s_header.group_id, "RIFF", 4);
+	s_header.file_size = sizeof(wave_header) - 8 + i_samples * i_block_align;
+	memcpy(s_header.wave, "WAVE", 4);
+	memcpy(s_header.subchunk1_id, "fmt ", 4);
+	s_header.subchunk1_size = 16;
+	s_header.audio_format = 1;
+	s_header.num_channels = i_channels;
+	s_header.sample_rate = SAMPLE_RATE;
+	s_header.bitrate = SAMPLE_RATE * i_block_align;
+	s_header.block_align = i_block_align;
+	s_header.bits_per_sample = i_bytes * 8;
+	memcpy(s_header.chunk2_id, "data", 4);
+	s_header.chunk2_size = i_samples * i_block_align;
+
+	FILE *f_wave = fopen(pc_wave_file, "wb");
+	if(f_wave == NULL)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot write %s.\n", __FILE__, __LINE__, pc_wave_file);
+		exit(1);
+	}
+	fwrite(&s_header, sizeof(wave_header), 1, f_wave);
+
+	unsigned char *pc_data = new unsigned char[(long)i_samples * i_block_align];
+	unsigned int ui_noise = 1;
+	long l_pos = 0;
+	for(int i=0;i<i_samples;i++)
+	{
+		for(int c=0;c<i_channels;c++)
+		{
+			ui_noise = ui_noise * 1664525 + 1013904223;
+			double d_sample = 0.5 * sin(2 * M_PI * (440 + 110*c) * i / SAMPLE_RATE) + ((int)ui_noise >> 8) / 16777216.0 * 0.1;
+			int i_sample = (int)(d_sample * 2147483647.0);
+			for(int b=0;b<i_bytes;b++)	// Little endian, the upper bytes of the 32 bit sample
+				pc_data[l_pos++] = i_sample >> (8 * (4 - i_bytes + b));
+		}
+	}
+	fwrite(pc_data, 1, (long)i_samples * i_block_align, f_wave);
+	delete [] pc_data;
+	fclose(f_wave);
+}
+
+void print_result(const char *pc_name, const char *pc_fields, double d_value, const char *pc_unit, double d_value2, const char *pc_unit2)
+{
+	if(g_i_json)
+	{
+		printf("%s\n    {\"name\": \"%s\", %s, \"%s\": %.3f", g_i_results ? "," : "", pc_name, pc_fields, pc_unit, d_value);
+		if(pc_unit2)
+			printf(", \"%s\": %.3f", pc_unit2, d_value2);
+		printf("}");
+	}
+	else
+	{
+		printf("%-20s %-50s %12.3f %s", pc_name, pc_fields, d_value, pc_unit);
+		if(pc_unit2)
+			printf(" %12.3f %s", d_value2, pc_unit2);
+		printf("\n");
+	}
+	g_i_results++;
+}
+
+void bench_formats(const char *pc_dir, int i_seconds)
+{
+	buffer_arena *pc_arena = new buffer_arena();
+	wave_read *pc_wave_read = new wave_read(pc_arena);
+	int *ppi_pcm[2];
+	ppi_pcm[0] = new int[READ_SAMPLES];
+	ppi_pcm[1] = new int[READ_SAMPLES];
+
+	for(size_t f=0;f<sizeof(g_s_formats)/sizeof(g_s_formats[0]);f++)
+	{
+		bench_format *ps_format = &g_s_formats[f];
+		char pc_wave_file[1024];
+		snprintf(pc_wave_file, sizeof(pc_wave_file), "%s/bench_%d_%d.wav", pc_dir, ps_format->i_bytes*8, ps_format->i_channels);
+		make_fixture(pc_wave_file, ps_format->i_bytes, ps_format->i_channels, i_seconds);
+
+		ps_format->p_read(pc_wave_read, pc_wave_file, (void **)ppi_pcm);	// Into the page cache
+		long l_samples = 0;
+		double d_start = get_seconds(), d_seconds;
+		do
+		{
+			l_samples += ps_format->p_read(pc_wave_read, pc_wave_file, (void **)ppi_pcm);
+		}
+		while((d_seconds = get_seconds() - d_start) < MIN_BENCH_SECONDS);
+
+		char pc_fields[256];
+		const char *pc_mode[] = {"fread", "mmap", "whole", "async"};
+		snprintf(pc_fields, sizeof(pc_fields), g_i_json ? "\"bits\": %d, \"channels\": %d, \"out\": \"%s\", \"mode\": \"%s\"" :
+			"%d bit %d ch to %s (%s)", ps_format->i_bytes*8, ps_format->i_channels,
+			ps_format->i_out_bytes == sizeof(short) ? "short" : "int", pc_mode[pc_wave_read->get_read_mode()]);
+		print_result("fill_wave_buffer", pc_fields, d_seconds * 1e9 / l_samples, "ns_per_sample",
+			l_samples * ps_format->i_bytes * ps_format->i_channels / d_seconds / 1e6, "mb_per_s");
+		unlink(pc_wave_file);
+	}
+
+	delete [] ppi_pcm[0];
+	delete [] ppi_pcm[1];
+	delete pc_wave_read;
+	delete pc_arena;
+}
+
+void bench_headers(const char *pc_dir)
+{
+	char pc_wave_file[1024];
+	snprintf(pc_wave_file, sizeof(pc_wave_file), "%s/bench_header.wav", pc_dir);
+	make_fixture(pc_wave_file, 2, 2, 0);	// Header only
+
+	// Opening, reading and parsing the header, as for every file encoded
+	buffer_arena *pc_arena = new buffer_arena();
+	wave_read *pc_wave_read = new wave_read(pc_arena);
+	long l_headers = 0;
+	double d_start = get_seconds(), d_seconds;
+	do
+	{
+		pc_wave_read->init(pc_wave_file, READ_SAMPLES * 4);
+		l_headers++;
+	}
+	while((d_seconds = get_seconds() - d_start) < MIN_BENCH_SECONDS);
+	print_result("header_file", g_i_json ? "\"bits\": 16, \"channels\": 2" : "16 bit 2 ch", l_headers / d_seconds, "headers_per_s", 0, NULL);
+	delete pc_wave_read;
+	delete pc_arena;
+
+	// Parsing only
+	unsigned char pc_wave[sizeof(wave_header)];
+	FILE *f_wave = fopen(pc_wave_file, "rb");
+	if(f_wave == NULL || fread(pc_wave, sizeof(pc_wave), 1, f_wave) != 1)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot read %s.\n", __FILE__, __LINE__, pc_wave_file);
+		exit(1);
+	}
+	fclose(f_wave);
+	unlink(pc_wave_file);
+
+	wav2mp3_format s_format;
+	const unsigned char *pc_pcm;
+	long l_pcm_bytes, l_sum = 0;
+	l_headers = 0;
+	d_start = get_seconds();
+	do
+	{
+		for(int i=0;i<1000;i++)
+		{
+			wav2mp3::read_wave(pc_wave, sizeof(pc_wave), &s_format, &pc_pcm, &l_pcm_bytes);
+			l_sum += s_format.i_channels;
+		}
+		l_headers += 1000;
+	}
+	while((d_seconds = get_seconds() - d_start) < MIN_BENCH_SECONDS);
+	if(l_sum != 2 * l_headers)
+		fprintf(stderr, "File %s Line %d: WARNING Header parsed wrong.\n", __FILE__, __LINE__);
+	print_result("header_memory", g_i_json ? "\"bits\": 16, \"channels\": 2" : "16 bit 2 ch", l_headers / d_seconds, "headers_per_s", 0, NULL);
+}
+
+void show_usage(char *pc_prog_name)
+{
+	fprintf(stderr, "\nUsage: %s [-d directory] [-s seconds] [-j] [-h]\n", pc_prog_name);
+	fprintf(stderr, "-d directory: where a directory of its own is made for the wave files, removed once\n");
+	fprintf(stderr, "              they are read (default /tmp).\n");
+	fprintf(stderr, "-s seconds:   length of the wave files (default %d).\n", DEFAULT_SECONDS);
+	fprintf(stderr, "-j:           print the results as JSON.\n");
+	fprintf(stderr, "-h:           show this help\n\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *pc_dir = "/tmp";
+	int i_seconds = DEFAULT_SECONDS;
+
+	for(int i=1;i<argc;i++)
+	{
+		if(strcmp(argv[i], "-d") == 0 && i+1 < argc)
+			pc_dir = argv[++i];
+		else if(strcmp(argv[i], "-s") == 0 && i+1 < argc)
+			i_seconds = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-j") == 0)
+			g_i_json = 1;
+		else
+		{
+			show_usage(argv[0]);
+			return 1;
+		}
+	}
+	if(i_seconds < 1)
+	{
+		show_usage(argv[0]);
+		return 1;
+	}
+
+	// A directory of its own, so that runs at the same time do not read each other's files
+	std::string s_dir_template = std::string(pc_dir) + "/bench_wave_read_XXXXXX";
+	char *pc_fixture_dir = mkdtemp(&s_dir_template[0]);
+	if(pc_fixture_dir == NULL)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot make a directory in %s.\n", __FILE__, __LINE__, pc_dir);
+		return 1;
+	}
+
+	if(g_i_json)
+		printf("{\"bench\": \"wave_read\", \"seconds\": %d, \"results\": [", i_seconds);
+	bench_formats(pc_fixture_dir, i_seconds);
+	bench_headers(pc_fixture_dir);
+	if(g_i_json)
+		printf("\n]}\n");
+
+	rmdir(pc_fixture_dir);
+	return 0;
+}
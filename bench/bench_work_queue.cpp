@@ -0,0 +1,150 @@
+/**
+* @file bench_work_queue.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief Contention microbenchmark of the work_queue, with and without locks.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <work_queue.h>
+#include <work_item.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define		QUEUE_LENGTH		50			//!< Same as the application
+#define		DEFAULT_JOBS		1000000		//!< Jobs per measurement
+
+/**
+*	Arguments of the producer and consumer threads.
+*/
+typedef struct _bench_args
+{
+	work_queue	*pc_work_queue;		//!< Queue under test
+	work_item	*pc_work_item;		//!< Item the producers add over and over
+	long		l_num_jobs;			//!< Jobs to add, for the producers
+} bench_args;
+
+void *produce(void *p_args)
+{
+	bench_args *ps_args = (bench_args*)p_args;
+	for(long l=0;l<ps_args->l_num_jobs;l++)
+		ps_args->pc_work_queue->add_to_job_wait(ps_args->pc_work_item);
+	return NULL;
+}
+
+void *consume(void *p_args)
+{
+	bench_args *ps_args = (bench_args*)p_args;
+	while(1)
+	{
+		work_item *pc_work_item = ps_args->pc_work_queue->get_next_job();
+		ps_args->pc_work_queue->set_job_done();
+		if(pc_work_item == NULL)	// Stop
+			break;
+	}
+	return NULL;
+}
+
+/**
+*	Pass jobs through the queue.
+*	@return Jobs per second.
+*/
+double run_bench(bool b_lock_free, int i_producers, int i_consumers, long l_num_jobs)
+{
+	work_queue *pc_work_queue = new work_queue(QUEUE_LENGTH, b_lock_free);
+	work_item c_work_item;
+	bench_args s_args;
+	s_args.pc_work_queue = pc_work_queue;
+	s_args.pc_work_item = &c_work_item;
+	s_args.l_num_jobs = l_num_jobs / i_producers;
+
+	pthread_t *pt_producers = new pthread_t[i_producers];
+	pthread_t *pt_consumers = new pthread_t[i_consumers];
+
+	timespec s_start, s_end;
+	clock_gettime(CLOCK_MONOTONIC, &s_start);
+
+	for(int i=0;i<i_consumers;i++)
+		pthread_create(&pt_consumers[i], NULL, consume, &s_args);
+	for(int i=0;i<i_producers;i++)
+		pthread_create(&pt_producers[i], NULL, produce, &s_args);
+
+	for(int i=0;i<i_producers;i++)
+		pthread_join(pt_producers[i], NULL);
+	for(int i=0;i<i_consumers;i++)	// A NULL job stops a consumer
+		pc_work_queue->add_to_job_wait(NULL);
+	for(int i=0;i<i_consumers;i++)
+		pthread_join(pt_consumers[i], NULL);
+	pc_work_queue->wait_for_queue_empty();
+
+	clock_gettime(CLOCK_MONOTONIC, &s_end);
+	double d_seconds = (s_end.tv_sec - s_start.tv_sec) + (s_end.tv_nsec - s_start.tv_nsec)*1e-9;
+
+	delete [] pt_producers;
+	delete [] pt_consumers;
+	delete pc_work_queue;
+
+	return (s_args.l_num_jobs*i_producers) / d_seconds;
+}
+
+void show_usage(char *pc_prog_name)
+{
+	fprintf(stderr, "\nUsage: %s [-t threads] [-n jobs] [-j] [-h]\n", pc_prog_name);
+	fprintf(stderr, "-t threads:   most producers and consumers, each from 1 to this (default 4).\n");
+	fprintf(stderr, "-n jobs:      jobs per measurement (default %d).\n", DEFAULT_JOBS);
+	fprintf(stderr, "-j:           print the results as JSON.\n");
+	fprintf(stderr, "-h:           show this help\n\n");
+}
+
+int main(int argc, char **argv)
+{
+	int i_threads = 4;
+	long l_num_jobs = DEFAULT_JOBS;
+	int i_json = 0;
+
+	for(int i=1;i<argc;i++)
+	{
+		if(strcmp(argv[i], "-t") == 0 && i+1 < argc)
+			i_threads = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+			l_num_jobs = atol(argv[++i]);
+		else if(strcmp(argv[i], "-j") == 0)
+			i_json = 1;
+		else
+		{
+			show_usage(argv[0]);
+			return 1;
+		}
+	}
+	if(i_threads < 1 || l_num_jobs < 1)
+	{
+		show_usage(argv[0]);
+		return 1;
+	}
+
+	if(i_json)
+		printf("{\"bench\": \"work_queue\", \"jobs\": %ld, \"results\": [", l_num_jobs);
+	else
+		printf("producers consumers   mutex jobs/s   lock free jobs/s   speedup\n");
+	for(int i_producers=1;i_producers<=i_threads;i_producers++)
+	{
+		for(int i_consumers=1;i_consumers<=i_threads;i_consumers++)
+		{
+			double d_mutex = run_bench(false, i_producers, i_consumers, l_num_jobs);
+			double d_lock_free = run_bench(true, i_producers, i_consumers, l_num_jobs);
+			if(i_json)
+				printf("%s\n    {\"name\": \"add_get\", \"producers\": %d, \"consumers\": %d, \"mutex_jobs_per_s\": %.0f, "
+					"\"lock_free_jobs_per_s\": %.0f}", (i_producers > 1 || i_consumers > 1) ? "," : "", i_producers, i_consumers,
+					d_mutex, d_lock_free);
+			else
+				printf("%9d %9d %15.0f %18.0f %9.2f\n", i_producers, i_consumers,
+					d_mutex, d_lock_free, d_lock_free/d_mutex);
+		}
+	}
+	if(i_json)
+		printf("\n]}\n");
+
+	return 0;
+}
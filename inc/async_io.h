@@ -0,0 +1,122 @@
+/**
+* @file async_io.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the async_io class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __ASYNC_IO_H__
+#define __ASYNC_IO_H__
+
+#include <pthread.h>
+#include <deque>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#define		ASYNC_IO_DEPTH			4		//!< Requests in flight per async_io, enough for double buffering
+
+/**
+*	Kind of request.
+*/
+typedef enum _async_io_op
+{
+	ASYNC_IO_READ,			//!< pread
+	ASYNC_IO_WRITE			//!< pwrite
+} async_io_op;
+
+/**
+*	Read or write request.
+*/
+typedef struct _async_io_request
+{
+	async_io_op		e_op;					//!< Read or write
+	int				i_fd;					//!< File descriptor
+	unsigned char	*pc_buffer;				//!< Data, must stay valid until the request is done
+	int				i_bytes;				//!< Bytes to transfer
+	long			l_offset;				//!< Offset in the file
+	int				i_result;				//!< Bytes transferred, or -errno
+	int				i_state;				//!< 0: Free, 1: In flight, 2: Done
+} async_io_request;
+
+/**
+*	Asynchronous reads and writes.
+*	Requests are submitted and the caller continues, e.g. encoding, until it waits for them.
+*	Uses io_uring if the program is built with liburing and the kernel supports it. Otherwise,
+*	a thread does the requests one after another with pread and pwrite. In both cases a request
+*	transfers all bytes, unless the end of the file is reached or there is an error.
+*	An object is used by one thread only, e.g. a thread handler.
+*/
+class async_io
+{
+private:
+	int					m_i_depth;					//!< Most requests in flight
+	async_io_request	*m_ps_requests;				//!< Requests, the index is the id returned by submit
+	int					m_i_uring;					//!< 1: Requests go to io_uring, 0: to the I/O thread
+#ifdef HAVE_LIBURING
+	struct io_uring		m_s_ring;					//!< io_uring instance
+#endif
+	pthread_t			m_t_thread;					//!< I/O thread
+	std::deque<int>		m_dq_queued;				//!< Requests for the I/O thread
+	int					m_i_shut_down;				//!< 1: The I/O thread exits
+	pthread_mutex_t		m_t_mutex;					//!< Mutex for the requests, with the I/O thread
+	pthread_cond_t		m_t_queued_cond;			//!< Condition variable if a request is queued
+	pthread_cond_t		m_t_done_cond;				//!< Condition variable if a request is done
+
+	/**
+	*	Try to set up io_uring.
+	*	@return 0: All clear, otherwise: not available
+	*/
+	int					init_uring();
+
+	/**
+	*	I/O thread function.
+	*/
+	void				run();
+
+	/**
+	*	Thread entry.
+	*/
+	static void			*run_io(void *p_async_io);
+
+	/**
+	*	Do (the rest of) a request synchronously.
+	*	@param i_done Bytes already transferred.
+	*	@return Bytes transferred, or -errno if nothing was.
+	*/
+	static int			transfer(async_io_request *ps_request, int i_done);
+
+public:
+
+	/**
+	*	Constructor.
+	*	@param i_depth Most requests in flight.
+	*/
+	async_io(int i_depth=ASYNC_IO_DEPTH);
+
+	/**
+	*	Destructor.
+	*	Waits for the requests in flight.
+	*/
+	~async_io();
+
+	/**
+	*	Submit a request.
+	*	@return Id of the request, to wait for it.
+	*/
+	int					submit(async_io_op e_op, int i_fd, unsigned char *pc_buffer, int i_bytes, long l_offset);
+
+	/**
+	*	Wait till a request is done.
+	*	The id is free again afterwards.
+	*	@return Bytes transferred, or -errno.
+	*/
+	int					wait(int i_request);
+
+	/**
+	*	Check if the requests go to io_uring.
+	*/
+	int					is_uring(){return m_i_uring;}
+};
+
+#endif // __ASYNC_IO_H__
@@ -0,0 +1,83 @@
+/**
+* @file buffer_arena.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the buffer_arena class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __BUFFER_ARENA_H__
+#define __BUFFER_ARENA_H__
+
+#include <deque>
+
+#define		ARENA_BLOCK_BYTES		(256*1024)			//!< Size of every buffer, the largest block any stage uses
+#define		ARENA_CHUNK_BYTES		(2*1024*1024)		//!< Memory taken from the system at once, one huge page
+
+/**
+*	Arena of buffers.
+*	Hands out buffers of ARENA_BLOCK_BYTES bytes, aligned to at least 64 bytes (a cache line).
+*	The buffers are cut from chunks of ARENA_CHUNK_BYTES bytes mapped from the system, which
+*	may be huge pages. A buffer given back is handed out again, so once the buffers a job needs
+*	are there, no more memory is allocated however many jobs follow. The chunks are only
+*	unmapped by the destructor.
+*	An object is not thread safe, e.g. every thread handler has its own.
+*/
+class buffer_arena
+{
+private:
+	int							m_i_huge_pages;			//!< 1: Try huge pages for the next chunks
+	std::deque<void*>			m_dq_chunks;			//!< Chunks mapped
+	std::deque<unsigned char*>	m_dq_free;				//!< Buffers not handed out
+	long						m_l_allocations;		//!< Chunks mapped by this arena
+	static long					s_l_total_allocations;	//!< Chunks mapped by all arenas
+
+	/**
+	*	Map another chunk and cut it into buffers.
+	*/
+	void						add_chunk();
+
+public:
+
+	/**
+	*	Constructor.
+	*	No memory is mapped until the first buffer is borrowed.
+	*	@param i_huge_pages 1: Back the buffers with huge pages if the system has them.
+	*/
+	buffer_arena(int i_huge_pages=0);
+
+	/**
+	*	Destructor.
+	*	Unmaps all chunks, including the buffers not given back.
+	*/
+	~buffer_arena();
+
+	/**
+	*	Borrow a buffer.
+	*	@param i_bytes Bytes needed, at most ARENA_BLOCK_BYTES. The buffer always has
+	*	ARENA_BLOCK_BYTES bytes, so it can be kept for later needs of any size.
+	*/
+	unsigned char				*borrow(int i_bytes);
+
+	/**
+	*	Give a buffer back. NULL is ignored.
+	*/
+	void						give_back(unsigned char *pc_buffer);
+
+	/**
+	*	Try huge pages for the chunks mapped from now on.
+	*	If the system has no huge pages reserved, transparent huge pages are asked for.
+	*/
+	void						set_huge_pages(int i_huge_pages){m_i_huge_pages = i_huge_pages;}
+
+	/**
+	*	Get number of chunks mapped by this arena.
+	*/
+	long						get_allocations(){return m_l_allocations;}
+
+	/**
+	*	Get number of chunks mapped by all arenas.
+	*/
+	static long					get_total_allocations();
+};
+
+#endif // __BUFFER_ARENA_H__
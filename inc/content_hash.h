@@ -0,0 +1,57 @@
+/**
+* @file content_hash.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the content_hash class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __CONTENT_HASH_H__
+#define __CONTENT_HASH_H__
+
+/**
+*	64 bit hash of the content of a file, added piece by piece.
+*	The hash is of the 8 byte words of the file, so it does not depend on how the file is split
+*	into pieces. Multiply and shift per word, far faster than the disk.
+*/
+class content_hash
+{
+private:
+	unsigned long long	m_ull_hash;			//!< Hash of the whole words so far
+	unsigned char		m_pc_word[8];		//!< Bytes of the word not whole yet
+	int					m_i_word_bytes;		//!< Number of bytes in m_pc_word
+	long				m_l_bytes;			//!< Bytes added
+
+	/**
+	*	Add a whole word to the hash.
+	*/
+	void				add_word(const unsigned char *pc_word);
+
+public:
+
+	/**
+	*	Constructor.
+	*/
+	content_hash(){reset();}
+
+	/**
+	*	Start again with no bytes.
+	*/
+	void				reset();
+
+	/**
+	*	Add the next bytes of the content.
+	*/
+	void				add(const unsigned char *pc_data, long l_bytes);
+
+	/**
+	*	Get the hash of the bytes added.
+	*/
+	unsigned long long	get();
+
+	/**
+	*	Get the number of bytes added.
+	*/
+	long				get_bytes(){return m_l_bytes;}
+};
+
+#endif // __CONTENT_HASH_H__
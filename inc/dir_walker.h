@@ -0,0 +1,103 @@
+/**
+* @file dir_walker.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the dir_walker class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __DIR_WALKER_H__
+#define __DIR_WALKER_H__
+
+#include <pthread.h>
+#include <deque>
+
+#define		DIR_WALK_MAX_FILES		4096	//!< Files found and not handed out yet, before the threads wait
+
+/**
+*	Directory walker.
+*	Lists the files with a given suffix in a directory and all its subdirectories. Several
+*	threads read the directories in parallel, and the files are handed out as soon as they are
+*	found, so their processing can start before the whole tree is listed. Symbolic links to
+*	files are listed, symbolic links to directories are not followed.
+*	The threads wait while about DIR_WALK_MAX_FILES files are not handed out yet, so a huge
+*	tree listed faster than its files are processed does not fill the memory.
+*/
+class dir_walker
+{
+private:
+	int					m_i_num_threads;			//!< Number of threads reading directories
+	pthread_t			*m_pt_threads;				//!< Threads reading directories
+	char				*m_pc_suffix;				//!< Suffix of the files to list
+	int					m_i_suffix_len;				//!< Length of m_pc_suffix
+	std::deque<char*>	m_dq_dirs;					//!< Directories still to read
+	std::deque<char*>	m_dq_files;					//!< Files found, not yet handed out
+	int					m_i_busy_threads;			//!< Threads reading a directory
+	int					m_i_done;					//!< 1: All directories are read
+	int					m_i_stop;					//!< 1: No more files are taken, the threads stop
+	pthread_mutex_t		m_t_mutex;					//!< Mutex for the directories and the files
+	pthread_cond_t		m_t_dir_avail_cond;			//!< Condition variable if a directory is available
+	pthread_cond_t		m_t_file_avail_cond;		//!< Condition variable if a file is available
+	pthread_cond_t		m_t_file_taken_cond;		//!< Condition variable if a file is handed out
+
+	/**
+	*	Thread function. Reads directories until all are read.
+	*/
+	void				walk();
+
+	/**
+	*	Read a directory.
+	*	Adds the matching files and the subdirectories.
+	*	@param pc_dir Path of the directory.
+	*	@param pc_dirent_buffer Buffer for the directory entries.
+	*/
+	void				read_dir(const char *pc_dir, char *pc_dirent_buffer);
+
+	/**
+	*	Join a directory path and a file name.
+	*	@return The path, allocated with new [] to its exact length.
+	*/
+	char				*join_path(const char *pc_dir, const char *pc_name);
+
+	/**
+	*	Add paths found in a directory.
+	*	Waits while DIR_WALK_MAX_FILES files are not handed out yet.
+	*/
+	void				add_paths(std::deque<char*> *pdq_dirs, std::deque<char*> *pdq_files);
+
+	/**
+	*	Thread entry.
+	*/
+	static void			*run_walker(void *p_walker);
+
+public:
+
+	/**
+	*	Constructor.
+	*	@param i_num_threads Number of threads reading directories.
+	*/
+	dir_walker(int i_num_threads);
+
+	/**
+	*	Destructor.
+	*	Stops the threads, the files not handed out yet are dropped.
+	*/
+	~dir_walker();
+
+	/**
+	*	Start walking a directory tree.
+	*	@param pc_root The top directory.
+	*	@param pc_suffix Only files whose name ends in this are listed, e.g. ".wav".
+	*/
+	void				start(const char *pc_root, const char *pc_suffix);
+
+	/**
+	*	Get the next file.
+	*	If no file is available, the function will be suspended in wait state until a directory
+	*	is read. I.e. this is a blocking function.
+	*	@return The path of the file, starting with the top directory. Allocated with new [],
+	*	and owned by the caller. NULL once all files are handed out.
+	*/
+	char				*get_next_file();
+};
+
+#endif // __DIR_WALKER_H__
@@ -0,0 +1,136 @@
+/**
+* @file dup_finder.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the dup_finder class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __DUP_FINDER_H__
+#define __DUP_FINDER_H__
+
+#include <pthread.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+class wave_read;
+class encode_manifest;
+
+#define		DUP_READ_BYTES		(64*1024)	//!< Bytes of samples hashed at once
+
+/**
+*	Wave file found to be a duplicate, or to be fingerprinted.
+*/
+typedef struct _dup_entry
+{
+	std::string		s_wave_file;			//!< Name of the wave file
+	std::string		s_mp3_file;				//!< Name of the mp3 file to link
+	std::string		s_original_mp3_file;	//!< mp3 file of the first wave file with the same samples
+} dup_entry;
+
+/**
+*	Finder of wave files with the same samples.
+*	Every wave file is fingerprinted by its format, the size of its data chunk and a 64 bit hash
+*	of the samples. Only the first file of a fingerprint is encoded. The mp3 files of the others
+*	are made from its mp3 file once it is encoded, as a reflink if the file system can share the
+*	blocks, otherwise as a hard link, or else as a copy. All files of a run have the same encoder
+*	settings, so the same samples give the same mp3 file.
+*	The files added are fingerprinted by threads of the finder, in parallel and while more files
+*	are added, and the files to encode are handed out as soon as their fingerprint is known, so
+*	they are encoded while their samples are still in the page cache. Of the files with the same
+*	samples, the first one fingerprinted is encoded.
+*/
+class dup_finder
+{
+private:
+	std::map<std::string, std::string>	m_m_originals;	//!< mp3 file of the first wave file of every fingerprint
+	std::vector<dup_entry>	m_v_duplicates;				//!< Duplicates to link once the originals are encoded
+	std::deque<dup_entry>	m_dq_added;					//!< Files added, not yet fingerprinted
+	std::deque<char*>	m_dq_originals;					//!< Files to encode, not yet handed out
+	int					m_i_num_threads;				//!< Number of threads fingerprinting
+	pthread_t			*m_pt_threads;					//!< Threads fingerprinting
+	int					m_i_busy_threads;				//!< Threads fingerprinting a file
+	int					m_i_adding;						//!< 1: More files may be added
+	pthread_mutex_t		m_t_mutex;						//!< Mutex for the files and the fingerprints
+	pthread_cond_t		m_t_added_cond;					//!< Condition variable if a file is added
+	pthread_cond_t		m_t_original_cond;				//!< Condition variable if a file to encode is available
+	int					m_i_reflinks;					//!< mp3 files made as reflinks
+	int					m_i_hard_links;					//!< mp3 files made as hard links
+	int					m_i_copies;						//!< mp3 files made as copies
+	int					m_i_failed;						//!< mp3 files that could not be made
+
+	/**
+	*	Thread function. Fingerprints the files added until no more are.
+	*/
+	void				run();
+
+	/**
+	*	Thread entry.
+	*/
+	static void			*run_finder(void *p_finder);
+
+	/**
+	*	Fingerprint a wave file.
+	*	@param pc_wave_read Reads the samples to hash, one per thread.
+	*	@param ps_fingerprint Returns the fingerprint.
+	*	@return 0: All clear, otherwise: not a wave file that can be hashed.
+	*/
+	static int			fingerprint(wave_read *pc_wave_read, const char *pc_wave_file, std::string *ps_fingerprint);
+
+	/**
+	*	Make a file with the content of another one, replacing any file of that name.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	int					link_file(const char *pc_file, const char *pc_new_file);
+
+public:
+
+	/**
+	*	Constructor.
+	*	@param i_num_threads Number of threads fingerprinting the files.
+	*/
+	dup_finder(int i_num_threads);
+
+	/**
+	*	Destructor.
+	*	Waits until all files added are fingerprinted.
+	*/
+	~dup_finder();
+
+	/**
+	*	Add a wave file, to be fingerprinted. The names are copied.
+	*	A file with the samples of one fingerprinted before is kept to be linked by
+	*	link_duplicates, the others are handed out by get_next_file.
+	*/
+	void				add(const char *pc_wave_file, const char *pc_mp3_file);
+
+	/**
+	*	No more files are added.
+	*/
+	void				finish_adding();
+
+	/**
+	*	Get the next file to encode.
+	*	Blocks until a file is fingerprinted and found to be the first of its samples. Files that
+	*	cannot be fingerprinted are handed out too, the encoder tells what is wrong with them.
+	*	@param i_wait 0: Return NULL at once if no file is ready yet, e.g. to add more files.
+	*	@return The name of the wave file, allocated with new [] and owned by the caller. NULL
+	*	once no more files are added and all are fingerprinted and handed out.
+	*/
+	char				*get_next_file(int i_wait = 1);
+
+	/**
+	*	Make the mp3 files of the duplicates, once all the other files are encoded.
+	*	@param pc_manifest Records the duplicates made, if not NULL.
+	*	@return 0: All clear, otherwise: number of mp3 files that could not be made.
+	*/
+	int					link_duplicates(encode_manifest *pc_manifest);
+
+	/**
+	*	Print how many duplicates were found and how they were made.
+	*/
+	void				display_summary();
+};
+
+#endif // __DUP_FINDER_H__
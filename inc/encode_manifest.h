@@ -0,0 +1,113 @@
+/**
+* @file encode_manifest.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the encode_manifest class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __ENCODE_MANIFEST_H__
+#define __ENCODE_MANIFEST_H__
+
+#include <pthread.h>
+#include <map>
+#include <string>
+
+class content_hash;
+
+/**
+*	What is known of a wave file encoded.
+*/
+typedef struct _manifest_entry
+{
+	long				l_size;					//!< Size of the wave file in bytes
+	long long			ll_mtime_ns;			//!< Modification time of the wave file in nsec
+	unsigned long long	ull_hash;				//!< Hash of the content of the wave file
+	std::string			s_settings;				//!< Encoder settings the mp3 file was made with
+	std::string			s_mp3_file;				//!< Name of the mp3 file
+} manifest_entry;
+
+/**
+*	Manifest of the wave files encoded.
+*	Remembers the size, modification time and content hash of every wave file encoded, and the
+*	settings and mp3 file it was encoded to, so that a later run only encodes the files that
+*	changed, or whose mp3 file is gone.
+*	A file whose size and modification time are those recorded is skipped with a stat of it and
+*	of its mp3 file. A file of the same size but another modification time, e.g. copied or
+*	restored, is only encoded again if its content hash changed.
+*	Every file done is appended to the manifest file at once, so a run stopped half way goes on
+*	from there the next time. save rewrites the file without the entries replaced, through a
+*	temporary file renamed over it, so the manifest is never lost.
+*	The manifest file has one line per wave file, "size mtime hash settings\twave file\tmp3 file".
+*	A later line replaces an earlier one of the same wave file. A file whose name, or the name of
+*	its mp3 file, has a tab or a new line is not recorded, so it is encoded by every run.
+*/
+class encode_manifest
+{
+private:
+	std::map<std::string, manifest_entry>	m_m_entries;	//!< Entries by wave file name
+	std::map<std::string, manifest_entry>	m_m_pending;	//!< Files being encoded, with their size and time when checked
+	std::string			m_s_settings;				//!< Settings of this run
+	std::string			m_s_manifest_file;			//!< Name of the manifest file
+	int					m_i_fd;						//!< Manifest file, open to append, -1: not loaded
+	pthread_mutex_t		m_t_mutex;					//!< Mutex for the entries and the appends
+
+	/**
+	*	Append an entry to the manifest file.
+	*/
+	void				append(const std::string &s_wave_file, const manifest_entry *ps_entry);
+
+public:
+
+	/**
+	*	Constructor.
+	*	@param pc_settings Encoder settings of this run, without white space. Files encoded with
+	*	other settings are encoded again.
+	*/
+	encode_manifest(const char *pc_settings);
+
+	/**
+	*	Destructor.
+	*/
+	~encode_manifest();
+
+	/**
+	*	Load the manifest.
+	*	A missing file is not an error, in which case every file is encoded.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	int					load(const char *pc_manifest_file);
+
+	/**
+	*	Save the manifest, replacing the file loaded.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	int					save();
+
+	/**
+	*	Check if a wave file has to be encoded.
+	*	It has to if it changed, or was encoded with other settings or to another mp3 file, or
+	*	its mp3 file is missing or empty. If so, its size and time are kept until it is done.
+	*	@param pc_mp3_file The mp3 file of this run.
+	*	@return 1: encode it, 0: the mp3 file is up to date.
+	*/
+	int					check(const char *pc_wave_file, const char *pc_mp3_file);
+
+	/**
+	*	Record a wave file checked as encoded.
+	*	It is not recorded if it changed since it was checked, so it is encoded again by the next
+	*	run. Can be called by any thread.
+	*	@param pc_hash Hash of the wave file taken while encoding it (see wave_read::set_content_hash).
+	*	If NULL, or not of the whole file, e.g. for a file encoded in segments, the file is read
+	*	again to hash it.
+	*/
+	void				done(const char *pc_wave_file, const char *pc_mp3_file, content_hash *pc_hash = NULL);
+
+	/**
+	*	Hash the content of a file.
+	*	@param pull_hash Returns the hash.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	static int			hash_file(const char *pc_file, unsigned long long *pull_hash);
+};
+
+#endif // __ENCODE_MANIFEST_H__
@@ -0,0 +1,150 @@
+/**
+* @file encode_server.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the encode_server class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __ENCODE_SERVER_H__
+#define __ENCODE_SERVER_H__
+
+#include <pthread.h>
+
+class pthread_queue;
+class wave_to_mp3;
+class encode_server;
+
+#define		SERVER_MAX_FRAME_BYTES	(16*1024)	//!< Largest payload of a frame
+#define		SERVER_BACKLOG			64			//!< Connections waiting to be accepted
+#define		SERVER_MAX_REPLY_BYTES	256			//!< Largest reply, with the terminating 0
+
+/**
+*	Reply waiting to be sent.
+*/
+typedef struct _server_reply
+{
+	char				pc_text[SERVER_MAX_REPLY_BYTES];	//!< Payload, NUL terminated
+	struct _server_reply *ps_next;							//!< Reply queued after this one
+} server_reply;
+
+/**
+*	Connection of a client.
+*/
+typedef struct _server_connection
+{
+	encode_server	*pc_server;				//!< Server accepting it
+	int				i_fd;					//!< Socket
+	int				i_jobs;					//!< Jobs queued and not replied to yet
+	int				i_reading;				//!< 1: The client may still send requests
+	server_reply	*ps_first_reply;		//!< Replies waiting to be sent, oldest first
+	server_reply	*ps_last_reply;			//!< Reply queued last
+	pthread_mutex_t	t_mutex;				//!< Mutex for i_jobs, i_reading and the replies
+	pthread_cond_t	t_reply_cond;			//!< Signalled when a reply is queued or the connection is done
+} server_connection;
+
+/**
+*	Job submitted by a client.
+*/
+typedef struct _server_job
+{
+	server_connection	*ps_connection;		//!< Connection to reply to
+	int					i_index;			//!< Number of the request on the connection, from 0
+	int					i_quality;			//!< Quality of the encoding
+	char				*pc_wave_file;		//!< Name of the wave file
+	char				*pc_mp3_file;		//!< Name of the mp3 file
+} server_job;
+
+/**
+*	Encoding server.
+*	Keeps a thread pool and its encoders (one wave_to_mp3 per thread) running, and encodes the
+*	files that clients submit over a Unix domain socket, so that a job only costs its encoding
+*	and not the start of a process.
+*	Every message is a frame: the size of the payload as 4 bytes little endian, and the payload.
+*	A request is "quality\0wave file\0mp3 file\0", with absolute names as seen by the server. A
+*	client may send any number of requests on a connection without waiting; they are encoded in
+*	parallel and every one is answered once done, in the order they finish, with
+*	"index OK milliseconds" or "index ERROR message". index counts the requests of the connection
+*	from 0. Requests for files that cannot be read or written are answered at once.
+*	Every connection has a thread of its own sending the replies, so that a client that does not
+*	read them only stalls itself, never the threads of the pool.
+*/
+class encode_server
+{
+private:
+	pthread_queue		*m_pc_thread_queue;		//!< Threads encoding the jobs
+	wave_to_mp3			**m_ppc_wave2mp3;		//!< Encoder of every thread
+	int					m_i_listen_fd;			//!< Socket accepting the clients
+	pthread_mutex_t		m_t_queue_mutex;		//!< The thread pool takes jobs from one thread at a time
+
+	/**
+	*	Thread reading the requests of a connection.
+	*	Queues them, and closes the connection once the client is done and every job is answered.
+	*/
+	static void			*run_connection(void *p_connection);
+
+	/**
+	*	Thread sending the replies of a connection, until the client is done and every job is answered.
+	*/
+	static void			*send_replies(void *p_connection);
+
+	/**
+	*	Job of the thread pool encoding a file and answering the request.
+	*/
+	static void			*encode_job(void *p_job, int i_thread_id);
+
+	/**
+	*	Check that a job can be done, before it is queued.
+	*	@param pc_error Returns the reason if not.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	static int			check_job(server_job *ps_job, char *pc_error, int i_error_size);
+
+	/**
+	*	Answer a request.
+	*	The reply is queued for the thread sending the replies, this never waits for the client.
+	*/
+	static void			reply(server_connection *ps_connection, const char *pc_reply);
+
+public:
+
+	/**
+	*	Constructor.
+	*	@param pc_thread_queue Thread pool, made by the caller.
+	*	@param ppc_wave2mp3 Encoder of every thread of the pool, owned by the caller.
+	*/
+	encode_server(pthread_queue *pc_thread_queue, wave_to_mp3 **ppc_wave2mp3);
+
+	/**
+	*	Destructor.
+	*/
+	~encode_server();
+
+	/**
+	*	Serve clients, until the process is stopped.
+	*	@param pc_socket_path Path of the socket. A socket left behind at this path is replaced,
+	*	anything else there is left alone and the server does not start.
+	*/
+	void				run(const char *pc_socket_path);
+
+	/**
+	*	Connect to a server.
+	*	@return Socket, -1: no server at pc_socket_path.
+	*/
+	static int			connect_to(const char *pc_socket_path);
+
+	/**
+	*	Send a frame.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	static int			send_frame(int i_fd, const char *pc_payload, int i_bytes);
+
+	/**
+	*	Receive a frame.
+	*	@param pc_payload Returns the payload, NUL terminated.
+	*	@param i_size Size of pc_payload, at least SERVER_MAX_FRAME_BYTES+1.
+	*	@return Size of the payload in bytes, -1: end of the connection or a broken frame.
+	*/
+	static int			recv_frame(int i_fd, char *pc_payload, int i_size);
+};
+
+#endif // __ENCODE_SERVER_H__
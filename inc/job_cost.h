@@ -0,0 +1,108 @@
+/**
+* @file job_cost.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the job_cost class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __JOB_COST_H__
+#define __JOB_COST_H__
+
+#include <pthread.h>
+
+#define		JOB_COST_MAX_FORMATS		64		//!< Most wave formats of which the cost is learned
+
+/**
+*	Wave format, which decides the encoding cost per sample.
+*/
+typedef struct _job_cost_format
+{
+	int			i_sample_rate;				//!< Sample rate in Hz
+	int			i_channels;					//!< Number of channels
+	int			i_bits_per_sample;			//!< Bits per sample
+} job_cost_format;
+
+/**
+*	Cost learned for one wave format.
+*/
+typedef struct _job_cost_entry
+{
+	job_cost_format	s_format;				//!< Wave format
+	double			d_samples;				//!< Samples (per channel) encoded so far
+	double			d_time_ms;				//!< Time taken to encode them in msec
+} job_cost_entry;
+
+/**
+*	Job cost model.
+*	Estimates how long encoding a wave file takes, from the number of samples in its header and
+*	the time per sample of its format. The time per sample is learned from the jobs done, and
+*	kept in a file from run to run. It is only used to order the jobs, so the estimate need
+*	not be exact.
+*/
+class job_cost
+{
+private:
+	job_cost_entry		m_s_entries[JOB_COST_MAX_FORMATS];	//!< Cost of every format
+	int					m_i_num_entries;					//!< Number of formats in m_s_entries
+	pthread_mutex_t		m_t_mutex;							//!< Mutex for adding times from the threads
+
+	/**
+	*	Find the entry of a format.
+	*	@return The entry, or NULL if the format was not seen yet.
+	*/
+	job_cost_entry		*find(const job_cost_format *ps_format);
+
+public:
+
+	/**
+	*	Constructor.
+	*/
+	job_cost();
+
+	/**
+	*	Destructor.
+	*/
+	~job_cost();
+
+	/**
+	*	Load the learned costs.
+	*	A missing file is not an error, in which case nothing is learned yet.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	int					load(const char *pc_cost_file);
+
+	/**
+	*	Save the learned costs.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	int					save(const char *pc_cost_file);
+
+	/**
+	*	Read the format and the number of samples from the header of a wave file.
+	*	The header is parsed with wav2mp3::read_header. If it gives no data size, the size of the
+	*	file is used.
+	*	@param pc_wave_file Name of the wave file.
+	*	@param ps_format Returns the format.
+	*	@param pi_samples Returns the number of samples per channel.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	int					read_format(const char *pc_wave_file, job_cost_format *ps_format, int *pi_samples);
+
+	/**
+	*	Estimate the time to encode samples of a format.
+	*	Formats not seen yet cost the average of the ones seen, or a default.
+	*	@return The time in msec.
+	*/
+	double				estimate(const job_cost_format *ps_format, int i_samples);
+
+	/**
+	*	Add the time a job took.
+	*	Can be called by any thread.
+	*	@param ps_format Format of the wave file.
+	*	@param i_samples Number of samples per channel encoded.
+	*	@param i_time_ms Time taken in msec.
+	*/
+	void				add_time(const job_cost_format *ps_format, int i_samples, int i_time_ms);
+};
+
+#endif // __JOB_COST_H__
@@ -0,0 +1,120 @@
+/**
+* @file job_stats.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the job_stats class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __JOB_STATS_H__
+#define __JOB_STATS_H__
+
+#include <perf_counters.h>
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+
+class pthread_queue;
+
+#define		JOB_STATS_BUCKETS		40			//!< Histogram buckets, bucket b > 0 counts times of 2^b to 2^(b+1) usec, bucket 0 the shorter ones
+
+/**
+*	Stage of a job.
+*/
+typedef enum _job_stage
+{
+	JOB_STAGE_WAIT = 0,		//!< Waiting in the queue
+	JOB_STAGE_READ,			//!< Opening and reading the wave file
+	JOB_STAGE_ENCODE,		//!< Converting and encoding the samples
+	JOB_STAGE_WRITE,		//!< Opening, writing and closing the mp3 file
+	JOB_STAGE_TOTAL,		//!< Whole job, from when a thread took it, without the wait
+	JOB_STAGES
+} job_stage;
+
+/**
+*	What a job took.
+*/
+typedef struct _job_record
+{
+	long long	pll_stage_ns[JOB_STAGES];	//!< Time of every stage in nsec
+	long		l_bytes_in;					//!< Wave bytes read
+	long		l_bytes_out;				//!< mp3 bytes written
+	double		d_audio_seconds;			//!< Length of the audio encoded
+	int			i_thread;					//!< Thread that did the job
+	perf_totals	s_perf;						//!< Hardware counts of the job per stage, if counting
+} job_record;
+
+/**
+*	Job statistics.
+*	Every thread keeps the records of its jobs in a buffer of its own, so recording takes no
+*	lock. Once all jobs are done, the report gives the percentiles and a histogram of the time
+*	of every stage, and how the time is shared between reading, encoding and writing, which
+*	tells a run bound by the disk from one bound by the CPU.
+*/
+class job_stats
+{
+private:
+	std::vector<job_record>	**m_ppv_records;	//!< Records of every thread
+	int					m_i_num_threads;		//!< Number of threads
+	pthread_queue		*m_pc_thread_queue;		//!< Tells how long the jobs waited
+	long long			m_ll_start_ns;			//!< When the run started
+
+	/**
+	*	Get the times of a stage of all jobs, sorted.
+	*/
+	void				get_sorted_times(job_stage e_stage, std::vector<long long> *pv_times);
+
+	/**
+	*	Write the report as JSON.
+	*/
+	void				write_json(FILE *f_report);
+
+	/**
+	*	Write the records as CSV, one line per job.
+	*/
+	void				write_csv(FILE *f_report);
+
+public:
+
+	/**
+	*	Constructor.
+	*	@param pc_thread_queue Thread pool running the jobs.
+	*	@param i_num_threads Number of threads of the pool.
+	*/
+	job_stats(pthread_queue *pc_thread_queue, int i_num_threads);
+
+	/**
+	*	Destructor.
+	*/
+	~job_stats();
+
+	/**
+	*	Start a record, before a job starts.
+	*	Called by the job, on the thread running it.
+	*/
+	static void			clear_record(job_record *ps_record);
+
+	/**
+	*	Add the record of a job once it is done, with the time it waited in the queue.
+	*	Called by the job, on the thread running it.
+	*/
+	void				add(int i_thread_num, job_record *ps_record);
+
+	/**
+	*	Print a summary, and write the report.
+	*	@param pc_report_file CSV if the name ends with .csv, otherwise JSON.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	int					write_report(const char *pc_report_file);
+
+	/**
+	*	Get the time in nsec.
+	*/
+	static long long	get_time_ns()
+	{
+		timespec s_time;
+		clock_gettime(CLOCK_MONOTONIC, &s_time);
+		return s_time.tv_sec * 1000000000LL + s_time.tv_nsec;
+	}
+};
+
+#endif // __JOB_STATS_H__
@@ -0,0 +1,109 @@
+/**
+* @file lame_pool.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the lame_pool class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __LAME_POOL_H__
+#define __LAME_POOL_H__
+
+#include <lame.h>
+#include <deque>
+
+#define		LAME_POOL_FINISH_BYTES		32768	//!< Room finish needs in the mp3 buffer
+#define		LAME_POOL_MAX_IDLE			4		//!< Idle encoders kept when reusing them
+
+/**
+*	Settings of a lame encoder. Only encoders with the same settings are reused.
+*/
+typedef struct _lame_pool_key
+{
+	int			i_sample_rate;				//!< Input sample rate in Hz
+	int			i_channels;					//!< Number of channels
+	int			i_quality;					//!< VBR quality, 0: highest, 9: lowest
+	int			i_segment;					//!< 1: Encoder of a segment (see wave_to_mp3::encode_segment)
+} lame_pool_key;
+
+/**
+*	Encoder in the pool.
+*/
+typedef struct _lame_pool_entry
+{
+	lame_pool_key	s_key;					//!< Settings
+	lame_t			lame;					//!< Encoder
+} lame_pool_entry;
+
+/**
+*	Pool of lame encoders.
+*	Every encoder taken with get is given back with finish, which ends its mp3 stream, or with
+*	release. By default, the encoder is closed then. If reusing is enabled, it is kept and handed
+*	out again for the next file with the same settings, which saves setting up the encoder.
+*	Its stream is ended by padding the last frame with silence (as lame_encode_flush does) and
+*	flushing it with lame_encode_flush_nogap, and started again with lame_init_bitstream. The
+*	mp3 files are then complete, but not bit identical to those of a new encoder, since the
+*	encoder keeps its state from the previous file. Encoders of segments are never reused, as
+*	their frames must line up with those of the other segments.
+*	An object is used by one thread only, e.g. by the wave_to_mp3 of a thread handler.
+*/
+class lame_pool
+{
+private:
+	int								m_i_max_idle;		//!< Most idle encoders kept, 0: encoders are not reused
+	std::deque<lame_pool_entry>		m_dq_idle;			//!< Idle encoders, the last used at the back
+	std::deque<lame_pool_entry>		m_dq_busy;			//!< Encoders handed out
+
+	/**
+	*	Create an encoder.
+	*	@return The encoder, NULL if lame cannot be set up for the settings.
+	*/
+	lame_t							create(const lame_pool_key *ps_key);
+
+	/**
+	*	Take an encoder out of the list of those handed out.
+	*/
+	lame_pool_entry					take_busy(lame_t lame);
+
+public:
+
+	/**
+	*	Constructor.
+	*	@param i_max_idle Most idle encoders kept for reusing, 0: encoders are not reused.
+	*/
+	lame_pool(int i_max_idle=0);
+
+	/**
+	*	Destructor.
+	*	Closes all encoders.
+	*/
+	~lame_pool();
+
+	/**
+	*	Get an encoder for a new mp3 stream.
+	*	@return The encoder, NULL if lame cannot be set up for the settings.
+	*/
+	lame_t							get(const lame_pool_key *ps_key);
+
+	/**
+	*	End the mp3 stream of an encoder, and give it back.
+	*	@param lame Encoder from get.
+	*	@param pc_mp3_buffer Output buffer, of at least LAME_POOL_FINISH_BYTES bytes.
+	*	@param i_mp3_buffer_size Size of the output buffer in bytes.
+	*	@return Number of mp3 bytes written to pc_mp3_buffer, negative if lame failed. The encoder
+	*	is closed then.
+	*/
+	int								finish(lame_t lame, unsigned char *pc_mp3_buffer, int i_mp3_buffer_size);
+
+	/**
+	*	Give an encoder back without ending its stream. It is closed.
+	*/
+	void							release(lame_t lame);
+
+	/**
+	*	Set the most idle encoders kept for reusing.
+	*	0: encoders are not reused.
+	*/
+	void							set_max_idle(int i_max_idle);
+};
+
+#endif // __LAME_POOL_H__
@@ -0,0 +1,130 @@
+/**
+* @file mp3_writer.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the mp3_writer class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __MP3_WRITER_H__
+#define __MP3_WRITER_H__
+
+#include <async_io.h>
+
+#define		MP3_WRITER_BUFFERS		2					//!< Buffers, one is filled while the other is written
+#define		MP3_WRITER_CHUNK_BYTES	(2*1024*1024)		//!< Size of a buffer, the most written at once
+#define		MP3_WRITER_ALIGN		4096				//!< Alignment of the writes in memory and in the file
+
+/**
+*	Writer of an mp3 file.
+*	The mp3 data is collected in large buffers, and written in pieces of up to MP3_WRITER_CHUNK_BYTES
+*	bytes, instead of a few hundred bytes per encoded block. The file is preallocated from an
+*	estimate of its size, so that it is laid out in one piece, and truncated to its real size once
+*	it is closed. Every write but the last starts and ends at a multiple of MP3_WRITER_ALIGN, so the
+*	file can also be written with O_DIRECT, bypassing the page cache.
+*	With an async_io, a buffer is written while the other one is filled.
+*	An object is used by one thread only, e.g. by the wave_to_mp3 of a thread handler.
+*/
+class mp3_writer
+{
+private:
+	int				m_i_fd;									//!< mp3 file, -1: none open
+	int				m_i_direct_io;							//!< 1: Open the files with O_DIRECT
+	int				m_i_direct;								//!< 1: The open file is written with O_DIRECT
+	async_io		*m_pc_async_io;							//!< Writes behind if not NULL, owned by the caller
+	unsigned char	*m_ppc_buffer[MP3_WRITER_BUFFERS];		//!< Buffers, aligned to MP3_WRITER_ALIGN
+	int				m_pi_request[MP3_WRITER_BUFFERS];		//!< Request writing each buffer, -1: none
+	int				m_pi_request_bytes[MP3_WRITER_BUFFERS];	//!< Bytes written by each request
+	int				m_i_buffer;								//!< Buffer being filled
+	int				m_i_fill;								//!< Bytes in the buffer being filled
+	long			m_l_offset;								//!< File offset of the buffer being filled
+	int				m_i_write_error;						//!< 1: A write of the open file failed
+	char			*m_pc_file;								//!< Name of the open file, for discard_file
+
+	/**
+	*	Write bytes of a buffer at an offset of the file, through m_pc_async_io if there is one.
+	*/
+	void			write_buffer(int i_buffer, int i_bytes, long l_offset);
+
+	/**
+	*	Wait until a buffer is written.
+	*/
+	void			wait_buffer(int i_buffer);
+
+	/**
+	*	Write the aligned part of the buffer being filled, and go on with the next buffer.
+	*	The rest is moved to the start of the next buffer.
+	*/
+	void			flush();
+
+public:
+
+	/**
+	*	Constructor.
+	*	The buffers are allocated with the first file.
+	*/
+	mp3_writer();
+
+	/**
+	*	Destructor.
+	*	Closes the open file.
+	*/
+	~mp3_writer();
+
+	/**
+	*	Open an mp3 file to write.
+	*	@param pc_mp3_file Name of the file.
+	*	@param l_estimated_bytes Bytes preallocated for the file, 0: none. Preallocation is
+	*	skipped if the file system does not support it.
+	*	@return 0: All clear, otherwise: the file cannot be opened.
+	*/
+	int				open_file(const char *pc_mp3_file, long l_estimated_bytes);
+
+	/**
+	*	Get room for mp3 data.
+	*	@param i_bytes Bytes of room needed, at most MP3_WRITER_CHUNK_BYTES - MP3_WRITER_ALIGN.
+	*	@return Where to put the data. It is written once added with add_bytes.
+	*/
+	unsigned char	*get_space(int i_bytes);
+
+	/**
+	*	Add mp3 data put where get_space pointed to.
+	*/
+	void			add_bytes(int i_bytes){m_i_fill += i_bytes;}
+
+	/**
+	*	Write mp3 data.
+	*	The data is copied into the buffers.
+	*/
+	void			write(const unsigned char *pc_data, int i_bytes);
+
+	/**
+	*	Write what is left, truncate the file to the data written and close it.
+	*	@return 0: All clear, otherwise: a write failed, the incomplete file is removed.
+	*/
+	int				close_file();
+
+	/**
+	*	Close the file and remove it, e.g. if its wave file could not be read completely.
+	*/
+	void			discard_file();
+
+	/**
+	*	Write behind through an async_io.
+	*	Takes effect with the next open_file.
+	*/
+	void			set_async_io(async_io *pc_async_io){m_pc_async_io = pc_async_io;}
+
+	/**
+	*	Write the files with O_DIRECT, if the file system supports it.
+	*	Takes effect with the next open_file.
+	*/
+	void			set_direct_io(int i_direct_io){m_i_direct_io = i_direct_io;}
+
+	/**
+	*	Remove an mp3 file that has other names, e.g. made for a duplicate wave file, before it
+	*	is written again, so that the other names keep their content.
+	*/
+	static void		unlink_shared(const char *pc_mp3_file);
+};
+
+#endif // __MP3_WRITER_H__
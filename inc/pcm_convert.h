@@ -0,0 +1,62 @@
+/**
+* @file pcm_convert.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief Convert interleaved PCM bytes to per channel sample arrays.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __PCM_CONVERT_H__
+#define __PCM_CONVERT_H__
+
+/**
+*	Instruction set of a conversion kernel.
+*/
+typedef enum _pcm_isa
+{
+	PCM_ISA_SCALAR = 0,		//!< Plain C++, the reference for all other kernels
+	PCM_ISA_SSE2,			//!< SSE2
+	PCM_ISA_AVX2,			//!< AVX2
+	PCM_ISA_COUNT
+} pcm_isa;
+
+/**
+*	Conversion kernel.
+*	Splits interleaved little endian signed PCM into one array per channel. Every kernel handles
+*	one input format (bytes per sample and channels) and one output type.
+*	Samples written as int are left justified to 32 bits, i.e. full scale is the full int range.
+*	Samples written as short are the upper 16 bits of the sample.
+*	@param pc_src Interleaved PCM bytes.
+*	@param ppv_dst Output arrays, one per channel, of short or int depending on the kernel.
+*	@param i_samples Number of samples per channel.
+*/
+typedef void (*pcm_convert_func)(const unsigned char *pc_src, void **ppv_dst, int i_samples);
+
+/**
+*	Get the best instruction set supported by this CPU.
+*	Detected once, when first called.
+*/
+pcm_isa				pcm_get_best_isa();
+
+/**
+*	Get the name of an instruction set.
+*/
+const char			*pcm_get_isa_name(pcm_isa e_isa);
+
+/**
+*	Get conversion kernel.
+*	If there is no kernel for the format with the given instruction set, the kernel of the next
+*	lower instruction set is returned.
+*	@param i_bytes_per_sample Bytes per sample of the input, 2, 3 or 4.
+*	@param i_channels Number of channels, 1 or 2.
+*	@param i_out_bytes Bytes per output sample, sizeof(short) or sizeof(int).
+*	@param e_isa Highest instruction set to use.
+*	@return The kernel, or NULL if the format is not supported.
+*/
+pcm_convert_func	pcm_get_convert_func(int i_bytes_per_sample, int i_channels, int i_out_bytes, pcm_isa e_isa);
+
+/**
+*	Get conversion kernel for the best instruction set supported by this CPU.
+*/
+pcm_convert_func	pcm_get_convert_func(int i_bytes_per_sample, int i_channels, int i_out_bytes);
+
+#endif // __PCM_CONVERT_H__
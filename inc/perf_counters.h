@@ -0,0 +1,154 @@
+/**
+* @file perf_counters.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the perf_counters class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __PERF_COUNTERS_H__
+#define __PERF_COUNTERS_H__
+
+/**
+*	Hardware counter.
+*/
+typedef enum _perf_counter
+{
+	PERF_CYCLES = 0,			//!< CPU cycles
+	PERF_INSTRUCTIONS,			//!< Instructions retired
+	PERF_CACHE_MISSES,			//!< Last level cache misses
+	PERF_BRANCH_MISSES,			//!< Mispredicted branches
+	PERF_COUNTERS
+} perf_counter;
+
+#define		PERF_READ_VALUES	(PERF_COUNTERS + 2)		//!< Values read by begin: the counters, then the times enabled and running
+
+/**
+*	Stage the counters are read around.
+*/
+typedef enum _perf_stage
+{
+	PERF_STAGE_CONVERT = 0,		//!< Deinterleaving and converting the samples in wave_read::fill_wave_buffer
+	PERF_STAGE_ENCODE,			//!< lame encoding and flushing in wave_to_mp3
+	PERF_STAGES
+} perf_stage;
+
+/**
+*	Counts of every counter in every stage.
+*/
+typedef struct _perf_totals
+{
+	long long	pll_count[PERF_STAGES][PERF_COUNTERS];	//!< Counts in user space, scaled if multiplexed
+	long long	pll_time_enabled[PERF_STAGES];			//!< Time the counters were enabled in nsec
+	long long	pll_time_running[PERF_STAGES];			//!< Time they were on the PMU in nsec, less if multiplexed
+} perf_totals;
+
+/**
+*	Counters of one thread.
+*/
+typedef struct _perf_thread
+{
+	int			pi_fd[PERF_COUNTERS];		//!< Counter of the thread, -1: not available
+	int			pi_index[PERF_COUNTERS];	//!< Position of the counter in a read of the group
+	int			i_num_open;					//!< Counters open
+	perf_totals	s_totals;					//!< Counts of the thread so far
+	struct _perf_thread *ps_next;			//!< Counters of the thread that started counting before
+} perf_thread;
+
+/**
+*	Hardware performance counters per thread, through perf_event_open.
+*	The cycles, instructions, cache misses and branch misses of the threads are read around the
+*	stages to count, and added to the totals of the stage:
+*	@code
+*	long long pll_start[PERF_READ_VALUES];
+*	perf_counters::begin(pll_start);
+*	...
+*	perf_counters::end(PERF_STAGE_CONVERT, pll_start);
+*	@endcode
+*	With more events than the PMU has counters, e.g. while perf record runs too, the kernel
+*	multiplexes them and the group only counts part of the time. The counts of a stage are then
+*	scaled by the time enabled over the time running, and the summary tells how much.
+*	Every thread opens its counters the first time. Where the kernel does not let the process
+*	count, e.g. in containers, or the CPU has no such counters, a warning is printed once and
+*	nothing is counted. A counter the CPU does not have alone is left out. The counters are
+*	kept open until the process ends, as the threads may outlive them.
+*/
+class perf_counters
+{
+private:
+	static int			m_i_on;							//!< 1: Counting
+	static int			m_pi_missing[PERF_COUNTERS];	//!< 1: Not available on some thread
+	static perf_thread	*m_ps_threads;					//!< Counters of all threads, newest first
+	static int			m_i_warned;						//!< 1: Warned that there are no counters
+
+	/**
+	*	Get the counters of the calling thread, opened the first time.
+	*	@return NULL if the thread cannot count.
+	*/
+	static perf_thread	*get_thread();
+
+	/**
+	*	Read the counters of the calling thread.
+	*	@param pll_counts Returns PERF_READ_VALUES values.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	static int			read_counters(perf_thread *ps_thread, long long *pll_counts);
+
+public:
+
+	/**
+	*	Start counting, and check that the calling thread can count.
+	*	@return 0: All clear, otherwise: no counters, and nothing is counted.
+	*/
+	static int			start();
+
+	/**
+	*	Is counting on?
+	*/
+	static int			is_on(){return __atomic_load_n(&m_i_on, __ATOMIC_RELAXED);}
+
+	/**
+	*	Read the counters before a stage.
+	*	@param pll_start PERF_READ_VALUES values. The first is -1 if the thread does not count.
+	*/
+	static void			begin(long long *pll_start);
+
+	/**
+	*	Read the counters after a stage, and add what was counted to the stage.
+	*	@param pll_start What begin read.
+	*/
+	static void			end(perf_stage e_stage, const long long *pll_start);
+
+	/**
+	*	Get the counts of the calling thread so far.
+	*	All 0 if the thread does not count.
+	*/
+	static void			get_thread_totals(perf_totals *ps_totals);
+
+	/**
+	*	Get the counts of all threads so far.
+	*	The threads should have finished their work.
+	*/
+	static void			get_totals(perf_totals *ps_totals);
+
+	/**
+	*	Is a counter available on all threads?
+	*/
+	static int			is_available(perf_counter e_counter){return !m_pi_missing[e_counter];}
+
+	/**
+	*	Get the name of a counter, e.g. "cycles".
+	*/
+	static const char	*get_counter_name(perf_counter e_counter);
+
+	/**
+	*	Get the name of a stage, e.g. "convert".
+	*/
+	static const char	*get_stage_name(perf_stage e_stage);
+
+	/**
+	*	Print the counts of all threads per stage.
+	*/
+	static void			display_summary();
+};
+
+#endif // __PERF_COUNTERS_H__
@@ -0,0 +1,178 @@
+/**
+* @file pipeline.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the pipeline class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <pthread.h>
+#include <deque>
+#include <wave_read.h>
+#include <buffer_arena.h>
+
+class wave_to_mp3;
+class encode_manifest;
+
+#define		PIPE_FILE_BLOCKS		4		//!< PCM blocks read ahead per wave file
+#define		PIPE_BLOCK_ITR			16		//!< Encoder iterations (see wave_to_mp3) per PCM block
+#define		PIPE_MP3_BLOCKS			64		//!< Most mp3 blocks waiting for the writers
+#define		PIPE_NEW_FILES			50		//!< Most wave files added but not opened yet
+
+/**
+*	Block of samples read from a wave file.
+*/
+typedef struct _pipe_pcm_block
+{
+	unsigned char	*pc_data;				//!< Interleaved samples as stored in the wave file
+	int				i_samples;				//!< Number of samples (per channel) in pc_data
+	int				i_last;					//!< 1: The wave file ends with this block
+} pipe_pcm_block;
+
+/**
+*	Wave file going through the pipeline.
+*/
+typedef struct _pipe_file
+{
+	char			*pc_wave_file;			//!< Name of the wave file
+	char			*pc_mp3_file;			//!< Name of the mp3 file
+	wave_read		*pc_wave_read;			//!< Reader, only used by the reader stage
+	content_hash	c_hash;					//!< Hash of the wave file for the manifest, taken by the reader
+	wave_header		s_wave_header;			//!< Header of the wave file
+	wave_to_mp3		*pc_wave2mp3;			//!< Encoder, keeps the lame state from block to block
+	int				i_mp3_fd;				//!< Descriptor of the mp3 file
+	int				i_block_samples;		//!< Samples (per channel) in a full PCM block
+	pipe_pcm_block	s_blocks[PIPE_FILE_BLOCKS];	//!< Ring of PCM blocks
+	int				i_fill_idx;				//!< Next block of the ring to read
+	int				i_encode_idx;			//!< Next block of the ring to encode
+	int				i_ready_blocks;			//!< Blocks read and not encoded yet
+	int				i_reading;				//!< 1: Queued for, or being read by, a reader
+	int				i_read_done;			//!< 1: The last block is read
+	int				i_encoding;				//!< 1: Queued for, or being encoded by, an encoder
+	int				i_encode_done;			//!< 1: The last block is encoded
+	long			l_mp3_offset;			//!< Offset of the next mp3 block in the mp3 file
+	int				i_pending_writes;		//!< mp3 blocks not written yet
+} pipe_file;
+
+/**
+*	Block of mp3 data to write.
+*/
+typedef struct _pipe_mp3_block
+{
+	pipe_file		*ps_file;				//!< File it belongs to
+	unsigned char	*pc_data;				//!< mp3 data, borrowed from the arena of the pipeline
+	int				i_bytes;				//!< Size of pc_data in bytes
+	long			l_offset;				//!< Offset in the mp3 file
+} pipe_mp3_block;
+
+/**
+*	Staged encoding pipeline.
+*	Reader threads read blocks of samples from the wave files, encoder threads encode them with
+*	lame, and writer threads write the mp3 blocks. The stages are connected by bounded queues, so
+*	that the disk and the CPUs are busy at the same time, and the memory in use is limited.
+*	A wave file is read and encoded block by block in order, and every block is only encoded by
+*	one thread at a time, but the blocks of different files are read, encoded and written in
+*	parallel. The mp3 files are the same as those of wave_to_mp3::encode_wave.
+*/
+class pipeline
+{
+private:
+	int						m_i_num_readers;		//!< Number of reader threads
+	int						m_i_num_encoders;		//!< Number of encoder threads
+	int						m_i_num_writers;		//!< Number of writer threads
+	pthread_t				*m_pt_threads;			//!< All threads, readers first, then encoders and writers
+	wave_to_mp3				**m_ppc_wave2mp3;		//!< Encoders, one per file that can be open
+	std::deque<wave_to_mp3*>	m_dq_free_wave2mp3;	//!< Encoders not used by an open file
+	int						m_i_max_open_files;		//!< Most wave files open at a time
+	int						m_i_open_files;			//!< Wave files open
+	int						m_i_files;				//!< Wave files added and not finished
+	std::deque<pipe_file*>	m_dq_new_files;			//!< Files added, not opened yet
+	std::deque<pipe_file*>	m_dq_read_files;		//!< Files with a free PCM block
+	std::deque<pipe_file*>	m_dq_encode_files;		//!< Files with a PCM block read
+	std::deque<pipe_mp3_block>	m_dq_mp3_blocks;	//!< mp3 blocks to write
+	buffer_arena			*m_pc_arena;			//!< PCM and mp3 blocks of all files
+	int						m_i_shut_down;			//!< 1: The threads exit
+	encode_manifest			*m_pc_manifest;			//!< Records the files finished, if not NULL
+	pthread_mutex_t			m_t_mutex;				//!< Mutex for all of the above
+	pthread_cond_t			m_t_read_cond;			//!< Condition variable if there is work for a reader
+	pthread_cond_t			m_t_encode_cond;		//!< Condition variable if there is work for an encoder
+	pthread_cond_t			m_t_write_cond;			//!< Condition variable if there is work for a writer
+	pthread_cond_t			m_t_new_space_cond;		//!< Condition variable if another file can be added
+	pthread_cond_t			m_t_mp3_space_cond;		//!< Condition variable if another mp3 block can be queued
+	pthread_cond_t			m_t_done_cond;			//!< Condition variable if a file is finished
+
+	/**
+	*	Reader thread function.
+	*/
+	void					read();
+
+	/**
+	*	Encoder thread function.
+	*/
+	void					encode();
+
+	/**
+	*	Writer thread function.
+	*/
+	void					write();
+
+	/**
+	*	Open a wave file and its mp3 file.
+	*/
+	void					open_file(pipe_file *ps_file);
+
+	/**
+	*	Read the next PCM block of a file.
+	*/
+	void					read_block(pipe_file *ps_file);
+
+	/**
+	*	Close a file whose mp3 data is completely written, and free it.
+	*/
+	void					finish_file(pipe_file *ps_file);
+
+	static void				*run_reader(void *p_pipeline);
+	static void				*run_encoder(void *p_pipeline);
+	static void				*run_writer(void *p_pipeline);
+
+public:
+
+	/**
+	*	Constructor.
+	*	Starts the threads of all stages.
+	*	@param i_readers Number of reader threads.
+	*	@param i_encoders Number of encoder threads.
+	*	@param i_writers Number of writer threads.
+	*	@param i_quality MP3 quality, 0: highest, 9: lowest.
+	*/
+	pipeline(int i_readers, int i_encoders, int i_writers, int i_quality);
+
+	/**
+	*	Destructor.
+	*	Stops the threads. Call wait_done first, or files added are left unfinished.
+	*/
+	~pipeline();
+
+	/**
+	*	Add a wave file to encode.
+	*	If too many files are waiting to be opened, the function will be suspended in wait state
+	*	until one is opened. I.e. this is a blocking function.
+	*	@param pc_wave_file Name of the wave file. Copied.
+	*	@param pc_mp3_file Name of the mp3 file. Copied.
+	*/
+	void					add_file(const char *pc_wave_file, const char *pc_mp3_file);
+
+	/**
+	*	Wait till all files added are encoded and written.
+	*/
+	void					wait_done();
+
+	/**
+	*	Record the files finished in a manifest (see encode_manifest).
+	*/
+	void					set_manifest(encode_manifest *pc_manifest){m_pc_manifest = pc_manifest;}
+};
+
+#endif // __PIPELINE_H__
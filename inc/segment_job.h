@@ -0,0 +1,108 @@
+/**
+* @file segment_job.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the segment_job class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __SEGMENT_JOB_H__
+#define __SEGMENT_JOB_H__
+
+#include <pthread.h>
+#include <buffer_arena.h>
+#include <mp3_writer.h>
+
+/**
+*	Segment job.
+*	Splits one wave file into frame aligned segments, which are encoded independently
+*	(see wave_to_mp3::encode_segment) by different threads. Collects the mp3 frames of every
+*	segment and writes them in order to the mp3 file once the last segment is done.
+*/
+class segment_job
+{
+private:
+	char				*m_pc_wave_file;			//!< Input wave file name
+	char				*m_pc_mp3_file;				//!< Output mp3 file name
+	int					m_i_num_segments;			//!< Number of segments
+	int					m_i_segment_samples;		//!< Samples in every segment, except maybe the last one
+	int					m_i_total_samples;			//!< Samples of the file
+	unsigned char		**m_ppc_mp3_data;			//!< Encoded frames of every segment
+	int					*m_pi_mp3_size;				//!< Size of the encoded frames of every segment
+	int					m_i_segments_left;			//!< Segments not yet encoded
+	pthread_mutex_t		m_t_mutex;					//!< Mutex for m_i_segments_left
+
+public:
+
+	/**
+	*	Constructor.
+	*	@param pc_wave_file Name of the input wave file. Copied.
+	*	@param pc_mp3_file Name of the output mp3 file. Copied.
+	*/
+	segment_job(const char *pc_wave_file, const char *pc_mp3_file);
+
+	/**
+	*	Destructor.
+	*/
+	~segment_job();
+
+	/**
+	*	Plan the segments.
+	*	Reads the wave header and splits the data in segments of about i_segment_seconds, rounded
+	*	to whole mp3 frames. Files with non standard sample rates are not split. 
+	*	@param i_segment_seconds Length of a segment in seconds.
+	*	@param pc_arena Arena for the buffers reading the header, NULL: a new one.
+	*	@return Number of segments. 1 means the file should be encoded as a whole, 0 that it 
+	*	cannot be read, or its header has no valid sample rate or no samples.
+	*/
+	int					plan(int i_segment_seconds, buffer_arena *pc_arena=NULL);
+
+	/**
+	*	Get number of segments.
+	*/
+	int					get_num_segments(){return m_i_num_segments;}
+
+	/**
+	*	Get first sample of a segment.
+	*/
+	int					get_first_sample(int i_segment){return i_segment * m_i_segment_samples;}
+
+	/**
+	*	Get number of samples of a segment.
+	*	For the last segment, it is the samples till the end of the file.
+	*/
+	int					get_num_samples(int i_segment)
+	{
+		return (i_segment == m_i_num_segments-1) ? m_i_total_samples - get_first_sample(i_segment) : m_i_segment_samples;
+	}
+
+	/**
+	*	Get wave file name.
+	*/
+	char				*get_wave_file(){return m_pc_wave_file;}
+
+	/**
+	*	Get mp3 file name.
+	*/
+	char				*get_mp3_file(){return m_pc_mp3_file;}
+
+	/**
+	*	Segment done.
+	*	Should be called by the working thread once it has encoded a segment.
+	*	@param i_segment The segment number.
+	*	@param pc_mp3_data Encoded frames of the segment, allocated with new []. Owned by this class afterwards.
+	*	@param i_mp3_size Size of pc_mp3_data in bytes, -1: the segment could not be encoded.
+	*	@return 1 if this was the last segment to finish, 0 otherwise.
+	*/
+	int					set_segment_done(int i_segment, unsigned char *pc_mp3_data, int i_mp3_size);
+
+	/**
+	*	Write the mp3 file.
+	*	Concatenates the frames of all the segments. Call once all segments are done.
+	*	@param pc_mp3_writer Writer, e.g. the one of the wave_to_mp3 of the calling thread.
+	*	@return 0: All clear, otherwise: a segment could not be encoded or the file cannot be written.
+	*	Nothing is left of the file then.
+	*/
+	int					write_mp3(mp3_writer *pc_mp3_writer);
+};
+
+#endif // __SEGMENT_JOB_H__
@@ -1,73 +1,93 @@
-/**
-* @file thread_handler.h
-* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
-* @brief This file contains the thread_handler class.
-* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
-*/
-
-#ifndef __THREAD_HANDLER_H__
-#define __THREAD_HANDLER_H__
-
-#include <pthread.h>
-
-class work_queue;
-
-/**
-*	Thread handler.
-*	Class to handle thread execution.
-*/
-class thread_handler
-{
-private:
-	void		*(*m_p_func_ptr)(void *p, int t);	//!< The default function the thread calls when it pops a job from the queue
-	int			m_i_thread_num;						//!< Thread number of the thread running this class
-	work_queue	*m_pc_work_queue;					//!< Working queue with jobs
-	int			m_i_status;							//!< 1 -> Running, 0 -> Idle
-	int			m_i_detached;						//!< 1 -> Detached, 0 -> Not detached (default)
-	pthread_t	m_t_id;								//!< Thread ID
-
-public:
-
-	/**
-	*	Constructor.
-	*	@param i_thread_num The ID of the thread.
-	*	@param pc_work_queue The work queue class from which to fetch the job.
-	*/
-	thread_handler(int i_thread_num, work_queue *pc_work_queue);
-	
-	/**
-	*	Destructor.
-	*/
-	~thread_handler();
-	
-	/**
-	*	Run the thread.
-	*	Actual runing function of the thread
-	*/
-	void		*run_thread();
-
-	/**
-	*	Start the thread.
-	*	It will wait for the jobs and then start processing
-	*/
-	int			start_thread();
-
-	/**
-	*	Wait for thread to finish.
-	*	This is actually pthread's join() function
-	*/
-	int			wait_till_thread_finished();
-
-	/**
-	*	Detach the thread
-	*/
-	int			detach_thread();
-
-	/**
-	*	Register default function. 
-	*/
-	void		set_default_function(void *(*p_func_ptr)(void *, int)){m_p_func_ptr = p_func_ptr;}
-
-};
-
+/**
+* @file thread_handler.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the thread_handler class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __THREAD_HANDLER_H__
+#define __THREAD_HANDLER_H__
+
+#include <pthread.h>
+
+class work_queue;
+class work_steal_queue;
+
+/**
+*	Thread handler.
+*	Class to handle thread execution.
+*/
+class thread_handler
+{
+private:
+	void		*(*m_p_func_ptr)(void *p, int t);	//!< The default function the thread calls when it pops a job from the queue
+	int			m_i_thread_num;						//!< Thread number of the thread running this class
+	work_queue	*m_pc_work_queue;					//!< Working queue with jobs
+	work_queue	*m_pc_free_queue;					//!< Queue to which finished work items are returned
+	work_steal_queue	*m_pc_steal_queue;				//!< Work stealing queue with jobs, used instead of m_pc_work_queue
+	int			m_i_status;							//!< 1 -> Running, 0 -> Idle
+	int			m_i_detached;						//!< 1 -> Detached, 0 -> Not detached (default)
+	pthread_t	m_t_id;								//!< Thread ID
+	long long	m_ll_wait_ns;						//!< Time the current (or last) job waited in the queue in nsec
+
+public:
+
+	/**
+	*	Constructor.
+	*	@param i_thread_num The ID of the thread.
+	*	@param pc_work_queue The work queue class from which to fetch the job.
+	*	@param pc_free_queue The queue to which a work item is returned once its job is done.
+	*	Can be NULL, in which case the work items are not returned.
+	*/
+	thread_handler(int i_thread_num, work_queue *pc_work_queue, work_queue *pc_free_queue = NULL);
+
+	/**
+	*	Constructor.
+	*	@param i_thread_num The ID of the thread, which is also its deque in pc_steal_queue.
+	*	@param pc_steal_queue The work stealing queue from which to fetch the job.
+	*/
+	thread_handler(int i_thread_num, work_steal_queue *pc_steal_queue);
+	
+	/**
+	*	Destructor.
+	*/
+	~thread_handler();
+	
+	/**
+	*	Run the thread.
+	*	Actual runing function of the thread. Exits when it pops a NULL job.
+	*/
+	void		*run_thread();
+
+	/**
+	*	Start the thread.
+	*	It will wait for the jobs and then start processing
+	*/
+	int			start_thread();
+
+	/**
+	*	Wait for thread to finish.
+	*	This is actually pthread's join() function
+	*/
+	int			wait_till_thread_finished();
+
+	/**
+	*	Detach the thread
+	*/
+	int			detach_thread();
+
+	/**
+	*	Register default function. 
+	*/
+	void		set_default_function(void *(*p_func_ptr)(void *, int)){m_p_func_ptr = p_func_ptr;}
+
+	/**
+	*	Get the time the current job waited in the queue, from when it was added until this thread
+	*	took it. Only valid on this thread, e.g. for the job to read it.
+	*	@return The time in nsec.
+	*/
+	long long	get_wait_ns(){return m_ll_wait_ns;}
+
+};
+
 #endif // __THREAD_HANDLER_H__
\ No newline at end of file
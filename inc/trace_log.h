@@ -0,0 +1,116 @@
+/**
+* @file trace_log.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the trace_log class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __TRACE_LOG_H__
+#define __TRACE_LOG_H__
+
+#include <time.h>
+
+#define		TRACE_RING_EVENTS		(64*1024)	//!< Spans every thread keeps, the oldest are overwritten once it is full
+#define		TRACE_NAME_LENGTH		32			//!< Longest thread name, with the terminating 0
+
+/**
+*	Span of time spent by a thread on one thing.
+*/
+typedef struct _trace_event
+{
+	const char	*pc_name;			//!< What the thread did, a string that is never freed
+	long long	ll_start_ns;		//!< Start in nsec of CLOCK_MONOTONIC
+	long long	ll_end_ns;			//!< End in nsec of CLOCK_MONOTONIC
+	long		l_bytes;			//!< Bytes read or written, -1: none
+} trace_event;
+
+/**
+*	Spans of one thread.
+*	Only the thread itself writes to its ring, so adding a span takes no lock and no atomic
+*	read-modify-write, just a store of the new head.
+*/
+typedef struct _trace_ring
+{
+	trace_event	ps_events[TRACE_RING_EVENTS];	//!< Span i is at i modulo TRACE_RING_EVENTS
+	long		l_head;							//!< Spans added so far
+	int			i_tid;							//!< Number of the thread in the trace
+	char		pc_thread_name[TRACE_NAME_LENGTH];	//!< Name of the thread in the trace
+	struct _trace_ring *ps_next;				//!< Ring of the thread that started tracing before
+} trace_ring;
+
+/**
+*	Timeline of what every thread did, in the Chrome trace event format.
+*	The file opens in chrome://tracing or Perfetto, where load imbalance and I/O stalls show up
+*	as gaps and long spans on the rows of the threads. The spans are timed where they happen:
+*	@code
+*	long long ll_start_ns = trace_log::begin();
+*	...
+*	trace_log::end("read", ll_start_ns, i_bytes);
+*	@endcode
+*	While tracing is off, begin returns 0 and end returns at once. Every thread gets a ring
+*	of its own the first time it adds a span. The rings are kept until the process ends,
+*	as the threads may outlive the trace.
+*/
+class trace_log
+{
+private:
+	static int			m_i_on;				//!< 1: Tracing
+	static long long	m_ll_start_ns;		//!< When tracing started
+	static trace_ring	*m_ps_rings;		//!< Rings of all threads, newest first
+	static int			m_i_num_rings;		//!< Number of rings
+
+	/**
+	*	Get the ring of the calling thread, made the first time.
+	*/
+	static trace_ring	*get_ring();
+
+public:
+
+	/**
+	*	Start tracing.
+	*	Should be called before the threads to trace are started, so that they get their names.
+	*/
+	static void			start();
+
+	/**
+	*	Is tracing on?
+	*/
+	static int			is_on(){return __atomic_load_n(&m_i_on, __ATOMIC_RELAXED);}
+
+	/**
+	*	Name the calling thread in the trace, e.g. "worker 3". Threads without a name are
+	*	named "thread" and their number.
+	*/
+	static void			set_thread_name(const char *pc_name);
+
+	/**
+	*	Start a span.
+	*	@return The time in nsec, 0 if tracing is off.
+	*/
+	static long long	begin()
+	{
+		if(!is_on())
+			return 0;
+		timespec s_time;
+		clock_gettime(CLOCK_MONOTONIC, &s_time);
+		return s_time.tv_sec * 1000000000LL + s_time.tv_nsec;
+	}
+
+	/**
+	*	End a span on the calling thread.
+	*	@param pc_name What the thread did. Must stay valid until the trace is written.
+	*	@param ll_start_ns What begin returned, nothing is added if 0.
+	*	@param l_bytes Bytes read or written during the span, -1: none (default).
+	*/
+	static void			end(const char *pc_name, long long ll_start_ns, long l_bytes = -1);
+
+	/**
+	*	Stop tracing and write the spans of all threads.
+	*	The threads should have finished their work, a span added while writing may be garbled.
+	*	@param pc_trace_file JSON file in the Chrome trace event format.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	static int			write(const char *pc_trace_file);
+};
+
+#endif // __TRACE_LOG_H__
@@ -0,0 +1,176 @@
+/**
+* @file wav2mp3.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the wav2mp3 class, the interface of libwav2mp3.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __WAV2MP3_H__
+#define __WAV2MP3_H__
+
+#include <vector>
+#include <wave_read.h>
+
+class wave_to_mp3;
+
+#define		WAV2MP3_ERROR_FORMAT	-1		//!< Not a wave file, or a format that cannot be encoded
+#define		WAV2MP3_ERROR_BUFFER	-2		//!< The output buffer is too small
+#define		WAV2MP3_ERROR_STATE		-3		//!< push or finish without begin, or begin twice
+#define		WAV2MP3_ERROR_ENCODE	-4		//!< lame failed, the stream is ended
+#define		WAV2MP3_ERROR_TRUNCATED	-5		//!< The wave header goes on past the bytes given
+
+/**
+*	Format of raw PCM samples.
+*/
+typedef struct _wav2mp3_format
+{
+	int			i_sample_rate;				//!< Sample rate in Hz
+	int			i_channels;					//!< Number of channels, 1 or 2
+	int			i_bits_per_sample;			//!< 16, 24 or 32 bits, little endian, interleaved
+} wav2mp3_format;
+
+/**
+*	Encoder of wave files or PCM samples in memory into mp3 data in memory.
+*	A whole wave file or block of samples is encoded at once with encode_wave or encode_pcm.
+*	Samples coming in pieces, e.g. from the network, are pushed as they come between begin and
+*	finish. The mp3 data is appended to a vector, which grows as needed, or written into a buffer
+*	of the caller. Either way, it is the same as that of the wave_to_mp3 command line tool.
+*	Errors in the input are returned, not printed.
+*	An object encodes one stream at a time, and is used by one thread at a time. Keeping it for
+*	the next stream saves setting up its buffers.
+*/
+class wav2mp3
+{
+private:
+	wave_to_mp3					*m_pc_wave2mp3;			//!< Encoder
+	wave_header					m_s_header;				//!< Header of the stream between begin and finish
+	int							m_i_streaming;			//!< 1: Between begin and finish
+	int							m_i_block_align;		//!< Bytes of one sample of all channels
+	int							m_i_itr_bytes;			//!< Bytes the encoder takes at once
+	int							m_i_slice_itrs;			//!< Iterations whose mp3 data fits into m_pc_mp3_buffer
+	unsigned char				*m_pc_pending;			//!< Bytes pushed but not encoded yet, less than m_i_itr_bytes
+	int							m_i_pending;			//!< Number of bytes in m_pc_pending
+	unsigned char				*m_pc_mp3_buffer;		//!< The encoder writes into it, before it is appended to the output
+
+	/**
+	*	Encode samples, appending the mp3 data to pv_mp3.
+	*	@param l_samples Number of samples, a multiple of the samples per iteration but for the last block.
+	*	@return 0, or WAV2MP3_ERROR_ENCODE. The stream is ended then.
+	*/
+	int							encode(const unsigned char *pc_pcm, long l_samples, std::vector<unsigned char> *pv_mp3);
+
+public:
+
+	/**
+	*	Constructor.
+	*	@param i_quality Quality of the encoding, 0: highest, 9: lowest.
+	*/
+	wav2mp3(int i_quality=0);
+
+	/**
+	*	Destructor.
+	*/
+	~wav2mp3();
+
+	/**
+	*	Parse the header of a wave file, up to where its samples start.
+	*	The RIFF chunks are walked up to the data chunk, skipping any others (e.g. LIST). The fmt
+	*	chunk may be longer than 16 bytes, and WAVE_FORMAT_EXTENSIBLE is taken if its subformat is
+	*	PCM. The RIFF size is not checked, as streaming recorders and pipes leave it at 0 or 0xFFFFFFFF.
+	*	@param pc_wave Start of the wave file.
+	*	@param l_bytes Bytes available at pc_wave.
+	*	@param ps_format Returns the format of the samples.
+	*	@param pl_header_bytes Returns the size of the header, the offset of the first sample.
+	*	@param pl_data_bytes Returns the size of the data chunk, -1 if it is 0 or 0xFFFFFFFF: the
+	*	samples go on up to the end of the file.
+	*	@return 0, WAV2MP3_ERROR_FORMAT, or WAV2MP3_ERROR_TRUNCATED if more bytes are needed.
+	*/
+	static int					read_header(const unsigned char *pc_wave, long l_bytes, wav2mp3_format *ps_format,
+									long *pl_header_bytes, long *pl_data_bytes);
+
+	/**
+	*	Check a wave file in memory and get its format.
+	*	The header is parsed with read_header. The samples are the bytes of the data chunk, or all 
+	*	the bytes after the header if its size is unknown.
+	*	@param pc_wave Wave file.
+	*	@param l_bytes Size of the wave file in bytes.
+	*	@param ps_format Returns the format of the samples.
+	*	@param ppc_pcm Returns the samples, in pc_wave.
+	*	@param pl_pcm_bytes Returns the size of the samples in bytes.
+	*	@return 0, or WAV2MP3_ERROR_FORMAT.
+	*/
+	static int					read_wave(const unsigned char *pc_wave, long l_bytes, wav2mp3_format *ps_format,
+									const unsigned char **ppc_pcm, long *pl_pcm_bytes);
+
+	/**
+	*	Encode a wave file in memory.
+	*	@param pc_wave Wave file.
+	*	@param l_bytes Size of the wave file in bytes.
+	*	@param pv_mp3 The mp3 data is appended to it.
+	*	@return Number of mp3 bytes, or an error.
+	*/
+	long						encode_wave(const unsigned char *pc_wave, long l_bytes, std::vector<unsigned char> *pv_mp3);
+
+	/**
+	*	Encode a wave file in memory into a buffer.
+	*	The parameters are the same as for the other encode_wave, but the mp3 data is written to
+	*	pc_mp3, which has l_mp3_size bytes.
+	*	@return Number of mp3 bytes, or an error. WAV2MP3_ERROR_BUFFER, before anything is encoded,
+	*	if l_mp3_size is less than get_max_mp3_bytes of the samples.
+	*/
+	long						encode_wave(const unsigned char *pc_wave, long l_bytes, unsigned char *pc_mp3, long l_mp3_size);
+
+	/**
+	*	Encode PCM samples in memory.
+	*	@param ps_format Format of the samples.
+	*	@param pc_pcm Samples.
+	*	@param l_bytes Size of the samples in bytes.
+	*	@param pv_mp3 The mp3 data is appended to it.
+	*	@return Number of mp3 bytes, or an error.
+	*/
+	long						encode_pcm(const wav2mp3_format *ps_format, const unsigned char *pc_pcm, long l_bytes,
+									std::vector<unsigned char> *pv_mp3);
+
+	/**
+	*	Encode PCM samples in memory into a buffer.
+	*	The parameters are the same as for the other encode_pcm, but the mp3 data is written to
+	*	pc_mp3, which has l_mp3_size bytes.
+	*	@return Number of mp3 bytes, or an error. WAV2MP3_ERROR_BUFFER, before anything is encoded,
+	*	if l_mp3_size is less than get_max_mp3_bytes(ps_format, l_bytes).
+	*/
+	long						encode_pcm(const wav2mp3_format *ps_format, const unsigned char *pc_pcm, long l_bytes,
+									unsigned char *pc_mp3, long l_mp3_size);
+
+	/**
+	*	Begin a stream of samples pushed in pieces.
+	*	@return 0, or an error.
+	*/
+	int							begin(const wav2mp3_format *ps_format);
+
+	/**
+	*	Push the next samples of the stream.
+	*	The pieces may be of any size, even split within a sample.
+	*	@param pc_pcm Samples.
+	*	@param l_bytes Size of the samples in bytes.
+	*	@param pv_mp3 The mp3 data encoded so far is appended to it.
+	*	@return Number of mp3 bytes, or an error.
+	*/
+	long						push(const unsigned char *pc_pcm, long l_bytes, std::vector<unsigned char> *pv_mp3);
+
+	/**
+	*	End the stream, and encode what is left of it.
+	*	A part of a sample left over is dropped.
+	*	@param pv_mp3 The last mp3 data is appended to it.
+	*	@return Number of mp3 bytes, or an error.
+	*/
+	long						finish(std::vector<unsigned char> *pv_mp3);
+
+	/**
+	*	Get most bytes of the mp3 data of samples, for sizing a buffer of the caller.
+	*	@param ps_format Format of the samples.
+	*	@param l_bytes Size of the samples in bytes.
+	*/
+	static long					get_max_mp3_bytes(const wav2mp3_format *ps_format, long l_bytes);
+};
+
+#endif // __WAV2MP3_H__
@@ -0,0 +1,93 @@
+/**
+* @file wave_corpus.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the wave_corpus class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __WAVE_CORPUS_H__
+#define __WAVE_CORPUS_H__
+
+#include <wav2mp3.h>
+#include <string>
+#include <vector>
+
+#define		CORPUS_MAX_FORMATS		16			//!< Most formats of a corpus
+
+/**
+*	Synthetic corpus of wave files, for benchmarking.
+*	The files are generated into a new temporary directory, which is removed with the corpus.
+*	File i has format i modulo the number of formats, and a length drawn evenly on a log scale
+*	between the shortest and the longest, so that there are many short files and a few long
+*	ones, as in real collections. The samples are sines with some noise, so that the encoder
+*	has to work. The same parameters always give the same files.
+*/
+class wave_corpus
+{
+private:
+	std::string					m_s_dir;						//!< Directory of the files, empty: none yet
+	std::vector<std::string>	m_v_wave_files;					//!< Names of the wave files
+	double						m_d_audio_seconds;				//!< Length of all the files together
+	long						m_l_bytes;						//!< Size of all the files together
+	wav2mp3_format				m_s_formats[CORPUS_MAX_FORMATS];	//!< Formats of the files
+	int							m_i_num_formats;				//!< Number of formats in m_s_formats
+
+	/**
+	*	Write one wave file.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	int					write_file(const char *pc_wave_file, const wav2mp3_format *ps_format, int i_samples, int i_seed);
+
+public:
+
+	/**
+	*	Constructor.
+	*	The corpus has the format 44100 Hz, 2 channels and 16 bits until set_formats is called.
+	*/
+	wave_corpus();
+
+	/**
+	*	Destructor.
+	*	Removes the files, the mp3 files next to them and the directory.
+	*/
+	~wave_corpus();
+
+	/**
+	*	Set the formats of the files.
+	*	@param pc_formats Comma separated list of rate/channels/bits, e.g. "44100/2/16,48000/1/24".
+	*	@return 0: All clear, otherwise: not a list of formats the encoder supports.
+	*/
+	int					set_formats(const char *pc_formats);
+
+	/**
+	*	Generate the files.
+	*	@param pc_parent_dir Directory the directory of the corpus is made in.
+	*	@param i_files Number of files.
+	*	@param d_min_seconds Length of the shortest file.
+	*	@param d_max_seconds Length of the longest file.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	int					generate(const char *pc_parent_dir, int i_files, double d_min_seconds, double d_max_seconds);
+
+	/**
+	*	Get the number of files.
+	*/
+	int					get_num_files(){return (int)m_v_wave_files.size();}
+
+	/**
+	*	Get the name of a wave file.
+	*/
+	const char			*get_wave_file(int i_file){return m_v_wave_files[i_file].c_str();}
+
+	/**
+	*	Get the length of all the files together in seconds.
+	*/
+	double				get_audio_seconds(){return m_d_audio_seconds;}
+
+	/**
+	*	Get the size of all the files together in bytes.
+	*/
+	long				get_bytes(){return m_l_bytes;}
+};
+
+#endif // __WAVE_CORPUS_H__
@@ -1,121 +1,246 @@
-/**
-* @file wave_read.h
-* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
-* @brief Read wave file.
-* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
-*/
-
-#ifndef __WAVE_READ_H__
-#define	__WAVE_READ_H__
-
-#include <iostream>
-#include <fstream>
-
-typedef struct _wave_header
-{
-	char		group_id[4];
-	int			file_size;
-	char		wave[4];
-	char		subchunk1_id[4];
-	int			subchunk1_size;
-	short int	audio_format;
-	short int	num_channels;
-	int			sample_rate;
-	int			bitrate;
-	short int	block_align;
-	short int	bits_per_sample;
-	char		chunk2_id[4];
-	int			chunk2_size;
-} wave_header;
-
-class wave_read
-{
-private:
-	wave_header			*m_ps_wave_header;				//!< Wave header
-	FILE				*m_f_wave_file;					//!< Wave file 
-	char				*m_pc_file_name;				//!< Wave file name
-	int					m_i_sanity_pass;				//!< 1- Sane wave file, 0- otherwise
-	unsigned char		*m_pc_header_buffer;			//!< Wave header buffer
-	int					m_i_bytes_per_sample;			//!< Number of bytes per sample
-	int					m_i_total_samples;				//!< Total number of data samples
-	int					m_i_buff_size_in_bytes;			//!< Size of the internal buffer in bytes
-	unsigned char		*m_pc_buffer;					//!< Buffer to hold sample data
-
-	/**
-	*	Fill wav header.
-	*/
-	void		fill_wave_header();
-public:
-
-	/**
-	*	Constructor.
-	*/
-	wave_read();
-
-	/**
-	*	Wave read constructor.
-	*	Get the wav header informaiton.
-	*	@param pc_wave_file Name of the wav file.
-	*/
-	wave_read(char *pc_wave_file);
-	
-	/**
-	*	Wave read destructor.
-	*/
-	~wave_read();
-
-	/**
-	*	Display Wave info.
-	*/
-	void	display_wave_info();
-
-	/**
-	*	Get wav header.
-	*	@return wave_header structure.
-	*/
-	wave_header	*get_wave_header(){return m_ps_wave_header;}
-
-	/**
-	*	Fill Wave buffer.
-	*	@param ppi_pcm_buffer Buffer to fill with PCM data from reading the wav file. User allocates
-	*	this buffer as int and it is filled by this function. First array is the left and the second is
-	*	the right channel.
-	*	@param i_samples Number of samples to read.
-	*	@return The number of bytes actually read from the file. 
-	*/
-	int		fill_wave_buffer(int **ppi_pcm_buffer, int i_samples);	
-
-	/**
-	*	Fill Wave buffer.
-	*	@param ppv_pcm_buffer Buffer to fill with PCM data from reading the wav file. User allocates
-	*	this buffer as short and it is filled by this function. First array is the left and the second is
-	*	the right channel.
-	*	@param i_samples Number of samples to read.
-	*	@return The number of bytes actually read from the file. 
-	*/
-	int		fill_wave_buffer(short **ppi_pcm_buffer, int i_samples);
-
-	/**
-	*	Sanity check of the current wav file.
-	*	@return 0: All clear, otherwise: problem
-	*/
-	int		sanity_check(){return sanity_check(m_ps_wave_header);}
-
-	/**
-	*	Sanity check.
-	*	ps_wave_header wave_header structure.
-	*	@return 0: All clear, otherwise: problem
-	*/
-	int		sanity_check(wave_header *ps_wave_header);
-
-	/**
-	*	Initialize.
-	*	Initialize the memory et/c. of the wave read class. 
-	*	@param i_buff_size_in_bytes Size of the buffer allocated for internal reading. The number of samples
-	*	read at once from the wave file should be less than this value.
-	*	@param pc_wave_file Name of the wave file.
-	*/
-	void	init(char *pc_wave_file, int i_buff_size_in_bytes);
-};
-
+/**
+* @file wave_read.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief Read wave file.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __WAVE_READ_H__
+#define	__WAVE_READ_H__
+
+#include <iostream>
+#include <fstream>
+#include <pcm_convert.h>
+#include <async_io.h>
+#include <buffer_arena.h>
+#include <content_hash.h>
+
+#define		WAVE_READ_AHEAD_BUFFERS		2			//!< Buffers of WAVE_READ_ASYNC, one is used while the next is read
+
+/**
+*	How the samples are read from the wave file.
+*/
+typedef enum _wave_read_mode
+{
+	WAVE_READ_FREAD,		//!< Buffered reads through stdio, e.g. for pipes
+	WAVE_READ_MMAP,			//!< Samples are served straight from a memory mapping of the file
+	WAVE_READ_WHOLE,		//!< Small files are read at once into memory
+	WAVE_READ_ASYNC			//!< The next part of the file is read through async_io while the current one is used
+} wave_read_mode;
+
+typedef struct _wave_header
+{
+	char		group_id[4];
+	int			file_size;
+	char		wave[4];
+	char		subchunk1_id[4];
+	int			subchunk1_size;
+	short int	audio_format;
+	short int	num_channels;
+	int			sample_rate;
+	int			bitrate;
+	short int	block_align;
+	short int	bits_per_sample;
+	char		chunk2_id[4];
+	int			chunk2_size;
+} wave_header;
+
+class wave_read
+{
+private:
+	wave_header			*m_ps_wave_header;				//!< Wave header
+	FILE				*m_f_wave_file;					//!< Wave file 
+	char				*m_pc_file_name;				//!< Wave file name
+	int					m_i_sanity_pass;				//!< 1- Sane wave file, 0- otherwise
+	unsigned char		*m_pc_header_buffer;			//!< Wave header buffer
+	int					m_i_bytes_per_sample;			//!< Number of bytes per sample
+	int					m_i_total_samples;				//!< Total number of data samples
+	int					m_i_buff_size_in_bytes;			//!< Size of the internal buffer in bytes
+	unsigned char		*m_pc_buffer;					//!< Buffer to hold sample data
+	wave_read_mode		m_e_read_mode;					//!< How the file is read
+	unsigned char		*m_pc_map;						//!< Memory mapping of the file
+	long				m_l_map_size;					//!< Size of the memory mapping in bytes
+	unsigned char		*m_pc_file_buffer;				//!< Buffer holding a small file completely
+	const unsigned char	*m_pc_file_data;				//!< Whole file in memory (m_pc_map or m_pc_file_buffer)
+	long				m_l_file_size;					//!< Size of the file in memory in bytes
+	long				m_l_file_pos;					//!< Read position in the file in memory
+	pcm_convert_func	m_p_convert_short;				//!< Kernel converting the samples of this file to short
+	pcm_convert_func	m_p_convert_int;				//!< Kernel converting the samples of this file to int
+	async_io			*m_pc_async_io;					//!< Reads ahead if not NULL, owned by the caller
+	int					m_i_fd;							//!< File descriptor for WAVE_READ_ASYNC
+	unsigned char		*m_ppc_ahead_buffer[WAVE_READ_AHEAD_BUFFERS];	//!< Buffers read ahead
+	buffer_arena		*m_pc_arena;					//!< Arena of the buffers
+	buffer_arena		*m_pc_own_arena;				//!< Arena created for this object if none was given
+	long				m_pl_ahead_part[WAVE_READ_AHEAD_BUFFERS];		//!< Part of the file in each buffer, -1: none
+	int					m_pi_ahead_request[WAVE_READ_AHEAD_BUFFERS];	//!< Request reading each buffer, -1: none
+	int					m_pi_ahead_bytes[WAVE_READ_AHEAD_BUFFERS];		//!< Bytes read into each buffer
+	int					m_i_read_error;					//!< 1: A read failed, the samples after it are missing
+	content_hash		*m_pc_hash;						//!< Hashes the bytes read if not NULL, owned by the caller
+
+	/**
+	*	Fill wav header.
+	*/
+	void		fill_wave_header();
+
+	/**
+	*	Open the wave file.
+	*	Regular files are mapped into memory, or read at once if they are small. Otherwise, 
+	*	e.g. for pipes, the file is read through stdio.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	int			open_file(char *pc_wave_file);
+
+	/**
+	*	Close the wave file and release its mapping.
+	*/
+	void		close_file();
+
+	/**
+	*	Read a block of bytes from the wave file.
+	*	@param i_bytes Number of bytes to read.
+	*	@param ppc_data Returns a pointer to the bytes read. It points into the file in memory,
+	*	or into m_pc_buffer when reading through stdio. 
+	*	@return The number of bytes actually read.
+	*/
+	int			read_block(int i_bytes, const unsigned char **ppc_data);
+
+	/**
+	*	Read a block of bytes from the buffers read ahead (WAVE_READ_ASYNC).
+	*	The parameters are the same as for read_block.
+	*/
+	int			read_block_ahead(int i_bytes, const unsigned char **ppc_data);
+
+	/**
+	*	Get the data read ahead at a position of the file.
+	*	Waits for the part of the file holding the position, and then starts reading the next part.
+	*	@param l_pos Position in the file.
+	*	@param ppc_data Returns a pointer to the data at l_pos.
+	*	@return The number of bytes from l_pos to the end of the part.
+	*/
+	int			get_ahead_data(long l_pos, const unsigned char **ppc_data);
+
+	/**
+	*	Start reading a part of the file into a buffer.
+	*/
+	void		submit_read_ahead(int i_buffer, long l_part);
+public:
+
+	/**
+	*	Constructor.
+	*	@param pc_arena Arena the buffers are borrowed from, owned by the caller. The buffers are 
+	*	borrowed once and given back by the destructor. NULL: the object has its own arena.
+	*/
+	wave_read(buffer_arena *pc_arena=NULL);
+
+	/**
+	*	Wave read constructor.
+	*	Get the wav header informaiton.
+	*	@param pc_wave_file Name of the wav file.
+	*/
+	wave_read(char *pc_wave_file);
+	
+	/**
+	*	Wave read destructor.
+	*/
+	~wave_read();
+
+	/**
+	*	Display Wave info.
+	*/
+	void	display_wave_info();
+
+	/**
+	*	Get wav header.
+	*	@return wave_header structure.
+	*/
+	wave_header	*get_wave_header(){return m_ps_wave_header;}
+
+	/**
+	*	Get total number of samples (per channel) in the data chunk.
+	*/
+	int		get_total_samples(){return m_i_total_samples;}
+
+	/**
+	*	Seek to sample.
+	*	The next fill_wave_buffer call will start reading from this sample.
+	*	@param i_sample Sample number (per channel) from the start of the data chunk.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	int		seek_to_sample(int i_sample);
+
+	/**
+	*	Fill Wave buffer.
+	*	Specialized at compile time for the format of the wave file, which the caller must have
+	*	checked after init. Instantiated for 2, 3 and 4 bytes per sample, 1 and 2 channels, short and int.
+	*	@param ppt_pcm_buffer Buffer to fill with PCM data from reading the wav file. User allocates
+	*	this buffer as T and it is filled by this function. First array is the left and the second is
+	*	the right channel. int samples are left justified to 32 bits. For short samples, the upper 
+	*	16 bits are kept.
+	*	@param i_samples Number of samples to read.
+	*	@return The number of bytes actually read from the file. 
+	*/
+	template <int BYTES, int CHANNELS, typename T>
+	int		fill_wave_buffer(T **ppt_pcm_buffer, int i_samples);
+
+	/**
+	*	Get a block of interleaved samples as they are stored in the wave file.
+	*	Nothing is converted or copied when the file is in memory.
+	*	@param ppc_data Returns a pointer to the samples. It is valid until the next read.
+	*	@param i_samples Number of samples to read.
+	*	@return The number of bytes actually read from the file. 
+	*/
+	int		get_raw_block(const unsigned char **ppc_data, int i_samples);
+
+	/**
+	*	Sanity check of the current wav file.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	int		sanity_check(){return sanity_check(m_ps_wave_header);}
+
+	/**
+	*	Sanity check.
+	*	ps_wave_header wave_header structure.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	int		sanity_check(wave_header *ps_wave_header);
+
+	/**
+	*	Initialize.
+	*	Initialize the memory et/c. of the wave read class. 
+	*	@param i_buff_size_in_bytes Size of the buffer allocated for internal reading. The number of samples
+	*	read at once from the wave file should be less than this value.
+	*	@param pc_wave_file Name of the wave file.
+	*	@return 0: All clear, otherwise: the file cannot be opened or has no header.
+	*/
+	int		init(char *pc_wave_file, int i_buff_size_in_bytes);
+
+	/**
+	*	Did a read fail since init?
+	*	A read that fails returns no more samples, as at the end of the file, so a caller that read
+	*	up to the end checks this to know if it got all samples.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	int		get_read_error(){return m_i_read_error;}
+
+	/**
+	*	Hash the bytes of the file as they are read, e.g. for encode_manifest.
+	*	The hash is reset by the next init. It is of the whole file once the file is read from
+	*	init to the end without seek_to_sample, see content_hash::get_bytes.
+	*	@param pc_hash NULL: not hashed (default).
+	*/
+	void	set_content_hash(content_hash *pc_hash){m_pc_hash = pc_hash;}
+
+	/**
+	*	Get how the file is read.
+	*/
+	wave_read_mode	get_read_mode(){return m_e_read_mode;}
+
+	/**
+	*	Read large files ahead through async_io.
+	*	Takes effect with the next init.
+	*	@param pc_async_io Does the reads, NULL: map the files into memory instead (default).
+	*/
+	void	set_async_io(async_io *pc_async_io){m_pc_async_io = pc_async_io;}
+};
+
 #endif	// __WAVE_READ_H__
\ No newline at end of file
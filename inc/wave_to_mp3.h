@@ -1,86 +1,353 @@
-/**
-* @file wave_to_mp3.h
-* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
-* @brief Read wave file.
-* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
-*/
-
-#ifndef __WAVE_TO_MP3_H__
-#define	__WAVE_TO_MP3_H__
-
-#include <iostream>
-#include <fstream>
-
-class wave_read;
-
-class wave_to_mp3
-{
-private:
-	wave_read			*m_pc_wave_read;				//!< Wave reader
-	FILE				*m_f_mp3_file;					//!< MP3 file name
-	int					m_iBytesPerSample;				//!< Number of bytes per sample
-	int					m_iTotalSamples;				//!< Total number of data samples
-	int					**m_ppi_pcm_buffer;				//!< Buffer holding PCM samples
-	int					m_i_samples_per_itr;			//!< Samples to read from wave file per iteration
-	int					m_i_vbr_quality;				//!< Quality of the encoding, 0: highest, 9: lowest
-
-	/**
-	*	Free internal memory.
-	*/
-	void	free_memory();
-
-	/**
-	*	Allocate internal memory.
-	*/
-	void	allocate_memory();
-
-public:
-
-	/**
-	*	Constructor.
-	*	If you use this constructor, then you must call the init function.
-	*/
-	wave_to_mp3();
-
-	/**
-	*	Destructor.
-	*/
-	~wave_to_mp3();
-
-	/**
-	*	Initialize.
-	*	@param pc_wave_file Name of the input wave file.
-	*	@param pc_mp3_file Name of the output mp3 file.
-	*/
-	void	init(char *pc_wave_file, char *pc_mp3_file);
-
-	/**
-	*	Display Wave info.
-	*/
-	void	display_wave_info();
-
-	/**
-	*	Sanity check.
-	*	@return 0: All clear, otherwise: problem
-	*/
-	int		sanity_check();
-
-	/**
-	*	Encode wave file.
-	*	Convert the PCM based wave file to mp3.
-	*/
-	void	encode_wave();
-
-	/**
-	*	Set quality.
-	*	0: highest, 9: lowest.
-	*/
-	void	set_quality(int i_vbr_quality){m_i_vbr_quality = i_vbr_quality;}
-
-	/**
-	*	Get quality.
-	*/
-	int		get_quality(){return m_i_vbr_quality;}
-};
-
+/**
+* @file wave_to_mp3.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief Read wave file.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __WAVE_TO_MP3_H__
+#define	__WAVE_TO_MP3_H__
+
+#include <iostream>
+#include <fstream>
+#include <lame.h>
+#include <wave_read.h>
+#include <async_io.h>
+#include <lame_pool.h>
+#include <buffer_arena.h>
+#include <mp3_writer.h>
+#include <job_stats.h>
+
+class wave_to_mp3;
+
+/**
+*	Errors of encoding a file.
+*/
+typedef enum _wave_to_mp3_error
+{
+	WAVE_TO_MP3_OK = 0,						//!< All clear
+	WAVE_TO_MP3_ERROR_READ,					//!< The wave file cannot be opened or read
+	WAVE_TO_MP3_ERROR_FORMAT,				//!< The wave format is not handled
+	WAVE_TO_MP3_ERROR_WRITE,				//!< The mp3 file cannot be opened or written
+	WAVE_TO_MP3_ERROR_ENCODE				//!< lame failed
+} wave_to_mp3_error;
+
+/**
+*	Function reading and encoding a block of samples, specialized for one wave format.
+*/
+typedef int (wave_to_mp3::*encode_block_func)(lame_t lame, int i_samples, unsigned char *pc_mp3_buffer, 
+	int i_mp3_buffer_size, int *pi_read_samples);
+
+/**
+*	Function encoding a block of samples as they are stored in the wave file, specialized for one wave format.
+*/
+typedef int (wave_to_mp3::*encode_raw_func)(lame_t lame, const unsigned char *pc_pcm, int i_samples, 
+	unsigned char *pc_mp3_buffer, int i_mp3_buffer_size);
+
+class wave_to_mp3
+{
+private:
+	wave_read			*m_pc_wave_read;				//!< Wave reader
+	mp3_writer			*m_pc_mp3_writer;				//!< Writer of the mp3 file
+	int					m_iBytesPerSample;				//!< Number of bytes per sample
+	int					m_iTotalSamples;				//!< Total number of data samples
+	void				*m_ppv_pcm_buffer[2];			//!< Buffer holding PCM samples, one array of short or int per channel
+	int					m_i_pcm_sample_bytes;			//!< Bytes per sample in m_ppv_pcm_buffer, sizeof(short) or sizeof(int)
+	encode_block_func	m_p_encode_block;				//!< Reads and encodes a block in the format of the current file
+	encode_raw_func		m_p_encode_raw;					//!< Encodes a block of samples as stored in the current file
+	pcm_convert_func	m_p_convert;					//!< Kernel converting the samples for m_p_encode_raw
+	lame_t				m_lame_stream;					//!< Encoder of the stream between begin_stream and end_stream
+	lame_pool			*m_pc_lame_pool;				//!< Encoders, given back once a file is encoded
+	int					m_i_block_align;				//!< Bytes of one sample of all channels in the wave file
+	int					m_i_samples_per_itr;			//!< Samples to read from wave file per iteration
+	int					m_i_vbr_quality;				//!< Quality of the encoding, 0: highest, 9: lowest
+	async_io			*m_pc_async_io;					//!< Reads ahead and writes behind, if not NULL
+	buffer_arena		*m_pc_arena;					//!< Buffers of this object and its wave reader
+	job_record			*m_ps_record;					//!< Times and bytes of the job are added to it, NULL: not timed
+
+	/**
+	*	Start timing a stage.
+	*	@return The time in nsec, 0 if the job is not timed.
+	*/
+	long long	start_timing(){return m_ps_record ? job_stats::get_time_ns() : 0;}
+
+	/**
+	*	Add the time since ll_since_ns to a stage of the job, if it is timed.
+	*	@param pll_since_ns Start of the stage, set to the time now for the next stage.
+	*/
+	void	add_time(job_stage e_stage, long long *pll_since_ns)
+	{
+		if(m_ps_record == NULL)
+			return;
+		long long ll_now_ns = job_stats::get_time_ns();
+		m_ps_record->pll_stage_ns[e_stage] += ll_now_ns - *pll_since_ns;
+		*pll_since_ns = ll_now_ns;
+	}
+
+	/**
+	*	Free internal memory.
+	*/
+	void	free_memory();
+
+	/**
+	*	Allocate internal memory.
+	*	The PCM buffers are borrowed from m_pc_arena for the first file, and hold the samples of 
+	*	any format, so they are kept for the following files.
+	*/
+	void	allocate_memory();
+
+	/**
+	*	Set up for a wave format.
+	*	Picks the encode_block and encode_raw specializations, so that the encoding loop has no format 
+	*	branches, and allocates the PCM buffers if they are needed.
+	*	@return 0: All clear, otherwise: the format is not handled.
+	*/
+	int		select_format(wave_header *ps_wave_header);
+
+	/**
+	*	Get a lame encoder from m_pc_lame_pool.
+	*	Give it back with m_pc_lame_pool->finish once the file is encoded.
+	*	@param ps_wave_header Header of the wave file to encode.
+	*	@param i_segment 1: The encoder is used for a segment of the file (see encode_segment).
+	*	The output sample rate is then fixed to the input one and the bit reservoir as well as the 
+	*	VBR tag are disabled, so that the frames can be cut and joined with those of other segments.
+	*	0: The encoder is used for the complete file.
+	*	@return The encoder, NULL if lame cannot be set up for the file.
+	*/
+	lame_t	init_lame(wave_header *ps_wave_header, int i_segment);
+
+	/**
+	*	Read and encode a block of samples.
+	*	Specialized at compile time for the bytes per sample and channels of the wave file, 
+	*	and the sample type handed to lame.
+	*	@param lame The lame encoder.
+	*	@param i_samples Maximum samples to read from the wave file.
+	*	@param pc_mp3_buffer Output buffer.
+	*	@param i_mp3_buffer_size Size of the output buffer in bytes.
+	*	@param pi_read_samples Returns the number of samples actually read.
+	*	@return Number of mp3 bytes written to pc_mp3_buffer, negative if lame failed.
+	*/
+	template <int BYTES, int CHANNELS, typename T>
+	int		encode_block(lame_t lame, int i_samples, unsigned char *pc_mp3_buffer, int i_mp3_buffer_size, 
+				int *pi_read_samples);
+
+	/**
+	*	Read and encode a block of 16 bit samples.
+	*	The samples are handed to lame as they are stored in the wave file, interleaved for stereo,
+	*	without any conversion or copy. Only for little endian machines.
+	*	The parameters are the same as for encode_block.
+	*/
+	template <int CHANNELS>
+	int		encode_block_s16(lame_t lame, int i_samples, unsigned char *pc_mp3_buffer, int i_mp3_buffer_size, 
+				int *pi_read_samples);
+
+	/**
+	*	Encode a block of samples as they are stored in the wave file.
+	*	The samples are converted to T with m_p_convert, and handed to lame.
+	*	@param lame The lame encoder.
+	*	@param pc_pcm Interleaved samples.
+	*	@param i_samples Number of samples, at most m_i_samples_per_itr.
+	*	@param pc_mp3_buffer Output buffer.
+	*	@param i_mp3_buffer_size Size of the output buffer in bytes.
+	*	@return Number of mp3 bytes written to pc_mp3_buffer, negative if lame failed.
+	*/
+	template <int CHANNELS, typename T>
+	int		encode_raw(lame_t lame, const unsigned char *pc_pcm, int i_samples, unsigned char *pc_mp3_buffer, 
+				int i_mp3_buffer_size);
+
+	/**
+	*	Encode a block of 16 bit samples as they are stored in the wave file, without any conversion.
+	*	Only for little endian machines. The parameters are the same as for encode_raw.
+	*/
+	template <int CHANNELS>
+	int		encode_raw_s16(lame_t lame, const unsigned char *pc_pcm, int i_samples, unsigned char *pc_mp3_buffer, 
+				int i_mp3_buffer_size);
+
+public:
+
+	/**
+	*	Constructor.
+	*	If you use this constructor, then you must call the init function.
+	*/
+	wave_to_mp3();
+
+	/**
+	*	Destructor.
+	*/
+	~wave_to_mp3();
+
+	/**
+	*	Initialize.
+	*	@param pc_wave_file Name of the input wave file.
+	*	@param pc_mp3_file Name of the output mp3 file.
+	*	@return WAVE_TO_MP3_OK, or the wave_to_mp3_error why the file cannot be encoded.
+	*/
+	int		init(char *pc_wave_file, char *pc_mp3_file);
+
+	/**
+	*	Display Wave info.
+	*/
+	void	display_wave_info();
+
+	/**
+	*	Sanity check.
+	*	@return 0: All clear, otherwise: problem
+	*/
+	int		sanity_check();
+
+	/**
+	*	Encode wave file.
+	*	Convert the PCM based wave file to mp3.
+	*	@return WAVE_TO_MP3_OK, or the wave_to_mp3_error why the file cannot be encoded. The mp3
+	*	file is removed then.
+	*/
+	int		encode_wave();
+
+	/**
+	*	Encode segment.
+	*	Encode samples [i_first_sample, i_first_sample+i_num_samples) of a wave file with an independent
+	*	encoder. i_first_sample and i_num_samples must be multiples of the mp3 frame size. The encoder 
+	*	starts SEGMENT_OVERLAP_FRAMES frames before the segment so that it settles, and the frames 
+	*	belonging to the overlap are dropped. The frames returned for consecutive segments can be 
+	*	concatenated into a valid mp3 stream. 
+	*	@param pc_wave_file Name of the input wave file.
+	*	@param i_first_sample First sample of the segment.
+	*	@param i_num_samples Number of samples in the segment. Ignored for the last segment.
+	*	@param i_last 1: This is the last segment, it is encoded till the end of the file and flushed.
+	*	@param ppc_mp3_buffer Returns the mp3 frames of the segment, allocated with new [].
+	*	@return Size of *ppc_mp3_buffer in bytes, -1 if the segment cannot be encoded. Nothing is
+	*	allocated then.
+	*/
+	int		encode_segment(char *pc_wave_file, int i_first_sample, int i_num_samples, int i_last, 
+				unsigned char **ppc_mp3_buffer);
+
+	/**
+	*	Begin encoding a stream.
+	*	For encoding in stages, where the samples are read by another thread (see pipeline). Call 
+	*	encode_stream for the blocks of samples in order, and then end_stream.
+	*	@param ps_wave_header Header of the wave file the samples come from.
+	*	@return WAVE_TO_MP3_OK, or the wave_to_mp3_error why the stream cannot be encoded.
+	*/
+	int		begin_stream(wave_header *ps_wave_header);
+
+	/**
+	*	Encode a block of a stream.
+	*	@param pc_pcm Interleaved samples as stored in the wave file.
+	*	@param i_samples Number of samples (per channel). All blocks but the last must hold a multiple
+	*	of get_samples_per_itr() samples, so that the output is the same as that of encode_wave.
+	*	@param pc_mp3_buffer Output buffer, of at least get_stream_buffer_size(i_samples) bytes.
+	*	@param i_mp3_buffer_size Size of the output buffer in bytes.
+	*	@return Number of mp3 bytes written to pc_mp3_buffer, negative if lame failed.
+	*/
+	int		encode_stream(const unsigned char *pc_pcm, int i_samples, unsigned char *pc_mp3_buffer, 
+				int i_mp3_buffer_size);
+
+	/**
+	*	End encoding a stream.
+	*	Flushes the encoder and closes it.
+	*	@param pc_mp3_buffer Output buffer, of at least get_stream_buffer_size(0) bytes.
+	*	@param i_mp3_buffer_size Size of the output buffer in bytes.
+	*	@return Number of mp3 bytes written to pc_mp3_buffer, negative if lame failed.
+	*/
+	int		end_stream(unsigned char *pc_mp3_buffer, int i_mp3_buffer_size);
+
+	/**
+	*	Get worst case size of the mp3 data of a block of a stream.
+	*/
+	int		get_stream_buffer_size(int i_samples);
+
+	/**
+	*	Get a description of a wave_to_mp3_error, e.g. for a reply to a client.
+	*/
+	static const char	*get_error_text(int i_error);
+
+	/**
+	*	Get samples read and encoded at once for a wave format.
+	*/
+	static int	get_samples_per_itr(wave_header *ps_wave_header);
+
+	/**
+	*	Get size of the buffer for reading wave files, see wave_read::init.
+	*/
+	static int	get_read_buffer_size();
+
+	/**
+	*	Get most bytes of the mp3 file of a wave file, at the highest bit rate.
+	*	Used to preallocate the mp3 file (see mp3_writer).
+	*	@return Bytes, 0: unknown, e.g. the data size in the header is 0 or 0xFFFFFFFF.
+	*/
+	static long	get_max_mp3_bytes(wave_header *ps_wave_header);
+
+	/**
+	*	Get most bytes of the mp3 data of samples, at the highest bit rate.
+	*	@param i_sample_rate Sample rate in Hz.
+	*	@param i_block_align Bytes of one sample of all channels.
+	*	@param l_pcm_bytes Size of the samples in bytes.
+	*/
+	static long	get_max_mp3_bytes(int i_sample_rate, int i_block_align, long l_pcm_bytes);
+
+	/**
+	*	Read ahead and write behind.
+	*	The next part of the wave file is read and the last mp3 data is written while encoding, 
+	*	through async_io. Takes effect with the next init.
+	*/
+	void	enable_async_io();
+
+	/**
+	*	Reuse lame encoders from file to file.
+	*	Saves setting up an encoder per file, but the mp3 files are not bit identical to those of 
+	*	new encoders (see lame_pool).
+	*	@param i_reuse 1: reuse, 0: a new encoder for every file (default).
+	*/
+	void	set_lame_reuse(int i_reuse){m_pc_lame_pool->set_max_idle(i_reuse ? LAME_POOL_MAX_IDLE : 0);}
+
+	/**
+	*	Back the buffers with huge pages if the system has them (see buffer_arena).
+	*	Takes effect for the buffers allocated from now on.
+	*/
+	void	set_huge_pages(int i_huge_pages){m_pc_arena->set_huge_pages(i_huge_pages);}
+
+	/**
+	*	Get the arena of the buffers of this object.
+	*	A wave_read reading for this object may borrow its buffers from it too.
+	*/
+	buffer_arena	*get_arena(){return m_pc_arena;}
+
+	/**
+	*	Write the mp3 files with O_DIRECT, if the file system supports it.
+	*	Takes effect with the next init.
+	*/
+	void	set_direct_io(int i_direct_io){m_pc_mp3_writer->set_direct_io(i_direct_io);}
+
+	/**
+	*	Get the writer of the mp3 files of this object.
+	*	It may write other mp3 files between encode_wave and the next init.
+	*/
+	mp3_writer	*get_mp3_writer(){return m_pc_mp3_writer;}
+
+	/**
+	*	Set quality.
+	*	0: highest, 9: lowest.
+	*/
+	void	set_quality(int i_vbr_quality){m_i_vbr_quality = i_vbr_quality;}
+
+	/**
+	*	Get quality.
+	*/
+	int		get_quality(){return m_i_vbr_quality;}
+
+	/**
+	*	Time the stages of the jobs and count their bytes.
+	*	@param ps_record The times and bytes of init, encode_wave and encode_segment are added to it.
+	*	NULL: not timed (default).
+	*/
+	void	set_job_record(job_record *ps_record){m_ps_record = ps_record;}
+
+	/**
+	*	Hash the wave file while encode_wave reads it (see wave_read::set_content_hash).
+	*	@param pc_hash NULL: not hashed (default).
+	*/
+	void	set_content_hash(content_hash *pc_hash){m_pc_wave_read->set_content_hash(pc_hash);}
+};
+
 #endif	// __WAVE_TO_MP3_H__
\ No newline at end of file
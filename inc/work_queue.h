@@ -1,88 +1,178 @@
-/**
-* @file work_queue.h
-* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
-* @brief This file contains the work_queue class.
-* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
-*/
-
-#ifndef __WORK_QUEUE_H__
-#define __WORK_QUEUE_H__
-
-#include <pthread.h>
-
-class work_item;
-
-/**
-*	Work queue.
-*	A work queue is for all the threads/jobs. Each threads pops a job from this queue.
-*/
-class work_queue
-{
-private:
-	work_item			**m_ppc_work_item_queue;	// A queue for work items
-	int					m_i_queue_size;				// Size of the queue
-	int					m_i_curr_queue_size;		// Current size of the queue
-	int					m_i_curr_rd_loc;			// Read location in the work queue
-	int					m_i_curr_w_loc;				// Write location in the work queue
-	int					m_i_pending_jobs;			// Total Pending jobs
-	pthread_mutex_t		m_t_mutex;					// Mutex for inserting and removing the job
-	pthread_cond_t		m_t_job_avail_cond;			// Condition variable if a job is available in the queue
-	pthread_cond_t		m_t_queue_empty_cond;		// Condition variable if the job queue is empty
-public:
-
-	/**
-	*	Constructor.
-	*/
-	work_queue(int i_queue_size = 1);
-
-	/**
-	*	Destructor.
-	*/
-	~work_queue();
-
-	/**
-	*	Add to the back of the job queue.
-	*	Before writing, always check if there is space in the queue
-	*	0 means successful and otherwise is unsuccessful.
-	*/
-	int					add_to_job(work_item *pc_work_item);
-
-	/**
-	*	Extract from the front of the job queue.
-	*	If no job is available, the function will be suspended in wait state
-	*	I.e. this is a blocking function.
-	*/
-	work_item			*get_next_job();
-
-	/**
-	*	Extract from the front of the job queue.
-	*	If no job is available, the function will return a NULL pointer, without being
-	*	suspended in the wait state.
-	*/
-	work_item			*get_next_job_no_wait();
-
-	/**
-	*	Get current work items written.
-	*/
-	int					get_num_jobs_in_queue();
-
-	/**
-	*	Increment job pending signal for the job.
-	*	Should be set by the working thread.
-	*/	
-	void				inc_num_jobs_in_process();
-
-	/**
-	*	Job done signal.
-	*	Should be called by the working thread.
-	*/
-	void				set_job_done();
-
-	/**
-	*	Wait until the job queue is empty.
-	*	It is better to sleep a little before calling this function.
-	*/
-	void				wait_for_queue_empty();
-};
-
+/**
+* @file work_queue.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the work_queue class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __WORK_QUEUE_H__
+#define __WORK_QUEUE_H__
+
+#include <pthread.h>
+
+class work_item;
+
+#ifndef CACHE_LINE_BYTES
+#define		CACHE_LINE_BYTES	64		//!< Size of a cache line, to keep the counters of different threads apart
+#endif
+
+/**
+*	Slot of the lock free ring.
+*	The sequence number tells whose turn it is: it equals the position of the next
+*	writer when the slot is free, and the position + 1 when it holds a job.
+*/
+typedef struct _mpmc_slot
+{
+	long		l_seq;				//!< Sequence number of the slot
+	work_item	*pc_work_item;		//!< Job
+} mpmc_slot;
+
+/**
+*	Work queue.
+*	A work queue is for all the threads/jobs. Each threads pops a job from this queue.
+*	The queue is either a circular buffer guarded by a mutex, or a lock free ring which any 
+*	number of threads can write and read at the same time. In the lock free ring, a waiting 
+*	thread spins for a while and only then goes to sleep on a condition variable.
+*/
+class work_queue
+{
+private:
+	work_item			**m_ppc_work_item_queue;	// A queue for work items
+	int					m_i_queue_size;				// Size of the queue
+	int					m_i_curr_queue_size;		// Current size of the queue
+	int					m_i_curr_rd_loc;			// Read location in the work queue
+	int					m_i_curr_w_loc;				// Write location in the work queue
+	int					m_i_pending_jobs;			// Total Pending jobs
+	pthread_mutex_t		m_t_mutex;					// Mutex for inserting and removing the job
+	pthread_cond_t		m_t_job_avail_cond;			// Condition variable if a job is available in the queue
+	pthread_cond_t		m_t_queue_empty_cond;		// Condition variable if the job queue is empty
+	pthread_cond_t		m_t_space_avail_cond;		// Condition variable if there is space in the queue
+
+	bool				m_b_lock_free;				//!< Use the lock free ring instead of the mutex
+	mpmc_slot			*m_ps_slots;				//!< Slots of the lock free ring
+	long				m_l_enqueue_pos __attribute__((aligned(CACHE_LINE_BYTES)));	//!< Position of the next job to add
+	long				m_l_dequeue_pos __attribute__((aligned(CACHE_LINE_BYTES)));	//!< Position of the next job to pop
+	long				m_l_jobs __attribute__((aligned(CACHE_LINE_BYTES)));			//!< Jobs added but not done yet
+	int					m_i_job_waiters;			//!< Threads sleeping until a job is available
+	int					m_i_space_waiters;			//!< Threads sleeping until there is space in the ring
+	int					m_i_spin_count;				//!< Times to retry before sleeping, adapted to how often spinning pays off
+	int					m_i_spin_count_max;			//!< Most times to retry before sleeping
+
+	/**
+	*	Add a job to the lock free ring.
+	*	@return 0 if successful, 1 if the ring is full.
+	*/
+	int					push(work_item *pc_work_item);
+
+	/**
+	*	Pop a job from the lock free ring.
+	*	@param ppc_work_item The popped job, which may be NULL as well.
+	*	@return 0 if successful, 1 if the ring is empty.
+	*/
+	int					pop(work_item **ppc_work_item);
+
+	/**
+	*	Pop a job from the lock free ring, retrying for a while if it is empty.
+	*	@param ppc_work_item The popped job, which may be NULL as well.
+	*	@return 0 if successful, 1 if the ring stayed empty.
+	*/
+	int					spin_pop(work_item **ppc_work_item);
+
+	/**
+	*	Add a job to the lock free ring, retrying for a while if it is full.
+	*	@return 0 if successful, 1 if the ring stayed full.
+	*/
+	int					spin_push(work_item *pc_work_item);
+
+	/**
+	*	Adapt the spin count.
+	*	It grows if spinning paid off, and shrinks if the thread had to sleep anyway.
+	*/
+	void				adapt_spin_count(bool b_spin_paid_off);
+
+	/**
+	*	Extract from the front of the job queue, waiting until a job is available.
+	*	@param b_count Count the job as being in process until set_job_done() is called.
+	*/
+	work_item			*remove_job(bool b_count);
+
+	/**
+	*	Wake up a thread sleeping in get_next_job(), if there is any.
+	*/
+	void				wake_job_waiter();
+
+	/**
+	*	Wake up a thread sleeping in add_to_job_wait(), if there is any.
+	*/
+	void				wake_space_waiter();
+
+public:
+
+	/**
+	*	Constructor.
+	*	@param i_queue_size Maximum number of jobs in the queue.
+	*	@param b_lock_free Use the lock free ring instead of the mutex.
+	*/
+	work_queue(int i_queue_size = 1, bool b_lock_free = false);
+
+	/**
+	*	Destructor.
+	*/
+	~work_queue();
+
+	/**
+	*	Add to the back of the job queue.
+	*	Before writing, always check if there is space in the queue
+	*	0 means successful and otherwise is unsuccessful.
+	*/
+	int					add_to_job(work_item *pc_work_item);
+
+	/**
+	*	Add to the back of the job queue.
+	*	If there is no space in the queue, the function will be suspended in wait state
+	*	until a thread pops a job. I.e. this is a blocking function.
+	*/
+	void				add_to_job_wait(work_item *pc_work_item);
+
+	/**
+	*	Extract from the front of the job queue.
+	*	If no job is available, the function will be suspended in wait state
+	*	I.e. this is a blocking function. The popped job is counted as being in process
+	*	until set_job_done() is called.
+	*/
+	work_item			*get_next_job();
+
+	/**
+	*	Extract from the front of the job queue.
+	*	If no job is available, the function will return a NULL pointer, without being
+	*	suspended in the wait state. A popped job is counted as being in process
+	*	until set_job_done() is called.
+	*/
+	work_item			*get_next_job_no_wait();
+
+	/**
+	*	Take a work item from the front of the queue, for queues of free work items.
+	*	Waits like get_next_job(), but the item is not counted as a job in process, so no 
+	*	set_job_done() follows. Such a queue should not be waited on with wait_for_queue_empty().
+	*/
+	work_item			*take();
+
+	/**
+	*	Get current work items written.
+	*/
+	int					get_num_jobs_in_queue();
+
+	/**
+	*	Job done signal.
+	*	Should be called by the working thread.
+	*/
+	void				set_job_done();
+
+	/**
+	*	Wait until the job queue is empty.
+	*	Any number of threads can wait, all of them are woken up.
+	*/
+	void				wait_for_queue_empty();
+};
+
 #endif // __WORK_QUEUE_H__
\ No newline at end of file
@@ -0,0 +1,125 @@
+/**
+* @file work_steal_queue.h
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the work_steal_queue class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#ifndef __WORK_STEAL_QUEUE_H__
+#define __WORK_STEAL_QUEUE_H__
+
+#include <pthread.h>
+
+class work_item;
+
+#define		CACHE_LINE_BYTES	64		//!< Size of a cache line, to keep the counters of different threads apart
+
+/**
+*	Job queue of one thread.
+*	A ring buffer written by the single producer and read by any thread.
+*/
+typedef struct _steal_deque
+{
+	long		l_head __attribute__((aligned(CACHE_LINE_BYTES)));	//!< Next job to pop, advanced with compare and swap
+	long		l_tail __attribute__((aligned(CACHE_LINE_BYTES)));	//!< Next free slot, only written by the producer
+	work_item	**ppc_ring __attribute__((aligned(CACHE_LINE_BYTES)));	//!< Jobs
+} steal_deque;
+
+/**
+*	Work stealing queue.
+*	Every thread has its own job queue, and the producer spreads the jobs over them without locks.
+*	A thread pops the jobs from its own queue, and when that is empty, it steals from the
+*	queues of the other threads. Threads only take a lock to sleep when there is no job at all.
+*	The work items are recycled through a lock free list, so the producer never takes a lock
+*	either, unless it has to wait for a free work item.
+*	Only one thread may add jobs and get free work items.
+*/
+class work_steal_queue
+{
+private:
+	int					m_i_num_threads;			//!< Number of threads, one deque each
+	long				m_l_ring_mask;				//!< Size of every ring - 1, the size is a power of 2
+	steal_deque			*m_ps_deque;				//!< Job queue of every thread
+	int					m_i_next_deque;				//!< Deque to which the next job is added
+	work_item			*m_pc_free_items;			//!< Lock free list of free work items
+	long				m_l_pending_jobs;			//!< Jobs added but not done yet
+	int					m_i_sleeping_threads;		//!< Threads waiting for a job
+	int					m_i_producer_waiting;		//!< 1: The producer waits for a free work item
+	int					m_i_shut_down;				//!< 1: No more jobs, the threads should exit
+	pthread_mutex_t		m_t_mutex;					//!< Mutex for sleeping
+	pthread_cond_t		m_t_job_avail_cond;			//!< Condition variable if a job is available
+	pthread_cond_t		m_t_item_free_cond;			//!< Condition variable if a work item is free
+	pthread_cond_t		m_t_queue_empty_cond;		//!< Condition variable if all jobs are done
+
+	/**
+	*	Pop a job from a deque.
+	*	@return The job, or NULL if the deque is empty.
+	*/
+	work_item			*pop(steal_deque *ps_deque);
+
+	/**
+	*	Check if any deque holds a job.
+	*/
+	int					job_available();
+
+public:
+
+	/**
+	*	Constructor.
+	*	@param i_num_threads Number of threads popping jobs.
+	*	@param i_queue_size Maximum number of work items in flight.
+	*/
+	work_steal_queue(int i_num_threads, int i_queue_size);
+
+	/**
+	*	Destructor.
+	*/
+	~work_steal_queue();
+
+	/**
+	*	Add a free work item.
+	*	Can be called by any thread.
+	*/
+	void				add_free_item(work_item *pc_work_item);
+
+	/**
+	*	Get a free work item.
+	*	If no work item is free, the function will be suspended in wait state until a job is done.
+	*	Only to be called by the producer.
+	*/
+	work_item			*get_free_item();
+
+	/**
+	*	Add a job.
+	*	Lock free, only to be called by the producer.
+	*/
+	void				add_to_job(work_item *pc_work_item);
+
+	/**
+	*	Get the next job for a thread.
+	*	Pops from the thread's own deque, otherwise steals from the others. If there is no job,
+	*	the function will be suspended in wait state. I.e. this is a blocking function.
+	*	@param i_thread_num The thread asking for the job.
+	*	@return The job, or NULL if the queue was shut down.
+	*/
+	work_item			*get_next_job(int i_thread_num);
+
+	/**
+	*	Job done signal.
+	*	Should be called by the working thread. The work item is returned to the free list.
+	*/
+	void				set_job_done(work_item *pc_work_item);
+
+	/**
+	*	Wait until all the jobs are done.
+	*/
+	void				wait_for_queue_empty();
+
+	/**
+	*	Wake up all the threads waiting for a job, and let them exit.
+	*	From now on, get_next_job() returns NULL.
+	*/
+	void				shut_down();
+};
+
+#endif // __WORK_STEAL_QUEUE_H__
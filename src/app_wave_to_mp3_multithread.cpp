@@ -1,183 +1,1068 @@
-/**
-* @file app_wave_to_mp3.cpp
-* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
-* @brief Convert wave file to mp3.
-* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
-*/
-
-#include <wave_to_mp3.h>
-#include <pthread_queue.h>
-#include <fstream>
-#include <cstring>
-#include <cstdlib>
-
-#define		SOFTWARE_VERSION	"0.1"	//!< Release version
-#define		QUEUE_LENGTH		50		//!< Maximum number of wave files processed concurrently in a batch
-
-using namespace std;
-
-typedef struct _thread_args
-{
-	char *pc_wave_file;
-	char *pc_mp3_file;
-	wave_to_mp3 **ppc_wave2mp3_objs;
-} thread_args;
-
-void show_usage(char *pc_prog_name)
-{
-	fprintf(stderr, "\nUsage: %s [-f file_name | -d directory] [-q quality] [-t threads] [-h]\n", pc_prog_name);
-	fprintf(stderr, "-f file_name: wave file to convert into mp3\n");
-	fprintf(stderr, "-d directory: directory path containing wave files which\n");
-	fprintf(stderr, "              will all be converted into mp3 files.\n");
-	fprintf(stderr, "              If this option is used, -f would be ignored.\n");
-	fprintf(stderr, "-q quality:   MP3 quality, 0: highest (default), 9: lowest.\n");
-	fprintf(stderr, "-t threads:   total number of threads to use.\n");
-	fprintf(stderr, "-h:           show this help\n\n");
-}
-
-void *encode_to_mp3(void *p_args, int i_thread_id)
-{
-	thread_args *p_thread_args = (thread_args *)p_args;
-	char *pc_wave_file = p_thread_args->pc_wave_file;
-	char *pc_mp3_file = p_thread_args->pc_mp3_file;
-	wave_to_mp3 *pc_wave2mp3 = p_thread_args->ppc_wave2mp3_objs[i_thread_id];
-
-	pc_wave2mp3->init(pc_wave_file, pc_mp3_file);
-	pc_wave2mp3->sanity_check();
-	pc_wave2mp3->display_wave_info();
-	pc_wave2mp3->encode_wave();
-	return NULL;
-}
-
-int main(int argc, char **argv)
-{
-	fprintf(stderr, "Multithreaded wave to mp3 encoder version %s\n", SOFTWARE_VERSION);
-	fprintf(stderr, "Copyright: Muhammad Usman Karim Khan <karim.usman@yahoo.com>\n\n");
-
-	char pc_wave_file[1024];
-	char pc_wave_dir[1024];
-	int i_threads = 4;
-	int i_quality = 0;
-
-	wave_to_mp3 **ppc_wave2mp3 = NULL;
-	pthread_queue *pc_thread_queue = new pthread_queue();
-	thread_args **ppc_thread_args = NULL;
-
-	int i_use_dir = 0;
-
-	if(argc < 3)
-	{
-		show_usage(argv[0]);
-		return 1;
-	}
-
-	for(int i=1;i<argc;i++)
-	{
-		if(strcmp(argv[i], "-f") == 0)
-			strcpy(pc_wave_file, argv[++i]);
-		else if(strcmp(argv[i], "-d") == 0)
-		{
-			i_use_dir = 1;
-			strcpy(pc_wave_dir, argv[++i]);
-		}
-		else if(strcmp(argv[i], "-q") == 0)
-			i_quality = atoi(argv[++i]);
-		else if(strcmp(argv[i], "-t") == 0)
-			i_threads = atoi(argv[++i]);
-		else if(strcmp(argv[i], "-h") == 0)
-		{
-			show_usage(argv[0]);
-			return 1;
-		}
-		else
-		{
-			show_usage(argv[0]);
-			return 1;
-		}
-	}
-
-	if(i_use_dir == 1)
-	{
-		char pc_cmd[1024];
-
-		// @todo need a better solution than using a system call. However, this is done only
-		// once per program run, so it might be OK. 
-#if defined _WIN32 || defined _WIN64
-		sprintf(pc_cmd, "dir /b /s /a-d %s > wave_files.txt", pc_wave_dir);
-#else
-		sprintf(pc_cmd, "ls %s > wave_files.txt", pc_wave_dir);
-#endif
-		system(pc_cmd);
-	}
-	else
-	{
-		ofstream f_tmp("wave_files.txt");
-		f_tmp << pc_wave_file << "\n";
-		f_tmp.close();
-	}
-
-	// Threads
-	// Number of threads = number of wave to mp3 convertors.
-	ppc_wave2mp3 = new wave_to_mp3*[i_threads];
-	for(int i=0;i<i_threads;i++)
-	{
-		ppc_wave2mp3[i] = new wave_to_mp3();
-		ppc_wave2mp3[i]->set_quality(i_quality);
-	}
-
-	pc_thread_queue->make_thread_pool(i_threads, QUEUE_LENGTH);
-	ppc_thread_args = new thread_args*[QUEUE_LENGTH];
-	for(int i=0;i<QUEUE_LENGTH;i++)
-	{
-		ppc_thread_args[i] = new thread_args;
-		ppc_thread_args[i]->pc_wave_file = new char[1024];
-		ppc_thread_args[i]->pc_mp3_file = new char[1024];
-		ppc_thread_args[i]->ppc_wave2mp3_objs = ppc_wave2mp3;
-	}
-
-	// Encoding
-	// Use a batch of QUEUE_LENGTH wave files at a time to encode 
-	ifstream f_wave_files("wave_files.txt");
-	int i_encode_job = 0;
-	while(f_wave_files >> ppc_thread_args[i_encode_job]->pc_wave_file)
-	{
-		char *pc_curr_wave_file = ppc_thread_args[i_encode_job]->pc_wave_file;
-		char *pc_curr_mp3_file = ppc_thread_args[i_encode_job]->pc_mp3_file;
-
-		int i_wave_file_len = strlen(pc_curr_wave_file);
-		if(strncmp(pc_curr_wave_file+i_wave_file_len-4,".wav",4))
-			continue;
-
-		strcpy(pc_curr_mp3_file,"");
-		strncat(pc_curr_mp3_file, pc_curr_wave_file, i_wave_file_len-4);
-		strcat(pc_curr_mp3_file, ".mp3");
-
-		pc_thread_queue->add_to_job_queue(encode_to_mp3, (void *)ppc_thread_args[i_encode_job]);
-		if(++i_encode_job == QUEUE_LENGTH)	// Queue full, let the batch finish
-		{
-			pc_thread_queue->wait_queue_done();
-			i_encode_job = 0;
-		}
-	}
-
-	// Wait for queue to finish
-	pc_thread_queue->wait_queue_done();
-
-	f_wave_files.close();
-
-	for(int i=0;i<i_threads;i++)
-		delete ppc_wave2mp3[i];
-	delete [] ppc_wave2mp3;
-
-	
-	for(int i=0;i<QUEUE_LENGTH;i++)
-	{
-		delete [] ppc_thread_args[i]->pc_wave_file;
-		delete [] ppc_thread_args[i]->pc_mp3_file;
-		delete ppc_thread_args[i];
-	}
-	delete [] ppc_thread_args;
-	delete pc_thread_queue;
-
-	return 0;
-}
+/**
+* @file app_wave_to_mp3.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief Convert wave file to mp3.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <wave_to_mp3.h>
+#include <segment_job.h>
+#include <pthread_queue.h>
+#include <job_cost.h>
+#include <dir_walker.h>
+#include <pipeline.h>
+#include <wav2mp3.h>
+#include <encode_server.h>
+#include <encode_manifest.h>
+#include <dup_finder.h>
+#include <wave_corpus.h>
+#include <job_stats.h>
+#include <trace_log.h>
+#include <perf_counters.h>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#define		SOFTWARE_VERSION	"0.1"	//!< Release version
+#define		QUEUE_LENGTH		50		//!< Maximum number of wave files queued or in process at a time
+#define		COST_FILE			"wave_cost.txt"	//!< Default file keeping the learned encoding cost
+#define		DIR_WALK_THREADS	4		//!< Threads listing the directories
+#define		STREAM_READ_BYTES	(64*1024)	//!< Most bytes read from the input at once with -i
+#define		SORT_WINDOW			1000	//!< Most jobs held back to be queued longest first with -L
+
+using namespace std;
+
+typedef struct _thread_args
+{
+	char *pc_wave_file;
+	char *pc_mp3_file;
+	wave_to_mp3 **ppc_wave2mp3_objs;
+	job_cost *pc_job_cost;			// Learns the time taken, if not NULL
+	job_cost_format s_format;
+	int i_samples;
+	encode_manifest *pc_manifest;	// Records the file once done, if not NULL
+	int *pi_done_ms;				// When every thread finished its last job, for -B, if not NULL
+	job_stats *pc_job_stats;		// Records the times of the job, if not NULL
+} thread_args;
+
+typedef struct _segment_args
+{
+	segment_job *pc_segment_job;
+	int i_segment;
+	wave_to_mp3 **ppc_wave2mp3_objs;
+	job_cost *pc_job_cost;			// Learns the time taken, if not NULL
+	job_cost_format s_format;
+	encode_manifest *pc_manifest;	// Records the file once done, if not NULL
+	job_stats *pc_job_stats;		// Records the times of the job, if not NULL
+} segment_args;
+
+typedef struct _queued_job
+{
+	double d_cost;
+	long l_order;					// Jobs of the same cost are queued in the order they came
+	void *(*p_func_ptr)(void *, int);
+	void *p_args;
+} queued_job;
+
+int g_i_failed_files = 0;	// Files that could not be encoded, counted by the threads
+
+int get_time_ms()
+{
+	timespec s_time;
+	clock_gettime(CLOCK_MONOTONIC, &s_time);
+	return s_time.tv_sec*1000 + s_time.tv_nsec/1000000;
+}
+
+bool is_cheaper(const queued_job &s_job1, const queued_job &s_job2)
+{
+	if(s_job1.d_cost != s_job2.d_cost)
+		return s_job1.d_cost < s_job2.d_cost;
+	return s_job1.l_order > s_job2.l_order;
+}
+
+// Queue the costliest job held back in the heap.
+void queue_costliest(vector<queued_job> *pv_jobs, pthread_queue *pc_thread_queue)
+{
+	pop_heap(pv_jobs->begin(), pv_jobs->end(), is_cheaper);
+	pc_thread_queue->add_to_job_queue(pv_jobs->back().p_func_ptr, pv_jobs->back().p_args);
+	pv_jobs->pop_back();
+}
+
+// Longest processing time first, so that no long job is left running alone at the end. Up to
+// SORT_WINDOW jobs are held back in a heap, and once it is full the costliest is queued for
+// every job that comes, so the encoding starts while files are listed and the jobs held are bounded.
+void queue_longest_first(vector<queued_job> *pv_jobs, pthread_queue *pc_thread_queue, double d_cost,
+	void *(*p_func_ptr)(void *, int), void *p_args)
+{
+	static long l_order = 0;
+	queued_job s_job = {d_cost, l_order++, p_func_ptr, p_args};
+	pv_jobs->push_back(s_job);
+	push_heap(pv_jobs->begin(), pv_jobs->end(), is_cheaper);
+	if(pv_jobs->size() > SORT_WINDOW)
+		queue_costliest(pv_jobs, pc_thread_queue);
+}
+
+// Next wave file from the directory walker, or else the single file given (only once).
+// Allocated with new [].
+char *get_next_wave_file(dir_walker *pc_dir_walker, char **ppc_wave_file)
+{
+	if(pc_dir_walker)
+		return pc_dir_walker->get_next_file();
+	if(*ppc_wave_file == NULL)
+		return NULL;
+
+	char *pc_file = new char[strlen(*ppc_wave_file)+1];
+	strcpy(pc_file, *ppc_wave_file);
+	*ppc_wave_file = NULL;
+	return pc_file;
+}
+
+/**
+*	Check if a file found is a wave file to encode.
+*	@param pc_manifest Skips the files up to date, if not NULL.
+*	@param pi_skipped Counts the files skipped as up to date.
+*	@return 1: encode it, 0: skip it.
+*/
+int is_wave_to_encode(const char *pc_wave_file, encode_manifest *pc_manifest, int *pi_skipped)
+{
+	int i_wave_file_len = strlen(pc_wave_file);
+	if(i_wave_file_len < 4 || strncmp(pc_wave_file+i_wave_file_len-4,".wav",4))
+		return 0;
+
+	string s_mp3_file = string(pc_wave_file, i_wave_file_len-4) + ".mp3";
+	if(pc_manifest && !pc_manifest->check(pc_wave_file, s_mp3_file.c_str()))
+	{
+		(*pi_skipped)++;
+		return 0;
+	}
+	return 1;
+}
+
+/**
+*	Get the next wave file to encode when finding duplicates.
+*	The files found are added to the finder, to be fingerprinted by its threads, until one of them
+*	comes back as the first of its samples, so the encoding starts while files are still found.
+*	@param pi_listing 1: Files are still found, set to 0 once all are added.
+*	@return The name of the wave file, allocated with new []. NULL once all are handed out.
+*/
+char *get_next_unique_file(dup_finder *pc_dup_finder, dir_walker *pc_dir_walker, char **ppc_wave_file,
+	encode_manifest *pc_manifest, int *pi_skipped, int *pi_listing)
+{
+	char *pc_file;
+	while(*pi_listing)
+	{
+		if((pc_file = pc_dup_finder->get_next_file(0)) != NULL)
+			return pc_file;
+		if((pc_file = get_next_wave_file(pc_dir_walker, ppc_wave_file)) == NULL)
+		{
+			pc_dup_finder->finish_adding();
+			*pi_listing = 0;
+			break;
+		}
+		if(is_wave_to_encode(pc_file, pc_manifest, pi_skipped))
+		{
+			string s_mp3_file = string(pc_file, strlen(pc_file)-4) + ".mp3";
+			pc_dup_finder->add(pc_file, s_mp3_file.c_str());
+		}
+		delete [] pc_file;
+	}
+	return pc_dup_finder->get_next_file();
+}
+
+void show_usage(char *pc_prog_name)
+{
+	fprintf(stderr, "\nUsage: %s [-f file_name | -d directory | -i input [-o output]] [-q quality] [-t threads] [-s seconds] [-w | -l] [-L [-c cost_file]] [-P r:e:w] [-a] [-D] [-R] [-H] [-S socket | -C socket] [-M manifest] [-u] [-B files:min:max[:formats]] [-T report] [--trace trace_file] [--perf] [-h]\n", pc_prog_name);
+	fprintf(stderr, "-f file_name: wave file to convert into mp3\n");
+	fprintf(stderr, "-d directory: directory path containing wave files which, together with the\n");
+	fprintf(stderr, "              ones in its subdirectories, will all be converted into mp3 files.\n");
+	fprintf(stderr, "              If this option is used, -f would be ignored.\n");
+	fprintf(stderr, "-i input:     wave file or - for stdin, encoded as it comes in, e.g. from a pipe.\n");
+	fprintf(stderr, "              A data size of 0 or 0xFFFFFFFF in the header means up to the end.\n");
+	fprintf(stderr, "              All options but -o and -q are ignored.\n");
+	fprintf(stderr, "-o output:    mp3 file or - for stdout, written as the frames come out of the\n");
+	fprintf(stderr, "              encoder. Default: - for -i -, otherwise the input with .mp3.\n");
+	fprintf(stderr, "-q quality:   MP3 quality, 0: highest (default), 9: lowest.\n");
+	fprintf(stderr, "-t threads:   total number of threads to use.\n");
+	fprintf(stderr, "-w:           threads steal jobs from each other instead of sharing one queue.\n");
+	fprintf(stderr, "-l:           threads share one lock free queue instead of one guarded by a mutex.\n");
+	fprintf(stderr, "-s seconds:   encode wave files of at least this length in segments of this\n");
+	fprintf(stderr, "              length in parallel on multiple threads. 0: disabled (default).\n");
+	fprintf(stderr, "-L:           encode the longest jobs first, as estimated from the wave headers\n");
+	fprintf(stderr, "              and the time taken in earlier runs.\n");
+	fprintf(stderr, "-c cost_file: file keeping the time taken per sample for -L (default %s).\n", COST_FILE);
+	fprintf(stderr, "-P r:e:w:     read, encode and write in separate stages with r reader, e encoder\n");
+	fprintf(stderr, "              and w writer threads, instead of -t threads doing all three.\n");
+	fprintf(stderr, "              -t, -s, -w, -l, -L, -D, -R and -H are ignored.\n");
+	fprintf(stderr, "-a:           read the wave files ahead and write the mp3 files behind while\n");
+	fprintf(stderr, "              encoding, through io_uring if available.\n");
+	fprintf(stderr, "-D:           write the mp3 files with O_DIRECT, bypassing the page cache.\n");
+	fprintf(stderr, "-R:           reuse lame encoders from file to file instead of setting up a new\n");
+	fprintf(stderr, "              one per file. The mp3 files are not bit identical then.\n");
+	fprintf(stderr, "-H:           back the buffers of the threads with huge pages if available.\n");
+	fprintf(stderr, "-S socket:    run as a server encoding the files clients submit over the Unix domain\n");
+	fprintf(stderr, "              socket, keeping the threads and encoders between jobs. -f, -d, -s, -L\n");
+	fprintf(stderr, "              and -P are ignored.\n");
+	fprintf(stderr, "-C socket:    submit the files of -f or -d to the server at socket, and print the\n");
+	fprintf(stderr, "              result of every file. -o output names the mp3 file of -f.\n");
+	fprintf(stderr, "-M manifest:  only encode the files that changed since they were recorded in the\n");
+	fprintf(stderr, "              manifest file, were encoded with other settings, or whose mp3 file\n");
+	fprintf(stderr, "              is missing or empty. A run stopped goes on where it stopped.\n");
+	fprintf(stderr, "-u:           encode wave files with the same samples only once, and make the mp3\n");
+	fprintf(stderr, "              files of the others as reflinks, hard links or copies.\n");
+	fprintf(stderr, "-B files:min:max[:formats]: benchmark. Generate files wave files of min to max seconds\n");
+	fprintf(stderr, "              in a temporary directory (in -d directory, default /tmp), encode them with\n");
+	fprintf(stderr, "              1 to -t threads, and print how the throughput scales. formats is a comma\n");
+	fprintf(stderr, "              separated list of rate/channels/bits (default 44100/2/16). -q, -w, -l and\n");
+	fprintf(stderr, "              -R apply, all other options are ignored.\n");
+	fprintf(stderr, "-T report:    time how long every job waited, read, encoded and wrote, and write the\n");
+	fprintf(stderr, "              percentiles and histograms to the report file, as CSV with one line per\n");
+	fprintf(stderr, "              job if its name ends with .csv, otherwise as JSON. Ignored with -P and -S.\n");
+	fprintf(stderr, "--trace trace_file: write what every thread did when (waiting for jobs, reading,\n");
+	fprintf(stderr, "              converting, encoding, writing) as a Chrome trace, to open in Perfetto\n");
+	fprintf(stderr, "              or chrome://tracing. Ignored with -i, -S and -C.\n");
+	fprintf(stderr, "--perf:       count the cycles, instructions, cache misses and branch misses of\n");
+	fprintf(stderr, "              converting the samples and of encoding them, if the system lets the\n");
+	fprintf(stderr, "              process count, and print them. With -T, they are reported per job too.\n");
+	fprintf(stderr, "              Ignored with -i, -S and -C.\n");
+	fprintf(stderr, "-h:           show this help\n\n");
+}
+
+// Read what is there, up to l_bytes, waiting only if nothing is. 0 at the end of the input.
+long read_input(int i_fd, unsigned char *pc_data, long l_bytes)
+{
+	long l_ret;
+	while((l_ret = read(i_fd, pc_data, l_bytes)) < 0 && errno == EINTR);
+	if(l_ret < 0)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot read input.\n", __FILE__, __LINE__);
+		exit(1);
+	}
+	return l_ret;
+}
+
+void write_output(int i_fd, const unsigned char *pc_data, long l_bytes)
+{
+	while(l_bytes > 0)
+	{
+		long l_ret = write(i_fd, pc_data, l_bytes);
+		if(l_ret < 0 && errno == EINTR)
+			continue;
+		if(l_ret <= 0)
+		{
+			fprintf(stderr, "File %s Line %d: ERROR Cannot write output.\n", __FILE__, __LINE__);
+			exit(1);
+		}
+		pc_data += l_ret;
+		l_bytes -= l_ret;
+	}
+}
+
+// Encode a wave stream as it comes in, writing the mp3 frames as soon as lame gives them.
+// Nothing but the mp3 data goes to stdout.
+int encode_stream(const char *pc_input, const char *pc_output, int i_quality)
+{
+	int i_in = strcmp(pc_input, "-") ? open(pc_input, O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+	if(i_in < 0)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot open wave file %s.\n", __FILE__, __LINE__, pc_input);
+		return 1;
+	}
+	int i_out = strcmp(pc_output, "-") ? open(pc_output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666) : STDOUT_FILENO;
+	if(i_out < 0)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot open mp3 file %s to write.\n", __FILE__, __LINE__, pc_output);
+		return 1;
+	}
+
+	// The chunks up to the samples (e.g. fmt and LIST from ffmpeg) are taken as they come, up to a buffer full
+	unsigned char *pc_buffer = new unsigned char[STREAM_READ_BYTES];
+	wav2mp3_format s_format;
+	long l_buffered = 0, l_header_bytes = 0, l_left = -1;
+	long l_ret;
+	int i_ret = WAV2MP3_ERROR_TRUNCATED;
+	while(i_ret == WAV2MP3_ERROR_TRUNCATED && l_buffered < STREAM_READ_BYTES &&
+		(l_ret = read_input(i_in, pc_buffer + l_buffered, STREAM_READ_BYTES - l_buffered)) > 0)
+	{
+		l_buffered += l_ret;
+		i_ret = wav2mp3::read_header(pc_buffer, l_buffered, &s_format, &l_header_bytes, &l_left);
+	}
+	if(i_ret)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR %s is not a PCM wave stream of 1 or 2 channels and 16, 24 or 32 bits%s.\n", 
+			__FILE__, __LINE__, pc_input, (i_ret == WAV2MP3_ERROR_TRUNCATED && l_buffered == STREAM_READ_BYTES) ? 
+			", or its header is larger than the read buffer" : "");
+		delete [] pc_buffer;
+		return 1;
+	}
+
+	// Streaming recorders do not know the size when they write the header
+	fprintf(stderr, "%s: %d Hz, %d channels, %d bits, %s\n", pc_input, s_format.i_sample_rate, s_format.i_channels, 
+		s_format.i_bits_per_sample, (l_left < 0) ? "up to the end" : "data size from the header");
+
+	// The samples read along with the header go first
+	wav2mp3 c_wav2mp3(i_quality);
+	vector<unsigned char> v_mp3;
+	long l_error = c_wav2mp3.begin(&s_format);
+	l_ret = l_buffered - l_header_bytes;
+	if(l_left >= 0 && l_ret > l_left)
+		l_ret = l_left;
+	memmove(pc_buffer, pc_buffer + l_header_bytes, l_ret);
+	while(l_error >= 0)
+	{
+		if(l_left > 0)
+			l_left -= l_ret;
+
+		v_mp3.clear();
+		l_error = c_wav2mp3.push(pc_buffer, l_ret, &v_mp3);
+		write_output(i_out, v_mp3.data(), v_mp3.size());
+
+		if(l_left == 0 || l_error < 0)
+			break;
+		l_ret = read_input(i_in, pc_buffer, (l_left < 0 || l_left > STREAM_READ_BYTES) ? STREAM_READ_BYTES : l_left);
+		if(l_ret == 0)
+			break;
+	}
+	if(l_error >= 0)
+	{
+		v_mp3.clear();
+		l_error = c_wav2mp3.finish(&v_mp3);
+		write_output(i_out, v_mp3.data(), v_mp3.size());
+	}
+	if(l_error < 0)
+		fprintf(stderr, "File %s Line %d: ERROR Cannot encode %s, error %ld.\n", __FILE__, __LINE__, pc_input, l_error);
+
+	if(i_in != STDIN_FILENO)
+		close(i_in);
+	if(i_out != STDOUT_FILENO && close(i_out))
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot close mp3 file %s.\n", __FILE__, __LINE__, pc_output);
+		delete [] pc_buffer;
+		return 1;
+	}
+	delete [] pc_buffer;
+	return (l_error < 0) ? 1 : 0;
+}
+
+// Print the answer of the server to a request, and count it if it failed.
+void print_reply(const char *pc_reply, vector<string> &v_files, int *pi_failed)
+{
+	char *pc_result;
+	long l_index = strtol(pc_reply, &pc_result, 10);
+	if(l_index < 0 || l_index >= (long)v_files.size())
+	{
+		fprintf(stderr, "File %s Line %d: WARNING Unexpected reply %s.\n", __FILE__, __LINE__, pc_reply);
+		return;
+	}
+	if(strncmp(pc_result, " OK", 3))
+		(*pi_failed)++;
+	printf("%s:%s\n", v_files[l_index].c_str(), pc_result);
+}
+
+// Submit the wave files to a server (see encode_server), and wait for all of them.
+// The requests are sent without waiting for the answers, so the files are encoded in parallel.
+int submit_to_server(const char *pc_socket_path, dir_walker *pc_dir_walker, char *pc_wave_file, 
+	const char *pc_output, int i_quality)
+{
+	int i_fd = encode_server::connect_to(pc_socket_path);
+	if(i_fd < 0)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR No server at %s.\n", __FILE__, __LINE__, pc_socket_path);
+		return 1;
+	}
+
+	vector<string> v_files;
+	int i_replies = 0;
+	int i_failed = 0;
+	char *pc_reply = new char[SERVER_MAX_FRAME_BYTES+1];
+	char pc_cwd[4096];
+	string s_cwd = getcwd(pc_cwd, sizeof(pc_cwd)) ? pc_cwd : ".";
+
+	char *pc_curr_wave_file;
+	while((pc_curr_wave_file = get_next_wave_file(pc_dir_walker, &pc_wave_file)) != NULL)
+	{
+		// The server has another working directory
+		char *pc_path = realpath(pc_curr_wave_file, NULL);
+		int i_len = pc_path ? strlen(pc_path) : 0;
+		if(pc_path == NULL || i_len < 4 || strcmp(pc_path+i_len-4, ".wav"))
+		{
+			if(pc_path == NULL)
+			{
+				fprintf(stderr, "File %s Line %d: ERROR Cannot find wave file %s.\n", __FILE__, __LINE__, pc_curr_wave_file);
+				i_failed++;
+			}
+			free(pc_path);
+			delete [] pc_curr_wave_file;
+			continue;
+		}
+		string s_mp3_file = string(pc_path, i_len-4) + ".mp3";
+		if(pc_output)
+			s_mp3_file = (pc_output[0] == '/') ? string(pc_output) : s_cwd + "/" + pc_output;
+
+		char pc_quality[16];
+		snprintf(pc_quality, sizeof(pc_quality), "%d", i_quality);
+		string s_request = string(pc_quality) + '\0' + pc_path + '\0' + s_mp3_file + '\0';
+		if(s_request.size() > SERVER_MAX_FRAME_BYTES || encode_server::send_frame(i_fd, s_request.data(), s_request.size()))
+		{
+			fprintf(stderr, "File %s Line %d: ERROR Cannot submit %s.\n", __FILE__, __LINE__, pc_path);
+			i_failed++;
+		}
+		else
+			v_files.push_back(pc_path);
+		free(pc_path);
+		delete [] pc_curr_wave_file;
+
+		// Take the answers already there, so that neither side waits on a full socket
+		pollfd s_poll = {i_fd, POLLIN, 0};
+		while(i_replies < (int)v_files.size() && poll(&s_poll, 1, 0) > 0 && 
+			encode_server::recv_frame(i_fd, pc_reply, SERVER_MAX_FRAME_BYTES+1) >= 0)
+		{
+			print_reply(pc_reply, v_files, &i_failed);
+			i_replies++;
+		}
+	}
+
+	shutdown(i_fd, SHUT_WR);
+	for(; i_replies < (int)v_files.size(); i_replies++)
+	{
+		if(encode_server::recv_frame(i_fd, pc_reply, SERVER_MAX_FRAME_BYTES+1) < 0)
+		{
+			fprintf(stderr, "File %s Line %d: ERROR Server closed the connection with %d files left.\n", 
+				__FILE__, __LINE__, (int)v_files.size() - i_replies);
+			i_failed += v_files.size() - i_replies;
+			break;
+		}
+		print_reply(pc_reply, v_files, &i_failed);
+	}
+
+	close(i_fd);
+	delete [] pc_reply;
+	return i_failed ? 1 : 0;
+}
+
+void *encode_to_mp3(void *p_args, int i_thread_id)
+{
+	thread_args *p_thread_args = (thread_args *)p_args;
+	char *pc_wave_file = p_thread_args->pc_wave_file;
+	char *pc_mp3_file = p_thread_args->pc_mp3_file;
+	wave_to_mp3 *pc_wave2mp3 = p_thread_args->ppc_wave2mp3_objs[i_thread_id];
+	int i_start_ms = get_time_ms();
+	job_record s_record;
+	long long ll_start_ns = 0;
+	if(p_thread_args->pc_job_stats)
+	{
+		job_stats::clear_record(&s_record);
+		pc_wave2mp3->set_job_record(&s_record);
+		ll_start_ns = job_stats::get_time_ns();
+	}
+
+	// The manifest takes the hash of the samples as they are read, not reading the file again
+	content_hash c_hash;
+	if(p_thread_args->pc_manifest)
+		pc_wave2mp3->set_content_hash(&c_hash);
+
+	// A file that cannot be encoded is reported, and the others go on
+	int i_error = pc_wave2mp3->init(pc_wave_file, pc_mp3_file);
+	if(i_error == WAVE_TO_MP3_OK)
+	{
+		pc_wave2mp3->sanity_check();
+		if(p_thread_args->pi_done_ms == NULL)	// Not while benchmarking
+			pc_wave2mp3->display_wave_info();
+		i_error = pc_wave2mp3->encode_wave();
+	}
+	if(i_error != WAVE_TO_MP3_OK)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot encode %s: %s.\n", __FILE__, __LINE__, pc_wave_file, 
+			wave_to_mp3::get_error_text(i_error));
+		__atomic_add_fetch(&g_i_failed_files, 1, __ATOMIC_RELAXED);
+	}
+	pc_wave2mp3->set_content_hash(NULL);
+
+	if(p_thread_args->pc_job_stats)
+	{
+		s_record.pll_stage_ns[JOB_STAGE_TOTAL] = job_stats::get_time_ns() - ll_start_ns;
+		pc_wave2mp3->set_job_record(NULL);
+		p_thread_args->pc_job_stats->add(i_thread_id, &s_record);
+	}
+
+	if(p_thread_args->pc_job_cost && i_error == WAVE_TO_MP3_OK)
+		p_thread_args->pc_job_cost->add_time(&p_thread_args->s_format, p_thread_args->i_samples, get_time_ms() - i_start_ms);
+	if(p_thread_args->pc_manifest && i_error == WAVE_TO_MP3_OK)
+		p_thread_args->pc_manifest->done(pc_wave_file, pc_mp3_file, &c_hash);
+	if(p_thread_args->pi_done_ms)
+		p_thread_args->pi_done_ms[i_thread_id] = get_time_ms();
+
+	// The arguments were allocated by main for this job only
+	delete [] p_thread_args->pc_wave_file;
+	delete [] p_thread_args->pc_mp3_file;
+	delete p_thread_args;
+	return NULL;
+}
+
+void *encode_segment_to_mp3(void *p_args, int i_thread_id)
+{
+	segment_args *p_segment_args = (segment_args *)p_args;
+	segment_job *pc_segment_job = p_segment_args->pc_segment_job;
+	int i_segment = p_segment_args->i_segment;
+	wave_to_mp3 *pc_wave2mp3 = p_segment_args->ppc_wave2mp3_objs[i_thread_id];
+	int i_start_ms = get_time_ms();
+	job_record s_record;
+	long long ll_start_ns = 0;
+	if(p_segment_args->pc_job_stats)
+	{
+		job_stats::clear_record(&s_record);
+		pc_wave2mp3->set_job_record(&s_record);
+		ll_start_ns = job_stats::get_time_ns();
+	}
+
+	unsigned char *pc_mp3_data;
+	int i_mp3_size = pc_wave2mp3->encode_segment(pc_segment_job->get_wave_file(), 
+		pc_segment_job->get_first_sample(i_segment), pc_segment_job->get_num_samples(i_segment),
+		i_segment == pc_segment_job->get_num_segments()-1, &pc_mp3_data);
+
+	if(i_mp3_size < 0)
+		pc_mp3_data = NULL;
+	else if(p_segment_args->pc_job_cost)
+		p_segment_args->pc_job_cost->add_time(&p_segment_args->s_format, pc_segment_job->get_num_samples(i_segment), get_time_ms() - i_start_ms);
+
+	// The thread finishing the last segment joins them
+	if(pc_segment_job->set_segment_done(i_segment, pc_mp3_data, i_mp3_size))
+	{
+		long long ll_write_ns = job_stats::get_time_ns();
+		int i_error = pc_segment_job->write_mp3(pc_wave2mp3->get_mp3_writer());
+		if(p_segment_args->pc_job_stats)
+			s_record.pll_stage_ns[JOB_STAGE_WRITE] += job_stats::get_time_ns() - ll_write_ns;
+		if(i_error)
+		{
+			fprintf(stderr, "File %s Line %d: ERROR Cannot encode %s.\n", __FILE__, __LINE__, pc_segment_job->get_wave_file());
+			__atomic_add_fetch(&g_i_failed_files, 1, __ATOMIC_RELAXED);
+		}
+		else if(p_segment_args->pc_manifest)
+			p_segment_args->pc_manifest->done(pc_segment_job->get_wave_file(), pc_segment_job->get_mp3_file());
+		delete pc_segment_job;
+	}
+
+	if(p_segment_args->pc_job_stats)
+	{
+		s_record.pll_stage_ns[JOB_STAGE_TOTAL] = job_stats::get_time_ns() - ll_start_ns;
+		pc_wave2mp3->set_job_record(NULL);
+		p_segment_args->pc_job_stats->add(i_thread_id, &s_record);
+	}
+
+	delete p_segment_args;
+	return NULL;
+}
+
+// Encode a generated corpus with 1 to i_max_threads threads, and print how the throughput scales.
+int run_benchmark(const char *pc_spec, const char *pc_parent_dir, int i_max_threads, int i_quality, int i_work_steal,
+	int i_lock_free, int i_lame_reuse)
+{
+	int i_files = 0;
+	double d_min_seconds = 0, d_max_seconds = 0;
+	char pc_formats[256] = "";
+	if(sscanf(pc_spec, "%d:%lf:%lf:%255s", &i_files, &d_min_seconds, &d_max_seconds, pc_formats) < 3 || 
+		i_files < 1 || d_min_seconds <= 0 || d_max_seconds < d_min_seconds || i_max_threads < 1)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Benchmark %s is not files:min:max[:formats].\n", __FILE__, __LINE__, pc_spec);
+		return 1;
+	}
+
+	wave_corpus *pc_corpus = new wave_corpus();
+	if(pc_formats[0] && pc_corpus->set_formats(pc_formats))
+	{
+		fprintf(stderr, "File %s Line %d: ERROR %s is not a list of rate/channels/bits.\n", __FILE__, __LINE__, pc_formats);
+		delete pc_corpus;
+		return 1;
+	}
+	fprintf(stderr, "Generating %d wave files of %g to %g seconds in %s\n", i_files, d_min_seconds, d_max_seconds, pc_parent_dir);
+	if(pc_corpus->generate(pc_parent_dir, i_files, d_min_seconds, d_max_seconds))
+	{
+		delete pc_corpus;
+		return 1;
+	}
+	fprintf(stderr, "Corpus of %d files, %.0f seconds of audio, %.1f MB\n\n", pc_corpus->get_num_files(), 
+		pc_corpus->get_audio_seconds(), pc_corpus->get_bytes() / 1e6);
+
+	// Efficiency: throughput over the throughput of 1 thread times the threads. 
+	// Tail idle: thread time spent waiting for the last jobs, over all the thread time.
+	printf("threads    seconds    files/s  audio s/s  efficiency  tail idle\n");
+	double d_files_per_s_1 = 0;
+	for(int i_threads=1;i_threads<=i_max_threads;i_threads++)
+	{
+		wave_to_mp3 **ppc_wave2mp3 = new wave_to_mp3*[i_threads];
+		for(int i=0;i<i_threads;i++)
+		{
+			ppc_wave2mp3[i] = new wave_to_mp3();
+			ppc_wave2mp3[i]->set_quality(i_quality);
+			ppc_wave2mp3[i]->set_lame_reuse(i_lame_reuse);
+		}
+		pthread_queue *pc_thread_queue = new pthread_queue();
+		if(i_work_steal)
+			pc_thread_queue->make_thread_pool_stealing(i_threads, QUEUE_LENGTH);
+		else
+			pc_thread_queue->make_thread_pool(i_threads, QUEUE_LENGTH, i_lock_free != 0);
+
+		int *pi_done_ms = new int[i_threads];
+		int i_start_ms = get_time_ms();
+		for(int i=0;i<i_threads;i++)
+			pi_done_ms[i] = i_start_ms;
+
+		for(int i=0;i<pc_corpus->get_num_files();i++)
+		{
+			const char *pc_wave_file = pc_corpus->get_wave_file(i);
+			int i_wave_file_len = strlen(pc_wave_file);
+			thread_args *pc_thread_args = new thread_args;	// Freed by the thread once the job is done
+			memset(pc_thread_args, 0, sizeof(thread_args));
+			pc_thread_args->pc_wave_file = new char[i_wave_file_len+1];
+			strcpy(pc_thread_args->pc_wave_file, pc_wave_file);
+			pc_thread_args->pc_mp3_file = new char[i_wave_file_len+1];
+			strcpy(pc_thread_args->pc_mp3_file, "");
+			strncat(pc_thread_args->pc_mp3_file, pc_wave_file, i_wave_file_len-4);
+			strcat(pc_thread_args->pc_mp3_file, ".mp3");
+			pc_thread_args->ppc_wave2mp3_objs = ppc_wave2mp3;
+			pc_thread_args->pi_done_ms = pi_done_ms;
+			pc_thread_queue->add_to_job_queue(encode_to_mp3, (void *)pc_thread_args);
+		}
+		pc_thread_queue->wait_queue_done();
+		int i_end_ms = get_time_ms();
+
+		double d_seconds = ((i_end_ms > i_start_ms) ? i_end_ms - i_start_ms : 1) / 1000.0;
+		double d_idle_ms = 0;
+		for(int i=0;i<i_threads;i++)
+			d_idle_ms += i_end_ms - pi_done_ms[i];
+		double d_files_per_s = pc_corpus->get_num_files() / d_seconds;
+		if(i_threads == 1)
+			d_files_per_s_1 = d_files_per_s;
+		printf("%7d %10.3f %10.2f %10.1f %11.3f %10.3f\n", i_threads, d_seconds, d_files_per_s, 
+			pc_corpus->get_audio_seconds() / d_seconds, d_files_per_s / (i_threads * d_files_per_s_1), 
+			d_idle_ms / (i_threads * d_seconds * 1000));
+		fflush(stdout);
+
+		delete pc_thread_queue;
+		delete [] pi_done_ms;
+		for(int i=0;i<i_threads;i++)
+			delete ppc_wave2mp3[i];
+		delete [] ppc_wave2mp3;
+	}
+
+	delete pc_corpus;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	fprintf(stderr, "Multithreaded wave to mp3 encoder version %s\n", SOFTWARE_VERSION);
+	fprintf(stderr, "Copyright: Muhammad Usman Karim Khan <karim.usman@yahoo.com>\n\n");
+
+	char *pc_wave_file = NULL;
+	char *pc_wave_dir = NULL;
+	char *pc_input = NULL;
+	char *pc_output = NULL;
+	char *pc_server_socket = NULL;
+	char *pc_client_socket = NULL;
+	char *pc_manifest_file = NULL;
+	char *pc_bench_spec = NULL;
+	char *pc_report_file = NULL;
+	char *pc_trace_file = NULL;
+	int i_perf = 0;
+	job_stats *pc_job_stats = NULL;
+	encode_manifest *pc_manifest = NULL;
+	int i_skipped = 0;
+	dup_finder *pc_dup_finder = NULL;
+	int i_find_dups = 0;
+	int i_threads = 4;
+	int i_quality = 0;
+	int i_segment_seconds = 0;
+	int i_work_steal = 0;
+	int i_lock_free = 0;
+	int i_largest_first = 0;
+	int i_readers = 0, i_encoders = 0, i_writers = 0;
+	int i_async_io = 0;
+	int i_lame_reuse = 0;
+	int i_huge_pages = 0;
+	int i_direct_io = 0;
+	buffer_arena *pc_plan_arena = NULL;	// Buffers for reading the headers of the files to segment
+	pipeline *pc_pipeline = NULL;
+	const char *pc_cost_file = COST_FILE;
+	job_cost *pc_job_cost = NULL;
+	vector<queued_job> v_jobs;		// Heap of the jobs held back to queue the longest first, for -L
+
+	wave_to_mp3 **ppc_wave2mp3 = NULL;
+	pthread_queue *pc_thread_queue = new pthread_queue();
+
+	int i_use_dir = 0;
+
+	if(argc < 3)
+	{
+		show_usage(argv[0]);
+		return 1;
+	}
+
+	for(int i=1;i<argc;i++)
+	{
+		if(strcmp(argv[i], "-f") == 0)
+			pc_wave_file = argv[++i];
+		else if(strcmp(argv[i], "-d") == 0)
+		{
+			i_use_dir = 1;
+			pc_wave_dir = argv[++i];
+		}
+		else if(strcmp(argv[i], "-i") == 0)
+			pc_input = argv[++i];
+		else if(strcmp(argv[i], "-o") == 0)
+			pc_output = argv[++i];
+		else if(strcmp(argv[i], "-S") == 0)
+			pc_server_socket = argv[++i];
+		else if(strcmp(argv[i], "-C") == 0)
+			pc_client_socket = argv[++i];
+		else if(strcmp(argv[i], "-M") == 0)
+			pc_manifest_file = argv[++i];
+		else if(strcmp(argv[i], "-q") == 0)
+			i_quality = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-t") == 0)
+			i_threads = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-w") == 0)
+			i_work_steal = 1;
+		else if(strcmp(argv[i], "-l") == 0)
+			i_lock_free = 1;
+		else if(strcmp(argv[i], "-s") == 0)
+			i_segment_seconds = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-L") == 0)
+			i_largest_first = 1;
+		else if(strcmp(argv[i], "-c") == 0)
+			pc_cost_file = argv[++i];
+		else if(strcmp(argv[i], "-a") == 0)
+			i_async_io = 1;
+		else if(strcmp(argv[i], "-D") == 0)
+			i_direct_io = 1;
+		else if(strcmp(argv[i], "-B") == 0)
+			pc_bench_spec = argv[++i];
+		else if(strcmp(argv[i], "-T") == 0)
+			pc_report_file = argv[++i];
+		else if(strcmp(argv[i], "--trace") == 0)
+			pc_trace_file = argv[++i];
+		else if(strcmp(argv[i], "--perf") == 0)
+			i_perf = 1;
+		else if(strcmp(argv[i], "-u") == 0)
+			i_find_dups = 1;
+		else if(strcmp(argv[i], "-R") == 0)
+			i_lame_reuse = 1;
+		else if(strcmp(argv[i], "-H") == 0)
+			i_huge_pages = 1;
+		else if(strcmp(argv[i], "-P") == 0)
+		{
+			if(i+1 >= argc || sscanf(argv[++i], "%d:%d:%d", &i_readers, &i_encoders, &i_writers) != 3 ||
+				i_readers < 1 || i_encoders < 1 || i_writers < 1)
+			{
+				show_usage(argv[0]);
+				return 1;
+			}
+		}
+		else if(strcmp(argv[i], "-h") == 0)
+		{
+			show_usage(argv[0]);
+			return 1;
+		}
+		else
+		{
+			show_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(pc_input)
+	{
+		string s_output = pc_output ? pc_output : pc_input;
+		if(pc_output == NULL && s_output != "-")
+		{
+			if(s_output.size() >= 4 && s_output.compare(s_output.size()-4, 4, ".wav") == 0)
+				s_output.resize(s_output.size()-4);
+			s_output += ".mp3";
+		}
+		return encode_stream(pc_input, s_output.c_str(), i_quality);
+	}
+
+	// Before any thread is started, so that the threads are named in the trace
+	if(pc_trace_file && !pc_server_socket)
+	{
+		trace_log::start();
+		trace_log::set_thread_name("main");
+	}
+	if(i_perf && !pc_server_socket && perf_counters::start())
+		i_perf = 0;		// Runs on without them
+
+	if(pc_bench_spec)
+	{
+		int i_ret = run_benchmark(pc_bench_spec, i_use_dir ? pc_wave_dir : "/tmp", i_threads, i_quality, i_work_steal, 
+			i_lock_free, i_lame_reuse);
+		if(pc_trace_file)
+			trace_log::write(pc_trace_file);
+		if(i_perf)
+			perf_counters::display_summary();
+		return i_ret;
+	}
+
+	if(pc_server_socket)	// Files come from the clients
+	{
+		i_use_dir = 0;
+		i_segment_seconds = 0;
+		i_largest_first = 0;
+		i_encoders = 0;
+	}
+	else if((i_use_dir == 1 && pc_wave_dir == NULL) || (i_use_dir == 0 && pc_wave_file == NULL))
+	{
+		show_usage(argv[0]);
+		return 1;
+	}
+
+	// The directories are listed while the files found are already encoded
+	dir_walker *pc_dir_walker = NULL;
+	if(i_use_dir == 1)
+	{
+		pc_dir_walker = new dir_walker(DIR_WALK_THREADS);
+		pc_dir_walker->start(pc_wave_dir, ".wav");
+	}
+
+	if(pc_client_socket)
+	{
+		int i_ret = submit_to_server(pc_client_socket, pc_dir_walker, pc_wave_file, i_use_dir ? NULL : pc_output, i_quality);
+		if(pc_dir_walker)
+			delete pc_dir_walker;
+		return i_ret;
+	}
+
+	// Threads
+	// Number of threads = number of wave to mp3 convertors.
+	if(i_encoders > 0)	// The stages have their own threads and encoders
+	{
+		i_threads = 0;
+		i_segment_seconds = 0;
+		i_largest_first = 0;
+	}
+	ppc_wave2mp3 = new wave_to_mp3*[i_threads];
+	for(int i=0;i<i_threads;i++)
+	{
+		ppc_wave2mp3[i] = new wave_to_mp3();
+		ppc_wave2mp3[i]->set_quality(i_quality);
+		if(i_async_io)
+			ppc_wave2mp3[i]->enable_async_io();
+		ppc_wave2mp3[i]->set_lame_reuse(i_lame_reuse);
+		ppc_wave2mp3[i]->set_huge_pages(i_huge_pages);
+		ppc_wave2mp3[i]->set_direct_io(i_direct_io);
+	}
+	if(i_segment_seconds > 0)
+		pc_plan_arena = new buffer_arena();
+
+	if(i_encoders > 0)
+		pc_pipeline = new pipeline(i_readers, i_encoders, i_writers, i_quality);
+	else if(i_work_steal)
+		pc_thread_queue->make_thread_pool_stealing(i_threads, QUEUE_LENGTH);
+	else
+		pc_thread_queue->make_thread_pool(i_threads, QUEUE_LENGTH, i_lock_free != 0);
+
+	if(pc_server_socket)
+	{
+		encode_server *pc_server = new encode_server(pc_thread_queue, ppc_wave2mp3);
+		pc_server->run(pc_server_socket);	// Until the process is stopped
+	}
+
+	if(pc_manifest_file && !pc_server_socket)
+	{
+		// Everything that makes other mp3 files
+		char pc_settings[64];
+		snprintf(pc_settings, sizeof(pc_settings), "v%s,q%d,s%d,r%d", SOFTWARE_VERSION, i_quality, i_segment_seconds, 
+			i_lame_reuse);
+		pc_manifest = new encode_manifest(pc_settings);
+		if(pc_manifest->load(pc_manifest_file))
+			return 1;
+		if(pc_pipeline)
+			pc_pipeline->set_manifest(pc_manifest);
+	}
+
+	if(i_find_dups)
+		pc_dup_finder = new dup_finder(i_threads > 0 ? i_threads : i_readers);
+
+	if(pc_report_file && !pc_pipeline)
+		pc_job_stats = new job_stats(pc_thread_queue, i_threads);
+
+	if(i_largest_first)
+	{
+		pc_job_cost = new job_cost();
+		pc_job_cost->load(pc_cost_file);
+	}
+
+	// Encoding
+	// Stream the wave files to the threads. Adding a job blocks only while QUEUE_LENGTH 
+	// jobs are queued or in process, and continues as soon as one of them is done.
+	// With duplicates found, the files are fingerprinted by the threads of the finder while they
+	// are listed. Only the first file of the same samples comes back to be encoded, the mp3 files
+	// of the others are made once it is.
+	char *pc_curr_wave_file;
+	int i_listing = 1;
+	while((pc_curr_wave_file = pc_dup_finder ? 
+		get_next_unique_file(pc_dup_finder, pc_dir_walker, &pc_wave_file, pc_manifest, &i_skipped, &i_listing) : 
+		get_next_wave_file(pc_dir_walker, &pc_wave_file)) != NULL)
+	{
+		int i_wave_file_len = strlen(pc_curr_wave_file);
+		if(!pc_dup_finder && !is_wave_to_encode(pc_curr_wave_file, pc_manifest, &i_skipped))
+		{
+			delete [] pc_curr_wave_file;
+			continue;
+		}
+
+		if(pc_pipeline)
+		{
+			char *pc_curr_mp3_file = new char[i_wave_file_len+1];
+			strcpy(pc_curr_mp3_file,"");
+			strncat(pc_curr_mp3_file, pc_curr_wave_file, i_wave_file_len-4);
+			strcat(pc_curr_mp3_file, ".mp3");
+
+			pc_pipeline->add_file(pc_curr_wave_file, pc_curr_mp3_file);	// Copies the names
+			delete [] pc_curr_wave_file;
+			delete [] pc_curr_mp3_file;
+			continue;
+		}
+
+		// Cost model, only needed to order the jobs
+		job_cost_format s_format = {0, 0, 0};
+		int i_samples = 0;
+		if(pc_job_cost)
+			pc_job_cost->read_format(pc_curr_wave_file, &s_format, &i_samples);
+
+		if(i_segment_seconds > 0)
+		{
+			// Long files are split and their segments are queued as separate jobs
+			char *pc_curr_mp3_file = new char[i_wave_file_len+1];
+			strcpy(pc_curr_mp3_file,"");
+			strncat(pc_curr_mp3_file, pc_curr_wave_file, i_wave_file_len-4);
+			strcat(pc_curr_mp3_file, ".mp3");
+
+			segment_job *pc_segment_job = new segment_job(pc_curr_wave_file, pc_curr_mp3_file);	// Freed by the last thread
+			delete [] pc_curr_mp3_file;
+
+			int i_num_segments = pc_segment_job->plan(i_segment_seconds, pc_plan_arena);
+			if(i_num_segments > 1)
+			{
+				delete [] pc_curr_wave_file;	// The segment job has its own copy
+
+				for(int i=0;i<i_num_segments;i++)
+				{
+					segment_args *pc_segment_args = new segment_args;	// Freed by the thread once the job is done
+					pc_segment_args->pc_segment_job = pc_segment_job;
+					pc_segment_args->i_segment = i;
+					pc_segment_args->ppc_wave2mp3_objs = ppc_wave2mp3;
+					pc_segment_args->pc_job_cost = pc_job_cost;
+					pc_segment_args->s_format = s_format;
+					pc_segment_args->pc_manifest = pc_manifest;
+					pc_segment_args->pc_job_stats = pc_job_stats;
+					if(pc_job_cost)
+						queue_longest_first(&v_jobs, pc_thread_queue, pc_job_cost->estimate(&s_format, 
+							pc_segment_job->get_num_samples(i)), encode_segment_to_mp3, (void *)pc_segment_args);
+					else
+						pc_thread_queue->add_to_job_queue(encode_segment_to_mp3, (void *)pc_segment_args);
+				}
+				continue;
+			}
+			delete pc_segment_job;
+			if(i_num_segments == 0)	// Cannot be encoded, plan tells why
+			{
+				__atomic_add_fetch(&g_i_failed_files, 1, __ATOMIC_RELAXED);
+				delete [] pc_curr_wave_file;
+				continue;
+			}
+		}
+
+		thread_args *pc_thread_args = new thread_args;	// Freed by the thread once the job is done
+		pc_thread_args->pc_wave_file = pc_curr_wave_file;	// Freed by the thread as well
+		pc_thread_args->pc_mp3_file = new char[i_wave_file_len+1];
+		pc_thread_args->ppc_wave2mp3_objs = ppc_wave2mp3;
+		pc_thread_args->pc_job_cost = pc_job_cost;
+		pc_thread_args->s_format = s_format;
+		pc_thread_args->i_samples = i_samples;
+		pc_thread_args->pc_manifest = pc_manifest;
+		pc_thread_args->pi_done_ms = NULL;
+		pc_thread_args->pc_job_stats = pc_job_stats;
+
+		strcpy(pc_thread_args->pc_mp3_file,"");
+		strncat(pc_thread_args->pc_mp3_file, pc_curr_wave_file, i_wave_file_len-4);
+		strcat(pc_thread_args->pc_mp3_file, ".mp3");
+
+		if(pc_job_cost)
+			queue_longest_first(&v_jobs, pc_thread_queue, pc_job_cost->estimate(&s_format, i_samples), 
+				encode_to_mp3, (void *)pc_thread_args);
+		else
+			pc_thread_queue->add_to_job_queue(encode_to_mp3, (void *)pc_thread_args);
+	}
+
+	// The jobs still held back, longest first
+	while(!v_jobs.empty())
+		queue_costliest(&v_jobs, pc_thread_queue);
+
+	// Wait for queue to finish
+	if(pc_pipeline)
+	{
+		pc_pipeline->wait_done();
+		delete pc_pipeline;
+	}
+	else
+		pc_thread_queue->wait_queue_done();
+
+	if(pc_dup_finder)
+	{
+		pc_dup_finder->link_duplicates(pc_manifest);
+		pc_dup_finder->display_summary();
+		delete pc_dup_finder;
+	}
+
+	if(pc_trace_file)
+		trace_log::write(pc_trace_file);
+
+	if(i_perf)
+		perf_counters::display_summary();
+
+	if(pc_job_stats)
+	{
+		pc_job_stats->write_report(pc_report_file);
+		delete pc_job_stats;
+	}
+
+	if(pc_job_cost)
+	{
+		pc_job_cost->save(pc_cost_file);
+		delete pc_job_cost;
+	}
+
+	if(pc_manifest)
+	{
+		fprintf(stderr, "Files up to date, skipped: %d\n", i_skipped);
+		pc_manifest->save();
+		delete pc_manifest;
+	}
+
+	if(pc_dir_walker)
+		delete pc_dir_walker;
+
+	for(int i=0;i<i_threads;i++)
+		delete ppc_wave2mp3[i];
+	delete [] ppc_wave2mp3;
+	delete pc_thread_queue;
+	if(pc_plan_arena)
+		delete pc_plan_arena;
+
+	// Stays the same however many files there are, once every thread has its buffers
+	fprintf(stderr, "Buffer chunks of %d KB allocated: %ld\n", ARENA_CHUNK_BYTES/1024, buffer_arena::get_total_allocations());
+
+	if(g_i_failed_files)
+	{
+		fprintf(stderr, "Files that could not be encoded: %d\n", g_i_failed_files);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,236 @@
+/**
+* @file async_io.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the async_io class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <async_io.h>
+#include <stdio.h>
+#include <cstdlib>
+#include <errno.h>
+#include <unistd.h>
+
+#define		REQUEST_FREE		0
+#define		REQUEST_IN_FLIGHT	1
+#define		REQUEST_DONE		2
+
+async_io::async_io(int i_depth)
+{
+	m_i_depth = i_depth < 1 ? 1 : i_depth;
+	m_ps_requests = new async_io_request[m_i_depth];
+	for(int i=0;i<m_i_depth;i++)
+		m_ps_requests[i].i_state = REQUEST_FREE;
+	m_i_shut_down = 0;
+
+	pthread_mutex_init(&m_t_mutex, NULL);
+	pthread_cond_init(&m_t_queued_cond, NULL);
+	pthread_cond_init(&m_t_done_cond, NULL);
+
+	m_i_uring = (init_uring() == 0);
+	if(!m_i_uring && pthread_create(&m_t_thread, NULL, run_io, this))
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot create thread.\n", __FILE__, __LINE__);
+		exit(1);
+	}
+}
+
+async_io::~async_io()
+{
+	for(int i=0;i<m_i_depth;i++)
+	{
+		if(m_ps_requests[i].i_state != REQUEST_FREE)
+			wait(i);
+	}
+
+	if(m_i_uring)
+	{
+#ifdef HAVE_LIBURING
+		io_uring_queue_exit(&m_s_ring);
+#endif
+	}
+	else
+	{
+		pthread_mutex_lock(&m_t_mutex);
+		m_i_shut_down = 1;
+		pthread_cond_signal(&m_t_queued_cond);
+		pthread_mutex_unlock(&m_t_mutex);
+		pthread_join(m_t_thread, NULL);
+	}
+
+	delete [] m_ps_requests;
+	pthread_mutex_destroy(&m_t_mutex);
+	pthread_cond_destroy(&m_t_queued_cond);
+	pthread_cond_destroy(&m_t_done_cond);
+}
+
+int async_io::init_uring()
+{
+#ifdef HAVE_LIBURING
+	if(io_uring_queue_init(m_i_depth, &m_s_ring, 0) < 0)
+		return 1;
+
+	// Plain reads and writes came after io_uring itself (Linux 5.6)
+	struct io_uring_probe *ps_probe = io_uring_get_probe_ring(&m_s_ring);
+	int i_supported = ps_probe && io_uring_opcode_supported(ps_probe, IORING_OP_READ) &&
+		io_uring_opcode_supported(ps_probe, IORING_OP_WRITE);
+	if(ps_probe)
+		io_uring_free_probe(ps_probe);
+	if(!i_supported)
+	{
+		io_uring_queue_exit(&m_s_ring);
+		return 1;
+	}
+	return 0;
+#else
+	return 1;
+#endif
+}
+
+void *async_io::run_io(void *p_async_io)
+{
+	((async_io*)p_async_io)->run();
+	return NULL;
+}
+
+void async_io::run()
+{
+	pthread_mutex_lock(&m_t_mutex);
+	while(1)
+	{
+		while(!m_i_shut_down && m_dq_queued.empty())
+			pthread_cond_wait(&m_t_queued_cond, &m_t_mutex);
+		if(m_dq_queued.empty())		// Shut down
+			break;
+
+		async_io_request *ps_request = &m_ps_requests[m_dq_queued.front()];
+		m_dq_queued.pop_front();
+		pthread_mutex_unlock(&m_t_mutex);
+
+		int i_result = transfer(ps_request, 0);
+
+		pthread_mutex_lock(&m_t_mutex);
+		ps_request->i_result = i_result;
+		ps_request->i_state = REQUEST_DONE;
+		pthread_cond_broadcast(&m_t_done_cond);
+	}
+	pthread_mutex_unlock(&m_t_mutex);
+}
+
+int async_io::transfer(async_io_request *ps_request, int i_done)
+{
+	while(i_done < ps_request->i_bytes)
+	{
+		ssize_t l_ret;
+		if(ps_request->e_op == ASYNC_IO_READ)
+			l_ret = pread(ps_request->i_fd, ps_request->pc_buffer + i_done, ps_request->i_bytes - i_done,
+				ps_request->l_offset + i_done);
+		else
+			l_ret = pwrite(ps_request->i_fd, ps_request->pc_buffer + i_done, ps_request->i_bytes - i_done,
+				ps_request->l_offset + i_done);
+
+		if(l_ret < 0 && errno == EINTR)
+			continue;
+		if(l_ret < 0)
+			return i_done > 0 ? i_done : -errno;
+		if(l_ret == 0)	// End of the file
+			break;
+		i_done += l_ret;
+	}
+	return i_done;
+}
+
+int async_io::submit(async_io_op e_op, int i_fd, unsigned char *pc_buffer, int i_bytes, long l_offset)
+{
+	int i_request;
+	for(i_request=0;i_request<m_i_depth;i_request++)
+	{
+		if(m_ps_requests[i_request].i_state == REQUEST_FREE)
+			break;
+	}
+	if(i_request == m_i_depth)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR More than %d requests in flight.\n", __FILE__, __LINE__, m_i_depth);
+		exit(1);
+	}
+
+	async_io_request *ps_request = &m_ps_requests[i_request];
+	ps_request->e_op = e_op;
+	ps_request->i_fd = i_fd;
+	ps_request->pc_buffer = pc_buffer;
+	ps_request->i_bytes = i_bytes;
+	ps_request->l_offset = l_offset;
+	ps_request->i_result = 0;
+
+	if(m_i_uring)
+	{
+#ifdef HAVE_LIBURING
+		struct io_uring_sqe *ps_sqe = io_uring_get_sqe(&m_s_ring);	// There is an entry for every request
+		if(e_op == ASYNC_IO_READ)
+			io_uring_prep_read(ps_sqe, i_fd, pc_buffer, i_bytes, l_offset);
+		else
+			io_uring_prep_write(ps_sqe, i_fd, pc_buffer, i_bytes, l_offset);
+		io_uring_sqe_set_data(ps_sqe, ps_request);
+		ps_request->i_state = REQUEST_IN_FLIGHT;
+
+		int i_ret = io_uring_submit(&m_s_ring);
+		if(i_ret < 0)
+		{
+			fprintf(stderr, "File %s Line %d: ERROR io_uring submit failed with %d.\n", __FILE__, __LINE__, i_ret);
+			exit(1);
+		}
+#endif
+	}
+	else
+	{
+		pthread_mutex_lock(&m_t_mutex);
+		ps_request->i_state = REQUEST_IN_FLIGHT;
+		m_dq_queued.push_back(i_request);
+		pthread_cond_signal(&m_t_queued_cond);
+		pthread_mutex_unlock(&m_t_mutex);
+	}
+
+	return i_request;
+}
+
+int async_io::wait(int i_request)
+{
+	async_io_request *ps_request = &m_ps_requests[i_request];
+
+	if(m_i_uring)
+	{
+#ifdef HAVE_LIBURING
+		// Completions come in any order, and are kept until their request is waited for
+		while(ps_request->i_state != REQUEST_DONE)
+		{
+			struct io_uring_cqe *ps_cqe;
+			int i_ret = io_uring_wait_cqe(&m_s_ring, &ps_cqe);
+			if(i_ret == -EINTR)
+				continue;
+			if(i_ret < 0)
+			{
+				fprintf(stderr, "File %s Line %d: ERROR io_uring wait failed with %d.\n", __FILE__, __LINE__, i_ret);
+				exit(1);
+			}
+			async_io_request *ps_done = (async_io_request *)io_uring_cqe_get_data(ps_cqe);
+			ps_done->i_result = ps_cqe->res;
+			ps_done->i_state = REQUEST_DONE;
+			io_uring_cqe_seen(&m_s_ring, ps_cqe);
+		}
+
+		// The kernel may transfer less, e.g. on network file systems
+		if(ps_request->i_result > 0 && ps_request->i_result < ps_request->i_bytes)
+			ps_request->i_result = transfer(ps_request, ps_request->i_result);
+#endif
+	}
+	else
+	{
+		pthread_mutex_lock(&m_t_mutex);
+		while(ps_request->i_state != REQUEST_DONE)
+			pthread_cond_wait(&m_t_done_cond, &m_t_mutex);
+		pthread_mutex_unlock(&m_t_mutex);
+	}
+
+	ps_request->i_state = REQUEST_FREE;
+	return ps_request->i_result;
+}
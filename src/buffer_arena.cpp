@@ -0,0 +1,80 @@
+/**
+* @file buffer_arena.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the buffer_arena class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <buffer_arena.h>
+#include <stdio.h>
+#include <cstdlib>
+#include <sys/mman.h>
+
+long buffer_arena::s_l_total_allocations = 0;
+
+buffer_arena::buffer_arena(int i_huge_pages)
+{
+	m_i_huge_pages = i_huge_pages;
+	m_l_allocations = 0;
+}
+
+buffer_arena::~buffer_arena()
+{
+	for(size_t i=0;i<m_dq_chunks.size();i++)
+		munmap(m_dq_chunks[i], ARENA_CHUNK_BYTES);
+}
+
+void buffer_arena::add_chunk()
+{
+	void *p_chunk = MAP_FAILED;
+	if(m_i_huge_pages)
+		p_chunk = mmap(NULL, ARENA_CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if(p_chunk == MAP_FAILED)
+	{
+		p_chunk = mmap(NULL, ARENA_CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(p_chunk == MAP_FAILED)
+		{
+			fprintf(stderr, "File %s Line %d: ERROR Cannot allocate %d bytes.\n", __FILE__, __LINE__, ARENA_CHUNK_BYTES);
+			exit(1);
+		}
+		if(m_i_huge_pages)	// None reserved, so let the kernel merge the pages if it can
+			madvise(p_chunk, ARENA_CHUNK_BYTES, MADV_HUGEPAGE);
+	}
+	m_dq_chunks.push_back(p_chunk);
+
+	// The mapping is page aligned, so every buffer is too
+	for(int i=0;i<ARENA_CHUNK_BYTES/ARENA_BLOCK_BYTES;i++)
+		m_dq_free.push_back((unsigned char *)p_chunk + i*ARENA_BLOCK_BYTES);
+
+	m_l_allocations++;
+	__atomic_add_fetch(&s_l_total_allocations, 1, __ATOMIC_RELAXED);
+}
+
+unsigned char *buffer_arena::borrow(int i_bytes)
+{
+	if(i_bytes > ARENA_BLOCK_BYTES)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Buffer of %d bytes more than arena block size %d.\n",
+			__FILE__, __LINE__, i_bytes, ARENA_BLOCK_BYTES);
+		exit(1);
+	}
+
+	if(m_dq_free.empty())
+		add_chunk();
+
+	// The last given back is the most likely to be in the cache
+	unsigned char *pc_buffer = m_dq_free.back();
+	m_dq_free.pop_back();
+	return pc_buffer;
+}
+
+void buffer_arena::give_back(unsigned char *pc_buffer)
+{
+	if(pc_buffer)
+		m_dq_free.push_back(pc_buffer);
+}
+
+long buffer_arena::get_total_allocations()
+{
+	return __atomic_load_n(&s_l_total_allocations, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,67 @@
+/**
+* @file content_hash.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the content_hash class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <content_hash.h>
+#include <cstring>
+
+#define		HASH_MULTIPLIER		0x9E3779B97F4A7C15ULL	//!< Odd constant spreading the bits of every word
+
+void content_hash::reset()
+{
+	m_ull_hash = 0;
+	m_i_word_bytes = 0;
+	m_l_bytes = 0;
+}
+
+void content_hash::add_word(const unsigned char *pc_word)
+{
+	unsigned long long ull_word;
+	memcpy(&ull_word, pc_word, sizeof(ull_word));
+	m_ull_hash = (m_ull_hash ^ ull_word) * HASH_MULTIPLIER;
+	m_ull_hash ^= m_ull_hash >> 29;
+}
+
+void content_hash::add(const unsigned char *pc_data, long l_bytes)
+{
+	m_l_bytes += l_bytes;
+
+	// The word left over from the last bytes first
+	if(m_i_word_bytes > 0)
+	{
+		int i_copy = (l_bytes < 8 - m_i_word_bytes) ? (int)l_bytes : 8 - m_i_word_bytes;
+		memcpy(m_pc_word + m_i_word_bytes, pc_data, i_copy);
+		m_i_word_bytes += i_copy;
+		pc_data += i_copy;
+		l_bytes -= i_copy;
+		if(m_i_word_bytes < 8)
+			return;
+		add_word(m_pc_word);
+		m_i_word_bytes = 0;
+	}
+
+	for(;l_bytes >= 8;l_bytes -= 8, pc_data += 8)
+		add_word(pc_data);
+
+	memcpy(m_pc_word, pc_data, l_bytes);
+	m_i_word_bytes = (int)l_bytes;
+}
+
+unsigned long long content_hash::get()
+{
+	// The last word is padded with zeros
+	unsigned long long ull_hash = m_ull_hash;
+	if(m_i_word_bytes > 0)
+	{
+		unsigned char pc_word[8] = {0};
+		memcpy(pc_word, m_pc_word, m_i_word_bytes);
+		unsigned long long ull_word;
+		memcpy(&ull_word, pc_word, sizeof(ull_word));
+		ull_hash = (ull_hash ^ ull_word) * HASH_MULTIPLIER;
+		ull_hash ^= ull_hash >> 29;
+	}
+	return (ull_hash ^ m_l_bytes) * HASH_MULTIPLIER;
+}
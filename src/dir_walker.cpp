@@ -0,0 +1,256 @@
+/**
+* @file dir_walker.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the dir_walker class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <dir_walker.h>
+#include <stdio.h>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+
+#define		DIRENT_BUFFER_BYTES		65536	//!< Directory entries read at once
+#define		FILES_PER_BATCH			64		//!< Files handed out together, to take the lock less often
+
+/**
+*	Directory entry as returned by getdents64.
+*/
+typedef struct _linux_dirent64
+{
+	unsigned long long	d_ino;
+	long long			d_off;
+	unsigned short		d_reclen;
+	unsigned char		d_type;
+	char				d_name[1];
+} linux_dirent64;
+
+dir_walker::dir_walker(int i_num_threads)
+{
+	m_i_num_threads = i_num_threads < 1 ? 1 : i_num_threads;
+	m_pt_threads = NULL;
+	m_pc_suffix = NULL;
+	m_i_suffix_len = 0;
+	m_i_busy_threads = 0;
+	m_i_done = 0;
+	m_i_stop = 0;
+
+	pthread_mutex_init(&m_t_mutex, NULL);
+	pthread_cond_init(&m_t_dir_avail_cond, NULL);
+	pthread_cond_init(&m_t_file_avail_cond, NULL);
+	pthread_cond_init(&m_t_file_taken_cond, NULL);
+}
+
+dir_walker::~dir_walker()
+{
+	// The caller may stop before all files are handed out, with threads waiting for room
+	pthread_mutex_lock(&m_t_mutex);
+	m_i_stop = 1;
+	pthread_cond_broadcast(&m_t_file_taken_cond);
+	pthread_mutex_unlock(&m_t_mutex);
+	if(m_pt_threads)
+	{
+		for(int i=0;i<m_i_num_threads;i++)
+			pthread_join(m_pt_threads[i], NULL);
+		delete [] m_pt_threads;
+	}
+
+	while(!m_dq_dirs.empty())
+	{
+		delete [] m_dq_dirs.front();
+		m_dq_dirs.pop_front();
+	}
+	while(!m_dq_files.empty())
+	{
+		delete [] m_dq_files.front();
+		m_dq_files.pop_front();
+	}
+	if(m_pc_suffix)
+		delete [] m_pc_suffix;
+
+	pthread_mutex_destroy(&m_t_mutex);
+	pthread_cond_destroy(&m_t_dir_avail_cond);
+	pthread_cond_destroy(&m_t_file_avail_cond);
+	pthread_cond_destroy(&m_t_file_taken_cond);
+}
+
+void dir_walker::start(const char *pc_root, const char *pc_suffix)
+{
+	m_i_suffix_len = strlen(pc_suffix);
+	m_pc_suffix = new char[m_i_suffix_len+1];
+	strcpy(m_pc_suffix, pc_suffix);
+
+	// Without the trailing slashes, so that the paths have a single slash
+	int i_root_len = strlen(pc_root);
+	while(i_root_len > 1 && pc_root[i_root_len-1] == '/')
+		i_root_len--;
+	char *pc_dir = new char[i_root_len+1];
+	strncpy(pc_dir, pc_root, i_root_len);
+	pc_dir[i_root_len] = '\0';
+	m_dq_dirs.push_back(pc_dir);
+
+	m_pt_threads = new pthread_t[m_i_num_threads];
+	for(int i=0;i<m_i_num_threads;i++)
+	{
+		if(pthread_create(&m_pt_threads[i], NULL, run_walker, this))
+		{
+			fprintf(stderr, "File %s Line %d: ERROR Cannot create thread.\n", __FILE__, __LINE__);
+			exit(1);
+		}
+	}
+}
+
+void *dir_walker::run_walker(void *p_walker)
+{
+	((dir_walker*)p_walker)->walk();
+	return NULL;
+}
+
+void dir_walker::walk()
+{
+	char *pc_dirent_buffer = new char[DIRENT_BUFFER_BYTES];
+
+	pthread_mutex_lock(&m_t_mutex);
+	while(1)
+	{
+		// Wait for a directory, as long as a busy thread might still find one
+		while(m_dq_dirs.empty() && m_i_busy_threads > 0)
+			pthread_cond_wait(&m_t_dir_avail_cond, &m_t_mutex);
+
+		if(m_dq_dirs.empty() || m_i_stop)	// All read, or no more wanted
+		{
+			m_i_done = 1;
+			pthread_cond_broadcast(&m_t_dir_avail_cond);
+			pthread_cond_broadcast(&m_t_file_avail_cond);
+			break;
+		}
+
+		char *pc_dir = m_dq_dirs.front();
+		m_dq_dirs.pop_front();
+		m_i_busy_threads++;
+		pthread_mutex_unlock(&m_t_mutex);
+
+		read_dir(pc_dir, pc_dirent_buffer);
+		delete [] pc_dir;
+
+		pthread_mutex_lock(&m_t_mutex);
+		m_i_busy_threads--;
+	}
+	pthread_mutex_unlock(&m_t_mutex);
+
+	delete [] pc_dirent_buffer;
+}
+
+char *dir_walker::join_path(const char *pc_dir, const char *pc_name)
+{
+	int i_dir_len = strlen(pc_dir);
+	int i_name_len = strlen(pc_name);
+	int i_slash = (i_dir_len > 0 && pc_dir[i_dir_len-1] != '/') ? 1 : 0;
+
+	char *pc_path = new char[i_dir_len+i_slash+i_name_len+1];
+	memcpy(pc_path, pc_dir, i_dir_len);
+	if(i_slash)
+		pc_path[i_dir_len] = '/';
+	memcpy(pc_path+i_dir_len+i_slash, pc_name, i_name_len+1);
+	return pc_path;
+}
+
+void dir_walker::add_paths(std::deque<char*> *pdq_dirs, std::deque<char*> *pdq_files)
+{
+	if(pdq_dirs->empty() && pdq_files->empty())
+		return;
+
+	pthread_mutex_lock(&m_t_mutex);
+	if(!pdq_dirs->empty())
+	{
+		m_dq_dirs.insert(m_dq_dirs.end(), pdq_dirs->begin(), pdq_dirs->end());
+		pthread_cond_broadcast(&m_t_dir_avail_cond);
+	}
+	if(!pdq_files->empty())
+	{
+		// The directories go first, so the other threads keep reading until the files fill up too
+		while((int)m_dq_files.size() >= DIR_WALK_MAX_FILES && !m_i_stop)
+			pthread_cond_wait(&m_t_file_taken_cond, &m_t_mutex);
+		m_dq_files.insert(m_dq_files.end(), pdq_files->begin(), pdq_files->end());
+		pthread_cond_signal(&m_t_file_avail_cond);
+	}
+	pthread_mutex_unlock(&m_t_mutex);
+
+	pdq_dirs->clear();
+	pdq_files->clear();
+}
+
+void dir_walker::read_dir(const char *pc_dir, char *pc_dirent_buffer)
+{
+	int i_fd = openat(AT_FDCWD, pc_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(i_fd < 0)
+	{
+		fprintf(stderr, "File %s Line %d: WARNING Cannot open directory %s.\n", __FILE__, __LINE__, pc_dir);
+		return;
+	}
+
+	// Read the entries in large blocks straight from the kernel, without the copies of readdir
+	std::deque<char*> dq_dirs, dq_files;
+	long l_bytes;
+	while((l_bytes = syscall(SYS_getdents64, i_fd, pc_dirent_buffer, DIRENT_BUFFER_BYTES)) > 0)
+	{
+		for(long l_pos=0;l_pos<l_bytes;)
+		{
+			linux_dirent64 *ps_dirent = (linux_dirent64 *)(pc_dirent_buffer + l_pos);
+			l_pos += ps_dirent->d_reclen;
+			const char *pc_name = ps_dirent->d_name;
+			unsigned char c_type = ps_dirent->d_type;
+			if(pc_name[0] == '.' && (pc_name[1] == '\0' || (pc_name[1] == '.' && pc_name[2] == '\0')))
+				continue;
+
+			// The file system may not tell the type, or it is a link
+			struct stat s_stat;
+			if(c_type == DT_UNKNOWN && fstatat(i_fd, pc_name, &s_stat, AT_SYMLINK_NOFOLLOW) == 0)
+				c_type = S_ISDIR(s_stat.st_mode) ? DT_DIR : S_ISREG(s_stat.st_mode) ? DT_REG :
+					S_ISLNK(s_stat.st_mode) ? DT_LNK : DT_UNKNOWN;
+			if(c_type == DT_LNK && fstatat(i_fd, pc_name, &s_stat, 0) == 0 && S_ISREG(s_stat.st_mode))
+				c_type = DT_REG;	// Links to directories are not followed, they might make a loop
+
+			if(c_type == DT_DIR)
+				dq_dirs.push_back(join_path(pc_dir, pc_name));
+			else if(c_type == DT_REG)
+			{
+				int i_name_len = strlen(pc_name);
+				if(i_name_len >= m_i_suffix_len && strcmp(pc_name+i_name_len-m_i_suffix_len, m_pc_suffix) == 0)
+					dq_files.push_back(join_path(pc_dir, pc_name));
+			}
+
+			if((int)dq_files.size() >= FILES_PER_BATCH)
+				add_paths(&dq_dirs, &dq_files);
+		}
+	}
+	if(l_bytes < 0)	// The entries read so far are still listed
+		fprintf(stderr, "File %s Line %d: WARNING Cannot read directory %s: %s.\n", __FILE__, __LINE__, 
+			pc_dir, strerror(errno));
+	close(i_fd);
+
+	add_paths(&dq_dirs, &dq_files);
+}
+
+char *dir_walker::get_next_file()
+{
+	char *pc_file = NULL;
+	pthread_mutex_lock(&m_t_mutex);
+	while(m_dq_files.empty() && !m_i_done)
+		pthread_cond_wait(&m_t_file_avail_cond, &m_t_mutex);
+	if(!m_dq_files.empty())
+	{
+		pc_file = m_dq_files.front();
+		m_dq_files.pop_front();
+		if((int)m_dq_files.size() == DIR_WALK_MAX_FILES - 1)	// There was no room before
+			pthread_cond_broadcast(&m_t_file_taken_cond);
+	}
+	pthread_mutex_unlock(&m_t_mutex);
+	return pc_file;
+}
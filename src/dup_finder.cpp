@@ -0,0 +1,283 @@
+/**
+* @file dup_finder.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the dup_finder class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <dup_finder.h>
+#include <wave_read.h>
+#include <buffer_arena.h>
+#include <encode_manifest.h>
+#include <stdio.h>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#define		HASH_MULTIPLIER		0x9E3779B97F4A7C15ULL	//!< Odd constant spreading the bits of every word
+#define		COPY_BYTES			(64*1024)				//!< Bytes copied at once if the file cannot be linked
+
+using namespace std;
+
+dup_finder::dup_finder(int i_num_threads)
+{
+	m_i_num_threads = i_num_threads < 1 ? 1 : i_num_threads;
+	m_i_busy_threads = 0;
+	m_i_adding = 1;
+	m_i_reflinks = 0;
+	m_i_hard_links = 0;
+	m_i_copies = 0;
+	m_i_failed = 0;
+
+	pthread_mutex_init(&m_t_mutex, NULL);
+	pthread_cond_init(&m_t_added_cond, NULL);
+	pthread_cond_init(&m_t_original_cond, NULL);
+
+	m_pt_threads = new pthread_t[m_i_num_threads];
+	for(int i=0;i<m_i_num_threads;i++)
+	{
+		if(pthread_create(&m_pt_threads[i], NULL, run_finder, this))
+		{
+			fprintf(stderr, "File %s Line %d: ERROR Cannot create thread.\n", __FILE__, __LINE__);
+			exit(1);
+		}
+	}
+}
+
+dup_finder::~dup_finder()
+{
+	finish_adding();
+	for(int i=0;i<m_i_num_threads;i++)
+		pthread_join(m_pt_threads[i], NULL);
+	delete [] m_pt_threads;
+
+	while(!m_dq_originals.empty())
+	{
+		delete [] m_dq_originals.front();
+		m_dq_originals.pop_front();
+	}
+
+	pthread_mutex_destroy(&m_t_mutex);
+	pthread_cond_destroy(&m_t_added_cond);
+	pthread_cond_destroy(&m_t_original_cond);
+}
+
+void *dup_finder::run_finder(void *p_finder)
+{
+	((dup_finder*)p_finder)->run();
+	return NULL;
+}
+
+void dup_finder::run()
+{
+	buffer_arena *pc_arena = new buffer_arena();
+	wave_read *pc_wave_read = new wave_read(pc_arena);
+
+	pthread_mutex_lock(&m_t_mutex);
+	while(1)
+	{
+		while(m_dq_added.empty() && m_i_adding)
+			pthread_cond_wait(&m_t_added_cond, &m_t_mutex);
+		if(m_dq_added.empty())	// All fingerprinted
+			break;
+
+		dup_entry s_entry = m_dq_added.front();
+		m_dq_added.pop_front();
+		m_i_busy_threads++;
+		pthread_mutex_unlock(&m_t_mutex);
+
+		string s_fingerprint;
+		int i_error = fingerprint(pc_wave_read, s_entry.s_wave_file.c_str(), &s_fingerprint);
+
+		pthread_mutex_lock(&m_t_mutex);
+		m_i_busy_threads--;
+		map<string, string>::iterator it = i_error ? m_m_originals.end() : m_m_originals.find(s_fingerprint);
+		if(i_error || it == m_m_originals.end())
+		{
+			if(!i_error)
+				m_m_originals[s_fingerprint] = s_entry.s_mp3_file;
+			char *pc_wave_file = new char[s_entry.s_wave_file.size()+1];
+			strcpy(pc_wave_file, s_entry.s_wave_file.c_str());
+			m_dq_originals.push_back(pc_wave_file);
+		}
+		else
+		{
+			s_entry.s_original_mp3_file = it->second;
+			m_v_duplicates.push_back(s_entry);
+		}
+
+		// The file to encode, or the last file is done and nothing more comes
+		pthread_cond_signal(&m_t_original_cond);
+	}
+
+	// The caller may wait for a file that never comes
+	pthread_cond_broadcast(&m_t_original_cond);
+	pthread_mutex_unlock(&m_t_mutex);
+
+	delete pc_wave_read;
+	delete pc_arena;
+}
+
+void dup_finder::add(const char *pc_wave_file, const char *pc_mp3_file)
+{
+	dup_entry s_entry;
+	s_entry.s_wave_file = pc_wave_file;
+	s_entry.s_mp3_file = pc_mp3_file;
+
+	pthread_mutex_lock(&m_t_mutex);
+	m_dq_added.push_back(s_entry);
+	pthread_cond_signal(&m_t_added_cond);
+	pthread_mutex_unlock(&m_t_mutex);
+}
+
+void dup_finder::finish_adding()
+{
+	pthread_mutex_lock(&m_t_mutex);
+	m_i_adding = 0;
+	pthread_cond_broadcast(&m_t_added_cond);
+	pthread_cond_broadcast(&m_t_original_cond);
+	pthread_mutex_unlock(&m_t_mutex);
+}
+
+char *dup_finder::get_next_file(int i_wait)
+{
+	pthread_mutex_lock(&m_t_mutex);
+	while(i_wait && m_dq_originals.empty() && (m_i_adding || !m_dq_added.empty() || m_i_busy_threads > 0))
+		pthread_cond_wait(&m_t_original_cond, &m_t_mutex);
+
+	char *pc_wave_file = NULL;
+	if(!m_dq_originals.empty())
+	{
+		pc_wave_file = m_dq_originals.front();
+		m_dq_originals.pop_front();
+	}
+	pthread_mutex_unlock(&m_t_mutex);
+	return pc_wave_file;
+}
+
+int dup_finder::fingerprint(wave_read *pc_wave_read, const char *pc_wave_file, string *ps_fingerprint)
+{
+	string s_wave_file = pc_wave_file;
+	if(pc_wave_read->init(&s_wave_file[0], DUP_READ_BYTES))
+		return 1;	// The encoder tells what is wrong
+	wave_header *ps_header = pc_wave_read->get_wave_header();
+	if(ps_header->audio_format != 1 || ps_header->num_channels <= 0 || ps_header->bits_per_sample <= 0 ||
+		ps_header->block_align <= 0 || ps_header->block_align > DUP_READ_BYTES/8)
+		return 1;	// The encoder tells what is wrong
+
+	// The same samples as the encoder reads, up to the end of the file. Whole words but at the end.
+	int i_block_samples = DUP_READ_BYTES / ps_header->block_align / 8 * 8;
+	unsigned long long ull_hash = 0;
+	long l_data_bytes = 0;
+	const unsigned char *pc_data;
+	int i_bytes;
+	while((i_bytes = pc_wave_read->get_raw_block(&pc_data, i_block_samples)) > 0)
+	{
+		for(int i=0;i<i_bytes;i+=8)
+		{
+			unsigned long long ull_word = 0;
+			memcpy(&ull_word, pc_data + i, (i_bytes - i < 8) ? i_bytes - i : 8);
+			ull_hash = (ull_hash ^ ull_word) * HASH_MULTIPLIER;
+			ull_hash ^= ull_hash >> 29;
+		}
+		l_data_bytes += i_bytes;
+	}
+	if(pc_wave_read->get_read_error())
+		return 1;	// Not all samples, so encoded on its own
+
+	char pc_fingerprint[128];
+	snprintf(pc_fingerprint, sizeof(pc_fingerprint), "%d %d %d %d %ld %016llx", ps_header->sample_rate,
+		ps_header->num_channels, ps_header->bits_per_sample, ps_header->block_align, l_data_bytes,
+		(ull_hash ^ l_data_bytes) * HASH_MULTIPLIER);
+	*ps_fingerprint = pc_fingerprint;
+	return 0;
+}
+
+int dup_finder::link_file(const char *pc_file, const char *pc_new_file)
+{
+	int i_fd = open(pc_file, O_RDONLY | O_CLOEXEC);
+	if(i_fd < 0)
+		return 1;
+
+	// A new file, so that no other name of the old one is written
+	unlink(pc_new_file);
+	int i_new_fd = open(pc_new_file, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+	if(i_new_fd < 0)
+	{
+		close(i_fd);
+		return 1;
+	}
+
+#ifdef FICLONE
+	// Shares the blocks, and the files stay independent
+	if(ioctl(i_new_fd, FICLONE, i_fd) == 0)
+	{
+		close(i_new_fd);
+		close(i_fd);
+		m_i_reflinks++;
+		return 0;
+	}
+#endif
+
+	close(i_new_fd);
+	unlink(pc_new_file);
+	if(link(pc_file, pc_new_file) == 0)
+	{
+		close(i_fd);
+		m_i_hard_links++;
+		return 0;
+	}
+
+	// Another file system
+	int i_error = 1;
+	i_new_fd = open(pc_new_file, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+	if(i_new_fd >= 0)
+	{
+		unsigned char *pc_buffer = new unsigned char[COPY_BYTES];
+		ssize_t l_read;
+		i_error = 0;
+		while(!i_error && (l_read = read(i_fd, pc_buffer, COPY_BYTES)) != 0)
+		{
+			if(l_read < 0 && errno == EINTR)
+				continue;
+			i_error = (l_read < 0 || write(i_new_fd, pc_buffer, l_read) != l_read);
+		}
+		delete [] pc_buffer;
+		i_error |= close(i_new_fd);
+		if(i_error)
+			unlink(pc_new_file);
+		else
+			m_i_copies++;
+	}
+	close(i_fd);
+	return i_error;
+}
+
+int dup_finder::link_duplicates(encode_manifest *pc_manifest)
+{
+	for(size_t i=0;i<m_v_duplicates.size();i++)
+	{
+		dup_entry *ps_entry = &m_v_duplicates[i];
+		if(link_file(ps_entry->s_original_mp3_file.c_str(), ps_entry->s_mp3_file.c_str()))
+		{
+			fprintf(stderr, "File %s Line %d: WARNING Cannot make %s from %s.\n", __FILE__, __LINE__,
+				ps_entry->s_mp3_file.c_str(), ps_entry->s_original_mp3_file.c_str());
+			m_i_failed++;
+			continue;
+		}
+		if(pc_manifest)
+			pc_manifest->done(ps_entry->s_wave_file.c_str(), ps_entry->s_mp3_file.c_str());
+	}
+	m_v_duplicates.clear();
+	return m_i_failed;
+}
+
+void dup_finder::display_summary()
+{
+	fprintf(stderr, "Duplicate files not encoded: %d (reflinks: %d, hard links: %d, copies: %d, failed: %d)\n",
+		m_i_reflinks + m_i_hard_links + m_i_copies + m_i_failed, m_i_reflinks, m_i_hard_links, m_i_copies, m_i_failed);
+}
@@ -0,0 +1,251 @@
+/**
+* @file encode_manifest.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the encode_manifest class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <encode_manifest.h>
+#include <content_hash.h>
+#include <stdio.h>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define		HASH_READ_BYTES		(1024*1024)				//!< Bytes hashed at once
+
+using namespace std;
+
+/**
+*	Get the modification time of a file in nsec.
+*/
+static long long get_mtime_ns(const struct stat *ps_stat)
+{
+	return ps_stat->st_mtim.tv_sec * 1000000000LL + ps_stat->st_mtim.tv_nsec;
+}
+
+encode_manifest::encode_manifest(const char *pc_settings)
+{
+	m_s_settings = pc_settings;
+	m_i_fd = -1;
+	pthread_mutex_init(&m_t_mutex, NULL);
+}
+
+encode_manifest::~encode_manifest()
+{
+	if(m_i_fd >= 0)
+		close(m_i_fd);
+	pthread_mutex_destroy(&m_t_mutex);
+}
+
+int encode_manifest::load(const char *pc_manifest_file)
+{
+	m_s_manifest_file = pc_manifest_file;
+
+	FILE *f_manifest = fopen(pc_manifest_file, "r");
+	if(f_manifest)
+	{
+		char *pc_line = NULL;
+		size_t l_line_size = 0;
+		ssize_t l_len;
+		while((l_len = getline(&pc_line, &l_line_size, f_manifest)) > 0)
+		{
+			// A line cut off by a run that was stopped is dropped
+			if(pc_line[l_len-1] != '\n')
+				break;
+			pc_line[l_len-1] = '\0';
+
+			manifest_entry s_entry;
+			char pc_settings[256];
+			int i_fields_len = 0;
+			if(sscanf(pc_line, "%ld %lld %llx %255s\t%n", &s_entry.l_size, &s_entry.ll_mtime_ns, &s_entry.ull_hash,
+				pc_settings, &i_fields_len) != 4 || i_fields_len == 0)
+				continue;
+			char *pc_wave_file = pc_line + i_fields_len;
+			char *pc_tab = strchr(pc_wave_file, '\t');
+			if(pc_tab == NULL || pc_tab == pc_wave_file)
+				continue;
+			*pc_tab = '\0';
+
+			s_entry.s_settings = pc_settings;
+			s_entry.s_mp3_file = pc_tab + 1;
+			m_m_entries[pc_wave_file] = s_entry;
+		}
+		free(pc_line);
+		fclose(f_manifest);
+	}
+
+	m_i_fd = open(pc_manifest_file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+	if(m_i_fd < 0)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot write manifest file %s.\n", __FILE__, __LINE__, pc_manifest_file);
+		return 1;
+	}
+	return 0;
+}
+
+void encode_manifest::append(const string &s_wave_file, const manifest_entry *ps_entry)
+{
+	char pc_fields[512];
+	int i_len = snprintf(pc_fields, sizeof(pc_fields), "%ld %lld %016llx %s\t", ps_entry->l_size, ps_entry->ll_mtime_ns,
+		ps_entry->ull_hash, ps_entry->s_settings.c_str());
+	string s_line = string(pc_fields, i_len) + s_wave_file + "\t" + ps_entry->s_mp3_file + "\n";
+
+	// One write per line, so the lines of a run stopped are whole but for the last one
+	if(m_i_fd >= 0 && write(m_i_fd, s_line.data(), s_line.size()) != (ssize_t)s_line.size())
+		fprintf(stderr, "File %s Line %d: WARNING Cannot append to manifest file %s.\n",
+			__FILE__, __LINE__, m_s_manifest_file.c_str());
+}
+
+int encode_manifest::save()
+{
+	if(m_s_manifest_file.empty())
+		return 1;
+
+	string s_temp_file = m_s_manifest_file + ".tmp";
+	FILE *f_manifest = fopen(s_temp_file.c_str(), "w");
+	if(f_manifest == NULL)
+	{
+		fprintf(stderr, "File %s Line %d: WARNING Cannot write manifest file %s.\n",
+			__FILE__, __LINE__, s_temp_file.c_str());
+		return 1;
+	}
+
+	pthread_mutex_lock(&m_t_mutex);
+	for(map<string, manifest_entry>::iterator it = m_m_entries.begin(); it != m_m_entries.end(); it++)
+		fprintf(f_manifest, "%ld %lld %016llx %s\t%s\t%s\n", it->second.l_size, it->second.ll_mtime_ns, it->second.ull_hash,
+			it->second.s_settings.c_str(), it->first.c_str(), it->second.s_mp3_file.c_str());
+	pthread_mutex_unlock(&m_t_mutex);
+
+	// On disk before it replaces the old one
+	int i_ret = (fflush(f_manifest) || fsync(fileno(f_manifest)));
+	i_ret |= fclose(f_manifest);
+	if(i_ret || rename(s_temp_file.c_str(), m_s_manifest_file.c_str()))
+	{
+		fprintf(stderr, "File %s Line %d: WARNING Cannot replace manifest file %s.\n",
+			__FILE__, __LINE__, m_s_manifest_file.c_str());
+		unlink(s_temp_file.c_str());
+		return 1;
+	}
+	return 0;
+}
+
+int encode_manifest::check(const char *pc_wave_file, const char *pc_mp3_file)
+{
+	// Not pending, so never recorded
+	if(strpbrk(pc_wave_file, "\t\n") || strpbrk(pc_mp3_file, "\t\n"))
+	{
+		fprintf(stderr, "File %s Line %d: WARNING The name of %s has a tab or a new line, it cannot be recorded in the manifest.\n",
+			__FILE__, __LINE__, pc_wave_file);
+		return 1;
+	}
+
+	struct stat s_stat;
+	if(stat(pc_wave_file, &s_stat))
+		return 1;	// The encoder tells what is wrong
+
+	manifest_entry s_checked;
+	s_checked.l_size = s_stat.st_size;
+	s_checked.ll_mtime_ns = get_mtime_ns(&s_stat);
+	s_checked.ull_hash = 0;
+	s_checked.s_settings = m_s_settings;
+
+	// The wave file may not have changed, but its mp3 file was deleted or never written out
+	struct stat s_mp3_stat;
+	int i_mp3_written = (lstat(pc_mp3_file, &s_mp3_stat) == 0 && s_mp3_stat.st_size > 0);
+
+	pthread_mutex_lock(&m_t_mutex);
+	map<string, manifest_entry>::iterator it = m_m_entries.find(pc_wave_file);
+	int i_known = (i_mp3_written && it != m_m_entries.end() && it->second.s_settings == m_s_settings &&
+		it->second.l_size == s_checked.l_size && it->second.s_mp3_file == pc_mp3_file);
+	if(i_known && it->second.ll_mtime_ns == s_checked.ll_mtime_ns)
+	{
+		pthread_mutex_unlock(&m_t_mutex);
+		return 0;
+	}
+	unsigned long long ull_known_hash = i_known ? it->second.ull_hash : 0;
+	pthread_mutex_unlock(&m_t_mutex);
+
+	// Same size but touched, so the content decides
+	if(i_known && hash_file(pc_wave_file, &s_checked.ull_hash) == 0 && s_checked.ull_hash == ull_known_hash)
+	{
+		pthread_mutex_lock(&m_t_mutex);
+		manifest_entry *ps_entry = &m_m_entries[pc_wave_file];
+		ps_entry->ll_mtime_ns = s_checked.ll_mtime_ns;	// Skipped with a stat from now on
+		append(pc_wave_file, ps_entry);
+		pthread_mutex_unlock(&m_t_mutex);
+		return 0;
+	}
+
+	pthread_mutex_lock(&m_t_mutex);
+	m_m_pending[pc_wave_file] = s_checked;
+	pthread_mutex_unlock(&m_t_mutex);
+	return 1;
+}
+
+void encode_manifest::done(const char *pc_wave_file, const char *pc_mp3_file, content_hash *pc_hash)
+{
+	pthread_mutex_lock(&m_t_mutex);
+	map<string, manifest_entry>::iterator it = m_m_pending.find(pc_wave_file);
+	if(it == m_m_pending.end())
+	{
+		pthread_mutex_unlock(&m_t_mutex);
+		return;
+	}
+	manifest_entry s_entry = it->second;
+	m_m_pending.erase(it);
+	pthread_mutex_unlock(&m_t_mutex);
+
+	// The mp3 file holds what the wave file was when it was checked, so the hash must be of that too.
+	// Hashed again only if the encoder did not read the whole file once.
+	int i_error = 0;
+	if(pc_hash && pc_hash->get_bytes() == s_entry.l_size)
+		s_entry.ull_hash = pc_hash->get();
+	else
+		i_error = hash_file(pc_wave_file, &s_entry.ull_hash);
+
+	struct stat s_stat;
+	if(i_error || stat(pc_wave_file, &s_stat) ||
+		s_stat.st_size != s_entry.l_size || get_mtime_ns(&s_stat) != s_entry.ll_mtime_ns)
+	{
+		fprintf(stderr, "File %s Line %d: WARNING %s changed while encoding, not recorded.\n",
+			__FILE__, __LINE__, pc_wave_file);
+		return;
+	}
+	s_entry.s_mp3_file = pc_mp3_file;
+
+	pthread_mutex_lock(&m_t_mutex);
+	m_m_entries[pc_wave_file] = s_entry;
+	append(pc_wave_file, &s_entry);
+	pthread_mutex_unlock(&m_t_mutex);
+}
+
+int encode_manifest::hash_file(const char *pc_file, unsigned long long *pull_hash)
+{
+	int i_fd = open(pc_file, O_RDONLY | O_CLOEXEC);
+	if(i_fd < 0)
+		return 1;
+
+	unsigned char *pc_buffer = new unsigned char[HASH_READ_BYTES];
+	content_hash c_hash;
+	int i_error = 0;
+	while(1)
+	{
+		ssize_t l_read = read(i_fd, pc_buffer, HASH_READ_BYTES);
+		if(l_read < 0 && errno == EINTR)
+			continue;
+		if(l_read < 0)
+			i_error = 1;
+		if(l_read <= 0)
+			break;
+		c_hash.add(pc_buffer, l_read);
+	}
+	delete [] pc_buffer;
+	close(i_fd);
+
+	*pull_hash = c_hash.get();
+	return i_error;
+}
@@ -0,0 +1,414 @@
+/**
+* @file encode_server.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the encode_server class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <encode_server.h>
+#include <pthread_queue.h>
+#include <wave_to_mp3.h>
+#include <wav2mp3.h>
+#include <stdio.h>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/**
+*	Read exactly i_bytes from a socket.
+*	@return 0: All clear, otherwise: end of the connection or an error.
+*/
+static int read_all(int i_fd, unsigned char *pc_data, int i_bytes)
+{
+	while(i_bytes > 0)
+	{
+		ssize_t l_ret = recv(i_fd, pc_data, i_bytes, 0);
+		if(l_ret < 0 && errno == EINTR)
+			continue;
+		if(l_ret <= 0)
+			return 1;
+		pc_data += l_ret;
+		i_bytes -= l_ret;
+	}
+	return 0;
+}
+
+/**
+*	Write exactly i_bytes to a socket.
+*	A client gone is an error, not a SIGPIPE.
+*	@return 0: All clear, otherwise: problem
+*/
+static int write_all(int i_fd, const unsigned char *pc_data, int i_bytes)
+{
+	while(i_bytes > 0)
+	{
+		ssize_t l_ret = send(i_fd, pc_data, i_bytes, MSG_NOSIGNAL);
+		if(l_ret < 0 && errno == EINTR)
+			continue;
+		if(l_ret <= 0)
+			return 1;
+		pc_data += l_ret;
+		i_bytes -= l_ret;
+	}
+	return 0;
+}
+
+/**
+*	Make a socket address from a path.
+*	@return 0: All clear, otherwise: the path is too long.
+*/
+static int make_address(const char *pc_socket_path, sockaddr_un *ps_address)
+{
+	memset(ps_address, 0, sizeof(sockaddr_un));
+	ps_address->sun_family = AF_UNIX;
+	if(strlen(pc_socket_path) >= sizeof(ps_address->sun_path))
+		return 1;
+	strcpy(ps_address->sun_path, pc_socket_path);
+	return 0;
+}
+
+static int get_time_ms()
+{
+	timespec s_time;
+	clock_gettime(CLOCK_MONOTONIC, &s_time);
+	return s_time.tv_sec*1000 + s_time.tv_nsec/1000000;
+}
+
+encode_server::encode_server(pthread_queue *pc_thread_queue, wave_to_mp3 **ppc_wave2mp3)
+{
+	m_pc_thread_queue = pc_thread_queue;
+	m_ppc_wave2mp3 = ppc_wave2mp3;
+	m_i_listen_fd = -1;
+	pthread_mutex_init(&m_t_queue_mutex, NULL);
+}
+
+encode_server::~encode_server()
+{
+	if(m_i_listen_fd >= 0)
+		close(m_i_listen_fd);
+	pthread_mutex_destroy(&m_t_queue_mutex);
+}
+
+int encode_server::send_frame(int i_fd, const char *pc_payload, int i_bytes)
+{
+	unsigned char pc_size[4] = {(unsigned char)i_bytes, (unsigned char)(i_bytes >> 8),
+		(unsigned char)(i_bytes >> 16), (unsigned char)(i_bytes >> 24)};
+	if(write_all(i_fd, pc_size, 4))
+		return 1;
+	return write_all(i_fd, (const unsigned char *)pc_payload, i_bytes);
+}
+
+int encode_server::recv_frame(int i_fd, char *pc_payload, int i_size)
+{
+	unsigned char pc_size[4];
+	if(read_all(i_fd, pc_size, 4))
+		return -1;
+
+	int i_bytes = pc_size[0] | (pc_size[1] << 8) | (pc_size[2] << 16) | (pc_size[3] << 24);
+	if(i_bytes < 0 || i_bytes > SERVER_MAX_FRAME_BYTES || i_bytes >= i_size)
+		return -1;
+	if(read_all(i_fd, (unsigned char *)pc_payload, i_bytes))
+		return -1;
+	pc_payload[i_bytes] = '\0';
+	return i_bytes;
+}
+
+int encode_server::connect_to(const char *pc_socket_path)
+{
+	sockaddr_un s_address;
+	if(make_address(pc_socket_path, &s_address))
+		return -1;
+
+	int i_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(i_fd < 0)
+		return -1;
+	if(connect(i_fd, (sockaddr *)&s_address, sizeof(s_address)))
+	{
+		close(i_fd);
+		return -1;
+	}
+	return i_fd;
+}
+
+void encode_server::run(const char *pc_socket_path)
+{
+	sockaddr_un s_address;
+	if(make_address(pc_socket_path, &s_address))
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Socket path %s too long.\n", __FILE__, __LINE__, pc_socket_path);
+		exit(1);
+	}
+
+	// A socket is left behind by a server that was stopped, anything else is not ours to remove
+	struct stat s_stat;
+	if(lstat(pc_socket_path, &s_stat) == 0)
+	{
+		if(!S_ISSOCK(s_stat.st_mode))
+		{
+			fprintf(stderr, "File %s Line %d: ERROR %s exists and is not a socket.\n", __FILE__, __LINE__, pc_socket_path);
+			exit(1);
+		}
+		unlink(pc_socket_path);
+	}
+	else if(errno != ENOENT)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot check socket path %s.\n", __FILE__, __LINE__, pc_socket_path);
+		exit(1);
+	}
+
+	m_i_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(m_i_listen_fd < 0 || bind(m_i_listen_fd, (sockaddr *)&s_address, sizeof(s_address)) ||
+		listen(m_i_listen_fd, SERVER_BACKLOG))
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot listen on socket %s.\n", __FILE__, __LINE__, pc_socket_path);
+		exit(1);
+	}
+	fprintf(stderr, "Listening on %s\n", pc_socket_path);
+
+	while(1)
+	{
+		int i_fd = accept4(m_i_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if(i_fd < 0)
+		{
+			if(errno != EINTR && errno != ECONNABORTED)
+				fprintf(stderr, "File %s Line %d: WARNING Cannot accept connection.\n", __FILE__, __LINE__);
+			continue;
+		}
+
+		server_connection *ps_connection = new server_connection;	// Freed by its thread
+		ps_connection->pc_server = this;
+		ps_connection->i_fd = i_fd;
+		ps_connection->i_jobs = 0;
+		ps_connection->i_reading = 1;
+		ps_connection->ps_first_reply = NULL;
+		ps_connection->ps_last_reply = NULL;
+		pthread_mutex_init(&ps_connection->t_mutex, NULL);
+		pthread_cond_init(&ps_connection->t_reply_cond, NULL);
+
+		pthread_t t_thread;
+		pthread_attr_t t_attr;
+		pthread_attr_init(&t_attr);
+		pthread_attr_setdetachstate(&t_attr, PTHREAD_CREATE_DETACHED);
+		if(pthread_create(&t_thread, &t_attr, run_connection, ps_connection))
+		{
+			fprintf(stderr, "File %s Line %d: WARNING Cannot create thread.\n", __FILE__, __LINE__);
+			close(i_fd);
+			pthread_mutex_destroy(&ps_connection->t_mutex);
+			pthread_cond_destroy(&ps_connection->t_reply_cond);
+			delete ps_connection;
+		}
+		pthread_attr_destroy(&t_attr);
+	}
+}
+
+void *encode_server::run_connection(void *p_connection)
+{
+	server_connection *ps_connection = (server_connection *)p_connection;
+	char *pc_request = new char[SERVER_MAX_FRAME_BYTES+1];
+	char pc_reply[SERVER_MAX_REPLY_BYTES];
+	int i_index = 0;
+	int i_bytes;
+
+	pthread_t t_send_thread;
+	int i_sending = (pthread_create(&t_send_thread, NULL, send_replies, ps_connection) == 0);
+	if(!i_sending)
+		fprintf(stderr, "File %s Line %d: WARNING Cannot create thread.\n", __FILE__, __LINE__);
+
+	while(i_sending && (i_bytes = recv_frame(ps_connection->i_fd, pc_request, SERVER_MAX_FRAME_BYTES+1)) >= 0)
+	{
+		// Three NUL separated fields, the payload itself is NUL terminated by recv_frame
+		char *pc_end = pc_request + i_bytes;
+		char *pc_wave_file = pc_request + strlen(pc_request) + 1;
+		char *pc_mp3_file = (pc_wave_file < pc_end) ? pc_wave_file + strlen(pc_wave_file) + 1 : pc_end;
+		if(pc_mp3_file >= pc_end || *pc_wave_file == '\0' || *pc_mp3_file == '\0')
+		{
+			snprintf(pc_reply, sizeof(pc_reply), "%d ERROR Malformed request", i_index++);
+			reply(ps_connection, pc_reply);
+			continue;
+		}
+
+		server_job *ps_job = new server_job;	// Freed by the thread doing the job
+		ps_job->ps_connection = ps_connection;
+		ps_job->i_index = i_index++;
+		ps_job->i_quality = atoi(pc_request);
+		ps_job->pc_wave_file = new char[strlen(pc_wave_file)+1];
+		ps_job->pc_mp3_file = new char[strlen(pc_mp3_file)+1];
+		strcpy(ps_job->pc_wave_file, pc_wave_file);
+		strcpy(ps_job->pc_mp3_file, pc_mp3_file);
+
+		// The encoders exit on files they cannot handle, so those are never queued
+		char pc_error[192];
+		if(check_job(ps_job, pc_error, sizeof(pc_error)))
+		{
+			snprintf(pc_reply, sizeof(pc_reply), "%d ERROR %s", ps_job->i_index, pc_error);
+			reply(ps_connection, pc_reply);
+			delete [] ps_job->pc_wave_file;
+			delete [] ps_job->pc_mp3_file;
+			delete ps_job;
+			continue;
+		}
+
+		pthread_mutex_lock(&ps_connection->t_mutex);
+		ps_connection->i_jobs++;
+		pthread_mutex_unlock(&ps_connection->t_mutex);
+		encode_server *pc_server = ps_connection->pc_server;
+		pthread_mutex_lock(&pc_server->m_t_queue_mutex);
+		pc_server->m_pc_thread_queue->add_to_job_queue(encode_job, (void *)ps_job);
+		pthread_mutex_unlock(&pc_server->m_t_queue_mutex);
+	}
+
+	// The client is done sending, but still waits for the answers
+	if(i_sending)
+	{
+		pthread_mutex_lock(&ps_connection->t_mutex);
+		ps_connection->i_reading = 0;
+		pthread_cond_signal(&ps_connection->t_reply_cond);
+		pthread_mutex_unlock(&ps_connection->t_mutex);
+		pthread_join(t_send_thread, NULL);
+	}
+
+	close(ps_connection->i_fd);
+	pthread_mutex_destroy(&ps_connection->t_mutex);
+	pthread_cond_destroy(&ps_connection->t_reply_cond);
+	delete ps_connection;
+	delete [] pc_request;
+	return NULL;
+}
+
+void *encode_server::send_replies(void *p_connection)
+{
+	server_connection *ps_connection = (server_connection *)p_connection;
+	int i_client_gone = 0;
+
+	pthread_mutex_lock(&ps_connection->t_mutex);
+	while(1)
+	{
+		while(ps_connection->ps_first_reply == NULL && (ps_connection->i_reading || ps_connection->i_jobs > 0))
+			pthread_cond_wait(&ps_connection->t_reply_cond, &ps_connection->t_mutex);
+		server_reply *ps_reply = ps_connection->ps_first_reply;
+		if(ps_reply == NULL)
+			break;
+		ps_connection->ps_first_reply = ps_reply->ps_next;
+		if(ps_connection->ps_first_reply == NULL)
+			ps_connection->ps_last_reply = NULL;
+		pthread_mutex_unlock(&ps_connection->t_mutex);
+
+		// The only thread waiting on the client. Once it is gone, the replies are dropped
+		if(!i_client_gone)
+			i_client_gone = send_frame(ps_connection->i_fd, ps_reply->pc_text, strlen(ps_reply->pc_text));
+		delete ps_reply;
+		pthread_mutex_lock(&ps_connection->t_mutex);
+	}
+	pthread_mutex_unlock(&ps_connection->t_mutex);
+	return NULL;
+}
+
+int encode_server::check_job(server_job *ps_job, char *pc_error, int i_error_size)
+{
+	if(ps_job->i_quality < 0 || ps_job->i_quality > 9)
+	{
+		snprintf(pc_error, i_error_size, "Quality %d not in 0 to 9", ps_job->i_quality);
+		return 1;
+	}
+
+	// Only the canonical header, the one the encoder of the files reads (see wave_read). Within
+	// its 44 bytes, read_wave finds the data chunk only if nothing comes before it but fmt.
+	unsigned char pc_header[sizeof(wave_header)];
+	int i_fd = open(ps_job->pc_wave_file, O_RDONLY | O_CLOEXEC);
+	if(i_fd < 0)
+	{
+		snprintf(pc_error, i_error_size, "Cannot open wave file");
+		return 1;
+	}
+	int i_read = pread(i_fd, pc_header, sizeof(wave_header), 0);
+	close(i_fd);
+
+	wav2mp3_format s_format;
+	const unsigned char *pc_pcm;
+	long l_pcm_bytes;
+	if(i_read != (int)sizeof(wave_header) || wav2mp3::read_wave(pc_header, sizeof(wave_header), &s_format, &pc_pcm, &l_pcm_bytes))
+	{
+		snprintf(pc_error, i_error_size, "Not a PCM wave file of 1 or 2 channels and 16, 24 or 32 bits");
+		return 1;
+	}
+
+	// Nothing is created before the encoding starts, so a job failing later leaves no empty file
+	i_fd = open(ps_job->pc_mp3_file, O_WRONLY | O_CLOEXEC);
+	if(i_fd >= 0)
+	{
+		close(i_fd);
+		return 0;
+	}
+	int i_can_create = 0;
+	if(errno == ENOENT)
+	{
+		char *pc_dir = new char[strlen(ps_job->pc_mp3_file)+2];
+		strcpy(pc_dir, ps_job->pc_mp3_file);
+		char *pc_slash = strrchr(pc_dir, '/');
+		if(pc_slash == NULL)
+			strcpy(pc_dir, ".");
+		else
+			pc_slash[pc_slash == pc_dir ? 1 : 0] = 0;	// The root keeps its slash
+		i_can_create = (access(pc_dir, W_OK | X_OK) == 0);
+		delete [] pc_dir;
+	}
+	if(!i_can_create)
+	{
+		snprintf(pc_error, i_error_size, "Cannot open mp3 file to write");
+		return 1;
+	}
+	return 0;
+}
+
+void encode_server::reply(server_connection *ps_connection, const char *pc_reply)
+{
+	server_reply *ps_reply = new server_reply;	// Freed by the thread sending it
+	snprintf(ps_reply->pc_text, SERVER_MAX_REPLY_BYTES, "%s", pc_reply);
+	ps_reply->ps_next = NULL;
+
+	pthread_mutex_lock(&ps_connection->t_mutex);
+	if(ps_connection->ps_last_reply)
+		ps_connection->ps_last_reply->ps_next = ps_reply;
+	else
+		ps_connection->ps_first_reply = ps_reply;
+	ps_connection->ps_last_reply = ps_reply;
+	pthread_cond_signal(&ps_connection->t_reply_cond);
+	pthread_mutex_unlock(&ps_connection->t_mutex);
+}
+
+void *encode_server::encode_job(void *p_job, int i_thread_id)
+{
+	server_job *ps_job = (server_job *)p_job;
+	server_connection *ps_connection = ps_job->ps_connection;
+	wave_to_mp3 *pc_wave2mp3 = ps_connection->pc_server->m_ppc_wave2mp3[i_thread_id];
+	int i_start_ms = get_time_ms();
+
+	// A file failing only fails its request, the server goes on with the others
+	pc_wave2mp3->set_quality(ps_job->i_quality);
+	int i_error = pc_wave2mp3->init(ps_job->pc_wave_file, ps_job->pc_mp3_file);
+	if(i_error == WAVE_TO_MP3_OK)
+		i_error = pc_wave2mp3->encode_wave();
+
+	char pc_reply[64];
+	if(i_error == WAVE_TO_MP3_OK)
+		snprintf(pc_reply, sizeof(pc_reply), "%d OK %d", ps_job->i_index, get_time_ms() - i_start_ms);
+	else
+		snprintf(pc_reply, sizeof(pc_reply), "%d ERROR %s", ps_job->i_index, wave_to_mp3::get_error_text(i_error));
+
+	reply(ps_connection, pc_reply);
+	pthread_mutex_lock(&ps_connection->t_mutex);
+	if(--ps_connection->i_jobs == 0)
+		pthread_cond_signal(&ps_connection->t_reply_cond);
+	pthread_mutex_unlock(&ps_connection->t_mutex);
+
+	delete [] ps_job->pc_wave_file;
+	delete [] ps_job->pc_mp3_file;
+	delete ps_job;
+	return NULL;
+}
@@ -0,0 +1,168 @@
+/**
+* @file job_cost.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the job_cost class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <job_cost.h>
+#include <wav2mp3.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define		DEFAULT_MS_PER_MSAMPLE		2000.0	//!< Cost of a million samples (per channel) of a format not seen yet
+#define		MAX_LEARNED_SAMPLES			1e10	//!< Samples after which the older times are given less weight
+#define		HEADER_READ_BYTES			4096	//!< Bytes read to find the format and the data chunk
+
+job_cost::job_cost()
+{
+	m_i_num_entries = 0;
+	pthread_mutex_init(&m_t_mutex, NULL);
+}
+
+job_cost::~job_cost()
+{
+	pthread_mutex_destroy(&m_t_mutex);
+}
+
+job_cost_entry *job_cost::find(const job_cost_format *ps_format)
+{
+	for(int i=0;i<m_i_num_entries;i++)
+	{
+		job_cost_format *ps_entry_format = &m_s_entries[i].s_format;
+		if(ps_entry_format->i_sample_rate == ps_format->i_sample_rate &&
+			ps_entry_format->i_channels == ps_format->i_channels &&
+			ps_entry_format->i_bits_per_sample == ps_format->i_bits_per_sample)
+			return &m_s_entries[i];
+	}
+	return NULL;
+}
+
+int job_cost::load(const char *pc_cost_file)
+{
+	FILE *f_cost = fopen(pc_cost_file, "r");
+	if(f_cost == NULL)	// Nothing learned yet
+		return 0;
+
+	job_cost_entry s_entry;
+	while(m_i_num_entries < JOB_COST_MAX_FORMATS && fscanf(f_cost, "%d %d %d %lf %lf",
+		&s_entry.s_format.i_sample_rate, &s_entry.s_format.i_channels, &s_entry.s_format.i_bits_per_sample,
+		&s_entry.d_samples, &s_entry.d_time_ms) == 5)
+	{
+		if(s_entry.d_samples > 0 && s_entry.d_time_ms >= 0 && find(&s_entry.s_format) == NULL)
+			m_s_entries[m_i_num_entries++] = s_entry;
+	}
+
+	fclose(f_cost);
+	return 0;
+}
+
+int job_cost::save(const char *pc_cost_file)
+{
+	FILE *f_cost = fopen(pc_cost_file, "w");
+	if(f_cost == NULL)
+	{
+		fprintf(stderr, "File %s Line %d: WARNING Cannot write cost file %s.\n",
+			__FILE__, __LINE__, pc_cost_file);
+		return 1;
+	}
+
+	pthread_mutex_lock(&m_t_mutex);
+	for(int i=0;i<m_i_num_entries;i++)
+		fprintf(f_cost, "%d %d %d %.0f %.0f\n", m_s_entries[i].s_format.i_sample_rate,
+			m_s_entries[i].s_format.i_channels, m_s_entries[i].s_format.i_bits_per_sample,
+			m_s_entries[i].d_samples, m_s_entries[i].d_time_ms);
+	pthread_mutex_unlock(&m_t_mutex);
+
+	fclose(f_cost);
+	return 0;
+}
+
+int job_cost::read_format(const char *pc_wave_file, job_cost_format *ps_format, int *pi_samples)
+{
+	struct stat s_stat;
+	int i_fd = open(pc_wave_file, O_RDONLY | O_CLOEXEC);
+	if(i_fd < 0)
+		return 1;
+	if(fstat(i_fd, &s_stat))
+	{
+		close(i_fd);
+		return 1;
+	}
+
+	// The chunks before the data are small, but for odd files whose estimate is not needed
+	unsigned char pc_header[HEADER_READ_BYTES];
+	ssize_t l_read = pread(i_fd, pc_header, sizeof(pc_header), 0);
+	close(i_fd);
+
+	wav2mp3_format s_format;
+	long l_header_bytes, l_data_size;
+	if(l_read <= 0 || wav2mp3::read_header(pc_header, l_read, &s_format, &l_header_bytes, &l_data_size))
+		return 1;
+
+	ps_format->i_sample_rate = s_format.i_sample_rate;
+	ps_format->i_channels = s_format.i_channels;
+	ps_format->i_bits_per_sample = s_format.i_bits_per_sample;
+
+	// Streamed files may not know their size in the header
+	long l_file_data_size = s_stat.st_size - l_header_bytes;
+	if(l_data_size < 0 || l_data_size > l_file_data_size)
+		l_data_size = l_file_data_size;
+
+	int i_block_align = s_format.i_channels * (s_format.i_bits_per_sample/8);
+	*pi_samples = (int)(l_data_size / i_block_align);
+	return 0;
+}
+
+double job_cost::estimate(const job_cost_format *ps_format, int i_samples)
+{
+	double d_ms_per_sample = DEFAULT_MS_PER_MSAMPLE / 1e6;
+
+	pthread_mutex_lock(&m_t_mutex);
+	job_cost_entry *ps_entry = find(ps_format);
+	if(ps_entry)
+		d_ms_per_sample = ps_entry->d_time_ms / ps_entry->d_samples;
+	else if(m_i_num_entries > 0)
+	{
+		// Scale the average of the formats seen by the channels, which matter most
+		double d_samples = 0, d_time_ms = 0;
+		for(int i=0;i<m_i_num_entries;i++)
+		{
+			d_samples += m_s_entries[i].d_samples * m_s_entries[i].s_format.i_channels;
+			d_time_ms += m_s_entries[i].d_time_ms;
+		}
+		d_ms_per_sample = ps_format->i_channels * d_time_ms / d_samples;
+	}
+	pthread_mutex_unlock(&m_t_mutex);
+
+	return d_ms_per_sample * i_samples;
+}
+
+void job_cost::add_time(const job_cost_format *ps_format, int i_samples, int i_time_ms)
+{
+	if(i_samples <= 0)
+		return;
+
+	pthread_mutex_lock(&m_t_mutex);
+	job_cost_entry *ps_entry = find(ps_format);
+	if(ps_entry == NULL && m_i_num_entries < JOB_COST_MAX_FORMATS)
+	{
+		ps_entry = &m_s_entries[m_i_num_entries++];
+		ps_entry->s_format = *ps_format;
+		ps_entry->d_samples = 0;
+		ps_entry->d_time_ms = 0;
+	}
+	if(ps_entry)
+	{
+		if(ps_entry->d_samples > MAX_LEARNED_SAMPLES)	// Forget slowly, e.g. if the machine changed
+		{
+			ps_entry->d_samples /= 2;
+			ps_entry->d_time_ms /= 2;
+		}
+		ps_entry->d_samples += i_samples;
+		ps_entry->d_time_ms += i_time_ms;
+	}
+	pthread_mutex_unlock(&m_t_mutex);
+}
@@ -0,0 +1,227 @@
+/**
+* @file job_stats.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the job_stats class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <job_stats.h>
+#include <pthread_queue.h>
+#include <cstring>
+#include <algorithm>
+
+#define		RECORDS_RESERVED	1024	//!< Records every thread has room for before its buffer grows
+
+using namespace std;
+
+static const char *g_ppc_stage_names[JOB_STAGES] = {"queue_wait", "read", "encode", "write", "total"};
+
+job_stats::job_stats(pthread_queue *pc_thread_queue, int i_num_threads)
+{
+	m_pc_thread_queue = pc_thread_queue;
+	m_i_num_threads = i_num_threads;
+	m_ppv_records = new vector<job_record>*[i_num_threads];
+	for(int i=0;i<i_num_threads;i++)
+	{
+		m_ppv_records[i] = new vector<job_record>();
+		m_ppv_records[i]->reserve(RECORDS_RESERVED);
+	}
+	m_ll_start_ns = get_time_ns();
+}
+
+job_stats::~job_stats()
+{
+	for(int i=0;i<m_i_num_threads;i++)
+		delete m_ppv_records[i];
+	delete [] m_ppv_records;
+}
+
+void job_stats::clear_record(job_record *ps_record)
+{
+	memset(ps_record, 0, sizeof(job_record));
+
+	// The counts of the thread so far are taken off once the job is added
+	perf_counters::get_thread_totals(&ps_record->s_perf);
+	for(int s=0;s<PERF_STAGES;s++)
+		for(int c=0;c<PERF_COUNTERS;c++)
+			ps_record->s_perf.pll_count[s][c] = -ps_record->s_perf.pll_count[s][c];
+}
+
+void job_stats::add(int i_thread_num, job_record *ps_record)
+{
+	ps_record->pll_stage_ns[JOB_STAGE_WAIT] = m_pc_thread_queue->get_job_wait_ns(i_thread_num);
+	ps_record->i_thread = i_thread_num;
+	perf_totals s_perf;
+	perf_counters::get_thread_totals(&s_perf);
+	for(int s=0;s<PERF_STAGES;s++)
+		for(int c=0;c<PERF_COUNTERS;c++)
+			ps_record->s_perf.pll_count[s][c] += s_perf.pll_count[s][c];
+	m_ppv_records[i_thread_num]->push_back(*ps_record);
+}
+
+void job_stats::get_sorted_times(job_stage e_stage, vector<long long> *pv_times)
+{
+	pv_times->clear();
+	for(int i=0;i<m_i_num_threads;i++)
+		for(size_t j=0;j<m_ppv_records[i]->size();j++)
+			pv_times->push_back((*m_ppv_records[i])[j].pll_stage_ns[e_stage]);
+	sort(pv_times->begin(), pv_times->end());
+}
+
+/**
+*	Get a percentile of sorted times, by the nearest rank.
+*/
+static double get_percentile_ms(const vector<long long> &v_times, int i_percent)
+{
+	if(v_times.empty())
+		return 0;
+	size_t l_rank = (v_times.size() * i_percent + 99) / 100;
+	return v_times[l_rank > 0 ? l_rank-1 : 0] / 1e6;
+}
+
+void job_stats::write_json(FILE *f_report)
+{
+	long l_jobs = 0, l_bytes_in = 0, l_bytes_out = 0;
+	double d_audio_seconds = 0;
+	for(int i=0;i<m_i_num_threads;i++)
+	{
+		for(size_t j=0;j<m_ppv_records[i]->size();j++)
+		{
+			job_record *ps_record = &(*m_ppv_records[i])[j];
+			l_jobs++;
+			l_bytes_in += ps_record->l_bytes_in;
+			l_bytes_out += ps_record->l_bytes_out;
+			d_audio_seconds += ps_record->d_audio_seconds;
+		}
+	}
+
+	fprintf(f_report, "{\n  \"jobs\": %ld,\n  \"threads\": %d,\n  \"wall_seconds\": %.3f,\n  \"audio_seconds\": %.3f,\n"
+		"  \"bytes_in\": %ld,\n  \"bytes_out\": %ld,\n  \"stages\": {", l_jobs, m_i_num_threads,
+		(get_time_ns() - m_ll_start_ns) / 1e9, d_audio_seconds, l_bytes_in, l_bytes_out);
+
+	vector<long long> v_times;
+	for(int s=0;s<JOB_STAGES;s++)
+	{
+		get_sorted_times((job_stage)s, &v_times);
+		long long ll_total_ns = 0;
+		int pi_buckets[JOB_STATS_BUCKETS] = {0};
+		for(size_t j=0;j<v_times.size();j++)
+		{
+			ll_total_ns += v_times[j];
+			int b = 0;
+			for(long long ll_us = v_times[j] / 1000; ll_us > 1 && b < JOB_STATS_BUCKETS-1; ll_us >>= 1)
+				b++;
+			pi_buckets[b]++;
+		}
+
+		fprintf(f_report, "%s\n    \"%s\": {\"total_ms\": %.3f, \"mean_ms\": %.3f, \"p50_ms\": %.3f, \"p95_ms\": %.3f, "
+			"\"p99_ms\": %.3f, \"max_ms\": %.3f,\n      \"histogram\": [", s ? "," : "", g_ppc_stage_names[s], ll_total_ns / 1e6,
+			v_times.empty() ? 0 : ll_total_ns / 1e6 / v_times.size(), get_percentile_ms(v_times, 50),
+			get_percentile_ms(v_times, 95), get_percentile_ms(v_times, 99), v_times.empty() ? 0 : v_times.back() / 1e6);
+		int i_printed = 0;
+		for(int b=0;b<JOB_STATS_BUCKETS;b++)
+		{
+			if(pi_buckets[b] == 0)
+				continue;
+			fprintf(f_report, "%s{\"from_us\": %lld, \"jobs\": %d}", i_printed ? ", " : "", b ? 1LL << b : 0LL, pi_buckets[b]);
+			i_printed++;
+		}
+		fprintf(f_report, "]}");
+	}
+	fprintf(f_report, "\n  }");
+
+	if(perf_counters::is_on())
+	{
+		perf_totals s_perf;
+		memset(&s_perf, 0, sizeof(perf_totals));
+		for(int i=0;i<m_i_num_threads;i++)
+			for(size_t j=0;j<m_ppv_records[i]->size();j++)
+				for(int s=0;s<PERF_STAGES;s++)
+					for(int c=0;c<PERF_COUNTERS;c++)
+						s_perf.pll_count[s][c] += (*m_ppv_records[i])[j].s_perf.pll_count[s][c];
+
+		fprintf(f_report, ",\n  \"counters\": {");
+		for(int s=0;s<PERF_STAGES;s++)
+		{
+			fprintf(f_report, "%s\n    \"%s\": {", s ? "," : "", perf_counters::get_stage_name((perf_stage)s));
+			for(int c=0;c<PERF_COUNTERS;c++)
+			{
+				if(perf_counters::is_available((perf_counter)c))
+					fprintf(f_report, "\"%s\": %lld, ", perf_counters::get_counter_name((perf_counter)c), s_perf.pll_count[s][c]);
+				else
+					fprintf(f_report, "\"%s\": null, ", perf_counters::get_counter_name((perf_counter)c));
+			}
+			long long ll_cycles = s_perf.pll_count[s][PERF_CYCLES];
+			if(perf_counters::is_available(PERF_INSTRUCTIONS) && ll_cycles > 0)
+				fprintf(f_report, "\"ipc\": %.3f}", (double)s_perf.pll_count[s][PERF_INSTRUCTIONS] / ll_cycles);
+			else
+				fprintf(f_report, "\"ipc\": null}");
+		}
+		fprintf(f_report, "\n  }");
+	}
+	fprintf(f_report, "\n}\n");
+}
+
+void job_stats::write_csv(FILE *f_report)
+{
+	fprintf(f_report, "thread,queue_wait_ms,read_ms,encode_ms,write_ms,total_ms,bytes_in,bytes_out,audio_seconds");
+	if(perf_counters::is_on())	// e.g. convert_cycles
+		for(int s=0;s<PERF_STAGES;s++)
+			for(int c=0;c<PERF_COUNTERS;c++)
+				fprintf(f_report, ",%s_%s", perf_counters::get_stage_name((perf_stage)s), perf_counters::get_counter_name((perf_counter)c));
+	fprintf(f_report, "\n");
+	for(int i=0;i<m_i_num_threads;i++)
+	{
+		for(size_t j=0;j<m_ppv_records[i]->size();j++)
+		{
+			job_record *ps_record = &(*m_ppv_records[i])[j];
+			fprintf(f_report, "%d", ps_record->i_thread);
+			for(int s=0;s<JOB_STAGES;s++)
+				fprintf(f_report, ",%.3f", ps_record->pll_stage_ns[s] / 1e6);
+			fprintf(f_report, ",%ld,%ld,%.3f", ps_record->l_bytes_in, ps_record->l_bytes_out, ps_record->d_audio_seconds);
+			if(perf_counters::is_on())
+				for(int s=0;s<PERF_STAGES;s++)
+					for(int c=0;c<PERF_COUNTERS;c++)
+					{
+						if(perf_counters::is_available((perf_counter)c))
+							fprintf(f_report, ",%lld", ps_record->s_perf.pll_count[s][c]);
+						else
+							fprintf(f_report, ",");
+					}
+			fprintf(f_report, "\n");
+		}
+	}
+}
+
+int job_stats::write_report(const char *pc_report_file)
+{
+	// Where the time of the threads went
+	long long pll_stage_ns[JOB_STAGES] = {0};
+	long l_jobs = 0;
+	for(int i=0;i<m_i_num_threads;i++)
+	{
+		for(size_t j=0;j<m_ppv_records[i]->size();j++)
+		{
+			for(int s=0;s<JOB_STAGES;s++)
+				pll_stage_ns[s] += (*m_ppv_records[i])[j].pll_stage_ns[s];
+			l_jobs++;
+		}
+	}
+	double d_total_ns = pll_stage_ns[JOB_STAGE_TOTAL] > 0 ? (double)pll_stage_ns[JOB_STAGE_TOTAL] : 1;
+	fprintf(stderr, "Jobs timed: %ld, time spent reading %.1f%%, encoding %.1f%%, writing %.1f%%\n", l_jobs,
+		100 * pll_stage_ns[JOB_STAGE_READ] / d_total_ns, 100 * pll_stage_ns[JOB_STAGE_ENCODE] / d_total_ns,
+		100 * pll_stage_ns[JOB_STAGE_WRITE] / d_total_ns);
+
+	FILE *f_report = fopen(pc_report_file, "w");
+	if(f_report == NULL)
+	{
+		fprintf(stderr, "File %s Line %d: WARNING Cannot write report file %s.\n", __FILE__, __LINE__, pc_report_file);
+		return 1;
+	}
+	int i_len = strlen(pc_report_file);
+	if(i_len >= 4 && strcmp(pc_report_file + i_len - 4, ".csv") == 0)
+		write_csv(f_report);
+	else
+		write_json(f_report);
+	return fclose(f_report) ? 1 : 0;
+}
@@ -0,0 +1,167 @@
+/**
+* @file lame_pool.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the lame_pool class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <lame_pool.h>
+#include <stdio.h>
+#include <cstdlib>
+
+#define		PAD_CHUNK_SAMPLES		1152	//!< Samples of silence handed to lame at once when padding
+
+lame_pool::lame_pool(int i_max_idle)
+{
+	m_i_max_idle = i_max_idle < 0 ? 0 : i_max_idle;
+}
+
+lame_pool::~lame_pool()
+{
+	for(size_t i=0;i<m_dq_idle.size();i++)
+		lame_close(m_dq_idle[i].lame);
+	for(size_t i=0;i<m_dq_busy.size();i++)
+		lame_close(m_dq_busy[i].lame);
+}
+
+static bool is_same_key(const lame_pool_key *ps_key1, const lame_pool_key *ps_key2)
+{
+	return ps_key1->i_sample_rate == ps_key2->i_sample_rate && ps_key1->i_channels == ps_key2->i_channels &&
+		ps_key1->i_quality == ps_key2->i_quality && ps_key1->i_segment == ps_key2->i_segment;
+}
+
+lame_t lame_pool::create(const lame_pool_key *ps_key)
+{
+	lame_t lame = lame_init();
+	if(lame == NULL)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot allocate lame encoder.\n", __FILE__,  __LINE__);
+		return NULL;
+	}
+	lame_set_in_samplerate(lame, ps_key->i_sample_rate);
+	lame_set_num_channels(lame, ps_key->i_channels);
+	lame_set_VBR(lame, vbr_default);
+	lame_set_VBR_q(lame, ps_key->i_quality);
+	if(ps_key->i_segment)
+	{
+		lame_set_out_samplerate(lame, ps_key->i_sample_rate);	// Frames must map to the same samples
+		lame_set_disable_reservoir(lame, 1);	// Every frame is self contained
+		lame_set_bWriteVbrTag(lame, 0);			// No tag frame in front of the segment
+	}
+
+	if(lame_init_params(lame) < 0)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot initialize lame encoder for %d Hz and %d channels.\n", 
+			__FILE__,  __LINE__, ps_key->i_sample_rate, ps_key->i_channels);
+		lame_close(lame);
+		return NULL;
+	}
+	return lame;
+}
+
+lame_t lame_pool::get(const lame_pool_key *ps_key)
+{
+	lame_pool_entry s_entry;
+	s_entry.s_key = *ps_key;
+	s_entry.lame = NULL;
+
+	// The last used first, it is the most likely to match the next file again
+	for(int i=(int)m_dq_idle.size()-1;i>=0;i--)
+	{
+		if(is_same_key(&m_dq_idle[i].s_key, ps_key))
+		{
+			s_entry.lame = m_dq_idle[i].lame;
+			m_dq_idle.erase(m_dq_idle.begin() + i);
+			lame_init_bitstream(s_entry.lame);
+			break;
+		}
+	}
+	if(s_entry.lame == NULL && (s_entry.lame = create(ps_key)) == NULL)
+		return NULL;
+
+	m_dq_busy.push_back(s_entry);
+	return s_entry.lame;
+}
+
+lame_pool_entry lame_pool::take_busy(lame_t lame)
+{
+	for(size_t i=0;i<m_dq_busy.size();i++)
+	{
+		if(m_dq_busy[i].lame == lame)
+		{
+			lame_pool_entry s_entry = m_dq_busy[i];
+			m_dq_busy.erase(m_dq_busy.begin() + i);
+			return s_entry;
+		}
+	}
+
+	fprintf(stderr, "File %s Line %d: ERROR Encoder not from this pool.\n", __FILE__,  __LINE__);
+	exit(1);
+}
+
+int lame_pool::finish(lame_t lame, unsigned char *pc_mp3_buffer, int i_mp3_buffer_size)
+{
+	lame_pool_entry s_entry = take_busy(lame);
+	if(m_i_max_idle == 0 || s_entry.s_key.i_segment)
+	{
+		int i_mp3_bytes = lame_encode_flush(lame, pc_mp3_buffer, i_mp3_buffer_size);
+		if(i_mp3_bytes < 0)
+			fprintf(stderr, "File %s Line %d: ERROR lame flushing failed with %d.\n",
+				__FILE__,  __LINE__, i_mp3_bytes);
+		lame_close(lame);
+		return i_mp3_bytes;
+	}
+
+	// Silence behind the last samples, so that they are all encoded into complete frames. What is
+	// left in the encoder is silence, which leads the next file like for a new encoder.
+	static const short pi_silence[PAD_CHUNK_SAMPLES] = {0};
+	int i_pad_samples = lame_get_mf_samples_to_encode(lame) + 2 * lame_get_framesize(lame);
+	int i_mp3_bytes = 0;
+	while(i_pad_samples > 0)
+	{
+		int i_samples = i_pad_samples < PAD_CHUNK_SAMPLES ? i_pad_samples : PAD_CHUNK_SAMPLES;
+		int i_write_bytes = lame_encode_buffer(lame, pi_silence, pi_silence, i_samples,
+			pc_mp3_buffer + i_mp3_bytes, i_mp3_buffer_size - i_mp3_bytes);
+		if(i_write_bytes < 0)
+		{
+			fprintf(stderr, "File %s Line %d: ERROR lame encoding failed with %d.\n",
+				__FILE__,  __LINE__, i_write_bytes);
+			lame_close(lame);	// Not fit to be reused
+			return i_write_bytes;
+		}
+		i_mp3_bytes += i_write_bytes;
+		i_pad_samples -= i_samples;
+	}
+	int i_flush_bytes = lame_encode_flush_nogap(lame, pc_mp3_buffer + i_mp3_bytes, i_mp3_buffer_size - i_mp3_bytes);
+	if(i_flush_bytes < 0)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR lame flushing failed with %d.\n",
+			__FILE__,  __LINE__, i_flush_bytes);
+		lame_close(lame);
+		return i_flush_bytes;
+	}
+	i_mp3_bytes += i_flush_bytes;
+
+	if((int)m_dq_idle.size() >= m_i_max_idle)	// The least recently used goes
+	{
+		lame_close(m_dq_idle.front().lame);
+		m_dq_idle.pop_front();
+	}
+	m_dq_idle.push_back(s_entry);
+	return i_mp3_bytes;
+}
+
+void lame_pool::release(lame_t lame)
+{
+	lame_close(take_busy(lame).lame);
+}
+
+void lame_pool::set_max_idle(int i_max_idle)
+{
+	m_i_max_idle = i_max_idle < 0 ? 0 : i_max_idle;
+	while((int)m_dq_idle.size() > m_i_max_idle)
+	{
+		lame_close(m_dq_idle.front().lame);
+		m_dq_idle.pop_front();
+	}
+}
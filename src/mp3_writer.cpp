@@ -0,0 +1,213 @@
+/**
+* @file mp3_writer.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the mp3_writer class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <mp3_writer.h>
+#include <trace_log.h>
+#include <stdio.h>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+mp3_writer::mp3_writer()
+{
+	m_i_fd = -1;
+	m_i_direct_io = 0;
+	m_i_direct = 0;
+	m_pc_async_io = NULL;
+	for(int i=0;i<MP3_WRITER_BUFFERS;i++)
+	{
+		m_ppc_buffer[i] = NULL;
+		m_pi_request[i] = -1;
+		m_pi_request_bytes[i] = 0;
+	}
+	m_i_buffer = 0;
+	m_i_fill = 0;
+	m_l_offset = 0;
+	m_i_write_error = 0;
+	m_pc_file = NULL;
+}
+
+int mp3_writer::open_file(const char *pc_mp3_file, long l_estimated_bytes)
+{
+	close_file();
+
+	for(int i=0;i<MP3_WRITER_BUFFERS;i++)
+	{
+		if(m_ppc_buffer[i] == NULL && posix_memalign((void **)&m_ppc_buffer[i], MP3_WRITER_ALIGN, MP3_WRITER_CHUNK_BYTES))
+		{
+			fprintf(stderr, "File %s Line %d: ERROR Cannot allocate %d bytes.\n", __FILE__, __LINE__, MP3_WRITER_CHUNK_BYTES);
+			m_ppc_buffer[i] = NULL;
+			return 1;
+		}
+	}
+
+	unlink_shared(pc_mp3_file);
+	int i_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	m_i_direct = 0;
+	if(m_i_direct_io)
+	{
+		m_i_fd = open(pc_mp3_file, i_flags | O_DIRECT, 0666);
+		m_i_direct = (m_i_fd >= 0);
+	}
+	if(m_i_fd < 0 && (m_i_fd = open(pc_mp3_file, i_flags, 0666)) < 0)	// Also if O_DIRECT is not supported
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot open mp3 file %s to write.\n", __FILE__, __LINE__, pc_mp3_file);
+		return 1;
+	}
+
+	// Only a hint, the file grows as it is written if the file system cannot preallocate it
+	if(l_estimated_bytes > 0)
+		fallocate(m_i_fd, 0, 0, l_estimated_bytes);
+
+	m_i_buffer = 0;
+	m_i_fill = 0;
+	m_l_offset = 0;
+	m_i_write_error = 0;
+	m_pc_file = strdup(pc_mp3_file);
+	return 0;
+}
+
+void mp3_writer::write_buffer(int i_buffer, int i_bytes, long l_offset)
+{
+	if(m_i_write_error)	// The file is incomplete anyway
+		return;
+
+	long long ll_trace_ns = trace_log::begin();
+	if(m_pc_async_io)
+	{
+		m_pi_request[i_buffer] = m_pc_async_io->submit(ASYNC_IO_WRITE, m_i_fd, m_ppc_buffer[i_buffer], i_bytes, l_offset);
+		m_pi_request_bytes[i_buffer] = i_bytes;
+		trace_log::end("write_submit", ll_trace_ns, i_bytes);
+		return;
+	}
+
+	for(int i_written = 0; i_written < i_bytes;)
+	{
+		ssize_t l_ret = pwrite(m_i_fd, m_ppc_buffer[i_buffer] + i_written, i_bytes - i_written, l_offset + i_written);
+		if(l_ret < 0 && errno == EINTR)
+			continue;
+		if(l_ret <= 0)
+		{
+			fprintf(stderr, "File %s Line %d: ERROR Cannot write mp3 file %s.\n", __FILE__, __LINE__, m_pc_file);
+			m_i_write_error = 1;
+			return;
+		}
+		i_written += l_ret;
+	}
+	trace_log::end("write", ll_trace_ns, i_bytes);
+}
+
+void mp3_writer::wait_buffer(int i_buffer)
+{
+	if(m_pi_request[i_buffer] < 0)
+		return;
+
+	long long ll_trace_ns = trace_log::begin();
+	if(m_pc_async_io->wait(m_pi_request[i_buffer]) != m_pi_request_bytes[i_buffer] && !m_i_write_error)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot write mp3 file %s.\n", __FILE__, __LINE__, m_pc_file);
+		m_i_write_error = 1;
+	}
+	trace_log::end("write_wait", ll_trace_ns);
+	m_pi_request[i_buffer] = -1;
+}
+
+void mp3_writer::flush()
+{
+	int i_aligned = m_i_fill / MP3_WRITER_ALIGN * MP3_WRITER_ALIGN;
+	int i_next = (m_i_buffer + 1) % MP3_WRITER_BUFFERS;
+
+	// The next buffer must be written before it is filled again
+	wait_buffer(i_next);
+	memcpy(m_ppc_buffer[i_next], m_ppc_buffer[m_i_buffer] + i_aligned, m_i_fill - i_aligned);
+	if(i_aligned > 0)
+		write_buffer(m_i_buffer, i_aligned, m_l_offset);
+
+	m_l_offset += i_aligned;
+	m_i_fill -= i_aligned;
+	m_i_buffer = i_next;
+}
+
+unsigned char *mp3_writer::get_space(int i_bytes)
+{
+	if(i_bytes > MP3_WRITER_CHUNK_BYTES - MP3_WRITER_ALIGN)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR %d bytes of mp3 data more than a buffer takes.\n",
+			__FILE__, __LINE__, i_bytes);
+		exit(1);
+	}
+
+	if(m_i_fill + i_bytes > MP3_WRITER_CHUNK_BYTES)
+		flush();
+	return m_ppc_buffer[m_i_buffer] + m_i_fill;
+}
+
+void mp3_writer::write(const unsigned char *pc_data, int i_bytes)
+{
+	while(i_bytes > 0)
+	{
+		int i_copy = i_bytes < MP3_WRITER_CHUNK_BYTES - MP3_WRITER_ALIGN ? i_bytes : MP3_WRITER_CHUNK_BYTES - MP3_WRITER_ALIGN;
+		memcpy(get_space(i_copy), pc_data, i_copy);
+		add_bytes(i_copy);
+		pc_data += i_copy;
+		i_bytes -= i_copy;
+	}
+}
+
+int mp3_writer::close_file()
+{
+	if(m_i_fd < 0)
+		return 0;
+
+	// O_DIRECT writes whole blocks, so the last one is padded too. The truncation cuts off the
+	// padding, as well as what is left of the preallocated space.
+	long l_size = m_l_offset + m_i_fill;
+	int i_bytes = m_i_fill;
+	if(m_i_direct)
+	{
+		i_bytes = (m_i_fill + MP3_WRITER_ALIGN - 1) / MP3_WRITER_ALIGN * MP3_WRITER_ALIGN;
+		memset(m_ppc_buffer[m_i_buffer] + m_i_fill, 0, i_bytes - m_i_fill);
+	}
+	if(i_bytes > 0)
+		write_buffer(m_i_buffer, i_bytes, m_l_offset);
+	for(int i=0;i<MP3_WRITER_BUFFERS;i++)
+		wait_buffer(i);
+
+	if(ftruncate(m_i_fd, l_size))
+		fprintf(stderr, "File %s Line %d: WARNING Cannot truncate mp3 file to %ld bytes.\n", __FILE__, __LINE__, l_size);
+	if(close(m_i_fd))
+		fprintf(stderr, "File %s Line %d: WARNING Cannot close mp3 file.\n", __FILE__, __LINE__);
+	m_i_fd = -1;
+	if(m_i_write_error && unlink(m_pc_file))	// Not left behind looking like a complete file
+		fprintf(stderr, "File %s Line %d: WARNING Cannot remove mp3 file %s.\n", __FILE__, __LINE__, m_pc_file);
+	free(m_pc_file);
+	m_pc_file = NULL;
+	return m_i_write_error;
+}
+
+void mp3_writer::discard_file()
+{
+	m_i_write_error = 1;	// Nothing more is written, and the file is removed
+	close_file();
+}
+
+mp3_writer::~mp3_writer()
+{
+	close_file();
+	for(int i=0;i<MP3_WRITER_BUFFERS;i++)
+		free(m_ppc_buffer[i]);
+}
+
+void mp3_writer::unlink_shared(const char *pc_mp3_file)
+{
+	struct stat s_stat;
+	if(lstat(pc_mp3_file, &s_stat) == 0 && S_ISREG(s_stat.st_mode) && s_stat.st_nlink > 1)
+		unlink(pc_mp3_file);
+}
@@ -0,0 +1,327 @@
+/**
+* @file pcm_convert.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief Convert interleaved PCM bytes to per channel sample arrays.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <pcm_convert.h>
+#include <cstring>
+#include <cstddef>
+
+#if defined __x86_64__ || defined __i386__
+#define		PCM_CONVERT_X86		//!< Build the SSE2 and AVX2 kernels
+#include <immintrin.h>
+#endif
+
+//*********************
+// Scalar reference
+
+/**
+*	Scalar kernel, specialized at compile time for the input format and output type.
+*/
+template <int BYTES, int CHANNELS, typename T>
+static void convert_scalar(const unsigned char *pc_src, void **ppv_dst, int i_samples)
+{
+	for(int i=0;i<i_samples;i++)
+	{
+		for(int j=0;j<CHANNELS;j++)
+		{
+			unsigned int i_tmp = 0;
+			for(int k=0;k<BYTES;k++)
+				i_tmp |= (unsigned int)pc_src[k] << (8*k + 32 - 8*BYTES);	// Left justify to 32 bits
+			((T *)ppv_dst[j])[i] = (T)((int)i_tmp >> (32 - 8*sizeof(T)));
+			pc_src += BYTES;
+		}
+	}
+}
+
+/**
+*	Convert the samples the vector loop left over with the scalar reference.
+*/
+template <int BYTES, int CHANNELS, typename T>
+static void convert_tail(const unsigned char *pc_src, void **ppv_dst, int i_done, int i_samples)
+{
+	if(i_done >= i_samples)
+		return;
+
+	void *ppv_tail[CHANNELS];
+	for(int j=0;j<CHANNELS;j++)
+		ppv_tail[j] = (T *)ppv_dst[j] + i_done;
+
+	convert_scalar<BYTES, CHANNELS, T>(pc_src + (ptrdiff_t)i_done*BYTES*CHANNELS, ppv_tail, i_samples-i_done);
+}
+
+/**
+*	Same width in and out with a single channel is a plain copy.
+*/
+template <int BYTES>
+static void convert_copy(const unsigned char *pc_src, void **ppv_dst, int i_samples)
+{
+	memcpy(ppv_dst[0], pc_src, (size_t)i_samples*BYTES);
+}
+
+#ifdef PCM_CONVERT_X86
+
+//*********************
+// SSE2
+
+static void convert_sse2_s16_stereo_short(const unsigned char *pc_src, void **ppv_dst, int i_samples)
+{
+	short *pi_left = (short *)ppv_dst[0];
+	short *pi_right = (short *)ppv_dst[1];
+	int i=0;
+	for(;i+8<=i_samples;i+=8)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)(pc_src + 4*i));		// L0 R0 .. L3 R3
+		__m128i b = _mm_loadu_si128((const __m128i *)(pc_src + 4*i + 16));	// L4 R4 .. L7 R7
+		__m128i la = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+		__m128i lb = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+		__m128i ra = _mm_srai_epi32(a, 16);
+		__m128i rb = _mm_srai_epi32(b, 16);
+		_mm_storeu_si128((__m128i *)(pi_left + i), _mm_packs_epi32(la, lb));
+		_mm_storeu_si128((__m128i *)(pi_right + i), _mm_packs_epi32(ra, rb));
+	}
+	convert_tail<2, 2, short>(pc_src, ppv_dst, i, i_samples);
+}
+
+static void convert_sse2_s16_stereo_int(const unsigned char *pc_src, void **ppv_dst, int i_samples)
+{
+	int *pi_left = (int *)ppv_dst[0];
+	int *pi_right = (int *)ppv_dst[1];
+	const __m128i mask = _mm_set1_epi32((int)0xFFFF0000);
+	int i=0;
+	for(;i+4<=i_samples;i+=4)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)(pc_src + 4*i));		// L0 R0 .. L3 R3
+		_mm_storeu_si128((__m128i *)(pi_left + i), _mm_slli_epi32(a, 16));
+		_mm_storeu_si128((__m128i *)(pi_right + i), _mm_and_si128(a, mask));
+	}
+	convert_tail<2, 2, int>(pc_src, ppv_dst, i, i_samples);
+}
+
+static void convert_sse2_s16_mono_int(const unsigned char *pc_src, void **ppv_dst, int i_samples)
+{
+	int *pi_out = (int *)ppv_dst[0];
+	const __m128i zero = _mm_setzero_si128();
+	int i=0;
+	for(;i+8<=i_samples;i+=8)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)(pc_src + 2*i));
+		_mm_storeu_si128((__m128i *)(pi_out + i), _mm_unpacklo_epi16(zero, a));
+		_mm_storeu_si128((__m128i *)(pi_out + i + 4), _mm_unpackhi_epi16(zero, a));
+	}
+	convert_tail<2, 1, int>(pc_src, ppv_dst, i, i_samples);
+}
+
+static void convert_sse2_s32_stereo_int(const unsigned char *pc_src, void **ppv_dst, int i_samples)
+{
+	int *pi_left = (int *)ppv_dst[0];
+	int *pi_right = (int *)ppv_dst[1];
+	int i=0;
+	for(;i+4<=i_samples;i+=4)
+	{
+		__m128 a = _mm_loadu_ps((const float *)(pc_src + 8*i));		// L0 R0 L1 R1
+		__m128 b = _mm_loadu_ps((const float *)(pc_src + 8*i + 16));	// L2 R2 L3 R3
+		_mm_storeu_ps((float *)(pi_left + i), _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0)));
+		_mm_storeu_ps((float *)(pi_right + i), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1)));
+	}
+	convert_tail<4, 2, int>(pc_src, ppv_dst, i, i_samples);
+}
+
+//*********************
+// AVX2
+
+__attribute__((target("avx2")))
+static void convert_avx2_s16_stereo_short(const unsigned char *pc_src, void **ppv_dst, int i_samples)
+{
+	short *pi_left = (short *)ppv_dst[0];
+	short *pi_right = (short *)ppv_dst[1];
+	int i=0;
+	for(;i+16<=i_samples;i+=16)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i *)(pc_src + 4*i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(pc_src + 4*i + 32));
+		__m256i la = _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16);
+		__m256i lb = _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16);
+		__m256i ra = _mm256_srai_epi32(a, 16);
+		__m256i rb = _mm256_srai_epi32(b, 16);
+		// Packing works per 128 bit lane, so put the 64 bit quarters back in order
+		_mm256_storeu_si256((__m256i *)(pi_left + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(la, lb), 0xD8));
+		_mm256_storeu_si256((__m256i *)(pi_right + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(ra, rb), 0xD8));
+	}
+	convert_tail<2, 2, short>(pc_src, ppv_dst, i, i_samples);
+}
+
+__attribute__((target("avx2")))
+static void convert_avx2_s16_stereo_int(const unsigned char *pc_src, void **ppv_dst, int i_samples)
+{
+	int *pi_left = (int *)ppv_dst[0];
+	int *pi_right = (int *)ppv_dst[1];
+	const __m256i mask = _mm256_set1_epi32((int)0xFFFF0000);
+	int i=0;
+	for(;i+8<=i_samples;i+=8)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i *)(pc_src + 4*i));
+		_mm256_storeu_si256((__m256i *)(pi_left + i), _mm256_slli_epi32(a, 16));
+		_mm256_storeu_si256((__m256i *)(pi_right + i), _mm256_and_si256(a, mask));
+	}
+	convert_tail<2, 2, int>(pc_src, ppv_dst, i, i_samples);
+}
+
+__attribute__((target("avx2")))
+static void convert_avx2_s16_mono_int(const unsigned char *pc_src, void **ppv_dst, int i_samples)
+{
+	int *pi_out = (int *)ppv_dst[0];
+	int i=0;
+	for(;i+8<=i_samples;i+=8)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)(pc_src + 2*i));
+		_mm256_storeu_si256((__m256i *)(pi_out + i), _mm256_slli_epi32(_mm256_cvtepi16_epi32(a), 16));
+	}
+	convert_tail<2, 1, int>(pc_src, ppv_dst, i, i_samples);
+}
+
+__attribute__((target("avx2")))
+static void convert_avx2_s24_stereo_int(const unsigned char *pc_src, void **ppv_dst, int i_samples)
+{
+	int *pi_left = (int *)ppv_dst[0];
+	int *pi_right = (int *)ppv_dst[1];
+	// Move every 3 byte sample to the upper 3 bytes of a 32 bit lane: L0 R0 L1 R1 in each 128 bit lane
+	const __m256i shuffle = _mm256_setr_epi8(
+		-1,0,1,2, -1,3,4,5, -1,6,7,8, -1,9,10,11,
+		-1,0,1,2, -1,3,4,5, -1,6,7,8, -1,9,10,11);
+	int i=0;
+	// Every iteration reads 28 bytes and uses 24 of them, so stop a sample early
+	for(;i+5<=i_samples;i+=4)
+	{
+		__m128i lo = _mm_loadu_si128((const __m128i *)(pc_src + 6*i));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(pc_src + 6*i + 12));
+		__m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+		a = _mm256_shuffle_epi8(a, shuffle);
+		a = _mm256_shuffle_epi32(a, _MM_SHUFFLE(3,1,2,0));		// L0 L1 R0 R1 | L2 L3 R2 R3
+		a = _mm256_permute4x64_epi64(a, 0xD8);				// L0 L1 L2 L3 | R0 R1 R2 R3
+		_mm_storeu_si128((__m128i *)(pi_left + i), _mm256_castsi256_si128(a));
+		_mm_storeu_si128((__m128i *)(pi_right + i), _mm256_extracti128_si256(a, 1));
+	}
+	convert_tail<3, 2, int>(pc_src, ppv_dst, i, i_samples);
+}
+
+__attribute__((target("avx2")))
+static void convert_avx2_s24_mono_int(const unsigned char *pc_src, void **ppv_dst, int i_samples)
+{
+	int *pi_out = (int *)ppv_dst[0];
+	const __m256i shuffle = _mm256_setr_epi8(
+		-1,0,1,2, -1,3,4,5, -1,6,7,8, -1,9,10,11,
+		-1,0,1,2, -1,3,4,5, -1,6,7,8, -1,9,10,11);
+	int i=0;
+	// Every iteration reads 28 bytes and uses 24 of them, so stop two samples early
+	for(;i+10<=i_samples;i+=8)
+	{
+		__m128i lo = _mm_loadu_si128((const __m128i *)(pc_src + 3*i));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(pc_src + 3*i + 12));
+		__m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+		_mm256_storeu_si256((__m256i *)(pi_out + i), _mm256_shuffle_epi8(a, shuffle));
+	}
+	convert_tail<3, 1, int>(pc_src, ppv_dst, i, i_samples);
+}
+
+__attribute__((target("avx2")))
+static void convert_avx2_s32_stereo_int(const unsigned char *pc_src, void **ppv_dst, int i_samples)
+{
+	int *pi_left = (int *)ppv_dst[0];
+	int *pi_right = (int *)ppv_dst[1];
+	int i=0;
+	for(;i+8<=i_samples;i+=8)
+	{
+		__m256 a = _mm256_loadu_ps((const float *)(pc_src + 8*i));		// L0 R0 .. L3 R3
+		__m256 b = _mm256_loadu_ps((const float *)(pc_src + 8*i + 32));	// L4 R4 .. L7 R7
+		__m256i l = _mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0)));
+		__m256i r = _mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1)));
+		_mm256_storeu_si256((__m256i *)(pi_left + i), _mm256_permute4x64_epi64(l, 0xD8));
+		_mm256_storeu_si256((__m256i *)(pi_right + i), _mm256_permute4x64_epi64(r, 0xD8));
+	}
+	convert_tail<4, 2, int>(pc_src, ppv_dst, i, i_samples);
+}
+
+#endif	// PCM_CONVERT_X86
+
+//*********************
+// Dispatch
+
+/**
+*	Kernels indexed by [instruction set][bytes per sample - 2][channels - 1][0: short, 1: int].
+*	NULL entries fall back to the next lower instruction set.
+*/
+static const pcm_convert_func s_p_kernels[PCM_ISA_COUNT][3][2][2] =
+{
+	{	// Scalar
+		{{convert_scalar<2,1,short>, convert_scalar<2,1,int>}, {convert_scalar<2,2,short>, convert_scalar<2,2,int>}},
+		{{convert_scalar<3,1,short>, convert_scalar<3,1,int>}, {convert_scalar<3,2,short>, convert_scalar<3,2,int>}},
+		{{convert_scalar<4,1,short>, convert_scalar<4,1,int>}, {convert_scalar<4,2,short>, convert_scalar<4,2,int>}}
+	},
+#ifdef PCM_CONVERT_X86
+	{	// SSE2
+		{{convert_copy<2>, convert_sse2_s16_mono_int}, {convert_sse2_s16_stereo_short, convert_sse2_s16_stereo_int}},
+		{{NULL, NULL}, {NULL, NULL}},
+		{{NULL, convert_copy<4>}, {NULL, convert_sse2_s32_stereo_int}}
+	},
+	{	// AVX2
+		{{NULL, convert_avx2_s16_mono_int}, {convert_avx2_s16_stereo_short, convert_avx2_s16_stereo_int}},
+		{{NULL, convert_avx2_s24_mono_int}, {NULL, convert_avx2_s24_stereo_int}},
+		{{NULL, NULL}, {NULL, convert_avx2_s32_stereo_int}}
+	}
+#endif
+};
+
+static pcm_isa detect_isa()
+{
+#ifdef PCM_CONVERT_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		return PCM_ISA_AVX2;
+	if(__builtin_cpu_supports("sse2"))
+		return PCM_ISA_SSE2;
+#endif
+	return PCM_ISA_SCALAR;
+}
+
+pcm_isa pcm_get_best_isa()
+{
+	static const pcm_isa e_best_isa = detect_isa();	// Detected once, also safe from static initializers
+	return e_best_isa;
+}
+
+const char *pcm_get_isa_name(pcm_isa e_isa)
+{
+	switch(e_isa)
+	{
+	case PCM_ISA_SCALAR:	return "scalar";
+	case PCM_ISA_SSE2:		return "sse2";
+	case PCM_ISA_AVX2:		return "avx2";
+	default:				return "unknown";
+	}
+}
+
+pcm_convert_func pcm_get_convert_func(int i_bytes_per_sample, int i_channels, int i_out_bytes, pcm_isa e_isa)
+{
+	if(i_bytes_per_sample < 2 || i_bytes_per_sample > 4 || i_channels < 1 || i_channels > 2 ||
+		(i_out_bytes != sizeof(short) && i_out_bytes != sizeof(int)))
+		return NULL;
+
+	if(e_isa > pcm_get_best_isa())
+		e_isa = pcm_get_best_isa();
+
+	for(int i=e_isa;i>=PCM_ISA_SCALAR;i--)
+	{
+		pcm_convert_func p_func = s_p_kernels[i][i_bytes_per_sample-2][i_channels-1][i_out_bytes == sizeof(int)];
+		if(p_func)
+			return p_func;
+	}
+	return NULL;
+}
+
+pcm_convert_func pcm_get_convert_func(int i_bytes_per_sample, int i_channels, int i_out_bytes)
+{
+	return pcm_get_convert_func(i_bytes_per_sample, i_channels, i_out_bytes, pcm_get_best_isa());
+}
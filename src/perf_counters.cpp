@@ -0,0 +1,216 @@
+/**
+* @file perf_counters.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the perf_counters class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <perf_counters.h>
+#include <stdio.h>
+#include <cstring>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+int perf_counters::m_i_on = 0;
+int perf_counters::m_pi_missing[PERF_COUNTERS] = {0};
+perf_thread *perf_counters::m_ps_threads = NULL;
+int perf_counters::m_i_warned = 0;
+
+static __thread perf_thread *g_ps_thread = NULL;	//!< Counters of the calling thread
+static __thread int g_i_thread_failed = 0;			//!< 1: The calling thread cannot count
+
+static const unsigned long long g_pull_configs[PERF_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+static const char *g_ppc_counter_names[PERF_COUNTERS] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+static const char *g_ppc_stage_names[PERF_STAGES] = {"convert", "encode"};
+
+/**
+*	Open a counter of the calling thread.
+*	@param i_group_fd Leader of the group, -1: the counter leads a new group.
+*	@return File descriptor, -1: not available.
+*/
+static int open_counter(unsigned long long ull_config, int i_group_fd)
+{
+	perf_event_attr s_attr;
+	memset(&s_attr, 0, sizeof(s_attr));
+	s_attr.size = sizeof(s_attr);
+	s_attr.type = PERF_TYPE_HARDWARE;
+	s_attr.config = ull_config;
+	// All counters with one read, with the times to scale them if they were multiplexed
+	s_attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	s_attr.exclude_kernel = 1;					// Allowed without privileges up to perf_event_paranoid 2
+	s_attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &s_attr, 0, -1, i_group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+perf_thread *perf_counters::get_thread()
+{
+	if(g_ps_thread || g_i_thread_failed)
+		return g_ps_thread;
+
+	perf_thread *ps_thread = new perf_thread;
+	memset(&ps_thread->s_totals, 0, sizeof(perf_totals));
+	ps_thread->i_num_open = 0;
+	for(int c=0;c<PERF_COUNTERS;c++)
+		ps_thread->pi_fd[c] = -1;
+
+	// The cycles lead the group, so that all counters count over the same time
+	int i_errno = 0;
+	for(int c=0;c<PERF_COUNTERS;c++)
+	{
+		ps_thread->pi_fd[c] = open_counter(g_pull_configs[c], ps_thread->pi_fd[PERF_CYCLES]);
+		if(ps_thread->pi_fd[c] < 0)
+		{
+			i_errno = errno;
+			__atomic_store_n(&m_pi_missing[c], 1, __ATOMIC_RELAXED);
+			if(c == PERF_CYCLES)
+				break;
+			continue;
+		}
+		ps_thread->pi_index[c] = ps_thread->i_num_open++;
+	}
+
+	if(ps_thread->pi_fd[PERF_CYCLES] < 0)
+	{
+		delete ps_thread;
+		g_i_thread_failed = 1;
+		if(__atomic_exchange_n(&m_i_warned, 1, __ATOMIC_RELAXED) == 0)
+			fprintf(stderr, "File %s Line %d: WARNING No hardware counters (%s), nothing is counted.\n",
+				__FILE__, __LINE__, strerror(i_errno));
+		return NULL;
+	}
+
+	// Push onto the list of threads
+	ps_thread->ps_next = __atomic_load_n(&m_ps_threads, __ATOMIC_RELAXED);
+	while(!__atomic_compare_exchange_n(&m_ps_threads, &ps_thread->ps_next, ps_thread, true, __ATOMIC_RELEASE,
+		__ATOMIC_RELAXED));
+
+	g_ps_thread = ps_thread;
+	return ps_thread;
+}
+
+int perf_counters::start()
+{
+	__atomic_store_n(&m_i_on, 1, __ATOMIC_RELAXED);
+	if(get_thread() == NULL)	// Already warned
+	{
+		__atomic_store_n(&m_i_on, 0, __ATOMIC_RELAXED);
+		return 1;
+	}
+	return 0;
+}
+
+int perf_counters::read_counters(perf_thread *ps_thread, long long *pll_counts)
+{
+	// Number of counters, time enabled, time running, then the counters
+	unsigned long long pull_values[3 + PERF_COUNTERS];
+	ssize_t l_bytes = (3 + ps_thread->i_num_open) * sizeof(unsigned long long);
+	if(read(ps_thread->pi_fd[PERF_CYCLES], pull_values, sizeof(pull_values)) != l_bytes)
+		return 1;
+	for(int c=0;c<PERF_COUNTERS;c++)
+		pll_counts[c] = (ps_thread->pi_fd[c] >= 0) ? (long long)pull_values[3 + ps_thread->pi_index[c]] : 0;
+	pll_counts[PERF_COUNTERS] = (long long)pull_values[1];
+	pll_counts[PERF_COUNTERS + 1] = (long long)pull_values[2];
+	return 0;
+}
+
+void perf_counters::begin(long long *pll_start)
+{
+	perf_thread *ps_thread = is_on() ? get_thread() : NULL;
+	if(ps_thread == NULL || read_counters(ps_thread, pll_start))
+		pll_start[0] = -1;
+}
+
+void perf_counters::end(perf_stage e_stage, const long long *pll_start)
+{
+	if(pll_start[0] < 0)
+		return;
+
+	long long pll_end[PERF_READ_VALUES];
+	perf_thread *ps_thread = get_thread();
+	if(read_counters(ps_thread, pll_end))
+		return;
+
+	// The group counted for part of the stage only if it was multiplexed
+	long long ll_enabled = pll_end[PERF_COUNTERS] - pll_start[PERF_COUNTERS];
+	long long ll_running = pll_end[PERF_COUNTERS + 1] - pll_start[PERF_COUNTERS + 1];
+	perf_totals *ps_totals = &ps_thread->s_totals;
+	ps_totals->pll_time_enabled[e_stage] += ll_enabled;
+	ps_totals->pll_time_running[e_stage] += ll_running;
+	if(ll_running <= 0)
+		return;
+	double d_scale = (ll_enabled > ll_running) ? (double)ll_enabled / ll_running : 1.0;
+	for(int c=0;c<PERF_COUNTERS;c++)
+		ps_totals->pll_count[e_stage][c] += (long long)((pll_end[c] - pll_start[c]) * d_scale + 0.5);
+}
+
+void perf_counters::get_thread_totals(perf_totals *ps_totals)
+{
+	if(g_ps_thread)
+		*ps_totals = g_ps_thread->s_totals;
+	else
+		memset(ps_totals, 0, sizeof(perf_totals));
+}
+
+void perf_counters::get_totals(perf_totals *ps_totals)
+{
+	memset(ps_totals, 0, sizeof(perf_totals));
+	for(perf_thread *ps_thread = __atomic_load_n(&m_ps_threads, __ATOMIC_ACQUIRE); ps_thread; ps_thread = ps_thread->ps_next)
+	{
+		for(int s=0;s<PERF_STAGES;s++)
+		{
+			for(int c=0;c<PERF_COUNTERS;c++)
+				ps_totals->pll_count[s][c] += ps_thread->s_totals.pll_count[s][c];
+			ps_totals->pll_time_enabled[s] += ps_thread->s_totals.pll_time_enabled[s];
+			ps_totals->pll_time_running[s] += ps_thread->s_totals.pll_time_running[s];
+		}
+	}
+}
+
+const char *perf_counters::get_counter_name(perf_counter e_counter)
+{
+	return g_ppc_counter_names[e_counter];
+}
+
+const char *perf_counters::get_stage_name(perf_stage e_stage)
+{
+	return g_ppc_stage_names[e_stage];
+}
+
+void perf_counters::display_summary()
+{
+	perf_totals s_totals;
+	get_totals(&s_totals);
+
+	// Few instructions per cycle with many cache misses: waiting for memory, many: computing
+	fprintf(stderr, "Hardware counters   %15s %15s %15s %15s %6s\n", "cycles", "instructions", "cache misses",
+		"branch misses", "IPC");
+	for(int s=0;s<PERF_STAGES;s++)
+	{
+		fprintf(stderr, "%-19s", g_ppc_stage_names[s]);
+		for(int c=0;c<PERF_COUNTERS;c++)
+		{
+			if(m_pi_missing[c])
+				fprintf(stderr, " %15s", "n/a");
+			else
+				fprintf(stderr, " %15lld", s_totals.pll_count[s][c]);
+		}
+		long long ll_cycles = s_totals.pll_count[s][PERF_CYCLES];
+		if(m_pi_missing[PERF_INSTRUCTIONS] || ll_cycles == 0)
+			fprintf(stderr, " %6s\n", "n/a");
+		else
+			fprintf(stderr, " %6.2f\n", (double)s_totals.pll_count[s][PERF_INSTRUCTIONS] / ll_cycles);
+	}
+
+	// Estimates only, the less time counted the rougher
+	for(int s=0;s<PERF_STAGES;s++)
+	{
+		long long ll_enabled = s_totals.pll_time_enabled[s];
+		long long ll_running = s_totals.pll_time_running[s];
+		if(ll_running < ll_enabled)
+			fprintf(stderr, "Counters multiplexed in %s, counted %.1f%% of the time and scaled up\n",
+				g_ppc_stage_names[s], 100.0 * ll_running / ll_enabled);
+	}
+}
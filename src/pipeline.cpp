@@ -0,0 +1,419 @@
+/**
+* @file pipeline.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the pipeline class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <pipeline.h>
+#include <wave_to_mp3.h>
+#include <encode_manifest.h>
+#include <mp3_writer.h>
+#include <stdio.h>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+pipeline::pipeline(int i_readers, int i_encoders, int i_writers, int i_quality)
+{
+	m_i_num_readers = i_readers < 1 ? 1 : i_readers;
+	m_i_num_encoders = i_encoders < 1 ? 1 : i_encoders;
+	m_i_num_writers = i_writers < 1 ? 1 : i_writers;
+	m_i_open_files = 0;
+	m_i_files = 0;
+	m_i_shut_down = 0;
+	m_pc_manifest = NULL;
+	m_pc_arena = new buffer_arena();
+
+	// Enough files open that the readers can keep every encoder busy
+	m_i_max_open_files = 2 * m_i_num_encoders + m_i_num_readers;
+	m_ppc_wave2mp3 = new wave_to_mp3*[m_i_max_open_files];
+	for(int i=0;i<m_i_max_open_files;i++)
+	{
+		m_ppc_wave2mp3[i] = new wave_to_mp3();
+		m_ppc_wave2mp3[i]->set_quality(i_quality);
+		m_dq_free_wave2mp3.push_back(m_ppc_wave2mp3[i]);
+	}
+
+	pthread_mutex_init(&m_t_mutex, NULL);
+	pthread_cond_init(&m_t_read_cond, NULL);
+	pthread_cond_init(&m_t_encode_cond, NULL);
+	pthread_cond_init(&m_t_write_cond, NULL);
+	pthread_cond_init(&m_t_new_space_cond, NULL);
+	pthread_cond_init(&m_t_mp3_space_cond, NULL);
+	pthread_cond_init(&m_t_done_cond, NULL);
+
+	int i_num_threads = m_i_num_readers + m_i_num_encoders + m_i_num_writers;
+	m_pt_threads = new pthread_t[i_num_threads];
+	for(int i=0;i<i_num_threads;i++)
+	{
+		void *(*p_run)(void *) = (i < m_i_num_readers) ? run_reader :
+			(i < m_i_num_readers + m_i_num_encoders) ? run_encoder : run_writer;
+		if(pthread_create(&m_pt_threads[i], NULL, p_run, this))
+		{
+			fprintf(stderr, "File %s Line %d: ERROR Cannot create thread.\n", __FILE__, __LINE__);
+			exit(1);
+		}
+	}
+}
+
+pipeline::~pipeline()
+{
+	pthread_mutex_lock(&m_t_mutex);
+	m_i_shut_down = 1;
+	pthread_cond_broadcast(&m_t_read_cond);
+	pthread_cond_broadcast(&m_t_encode_cond);
+	pthread_cond_broadcast(&m_t_write_cond);
+	pthread_cond_broadcast(&m_t_mp3_space_cond);
+	pthread_mutex_unlock(&m_t_mutex);
+
+	for(int i=0;i<m_i_num_readers+m_i_num_encoders+m_i_num_writers;i++)
+		pthread_join(m_pt_threads[i], NULL);
+	delete [] m_pt_threads;
+
+	for(int i=0;i<m_i_max_open_files;i++)
+		delete m_ppc_wave2mp3[i];
+	delete [] m_ppc_wave2mp3;
+	delete m_pc_arena;
+
+	pthread_mutex_destroy(&m_t_mutex);
+	pthread_cond_destroy(&m_t_read_cond);
+	pthread_cond_destroy(&m_t_encode_cond);
+	pthread_cond_destroy(&m_t_write_cond);
+	pthread_cond_destroy(&m_t_new_space_cond);
+	pthread_cond_destroy(&m_t_mp3_space_cond);
+	pthread_cond_destroy(&m_t_done_cond);
+}
+
+void *pipeline::run_reader(void *p_pipeline)
+{
+	((pipeline*)p_pipeline)->read();
+	return NULL;
+}
+
+void *pipeline::run_encoder(void *p_pipeline)
+{
+	((pipeline*)p_pipeline)->encode();
+	return NULL;
+}
+
+void *pipeline::run_writer(void *p_pipeline)
+{
+	((pipeline*)p_pipeline)->write();
+	return NULL;
+}
+
+void pipeline::add_file(const char *pc_wave_file, const char *pc_mp3_file)
+{
+	pipe_file *ps_file = new pipe_file;		// Freed by finish_file
+	ps_file->pc_wave_file = new char[strlen(pc_wave_file)+1];
+	strcpy(ps_file->pc_wave_file, pc_wave_file);
+	ps_file->pc_mp3_file = new char[strlen(pc_mp3_file)+1];
+	strcpy(ps_file->pc_mp3_file, pc_mp3_file);
+	ps_file->pc_wave_read = NULL;
+	ps_file->pc_wave2mp3 = NULL;
+	ps_file->i_mp3_fd = -1;
+	ps_file->i_block_samples = 0;
+	for(int i=0;i<PIPE_FILE_BLOCKS;i++)
+		ps_file->s_blocks[i].pc_data = NULL;
+	ps_file->i_fill_idx = 0;
+	ps_file->i_encode_idx = 0;
+	ps_file->i_ready_blocks = 0;
+	ps_file->i_reading = 1;
+	ps_file->i_read_done = 0;
+	ps_file->i_encoding = 0;
+	ps_file->i_encode_done = 0;
+	ps_file->l_mp3_offset = 0;
+	ps_file->i_pending_writes = 0;
+
+	pthread_mutex_lock(&m_t_mutex);
+	while(m_dq_new_files.size() >= PIPE_NEW_FILES)
+		pthread_cond_wait(&m_t_new_space_cond, &m_t_mutex);
+	m_dq_new_files.push_back(ps_file);
+	m_i_files++;
+	pthread_cond_signal(&m_t_read_cond);
+	pthread_mutex_unlock(&m_t_mutex);
+}
+
+void pipeline::wait_done()
+{
+	pthread_mutex_lock(&m_t_mutex);
+	while(m_i_files > 0)
+		pthread_cond_wait(&m_t_done_cond, &m_t_mutex);
+	pthread_mutex_unlock(&m_t_mutex);
+}
+
+void pipeline::open_file(pipe_file *ps_file)
+{
+	// Only the reader of the file uses the arena of its encoder
+	ps_file->pc_wave_read = new wave_read(ps_file->pc_wave2mp3->get_arena());
+	if(m_pc_manifest)
+		ps_file->pc_wave_read->set_content_hash(&ps_file->c_hash);
+	if(ps_file->pc_wave_read->init(ps_file->pc_wave_file, wave_to_mp3::get_read_buffer_size()))
+		exit(1);
+	ps_file->pc_wave_read->display_wave_info();
+	ps_file->s_wave_header = *ps_file->pc_wave_read->get_wave_header();
+
+	// The blocks hold whole iterations of the encoder, so that it sees the same pieces as encode_wave
+	ps_file->i_block_samples = PIPE_BLOCK_ITR * wave_to_mp3::get_samples_per_itr(&ps_file->s_wave_header);
+
+	if(ps_file->pc_wave2mp3->begin_stream(&ps_file->s_wave_header))
+		exit(1);
+
+	mp3_writer::unlink_shared(ps_file->pc_mp3_file);
+	ps_file->i_mp3_fd = open(ps_file->pc_mp3_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if(ps_file->i_mp3_fd < 0)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot open mp3 file %s to write.\n",
+			__FILE__, __LINE__, ps_file->pc_mp3_file);
+		exit(1);
+	}
+
+	// Laid out in one piece, and truncated once written (see mp3_writer)
+	long l_max_mp3_bytes = wave_to_mp3::get_max_mp3_bytes(&ps_file->s_wave_header);
+	if(l_max_mp3_bytes > 0)
+		fallocate(ps_file->i_mp3_fd, 0, 0, l_max_mp3_bytes);
+}
+
+void pipeline::read_block(pipe_file *ps_file)
+{
+	pipe_pcm_block *ps_block = &ps_file->s_blocks[ps_file->i_fill_idx];
+	int i_itr_samples = ps_file->i_block_samples / PIPE_BLOCK_ITR;
+	int i_frame_bytes = ps_file->s_wave_header.num_channels * (ps_file->s_wave_header.bits_per_sample/8);
+
+	// The file is mapped into memory, so this is where the thread waits for the disk
+	int i_block_bytes = 0;
+	ps_block->i_last = 0;
+	for(int i=0;i<PIPE_BLOCK_ITR;i++)
+	{
+		const unsigned char *pc_data;
+		int i_read_bytes = ps_file->pc_wave_read->get_raw_block(&pc_data, i_itr_samples);
+		if(i_read_bytes == 0)
+		{
+			ps_block->i_last = 1;
+			break;
+		}
+		memcpy(ps_block->pc_data + i_block_bytes, pc_data, i_read_bytes);
+		i_block_bytes += i_read_bytes;
+	}
+	ps_block->i_samples = i_block_bytes / i_frame_bytes;
+
+	if(ps_block->i_last)	// Release the mapping early
+	{
+		delete ps_file->pc_wave_read;
+		ps_file->pc_wave_read = NULL;
+	}
+}
+
+void pipeline::read()
+{
+	pthread_mutex_lock(&m_t_mutex);
+	while(1)
+	{
+		// Files already open come first, so that their encoders don't wait
+		while(!m_i_shut_down && m_dq_read_files.empty() &&
+			(m_dq_new_files.empty() || m_i_open_files >= m_i_max_open_files))
+			pthread_cond_wait(&m_t_read_cond, &m_t_mutex);
+		if(m_i_shut_down)
+			break;
+
+		pipe_file *ps_file;
+		int i_new_file = 0;
+		if(!m_dq_read_files.empty())
+		{
+			ps_file = m_dq_read_files.front();
+			m_dq_read_files.pop_front();
+		}
+		else
+		{
+			ps_file = m_dq_new_files.front();
+			m_dq_new_files.pop_front();
+			ps_file->pc_wave2mp3 = m_dq_free_wave2mp3.front();
+			m_dq_free_wave2mp3.pop_front();
+			m_i_open_files++;
+			i_new_file = 1;
+
+			// Iterations of the encoder are at most a read buffer, whatever the format
+			for(int i=0;i<PIPE_FILE_BLOCKS;i++)
+				ps_file->s_blocks[i].pc_data = m_pc_arena->borrow(PIPE_BLOCK_ITR * wave_to_mp3::get_read_buffer_size());
+			pthread_cond_signal(&m_t_new_space_cond);
+		}
+		pthread_mutex_unlock(&m_t_mutex);
+
+		if(i_new_file)
+			open_file(ps_file);
+		read_block(ps_file);
+
+		pthread_mutex_lock(&m_t_mutex);
+		ps_file->i_read_done = ps_file->s_blocks[ps_file->i_fill_idx].i_last;
+		ps_file->i_fill_idx = (ps_file->i_fill_idx + 1) % PIPE_FILE_BLOCKS;
+		ps_file->i_ready_blocks++;
+		if(!ps_file->i_encoding)
+		{
+			ps_file->i_encoding = 1;
+			m_dq_encode_files.push_back(ps_file);
+			pthread_cond_signal(&m_t_encode_cond);
+		}
+
+		// Read ahead while there is a free block, otherwise an encoder queues the file again
+		if(!ps_file->i_read_done && ps_file->i_ready_blocks < PIPE_FILE_BLOCKS)
+			m_dq_read_files.push_back(ps_file);
+		else
+			ps_file->i_reading = 0;
+	}
+	pthread_mutex_unlock(&m_t_mutex);
+}
+
+void pipeline::encode()
+{
+	pthread_mutex_lock(&m_t_mutex);
+	while(1)
+	{
+		while(!m_i_shut_down && m_dq_encode_files.empty())
+			pthread_cond_wait(&m_t_encode_cond, &m_t_mutex);
+		if(m_i_shut_down)
+			break;
+
+		// Only this thread encodes the file until it is queued again, so the blocks stay in order
+		pipe_file *ps_file = m_dq_encode_files.front();
+		m_dq_encode_files.pop_front();
+		pipe_pcm_block *ps_block = &ps_file->s_blocks[ps_file->i_encode_idx];
+
+		wave_to_mp3 *pc_wave2mp3 = ps_file->pc_wave2mp3;
+		int i_mp3_buffer_size = pc_wave2mp3->get_stream_buffer_size(ps_block->i_samples);
+		if(ps_block->i_last)
+			i_mp3_buffer_size += pc_wave2mp3->get_stream_buffer_size(0);
+		unsigned char *pc_mp3_buffer = m_pc_arena->borrow(i_mp3_buffer_size);	// Given back by the writer
+		pthread_mutex_unlock(&m_t_mutex);
+
+		int i_mp3_bytes = pc_wave2mp3->encode_stream(ps_block->pc_data, ps_block->i_samples,
+			pc_mp3_buffer, i_mp3_buffer_size);
+		if(ps_block->i_last && i_mp3_bytes >= 0)
+		{
+			int i_flush_bytes = pc_wave2mp3->end_stream(pc_mp3_buffer + i_mp3_bytes, i_mp3_buffer_size - i_mp3_bytes);
+			i_mp3_bytes = (i_flush_bytes < 0) ? i_flush_bytes : i_mp3_bytes + i_flush_bytes;
+		}
+		if(i_mp3_bytes < 0)
+		{
+			fprintf(stderr, "File %s Line %d: ERROR Cannot encode %s.\n", __FILE__, __LINE__, ps_file->pc_wave_file);
+			exit(1);
+		}
+
+		pthread_mutex_lock(&m_t_mutex);
+		int i_last = ps_block->i_last;
+		ps_file->i_encode_idx = (ps_file->i_encode_idx + 1) % PIPE_FILE_BLOCKS;
+		ps_file->i_ready_blocks--;
+		if(!ps_file->i_read_done && !ps_file->i_reading)
+		{
+			ps_file->i_reading = 1;
+			m_dq_read_files.push_back(ps_file);
+			pthread_cond_signal(&m_t_read_cond);
+		}
+
+		if(i_mp3_bytes > 0)
+		{
+			while(!m_i_shut_down && m_dq_mp3_blocks.size() >= PIPE_MP3_BLOCKS)
+				pthread_cond_wait(&m_t_mp3_space_cond, &m_t_mutex);
+
+			pipe_mp3_block s_mp3_block = {ps_file, pc_mp3_buffer, i_mp3_bytes, ps_file->l_mp3_offset};
+			m_dq_mp3_blocks.push_back(s_mp3_block);
+			ps_file->l_mp3_offset += i_mp3_bytes;
+			ps_file->i_pending_writes++;
+			pthread_cond_signal(&m_t_write_cond);
+		}
+		else
+			m_pc_arena->give_back(pc_mp3_buffer);
+
+		if(i_last)
+		{
+			ps_file->i_encode_done = 1;
+			if(ps_file->i_pending_writes == 0)
+			{
+				pthread_mutex_unlock(&m_t_mutex);
+				finish_file(ps_file);
+				pthread_mutex_lock(&m_t_mutex);
+			}
+		}
+		else if(ps_file->i_ready_blocks > 0)
+			m_dq_encode_files.push_back(ps_file);	// Behind the other files, so that they all move on
+		else
+			ps_file->i_encoding = 0;				// The reader queues it again
+	}
+	pthread_mutex_unlock(&m_t_mutex);
+}
+
+void pipeline::write()
+{
+	pthread_mutex_lock(&m_t_mutex);
+	while(1)
+	{
+		while(!m_i_shut_down && m_dq_mp3_blocks.empty())
+			pthread_cond_wait(&m_t_write_cond, &m_t_mutex);
+		if(m_dq_mp3_blocks.empty())		// Shut down
+			break;
+
+		pipe_mp3_block s_mp3_block = m_dq_mp3_blocks.front();
+		m_dq_mp3_blocks.pop_front();
+		pthread_cond_signal(&m_t_mp3_space_cond);
+		pthread_mutex_unlock(&m_t_mutex);
+
+		// Each block has its place in the file, so the writers need not take turns
+		pipe_file *ps_file = s_mp3_block.ps_file;
+		for(int i_written = 0; i_written < s_mp3_block.i_bytes;)
+		{
+			ssize_t l_ret = pwrite(ps_file->i_mp3_fd, s_mp3_block.pc_data + i_written,
+				s_mp3_block.i_bytes - i_written, s_mp3_block.l_offset + i_written);
+			if(l_ret < 0 && errno == EINTR)
+				continue;
+			if(l_ret <= 0)
+			{
+				fprintf(stderr, "File %s Line %d: ERROR Cannot write mp3 file %s.\n",
+					__FILE__, __LINE__, ps_file->pc_mp3_file);
+				exit(1);
+			}
+			i_written += l_ret;
+		}
+
+		pthread_mutex_lock(&m_t_mutex);
+		m_pc_arena->give_back(s_mp3_block.pc_data);
+		ps_file->i_pending_writes--;
+		if(ps_file->i_encode_done && ps_file->i_pending_writes == 0)
+		{
+			pthread_mutex_unlock(&m_t_mutex);
+			finish_file(ps_file);
+			pthread_mutex_lock(&m_t_mutex);
+		}
+	}
+	pthread_mutex_unlock(&m_t_mutex);
+}
+
+void pipeline::finish_file(pipe_file *ps_file)
+{
+	if(ftruncate(ps_file->i_mp3_fd, ps_file->l_mp3_offset))
+		fprintf(stderr, "File %s Line %d: WARNING Cannot truncate mp3 file %s.\n",
+			__FILE__, __LINE__, ps_file->pc_mp3_file);
+	if(close(ps_file->i_mp3_fd))
+		fprintf(stderr, "File %s Line %d: WARNING Cannot close mp3 file %s.\n",
+			__FILE__, __LINE__, ps_file->pc_mp3_file);
+
+	if(ps_file->pc_wave_read)
+		delete ps_file->pc_wave_read;
+	if(m_pc_manifest)
+		m_pc_manifest->done(ps_file->pc_wave_file, ps_file->pc_mp3_file, &ps_file->c_hash);
+
+	pthread_mutex_lock(&m_t_mutex);
+	for(int i=0;i<PIPE_FILE_BLOCKS;i++)
+		m_pc_arena->give_back(ps_file->s_blocks[i].pc_data);
+	m_dq_free_wave2mp3.push_back(ps_file->pc_wave2mp3);
+	m_i_open_files--;
+	m_i_files--;
+	pthread_cond_signal(&m_t_read_cond);	// Another file can be opened
+	pthread_cond_broadcast(&m_t_done_cond);
+	pthread_mutex_unlock(&m_t_mutex);
+
+	delete [] ps_file->pc_wave_file;
+	delete [] ps_file->pc_mp3_file;
+	delete ps_file;
+}
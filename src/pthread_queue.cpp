@@ -1,198 +1,254 @@
-/**
-* @file pthread_queue.cpp
-* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
-* @brief This file contains the pthread_queue class.
-* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
-*/
-
-#include <work_queue.h>
-#include <work_item.h>
-#include <thread_handler.h>
-#include <pthread_queue.h>
-#include <pthread.h>
-#include <stdio.h>
-#include <cstdlib>
-
-pthread_queue::pthread_queue()
-{
-	m_i_num_threads = 0;
-	m_i_num_jobs = 0;
-	m_i_curr_job = 0;
-	m_pc_work_queue = NULL;
-	m_ppc_fixed_work_queue = NULL;
-}
-
-void pthread_queue::make_thread_pool(int i_num_threads, int i_num_jobs)
-{
-	m_b_fixed_assign = false;
-	if(m_i_num_threads)	// There are alive threads, so delete them first
-	{
-		for(int i=0;i<m_i_num_threads;i++)
-			delete m_ppc_thread_handler[i];
-		delete [] m_ppc_thread_handler;
-
-		delete m_pc_work_queue;
-
-		if(m_ppc_fixed_work_queue)
-		{
-			for(int i=0;i<m_i_num_threads+1;i++)
-				delete m_ppc_fixed_work_queue[i];
-			delete [] m_ppc_fixed_work_queue;
-		}
-
-		for(int i=0;i<m_i_num_jobs;i++)
-			delete m_ppc_work_item[i];
-		delete [] m_ppc_work_item;
-	}
-
-	m_i_num_threads = i_num_threads;	// The manager will do one of the jobs
-	m_i_num_jobs = i_num_jobs;
-	m_i_curr_job = 0;
-
-	m_pc_work_queue = new work_queue(m_i_num_jobs);
-
-	m_ppc_thread_handler = new thread_handler*[m_i_num_threads];
-	for(int i=0;i<m_i_num_threads;i++)
-		m_ppc_thread_handler[i] = new thread_handler(i,m_pc_work_queue);
-	
-	// Start the threads
-	for(int i=0;i<m_i_num_threads;i++)
-		m_ppc_thread_handler[i]->start_thread();
-
-	m_ppc_work_item = new work_item*[m_i_num_jobs];
-	for(int i=0;i<m_i_num_jobs;i++)
-		m_ppc_work_item[i] = new work_item();
-}
-
-void pthread_queue::make_thread_pool_fixed(int i_num_threads,int i_num_jobs)
-{
-	m_b_fixed_assign = true;
-	if(m_i_num_threads)	// There are alive threads, so delete them first
-	{
-		for(int i=0;i<m_i_num_threads;i++)
-			delete m_ppc_thread_handler[i];
-		delete[] m_ppc_thread_handler;
-
-		if(m_pc_work_queue)
-			delete m_pc_work_queue;
-
-		for(int i=0;i<m_i_num_threads;i++)
-			delete m_ppc_fixed_work_queue[i];
-		delete [] m_ppc_fixed_work_queue;
-
-		for(int i=0;i<m_i_num_jobs;i++)
-			delete m_ppc_work_item[i];
-		delete[] m_ppc_work_item;
-	}
-
-	m_i_num_threads = i_num_threads;
-	m_i_num_jobs = i_num_jobs;
-	m_i_curr_job = 0;
-
-	// Every thread will have its own personal job queue.
-	m_ppc_fixed_work_queue = new work_queue*[m_i_num_threads];
-	for(int i=0;i<m_i_num_threads;i++)
-		m_ppc_fixed_work_queue[i] = new work_queue(1+m_i_num_jobs/m_i_num_threads);	// A thread can be assigned multiple jobs
-
-	m_ppc_thread_handler = new thread_handler*[m_i_num_threads];
-	for(int i=0;i<m_i_num_threads;i++)
-		m_ppc_thread_handler[i] = new thread_handler(i,m_ppc_fixed_work_queue[i]);	// The last queue is not assigned to any thread
-
-	// Start the threads
-	for(int i=0;i<m_i_num_threads;i++)
-		m_ppc_thread_handler[i]->start_thread();
-
-	m_ppc_work_item = new work_item*[m_i_num_jobs];
-	for(int i=0;i<m_i_num_jobs;i++)
-		m_ppc_work_item[i] = new work_item();
-}
-
-void pthread_queue::register_function(int i_thread_num, void *(*p_func_ptr)(void *, int))
-{
-	if(i_thread_num >= m_i_num_threads)
-	{
-		fprintf(stderr, "File %s Line %d: ERROR Thread number is more than available threads.\n", 
-			__FILE__,  __LINE__);
-		exit(1);
-	}
-	m_ppc_thread_handler[i_thread_num]->set_default_function(p_func_ptr);
-}
-
-int pthread_queue::add_to_job_queue(void *(*p_func_ptr)(void *, int), void *p_args)
-{
-	// Check if queue full, if yes, then wait
-	if(m_i_curr_job == m_i_num_jobs)
-	{
-		if(m_b_fixed_assign)
-		{
-			for(int i=0;i<m_i_num_threads;i++)
-				m_ppc_fixed_work_queue[i]->wait_for_queue_empty();	// Check every independent queue
-		}
-		else
-			m_pc_work_queue->wait_for_queue_empty(); 
-
-		m_i_curr_job = 0;
-	}
-
-	m_ppc_work_item[m_i_curr_job]->m_i_item_num = m_i_curr_job;
-	m_ppc_work_item[m_i_curr_job]->m_p_args = p_args;
-	m_ppc_work_item[m_i_curr_job]->m_p_func_ptr = p_func_ptr;
-
-	// Add the jobs to the queue
-	if(m_b_fixed_assign)
-		m_ppc_fixed_work_queue[m_i_curr_job%(m_i_num_threads+1)]->add_to_job(m_ppc_work_item[m_i_curr_job]);
-	else
-		m_pc_work_queue->add_to_job(m_ppc_work_item[m_i_curr_job]);
-
-	m_i_curr_job++;
-
-	return 0;
-}
-
-void pthread_queue::wait_queue_done()
-{
-	// Wait until all threads are done 
-	if(m_b_fixed_assign)
-	{
-		for(int i=0;i<m_i_num_threads;i++)
-			m_ppc_fixed_work_queue[i]->wait_for_queue_empty();	// Check every independent queue
-	}
-	else
-		m_pc_work_queue->wait_for_queue_empty();
-
-	m_i_curr_job = 0;
-}
-
-int pthread_queue::get_job_time(int i_job_num)
-{
-	return m_ppc_work_item[i_job_num]->m_i_thread_time;
-}
-
-int pthread_queue::get_thread_id_for_job_id(int i_job_num)
-{
-	return m_ppc_work_item[i_job_num]->m_i_thread_num;
-}
-
-pthread_queue::~pthread_queue()
-{
-	if(m_i_num_threads)	// There are alive threads, so delete them first
-	{
-		for(int i=0;i<m_i_num_threads;i++)
-			delete m_ppc_thread_handler[i];
-		delete [] m_ppc_thread_handler;
-
-		if(m_ppc_fixed_work_queue)
-		{
-			for(int i=0;i<m_i_num_threads+1;i++)
-				delete m_ppc_fixed_work_queue[i];
-			delete [] m_ppc_fixed_work_queue;
-		}
-
-		for(int i=0;i<m_i_num_jobs;i++)
-			delete m_ppc_work_item[i];
-		delete [] m_ppc_work_item;
-
-		if(m_pc_work_queue)
-			delete m_pc_work_queue;
-	}
-}
+/**
+* @file pthread_queue.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the pthread_queue class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <work_queue.h>
+#include <work_steal_queue.h>
+#include <work_item.h>
+#include <thread_handler.h>
+#include <pthread_queue.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <cstdlib>
+#include <time.h>
+
+/**
+*	Get the time in nsec of CLOCK_MONOTONIC, as the threads measure the wait of the jobs.
+*/
+static long long get_time_ns()
+{
+	timespec s_time;
+	clock_gettime(CLOCK_MONOTONIC, &s_time);
+	return s_time.tv_sec * 1000000000LL + s_time.tv_nsec;
+}
+
+pthread_queue::pthread_queue()
+{
+	m_b_fixed_assign = false;
+	m_b_work_steal = false;
+	m_i_num_threads = 0;
+	m_i_num_jobs = 0;
+	m_i_curr_job = 0;
+	m_pc_work_queue = NULL;
+	m_ppc_fixed_work_queue = NULL;
+	m_pc_free_queue = NULL;
+	m_pc_steal_queue = NULL;
+}
+
+void pthread_queue::delete_thread_pool()
+{
+	if(m_i_num_threads == 0)
+		return;
+
+	// The threads may spin without reaching a cancellation point, so let them exit and wait for them.
+	// A NULL job makes a thread exit.
+	if(m_pc_steal_queue)
+		m_pc_steal_queue->shut_down();
+	else if(m_ppc_fixed_work_queue)
+	{
+		for(int i=0;i<m_i_num_threads;i++)
+			m_ppc_fixed_work_queue[i]->add_to_job_wait(NULL);
+	}
+	else
+	{
+		for(int i=0;i<m_i_num_threads;i++)
+			m_pc_work_queue->add_to_job_wait(NULL);
+	}
+	for(int i=0;i<m_i_num_threads;i++)
+		m_ppc_thread_handler[i]->wait_till_thread_finished();
+
+	for(int i=0;i<m_i_num_threads;i++)
+		delete m_ppc_thread_handler[i];
+	delete [] m_ppc_thread_handler;
+
+	if(m_pc_work_queue)
+		delete m_pc_work_queue;
+	m_pc_work_queue = NULL;
+
+	if(m_ppc_fixed_work_queue)
+	{
+		for(int i=0;i<m_i_num_threads;i++)
+			delete m_ppc_fixed_work_queue[i];
+		delete [] m_ppc_fixed_work_queue;
+	}
+	m_ppc_fixed_work_queue = NULL;
+
+	if(m_pc_free_queue)
+		delete m_pc_free_queue;
+	m_pc_free_queue = NULL;
+
+	if(m_pc_steal_queue)
+		delete m_pc_steal_queue;
+	m_pc_steal_queue = NULL;
+
+	for(int i=0;i<m_i_num_jobs;i++)
+		delete m_ppc_work_item[i];
+	delete [] m_ppc_work_item;
+
+	m_i_num_threads = 0;
+}
+
+void pthread_queue::make_thread_pool(int i_num_threads, int i_num_jobs, bool b_lock_free)
+{
+	delete_thread_pool();	// There might be alive threads, so delete them first
+
+	m_b_fixed_assign = false;
+	m_b_work_steal = false;
+	m_i_num_threads = i_num_threads;	// The manager will do one of the jobs
+	m_i_num_jobs = i_num_jobs;
+	m_i_curr_job = 0;
+
+	m_pc_work_queue = new work_queue(m_i_num_jobs, b_lock_free);
+
+	// All the work items are free to start with
+	m_ppc_work_item = new work_item*[m_i_num_jobs];
+	m_pc_free_queue = new work_queue(m_i_num_jobs, b_lock_free);
+	for(int i=0;i<m_i_num_jobs;i++)
+	{
+		m_ppc_work_item[i] = new work_item();
+		m_ppc_work_item[i]->m_i_item_num = i;
+		m_pc_free_queue->add_to_job(m_ppc_work_item[i]);
+	}
+
+	m_ppc_thread_handler = new thread_handler*[m_i_num_threads];
+	for(int i=0;i<m_i_num_threads;i++)
+		m_ppc_thread_handler[i] = new thread_handler(i,m_pc_work_queue,m_pc_free_queue);
+	
+	// Start the threads
+	for(int i=0;i<m_i_num_threads;i++)
+		m_ppc_thread_handler[i]->start_thread();
+}
+
+void pthread_queue::make_thread_pool_fixed(int i_num_threads,int i_num_jobs)
+{
+	delete_thread_pool();	// There might be alive threads, so delete them first
+
+	m_b_fixed_assign = true;
+	m_b_work_steal = false;
+	m_i_num_threads = i_num_threads;
+	m_i_num_jobs = i_num_jobs;
+	m_i_curr_job = 0;
+
+	// Every thread will have its own personal job queue.
+	m_ppc_fixed_work_queue = new work_queue*[m_i_num_threads];
+	for(int i=0;i<m_i_num_threads;i++)
+		m_ppc_fixed_work_queue[i] = new work_queue(1+m_i_num_jobs/m_i_num_threads);	// A thread can be assigned multiple jobs
+
+	// All the work items are free to start with
+	m_ppc_work_item = new work_item*[m_i_num_jobs];
+	m_pc_free_queue = new work_queue(m_i_num_jobs);
+	for(int i=0;i<m_i_num_jobs;i++)
+	{
+		m_ppc_work_item[i] = new work_item();
+		m_ppc_work_item[i]->m_i_item_num = i;
+		m_pc_free_queue->add_to_job(m_ppc_work_item[i]);
+	}
+
+	m_ppc_thread_handler = new thread_handler*[m_i_num_threads];
+	for(int i=0;i<m_i_num_threads;i++)
+		m_ppc_thread_handler[i] = new thread_handler(i,m_ppc_fixed_work_queue[i],m_pc_free_queue);
+
+	// Start the threads
+	for(int i=0;i<m_i_num_threads;i++)
+		m_ppc_thread_handler[i]->start_thread();
+}
+
+void pthread_queue::make_thread_pool_stealing(int i_num_threads, int i_num_jobs)
+{
+	delete_thread_pool();	// There might be alive threads, so delete them first
+
+	m_b_fixed_assign = false;
+	m_b_work_steal = true;
+	m_i_num_threads = i_num_threads;
+	m_i_num_jobs = i_num_jobs;
+	m_i_curr_job = 0;
+
+	m_pc_steal_queue = new work_steal_queue(m_i_num_threads, m_i_num_jobs);
+
+	// All the work items are free to start with
+	m_ppc_work_item = new work_item*[m_i_num_jobs];
+	for(int i=0;i<m_i_num_jobs;i++)
+	{
+		m_ppc_work_item[i] = new work_item();
+		m_ppc_work_item[i]->m_i_item_num = i;
+		m_pc_steal_queue->add_free_item(m_ppc_work_item[i]);
+	}
+
+	m_ppc_thread_handler = new thread_handler*[m_i_num_threads];
+	for(int i=0;i<m_i_num_threads;i++)
+		m_ppc_thread_handler[i] = new thread_handler(i,m_pc_steal_queue);
+
+	// Start the threads
+	for(int i=0;i<m_i_num_threads;i++)
+		m_ppc_thread_handler[i]->start_thread();
+}
+
+void pthread_queue::register_function(int i_thread_num, void *(*p_func_ptr)(void *, int))
+{
+	if(i_thread_num >= m_i_num_threads)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Thread number is more than available threads.\n", 
+			__FILE__,  __LINE__);
+		exit(1);
+	}
+	m_ppc_thread_handler[i_thread_num]->set_default_function(p_func_ptr);
+}
+
+int pthread_queue::add_to_job_queue(void *(*p_func_ptr)(void *, int), void *p_args)
+{
+	if(m_b_work_steal)
+	{
+		work_item *pc_work_item = m_pc_steal_queue->get_free_item();
+		pc_work_item->m_p_args = p_args;
+		pc_work_item->m_p_func_ptr = p_func_ptr;
+		pc_work_item->m_ll_queued_ns = get_time_ns();
+		m_pc_steal_queue->add_to_job(pc_work_item);
+		return 0;
+	}
+
+	// Get a free work item. If all of them are queued or in process, this waits 
+	// until a thread finishes its job.
+	work_item *pc_work_item = m_pc_free_queue->take();
+
+	pc_work_item->m_p_args = p_args;
+	pc_work_item->m_p_func_ptr = p_func_ptr;
+	pc_work_item->m_ll_queued_ns = get_time_ns();
+
+	// Add the jobs to the queue
+	if(m_b_fixed_assign)
+	{
+		m_ppc_fixed_work_queue[m_i_curr_job]->add_to_job_wait(pc_work_item);
+		m_i_curr_job = (m_i_curr_job+1) % m_i_num_threads;
+	}
+	else
+		m_pc_work_queue->add_to_job_wait(pc_work_item);
+
+	return 0;
+}
+
+void pthread_queue::wait_queue_done()
+{
+	// Wait until all threads are done 
+	if(m_b_work_steal)
+		m_pc_steal_queue->wait_for_queue_empty();
+	else if(m_b_fixed_assign)
+	{
+		for(int i=0;i<m_i_num_threads;i++)
+			m_ppc_fixed_work_queue[i]->wait_for_queue_empty();	// Check every independent queue
+	}
+	else
+		m_pc_work_queue->wait_for_queue_empty();
+}
+
+long long pthread_queue::get_job_wait_ns(int i_thread_num)
+{
+	return m_ppc_thread_handler[i_thread_num]->get_wait_ns();
+}
+
+pthread_queue::~pthread_queue()
+{
+	delete_thread_pool();
+}
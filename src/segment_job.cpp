@@ -0,0 +1,124 @@
+/**
+* @file segment_job.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the segment_job class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <segment_job.h>
+#include <wave_read.h>
+#include <stdio.h>
+#include <cstdlib>
+#include <cstring>
+
+segment_job::segment_job(const char *pc_wave_file, const char *pc_mp3_file)
+{
+	m_pc_wave_file = new char[strlen(pc_wave_file)+1];
+	strcpy(m_pc_wave_file, pc_wave_file);
+	m_pc_mp3_file = new char[strlen(pc_mp3_file)+1];
+	strcpy(m_pc_mp3_file, pc_mp3_file);
+
+	m_i_num_segments = 0;
+	m_i_segment_samples = 0;
+	m_i_total_samples = 0;
+	m_ppc_mp3_data = NULL;
+	m_pi_mp3_size = NULL;
+	m_i_segments_left = 0;
+	pthread_mutex_init(&m_t_mutex, NULL);
+}
+
+segment_job::~segment_job()
+{
+	for(int i=0;i<m_i_num_segments;i++)
+		if(m_ppc_mp3_data[i]) delete [] m_ppc_mp3_data[i];
+	if(m_ppc_mp3_data) delete [] m_ppc_mp3_data;
+	if(m_pi_mp3_size) delete [] m_pi_mp3_size;
+
+	delete [] m_pc_wave_file;
+	delete [] m_pc_mp3_file;
+	pthread_mutex_destroy(&m_t_mutex);
+}
+
+int segment_job::plan(int i_segment_seconds, buffer_arena *pc_arena)
+{
+	wave_read *pc_wave_read = new wave_read(pc_arena);
+	if(pc_wave_read->init(m_pc_wave_file, sizeof(wave_header)))
+	{
+		delete pc_wave_read;
+		return 0;
+	}
+	int i_sample_rate = pc_wave_read->get_wave_header()->sample_rate;
+	int i_total_samples = pc_wave_read->get_total_samples();
+	delete pc_wave_read;
+	if(i_sample_rate <= 0 || i_total_samples <= 0)
+	{
+		fprintf(stderr, "File %s Line %d: WARNING Sample rate %d or samples %d of %s not valid, not encoded.\n", 
+			__FILE__, __LINE__, i_sample_rate, i_total_samples, m_pc_wave_file);
+		return 0;
+	}
+	m_i_total_samples = i_total_samples;
+
+	// Segments are only joined without resampling, so the frames must map to the input samples. 
+	// lame uses 1152 samples per frame for MPEG1 and 576 for MPEG2 and 2.5.
+	int i_frame_size;
+	switch(i_sample_rate)
+	{
+	case 32000: case 44100: case 48000:
+		i_frame_size = 1152;
+		break;
+	case 8000: case 11025: case 12000: case 16000: case 22050: case 24000:
+		i_frame_size = 576;
+		break;
+	default:
+		i_frame_size = 0;
+	}
+
+	m_i_segment_samples = (i_frame_size == 0) ? 0 : (long)i_segment_seconds * i_sample_rate / i_frame_size * i_frame_size;
+	if(m_i_segment_samples == 0)
+		m_i_num_segments = 1;
+	else
+	{
+		m_i_num_segments = i_total_samples / m_i_segment_samples;	// The last segment takes the remainder
+		if(m_i_num_segments == 0)
+			m_i_num_segments = 1;
+	}
+
+	m_ppc_mp3_data = new unsigned char*[m_i_num_segments];
+	m_pi_mp3_size = new int[m_i_num_segments];
+	for(int i=0;i<m_i_num_segments;i++)
+	{
+		m_ppc_mp3_data[i] = NULL;
+		m_pi_mp3_size[i] = 0;
+	}
+	m_i_segments_left = m_i_num_segments;
+
+	return m_i_num_segments;
+}
+
+int segment_job::set_segment_done(int i_segment, unsigned char *pc_mp3_data, int i_mp3_size)
+{
+	m_ppc_mp3_data[i_segment] = pc_mp3_data;
+	m_pi_mp3_size[i_segment] = i_mp3_size;
+
+	pthread_mutex_lock(&m_t_mutex);
+	int i_last = (--m_i_segments_left == 0);
+	pthread_mutex_unlock(&m_t_mutex);
+	return i_last;
+}
+
+int segment_job::write_mp3(mp3_writer *pc_mp3_writer)
+{
+	long l_mp3_bytes = 0;
+	for(int i=0;i<m_i_num_segments;i++)
+	{
+		if(m_pi_mp3_size[i] < 0)	// A gap would not play as the file
+			return 1;
+		l_mp3_bytes += m_pi_mp3_size[i];
+	}
+
+	if(pc_mp3_writer->open_file(m_pc_mp3_file, l_mp3_bytes))
+		return 1;
+	for(int i=0;i<m_i_num_segments;i++)
+		pc_mp3_writer->write(m_ppc_mp3_data[i], m_pi_mp3_size[i]);
+	return pc_mp3_writer->close_file();
+}
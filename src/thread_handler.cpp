@@ -1,81 +1,130 @@
-/**
-* @file thread_handler.cpp
-* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
-* @brief This file contains the thread_handler class.
-* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
-*/
-
-#include <thread_handler.h>
-#include <work_item.h>
-#include <work_queue.h>
-
-thread_handler::thread_handler(int i_thread_num, work_queue *pc_work_queue):
-	m_i_thread_num(i_thread_num), m_pc_work_queue(pc_work_queue)
-{
-	m_i_status = 0;
-	m_i_detached = 0;
-	m_p_func_ptr = NULL;
-}
-
-thread_handler::~thread_handler()
-{
-	if(m_i_status == 1 && m_i_detached == 0)
-		pthread_detach(m_t_id);
-	//if(m_i_status == 1)
-		pthread_cancel(m_t_id);
-}
-
-static void* runThread(void* arg)
-{
-	return ((thread_handler*)arg)->run_thread();
-}
-
-void *thread_handler::run_thread()
-{
-	while(1)
-	{
-		// Remove an item from the queue
-		work_item *pc_work_item = m_pc_work_queue->get_next_job();
-		m_pc_work_queue->inc_num_jobs_in_process();
-		pc_work_item->m_i_thread_num = m_i_thread_num;
-		if(pc_work_item->m_p_func_ptr != NULL)		// Call the provided function
-			pc_work_item->m_p_func_ptr(pc_work_item->m_p_args, m_i_thread_num);
-		else	// Use the default registered function
-			m_p_func_ptr(pc_work_item->m_p_args, m_i_thread_num);
-		m_pc_work_queue->set_job_done();
-	}
-	pthread_exit((void*) 0);
-}
-
-int thread_handler::start_thread()
-{
-	int result = pthread_create(&m_t_id, NULL, runThread, this);
-	if (result == 0)
-		m_i_status = 1;
-
-	return result;
-}
-
-int thread_handler::wait_till_thread_finished()
-{
-	int i_ret = -1;
-	if(m_i_status == 1)	// Still running
-	{
-		i_ret = pthread_join(m_t_id, NULL);	// Wait for the thread to finish
-		if(i_ret == 0)
-			m_i_detached = 1;
-	}
-	return i_ret;
-}
-
-int thread_handler::detach_thread()
-{
-	int i_ret = -1;
-	if (m_i_status == 1 && m_i_detached == 0) 
-	{
-		i_ret = pthread_detach(m_t_id);
-		if (i_ret == 0) 
-			m_i_detached = 1;
-	}
-	return i_ret;
+/**
+* @file thread_handler.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the thread_handler class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <thread_handler.h>
+#include <work_item.h>
+#include <work_queue.h>
+#include <work_steal_queue.h>
+#include <trace_log.h>
+#include <stdio.h>
+#include <time.h>
+
+thread_handler::thread_handler(int i_thread_num, work_queue *pc_work_queue, work_queue *pc_free_queue):
+	m_i_thread_num(i_thread_num), m_pc_work_queue(pc_work_queue), m_pc_free_queue(pc_free_queue)
+{
+	m_pc_steal_queue = NULL;
+	m_i_status = 0;
+	m_i_detached = 0;
+	m_ll_wait_ns = 0;
+	m_p_func_ptr = NULL;
+}
+
+thread_handler::thread_handler(int i_thread_num, work_steal_queue *pc_steal_queue):
+	m_i_thread_num(i_thread_num), m_pc_steal_queue(pc_steal_queue)
+{
+	m_pc_work_queue = NULL;
+	m_pc_free_queue = NULL;
+	m_i_status = 0;
+	m_i_detached = 0;
+	m_ll_wait_ns = 0;
+	m_p_func_ptr = NULL;
+}
+
+thread_handler::~thread_handler()
+{
+	if(m_i_status == 1 && m_i_detached == 0)
+		pthread_detach(m_t_id);
+	if(m_i_status == 1)
+		pthread_cancel(m_t_id);
+}
+
+static void* runThread(void* arg)
+{
+	return ((thread_handler*)arg)->run_thread();
+}
+
+void *thread_handler::run_thread()
+{
+	if(trace_log::is_on())
+	{
+		char pc_name[TRACE_NAME_LENGTH];
+		snprintf(pc_name, sizeof(pc_name), "worker %d", m_i_thread_num);
+		trace_log::set_thread_name(pc_name);
+	}
+
+	while(1)
+	{
+		// Remove an item from the queue
+		long long ll_trace_ns = trace_log::begin();
+		work_item *pc_work_item;
+		if(m_pc_steal_queue)
+			pc_work_item = m_pc_steal_queue->get_next_job(m_i_thread_num);
+		else
+			pc_work_item = m_pc_work_queue->get_next_job();
+		if(pc_work_item == NULL)	// Shut down
+			break;
+		trace_log::end("dequeue", ll_trace_ns);
+
+		timespec s_start;
+		clock_gettime(CLOCK_MONOTONIC, &s_start);
+		m_ll_wait_ns = s_start.tv_sec * 1000000000LL + s_start.tv_nsec - pc_work_item->m_ll_queued_ns;
+		ll_trace_ns = trace_log::begin();
+		if(pc_work_item->m_p_func_ptr != NULL)		// Call the provided function
+			pc_work_item->m_p_func_ptr(pc_work_item->m_p_args, m_i_thread_num);
+		else	// Use the default registered function
+			m_p_func_ptr(pc_work_item->m_p_args, m_i_thread_num);
+		trace_log::end("job", ll_trace_ns);
+
+		if(m_pc_steal_queue)
+			m_pc_steal_queue->set_job_done(pc_work_item);	// Also hands the work item back
+		else
+		{
+			// Hand the work item back so that the producer can reuse it. This comes before the 
+			// job done signal, after which the queues may be deleted.
+			if(m_pc_free_queue)
+				m_pc_free_queue->add_to_job(pc_work_item);
+			m_pc_work_queue->set_job_done();
+		}
+	}
+	pthread_exit((void*) 0);
+}
+
+int thread_handler::start_thread()
+{
+	int result = pthread_create(&m_t_id, NULL, runThread, this);
+	if (result == 0)
+		m_i_status = 1;
+
+	return result;
+}
+
+int thread_handler::wait_till_thread_finished()
+{
+	int i_ret = -1;
+	if(m_i_status == 1)	// Still running
+	{
+		i_ret = pthread_join(m_t_id, NULL);	// Wait for the thread to finish
+		if(i_ret == 0)
+		{
+			m_i_detached = 1;
+			m_i_status = 0;
+		}
+	}
+	return i_ret;
+}
+
+int thread_handler::detach_thread()
+{
+	int i_ret = -1;
+	if (m_i_status == 1 && m_i_detached == 0) 
+	{
+		i_ret = pthread_detach(m_t_id);
+		if (i_ret == 0) 
+			m_i_detached = 1;
+	}
+	return i_ret;
 }
\ No newline at end of file
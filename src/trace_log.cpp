@@ -0,0 +1,112 @@
+/**
+* @file trace_log.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the trace_log class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <trace_log.h>
+#include <stdio.h>
+#include <cstring>
+
+int trace_log::m_i_on = 0;
+long long trace_log::m_ll_start_ns = 0;
+trace_ring *trace_log::m_ps_rings = NULL;
+int trace_log::m_i_num_rings = 0;
+
+static __thread trace_ring *g_ps_thread_ring = NULL;	//!< Ring of the calling thread
+
+void trace_log::start()
+{
+	__atomic_store_n(&m_i_on, 1, __ATOMIC_RELAXED);
+	m_ll_start_ns = begin();
+}
+
+trace_ring *trace_log::get_ring()
+{
+	if(g_ps_thread_ring)
+		return g_ps_thread_ring;
+
+	trace_ring *ps_ring = new trace_ring;
+	ps_ring->l_head = 0;
+	ps_ring->i_tid = __atomic_fetch_add(&m_i_num_rings, 1, __ATOMIC_RELAXED);
+	snprintf(ps_ring->pc_thread_name, TRACE_NAME_LENGTH, "thread %d", ps_ring->i_tid);
+
+	// Push onto the list of rings
+	ps_ring->ps_next = __atomic_load_n(&m_ps_rings, __ATOMIC_RELAXED);
+	while(!__atomic_compare_exchange_n(&m_ps_rings, &ps_ring->ps_next, ps_ring, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	g_ps_thread_ring = ps_ring;
+	return ps_ring;
+}
+
+void trace_log::set_thread_name(const char *pc_name)
+{
+	if(!is_on())
+		return;
+	trace_ring *ps_ring = get_ring();
+	snprintf(ps_ring->pc_thread_name, TRACE_NAME_LENGTH, "%s", pc_name);
+}
+
+void trace_log::end(const char *pc_name, long long ll_start_ns, long l_bytes)
+{
+	if(ll_start_ns == 0 || !is_on())
+		return;
+
+	trace_ring *ps_ring = get_ring();
+	trace_event *ps_event = &ps_ring->ps_events[ps_ring->l_head % TRACE_RING_EVENTS];
+	ps_event->pc_name = pc_name;
+	ps_event->ll_start_ns = ll_start_ns;
+	ps_event->ll_end_ns = begin();
+	ps_event->l_bytes = l_bytes;
+	__atomic_store_n(&ps_ring->l_head, ps_ring->l_head + 1, __ATOMIC_RELEASE);	// The span is complete
+}
+
+int trace_log::write(const char *pc_trace_file)
+{
+	__atomic_store_n(&m_i_on, 0, __ATOMIC_RELAXED);
+
+	FILE *f_trace = fopen(pc_trace_file, "w");
+	if(f_trace == NULL)
+	{
+		fprintf(stderr, "File %s Line %d: WARNING Cannot write trace file %s.\n", __FILE__, __LINE__, pc_trace_file);
+		return 1;
+	}
+
+	// Complete events ("X") in usec since tracing started, one row (tid) per thread
+	long l_spans = 0, l_lost = 0;
+	fprintf(f_trace, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	fprintf(f_trace, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"wav2mp3\"}}");
+	for(trace_ring *ps_ring = __atomic_load_n(&m_ps_rings, __ATOMIC_ACQUIRE); ps_ring; ps_ring = ps_ring->ps_next)
+	{
+		fprintf(f_trace, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+			ps_ring->i_tid, ps_ring->pc_thread_name);
+
+		long l_head = __atomic_load_n(&ps_ring->l_head, __ATOMIC_ACQUIRE);
+		long l_first = (l_head > TRACE_RING_EVENTS) ? l_head - TRACE_RING_EVENTS : 0;
+		for(long i=l_first;i<l_head;i++)
+		{
+			trace_event *ps_event = &ps_ring->ps_events[i % TRACE_RING_EVENTS];
+			fprintf(f_trace, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+				ps_event->pc_name, ps_ring->i_tid, (ps_event->ll_start_ns - m_ll_start_ns) / 1e3,
+				(ps_event->ll_end_ns - ps_event->ll_start_ns) / 1e3);
+			if(ps_event->l_bytes >= 0)
+				fprintf(f_trace, ", \"args\": {\"bytes\": %ld}", ps_event->l_bytes);
+			fprintf(f_trace, "}");
+		}
+		l_spans += l_head - l_first;
+		l_lost += l_first;
+	}
+	fprintf(f_trace, "\n]}\n");
+
+	if(fclose(f_trace))
+	{
+		fprintf(stderr, "File %s Line %d: WARNING Cannot write trace file %s.\n", __FILE__, __LINE__, pc_trace_file);
+		return 1;
+	}
+	fprintf(stderr, "Trace of %d threads written to %s: %ld spans", m_i_num_rings, pc_trace_file, l_spans);
+	if(l_lost)
+		fprintf(stderr, ", %ld oldest overwritten", l_lost);
+	fprintf(stderr, "\n");
+	return 0;
+}
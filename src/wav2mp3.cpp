@@ -0,0 +1,336 @@
+/**
+* @file wav2mp3.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the wav2mp3 class, the interface of libwav2mp3.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <wav2mp3.h>
+#include <wave_to_mp3.h>
+#include <cstring>
+
+/**
+*	Get a little endian number from a wave header.
+*/
+static int get_le(const unsigned char *pc_data, int i_bytes)
+{
+	int i_value = 0;
+	for(int i=i_bytes-1;i>=0;i--)
+		i_value = (i_value << 8) | pc_data[i];
+	if(i_bytes == 2)
+		i_value = (short)i_value;
+	return i_value;
+}
+
+/**
+*	Check that samples of a format can be encoded.
+*/
+static int check_format(const wav2mp3_format *ps_format)
+{
+	if(ps_format == NULL || ps_format->i_sample_rate <= 0)
+		return WAV2MP3_ERROR_FORMAT;
+	if(ps_format->i_channels != 1 && ps_format->i_channels != 2)
+		return WAV2MP3_ERROR_FORMAT;
+	if(ps_format->i_bits_per_sample != 16 && ps_format->i_bits_per_sample != 24 && ps_format->i_bits_per_sample != 32)
+		return WAV2MP3_ERROR_FORMAT;
+	return 0;
+}
+
+/**
+*	Get the room left in a buffer of the caller, as lame takes it.
+*/
+static int get_room(long l_bytes)
+{
+	return (l_bytes < 0x7FFFFFFFL) ? (int)l_bytes : 0x7FFFFFFF;
+}
+
+/**
+*	Fill the wave header the encoder sets up from.
+*/
+static void fill_header(const wav2mp3_format *ps_format, wave_header *ps_wave_header)
+{
+	int i_block_align = ps_format->i_channels * ps_format->i_bits_per_sample / 8;
+
+	memset(ps_wave_header, 0, sizeof(wave_header));
+	memcpy(ps_wave_header->group_id, "RIFF", 4);
+	memcpy(ps_wave_header->wave, "WAVE", 4);
+	memcpy(ps_wave_header->subchunk1_id, "fmt ", 4);
+	memcpy(ps_wave_header->chunk2_id, "data", 4);
+	ps_wave_header->subchunk1_size = 16;
+	ps_wave_header->audio_format = 1;
+	ps_wave_header->num_channels = ps_format->i_channels;
+	ps_wave_header->sample_rate = ps_format->i_sample_rate;
+	ps_wave_header->bitrate = ps_format->i_sample_rate * i_block_align;
+	ps_wave_header->block_align = i_block_align;
+	ps_wave_header->bits_per_sample = ps_format->i_bits_per_sample;
+}
+
+wav2mp3::wav2mp3(int i_quality)
+{
+	m_pc_wave2mp3 = new wave_to_mp3();
+	m_pc_wave2mp3->set_quality(i_quality);
+	memset(&m_s_header, 0, sizeof(wave_header));
+	m_i_streaming = 0;
+	m_i_block_align = 0;
+	m_i_itr_bytes = 0;
+	m_i_slice_itrs = 0;
+	m_i_pending = 0;
+
+	// An iteration of samples and the mp3 data of a few fit into blocks of the arena
+	m_pc_pending = m_pc_wave2mp3->get_arena()->borrow(wave_to_mp3::get_read_buffer_size());
+	m_pc_mp3_buffer = m_pc_wave2mp3->get_arena()->borrow(ARENA_BLOCK_BYTES);
+}
+
+wav2mp3::~wav2mp3()
+{
+	if(m_i_streaming)
+		m_pc_wave2mp3->end_stream(m_pc_mp3_buffer, ARENA_BLOCK_BYTES);
+	m_pc_wave2mp3->get_arena()->give_back(m_pc_pending);
+	m_pc_wave2mp3->get_arena()->give_back(m_pc_mp3_buffer);
+	delete m_pc_wave2mp3;
+}
+
+int wav2mp3::read_header(const unsigned char *pc_wave, long l_bytes, wav2mp3_format *ps_format,
+	long *pl_header_bytes, long *pl_data_bytes)
+{
+	if(pc_wave == NULL || l_bytes < 0)
+		return WAV2MP3_ERROR_FORMAT;
+	if(l_bytes < 12)
+		return WAV2MP3_ERROR_TRUNCATED;
+	if(memcmp(pc_wave, "RIFF", 4) || memcmp(pc_wave + 8, "WAVE", 4))
+		return WAV2MP3_ERROR_FORMAT;
+
+	// Chunks are an id, a size and the data, padded to an even size
+	int i_fmt = 0;
+	for(long l_pos = 12; ; )
+	{
+		if(l_pos + 8 > l_bytes)
+			return WAV2MP3_ERROR_TRUNCATED;
+		const unsigned char *pc_chunk = pc_wave + l_pos;
+		long l_size = (unsigned int)get_le(pc_chunk + 4, 4);
+
+		if(!memcmp(pc_chunk, "data", 4))
+		{
+			if(!i_fmt)
+				return WAV2MP3_ERROR_FORMAT;
+			*pl_header_bytes = l_pos + 8;
+			*pl_data_bytes = (l_size == 0 || l_size == 0xFFFFFFFFL) ? -1 : l_size;
+			return check_format(ps_format);
+		}
+		if(!memcmp(pc_chunk, "fmt ", 4))
+		{
+			if(l_size < 16)
+				return WAV2MP3_ERROR_FORMAT;
+			if(l_pos + 8 + l_size > l_bytes)
+				return WAV2MP3_ERROR_TRUNCATED;
+
+			// WAVE_FORMAT_EXTENSIBLE keeps the format in the first 2 bytes of its subformat GUID
+			const unsigned char *pc_fmt = pc_chunk + 8;
+			int i_format = get_le(pc_fmt, 2) & 0xFFFF;
+			if(i_format == 0xFFFE)
+				i_format = (l_size >= 40) ? get_le(pc_fmt + 24, 2) : 0;
+			if(i_format != 1)
+				return WAV2MP3_ERROR_FORMAT;
+			ps_format->i_channels = get_le(pc_fmt + 2, 2);
+			ps_format->i_sample_rate = get_le(pc_fmt + 4, 4);
+			ps_format->i_bits_per_sample = get_le(pc_fmt + 14, 2);
+			i_fmt = 1;
+		}
+		else if(l_size == 0xFFFFFFFFL)	// Only the data may run up to the end
+			return WAV2MP3_ERROR_FORMAT;
+		l_pos += 8 + l_size + (l_size & 1);
+	}
+}
+
+int wav2mp3::read_wave(const unsigned char *pc_wave, long l_bytes, wav2mp3_format *ps_format,
+	const unsigned char **ppc_pcm, long *pl_pcm_bytes)
+{
+	long l_header_bytes, l_data_bytes;
+	int i_ret = read_header(pc_wave, l_bytes, ps_format, &l_header_bytes, &l_data_bytes);
+	if(i_ret)
+		return WAV2MP3_ERROR_FORMAT;	// Truncated as well, the file is all there is
+
+	// Chunks after the data are not samples
+	*ppc_pcm = pc_wave + l_header_bytes;
+	*pl_pcm_bytes = l_bytes - l_header_bytes;
+	if(l_data_bytes >= 0 && l_data_bytes < *pl_pcm_bytes)
+		*pl_pcm_bytes = l_data_bytes;
+	return 0;
+}
+
+int wav2mp3::begin(const wav2mp3_format *ps_format)
+{
+	if(m_i_streaming)
+		return WAV2MP3_ERROR_STATE;
+	if(check_format(ps_format))
+		return WAV2MP3_ERROR_FORMAT;
+
+	fill_header(ps_format, &m_s_header);
+	int i_error = m_pc_wave2mp3->begin_stream(&m_s_header);
+	if(i_error)
+		return (i_error == WAVE_TO_MP3_ERROR_FORMAT) ? WAV2MP3_ERROR_FORMAT : WAV2MP3_ERROR_ENCODE;
+	m_i_block_align = m_s_header.block_align;
+	m_i_itr_bytes = wave_to_mp3::get_samples_per_itr(&m_s_header) * m_i_block_align;
+	m_i_slice_itrs = ARENA_BLOCK_BYTES / m_pc_wave2mp3->get_stream_buffer_size(m_i_itr_bytes / m_i_block_align);
+	m_i_pending = 0;
+	m_i_streaming = 1;
+	return 0;
+}
+
+int wav2mp3::encode(const unsigned char *pc_pcm, long l_samples, std::vector<unsigned char> *pv_mp3)
+{
+	// In slices whose worst case output fits into m_pc_mp3_buffer
+	long l_slice_samples = (long)m_i_slice_itrs * (m_i_itr_bytes / m_i_block_align);
+	while(l_samples > 0)
+	{
+		int i_samples = (l_samples < l_slice_samples) ? (int)l_samples : (int)l_slice_samples;
+		int i_mp3_bytes = m_pc_wave2mp3->encode_stream(pc_pcm, i_samples, m_pc_mp3_buffer, ARENA_BLOCK_BYTES);
+		if(i_mp3_bytes < 0)	// The encoder cannot go on, it is given back
+		{
+			m_pc_wave2mp3->end_stream(m_pc_mp3_buffer, ARENA_BLOCK_BYTES);
+			m_i_streaming = 0;
+			return WAV2MP3_ERROR_ENCODE;
+		}
+		pv_mp3->insert(pv_mp3->end(), m_pc_mp3_buffer, m_pc_mp3_buffer + i_mp3_bytes);
+		pc_pcm += (long)i_samples * m_i_block_align;
+		l_samples -= i_samples;
+	}
+	return 0;
+}
+
+long wav2mp3::push(const unsigned char *pc_pcm, long l_bytes, std::vector<unsigned char> *pv_mp3)
+{
+	if(!m_i_streaming)
+		return WAV2MP3_ERROR_STATE;
+
+	size_t l_start = pv_mp3->size();
+
+	// Complete the iteration left over from the last push
+	if(m_i_pending > 0)
+	{
+		int i_copy = (l_bytes < m_i_itr_bytes - m_i_pending) ? (int)l_bytes : m_i_itr_bytes - m_i_pending;
+		memcpy(m_pc_pending + m_i_pending, pc_pcm, i_copy);
+		m_i_pending += i_copy;
+		pc_pcm += i_copy;
+		l_bytes -= i_copy;
+		if(m_i_pending < m_i_itr_bytes)
+			return 0;
+		if(encode(m_pc_pending, m_i_itr_bytes / m_i_block_align, pv_mp3))
+			return WAV2MP3_ERROR_ENCODE;
+		m_i_pending = 0;
+	}
+
+	// Whole iterations straight from the caller, the rest waits for the next push
+	long l_whole = l_bytes / m_i_itr_bytes * m_i_itr_bytes;
+	if(encode(pc_pcm, l_whole / m_i_block_align, pv_mp3))
+		return WAV2MP3_ERROR_ENCODE;
+	m_i_pending = (int)(l_bytes - l_whole);
+	memcpy(m_pc_pending, pc_pcm + l_whole, m_i_pending);
+
+	return pv_mp3->size() - l_start;
+}
+
+long wav2mp3::finish(std::vector<unsigned char> *pv_mp3)
+{
+	if(!m_i_streaming)
+		return WAV2MP3_ERROR_STATE;
+
+	size_t l_start = pv_mp3->size();
+	if(encode(m_pc_pending, m_i_pending / m_i_block_align, pv_mp3))
+		return WAV2MP3_ERROR_ENCODE;
+	m_i_pending = 0;
+
+	int i_mp3_bytes = m_pc_wave2mp3->end_stream(m_pc_mp3_buffer, ARENA_BLOCK_BYTES);
+	m_i_streaming = 0;
+	if(i_mp3_bytes < 0)
+		return WAV2MP3_ERROR_ENCODE;
+	pv_mp3->insert(pv_mp3->end(), m_pc_mp3_buffer, m_pc_mp3_buffer + i_mp3_bytes);
+
+	return pv_mp3->size() - l_start;
+}
+
+long wav2mp3::encode_pcm(const wav2mp3_format *ps_format, const unsigned char *pc_pcm, long l_bytes,
+	std::vector<unsigned char> *pv_mp3)
+{
+	int i_ret = begin(ps_format);
+	if(i_ret)
+		return i_ret;
+
+	long l_mp3_bytes = push(pc_pcm, l_bytes, pv_mp3);
+	if(l_mp3_bytes < 0)
+		return l_mp3_bytes;
+	long l_finish_bytes = finish(pv_mp3);
+	return (l_finish_bytes < 0) ? l_finish_bytes : l_mp3_bytes + l_finish_bytes;
+}
+
+long wav2mp3::encode_wave(const unsigned char *pc_wave, long l_bytes, std::vector<unsigned char> *pv_mp3)
+{
+	wav2mp3_format s_format;
+	const unsigned char *pc_pcm;
+	long l_pcm_bytes;
+
+	int i_ret = read_wave(pc_wave, l_bytes, &s_format, &pc_pcm, &l_pcm_bytes);
+	if(i_ret)
+		return i_ret;
+	return encode_pcm(&s_format, pc_pcm, l_pcm_bytes, pv_mp3);
+}
+
+long wav2mp3::encode_pcm(const wav2mp3_format *ps_format, const unsigned char *pc_pcm, long l_bytes,
+	unsigned char *pc_mp3, long l_mp3_size)
+{
+	// The worst case must fit, so that lame never runs out of room half way
+	long l_max_bytes = get_max_mp3_bytes(ps_format, l_bytes);
+	if(l_max_bytes < 0)
+		return l_max_bytes;
+	if(l_mp3_size < l_max_bytes)
+		return WAV2MP3_ERROR_BUFFER;
+
+	int i_ret = begin(ps_format);
+	if(i_ret)
+		return i_ret;
+
+	// Straight into the buffer of the caller, in the same pieces as push and finish hand to the encoder
+	long l_samples = l_bytes / m_i_block_align;
+	long l_slice_samples = (long)m_i_slice_itrs * (m_i_itr_bytes / m_i_block_align);
+	long l_mp3_bytes = 0;
+	while(l_samples > 0)
+	{
+		int i_samples = (l_samples < l_slice_samples) ? (int)l_samples : (int)l_slice_samples;
+		int i_mp3_bytes = m_pc_wave2mp3->encode_stream(pc_pcm, i_samples, pc_mp3 + l_mp3_bytes, 
+			get_room(l_mp3_size - l_mp3_bytes));
+		if(i_mp3_bytes < 0)
+		{
+			m_pc_wave2mp3->end_stream(m_pc_mp3_buffer, ARENA_BLOCK_BYTES);
+			m_i_streaming = 0;
+			return WAV2MP3_ERROR_ENCODE;
+		}
+		l_mp3_bytes += i_mp3_bytes;
+		pc_pcm += (long)i_samples * m_i_block_align;
+		l_samples -= i_samples;
+	}
+
+	int i_mp3_bytes = m_pc_wave2mp3->end_stream(pc_mp3 + l_mp3_bytes, get_room(l_mp3_size - l_mp3_bytes));
+	m_i_streaming = 0;
+	return (i_mp3_bytes < 0) ? WAV2MP3_ERROR_ENCODE : l_mp3_bytes + i_mp3_bytes;
+}
+
+long wav2mp3::encode_wave(const unsigned char *pc_wave, long l_bytes, unsigned char *pc_mp3, long l_mp3_size)
+{
+	wav2mp3_format s_format;
+	const unsigned char *pc_pcm;
+	long l_pcm_bytes;
+
+	int i_ret = read_wave(pc_wave, l_bytes, &s_format, &pc_pcm, &l_pcm_bytes);
+	if(i_ret)
+		return i_ret;
+	return encode_pcm(&s_format, pc_pcm, l_pcm_bytes, pc_mp3, l_mp3_size);
+}
+
+long wav2mp3::get_max_mp3_bytes(const wav2mp3_format *ps_format, long l_bytes)
+{
+	if(check_format(ps_format))
+		return WAV2MP3_ERROR_FORMAT;
+
+	return wave_to_mp3::get_max_mp3_bytes(ps_format->i_sample_rate, 
+		ps_format->i_channels * ps_format->i_bits_per_sample / 8, l_bytes);
+}
@@ -0,0 +1,159 @@
+/**
+* @file wave_corpus.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the wave_corpus class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <wave_corpus.h>
+#include <wave_read.h>
+#include <stdio.h>
+#include <cstdlib>
+#include <cstring>
+#include <math.h>
+#include <unistd.h>
+
+#define		CORPUS_WRITE_SAMPLES	(64*1024)	//!< Samples (per channel) written at once
+
+using namespace std;
+
+wave_corpus::wave_corpus()
+{
+	m_d_audio_seconds = 0;
+	m_l_bytes = 0;
+	m_s_formats[0].i_sample_rate = 44100;
+	m_s_formats[0].i_channels = 2;
+	m_s_formats[0].i_bits_per_sample = 16;
+	m_i_num_formats = 1;
+}
+
+wave_corpus::~wave_corpus()
+{
+	for(size_t i=0;i<m_v_wave_files.size();i++)
+	{
+		string s_mp3_file = m_v_wave_files[i].substr(0, m_v_wave_files[i].size()-4) + ".mp3";
+		unlink(m_v_wave_files[i].c_str());
+		unlink(s_mp3_file.c_str());
+	}
+	if(!m_s_dir.empty())
+		rmdir(m_s_dir.c_str());
+}
+
+int wave_corpus::set_formats(const char *pc_formats)
+{
+	int i_num_formats = 0;
+	const char *pc_format = pc_formats;
+	while(pc_format && i_num_formats < CORPUS_MAX_FORMATS)
+	{
+		wav2mp3_format *ps_format = &m_s_formats[i_num_formats];
+		if(sscanf(pc_format, "%d/%d/%d", &ps_format->i_sample_rate, &ps_format->i_channels, &ps_format->i_bits_per_sample) != 3 ||
+			ps_format->i_sample_rate < 8000 || ps_format->i_sample_rate > 48000 ||
+			ps_format->i_channels < 1 || ps_format->i_channels > 2 ||
+			(ps_format->i_bits_per_sample != 16 && ps_format->i_bits_per_sample != 24 && ps_format->i_bits_per_sample != 32))
+			return 1;
+		i_num_formats++;
+		pc_format = strchr(pc_format, ',');
+		if(pc_format)
+			pc_format++;
+	}
+	if(pc_format)	// Too many
+		return 1;
+	m_i_num_formats = i_num_formats;
+	return 0;
+}
+
+int wave_corpus::write_file(const char *pc_wave_file, const wav2mp3_format *ps_format, int i_samples, int i_seed)
+{
+	int i_bytes = ps_format->i_bits_per_sample / 8;
+	int i_block_align = i_bytes * ps_format->i_channels;
+
+	wave_header s_header;
+	memcpy(s_header.group_id, "RIFF", 4);
+	s_header.file_size = sizeof(wave_header) - 8 + i_samples * i_block_align;
+	memcpy(s_header.wave, "WAVE", 4);
+	memcpy(s_header.subchunk1_id, "fmt ", 4);
+	s_header.subchunk1_size = 16;
+	s_header.audio_format = 1;
+	s_header.num_channels = ps_format->i_channels;
+	s_header.sample_rate = ps_format->i_sample_rate;
+	s_header.bitrate = ps_format->i_sample_rate * i_block_align;
+	s_header.block_align = i_block_align;
+	s_header.bits_per_sample = ps_format->i_bits_per_sample;
+	memcpy(s_header.chunk2_id, "data", 4);
+	s_header.chunk2_size = i_samples * i_block_align;
+
+	FILE *f_wave = fopen(pc_wave_file, "wb");
+	if(f_wave == NULL)
+		return 1;
+	int i_error = (fwrite(&s_header, sizeof(wave_header), 1, f_wave) != 1);
+
+	// A tone per channel, turned by a rotation per sample instead of calling sin, plus noise
+	double pd_cos[2], pd_sin[2], pd_re[2] = {0.5, 0.5}, pd_im[2] = {0, 0};
+	for(int c=0;c<2;c++)
+	{
+		double d_freq = 110.0 * (2 + (i_seed * 7 + c * 3) % 17);
+		pd_cos[c] = cos(2 * M_PI * d_freq / ps_format->i_sample_rate);
+		pd_sin[c] = sin(2 * M_PI * d_freq / ps_format->i_sample_rate);
+	}
+	unsigned int ui_noise = i_seed * 2654435761u + 1;
+
+	unsigned char *pc_data = new unsigned char[CORPUS_WRITE_SAMPLES * i_block_align];
+	for(int i=0;i<i_samples && !i_error;i+=CORPUS_WRITE_SAMPLES)
+	{
+		int i_block = (i_samples - i < CORPUS_WRITE_SAMPLES) ? i_samples - i : CORPUS_WRITE_SAMPLES;
+		long l_pos = 0;
+		for(int s=0;s<i_block;s++)
+		{
+			for(int c=0;c<ps_format->i_channels;c++)
+			{
+				double d_re = pd_re[c] * pd_cos[c] - pd_im[c] * pd_sin[c];
+				pd_im[c] = pd_re[c] * pd_sin[c] + pd_im[c] * pd_cos[c];
+				pd_re[c] = d_re;
+				ui_noise = ui_noise * 1664525 + 1013904223;
+				int i_sample = (int)(pd_re[c] * 2147483647.0) + ((int)ui_noise >> 4);
+				for(int b=0;b<i_bytes;b++)	// Little endian, the upper bytes of the 32 bit sample
+					pc_data[l_pos++] = i_sample >> (8 * (4 - i_bytes + b));
+			}
+		}
+		i_error = (fwrite(pc_data, 1, l_pos, f_wave) != (size_t)l_pos);
+	}
+	delete [] pc_data;
+
+	i_error |= fclose(f_wave);
+	return i_error;
+}
+
+int wave_corpus::generate(const char *pc_parent_dir, int i_files, double d_min_seconds, double d_max_seconds)
+{
+	string s_dir_template = string(pc_parent_dir) + "/wav2mp3_corpus_XXXXXX";
+	char *pc_dir = mkdtemp(&s_dir_template[0]);
+	if(pc_dir == NULL)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot make a directory in %s.\n", __FILE__, __LINE__, pc_parent_dir);
+		return 1;
+	}
+	m_s_dir = pc_dir;
+
+	for(int i=0;i<i_files;i++)
+	{
+		// Evenly on a log scale, in a shuffled order (golden ratio steps)
+		double d_fraction = fmod(i * 0.6180339887498949, 1.0);
+		double d_seconds = d_min_seconds * pow(d_max_seconds / d_min_seconds, d_fraction);
+
+		const wav2mp3_format *ps_format = &m_s_formats[i % m_i_num_formats];
+		int i_samples = (int)(d_seconds * ps_format->i_sample_rate);
+		char pc_name[64];
+		snprintf(pc_name, sizeof(pc_name), "/corpus_%05d.wav", i);
+		string s_wave_file = m_s_dir + pc_name;
+		if(write_file(s_wave_file.c_str(), ps_format, i_samples, i))
+		{
+			fprintf(stderr, "File %s Line %d: ERROR Cannot write %s.\n", __FILE__, __LINE__, s_wave_file.c_str());
+			unlink(s_wave_file.c_str());
+			return 1;
+		}
+		m_v_wave_files.push_back(s_wave_file);
+		m_d_audio_seconds += (double)i_samples / ps_format->i_sample_rate;
+		m_l_bytes += sizeof(wave_header) + (long)i_samples * ps_format->i_channels * ps_format->i_bits_per_sample / 8;
+	}
+	return 0;
+}
@@ -1,322 +1,602 @@
-/**
-* @file wave_read.cpp
-* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
-* @brief Read wav class.
-* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
-*/
-
-#include <wave_read.h>
-#include <cstdlib>
-#include <cstring>
-
-using namespace std;
-
-wave_read::wave_read()
-{
-	m_ps_wave_header = new wave_header;
-	m_pc_header_buffer = new unsigned char[sizeof(wave_header)];
-	m_pc_buffer = NULL;
-	m_f_wave_file = NULL;
-}
-
-void wave_read::init(char *pc_wave_file, int i_buff_size_in_bytes)
-{
-	m_pc_file_name = pc_wave_file;
-	
-	if(m_f_wave_file) fclose(m_f_wave_file);
-	if(!(m_f_wave_file = fopen(pc_wave_file, "rb")))
-	{
-		fprintf(stderr, "File %s Line %d: ERROR Cannot open wave file %s to read.\n",
-			__FILE__, __LINE__, pc_wave_file);
-		exit(1);
-	}
-		
-	// @todo Will need to fix this in case there are more chunks in the header
-	if(fread(m_pc_header_buffer,sizeof(wave_header),1,m_f_wave_file) <= 0)
-	{
-		fprintf(stderr, "File %s Line %d: ERROR Could not read header.\n", __FILE__,  __LINE__);
-		exit(1);
-	}
-
-	fill_wave_header();
-	if(sanity_check())
-	{
-		fprintf(stderr, "File %s Line %d: WARNING Header not compliant.\n", __FILE__,  __LINE__);
-	}
-
-	m_i_bytes_per_sample = m_ps_wave_header->bits_per_sample/8;
-	m_i_total_samples =  m_ps_wave_header->chunk2_size / (m_ps_wave_header->num_channels * m_ps_wave_header->bits_per_sample/8);
-	
-	m_i_buff_size_in_bytes = i_buff_size_in_bytes;
-	if(m_pc_buffer) delete [] m_pc_buffer;
-	m_pc_buffer = new unsigned char[m_i_buff_size_in_bytes];
-}
-
-void wave_read::fill_wave_header()
-{
-	unsigned char *pcHeaderBuffer = m_pc_header_buffer;
-
-	unsigned char pucBuffer[5];		// Read and compare buffer
-	pucBuffer[4] = '\0';
-
-	//*********************
-	// Header
-	// RIFF Chunk ID
-	memcpy(pucBuffer,pcHeaderBuffer,4);
-	pcHeaderBuffer += 4;
-	strncpy(m_ps_wave_header->group_id,(char *)pucBuffer,4);
-
-	// Chunk size
-	memcpy(pucBuffer,pcHeaderBuffer,4);
-	pcHeaderBuffer += 4;
-	m_ps_wave_header->file_size = pucBuffer[0] + (pucBuffer[1]<<8) + (pucBuffer[2]<<16)
-		+ (pucBuffer[3]<<24);
-
-	// WAVE
-	memcpy(pucBuffer,pcHeaderBuffer,4);
-	pcHeaderBuffer += 4;
-	strncpy(m_ps_wave_header->wave,(char *)pucBuffer,4);
-
-	//***********************
-	// Format chunk
-	// fmt
-	memcpy(pucBuffer,pcHeaderBuffer,4);
-	pcHeaderBuffer += 4;
-	strncpy(m_ps_wave_header->subchunk1_id,(char *)pucBuffer,4);
-
-	// Chunk size
-	memcpy(pucBuffer,pcHeaderBuffer,4);
-	pcHeaderBuffer += 4;
-	m_ps_wave_header->subchunk1_size = pucBuffer[0] + (pucBuffer[1]<<8) + (pucBuffer[2]<<16)
-		+ (pucBuffer[3]<<24);
-
-	// Audio fmt
-	memcpy(pucBuffer,pcHeaderBuffer,2);
-	pcHeaderBuffer += 2;
-	m_ps_wave_header->audio_format = pucBuffer[0] + (pucBuffer[1]<<8);
-
-	// Number of channels
-	memcpy(pucBuffer,pcHeaderBuffer,2);
-	pcHeaderBuffer += 2;
-	m_ps_wave_header->num_channels = pucBuffer[0] + (pucBuffer[1]<<8);
-
-	// Sample rate
-	memcpy(pucBuffer,pcHeaderBuffer,4);
-	pcHeaderBuffer += 4;
-	m_ps_wave_header->sample_rate = pucBuffer[0] + (pucBuffer[1]<<8) + (pucBuffer[2]<<16)
-		+ (pucBuffer[3]<<24);
-
-	// Byte rate = num_channels * sample_rate * bits_per_sample/8
-	memcpy(pucBuffer,pcHeaderBuffer,4);
-	pcHeaderBuffer += 4;
-	m_ps_wave_header->bitrate = pucBuffer[0] + (pucBuffer[1]<<8) + (pucBuffer[2]<<16)
-		+ (pucBuffer[3]<<24);
-
-	// Block align =  num_channels * bits_per_sample/8
-	memcpy(pucBuffer,pcHeaderBuffer,2);
-	pcHeaderBuffer += 2;
-	m_ps_wave_header->block_align = pucBuffer[0] + (pucBuffer[1]<<8);
-
-	// Bits per sample
-	memcpy(pucBuffer,pcHeaderBuffer,2);
-	pcHeaderBuffer += 2;
-	m_ps_wave_header->bits_per_sample = pucBuffer[0] + (pucBuffer[1]<<8);
-
-	//***************************
-	// Data chunck
-	// ID
-	memcpy(pucBuffer,pcHeaderBuffer,4);
-	pcHeaderBuffer += 4;
-	strncpy(m_ps_wave_header->chunk2_id,(char *)pucBuffer,4);
-
-	// Size
-	memcpy(pucBuffer,pcHeaderBuffer,4);
-	pcHeaderBuffer += 4;
-	m_ps_wave_header->chunk2_size = pucBuffer[0] + (pucBuffer[1]<<8) + (pucBuffer[2]<<16)
-		+ (pucBuffer[3]<<24);
-
-}
-
-int	wave_read::sanity_check(wave_header *ps_wave_header)
-{
-	int iRet = 0;
-	m_i_sanity_pass = 1;
-	if(strncmp((char *)ps_wave_header->group_id, "RIFF", 4))
-	{
-		fprintf(stderr, "File %s Line %d: WARNING RIFF fmt not detected.\n", __FILE__,  __LINE__);
-		iRet = 1;
-	}
-	
-	if(strncmp((char *)ps_wave_header->wave, "WAVE", 4))
-	{
-		fprintf(stderr, "File %s Line %d: WARNING WAVE fmt not detected.\n", __FILE__,  __LINE__);
-		iRet = 2;
-	}
-
-	if(strncmp((char *)ps_wave_header->subchunk1_id, "fmt ", 4))
-	{
-		fprintf(stderr, "File %s Line %d: WARNING fmt not detected.\n", __FILE__,  __LINE__);
-		iRet = 3;
-	}
-
-	if(ps_wave_header->subchunk1_size != 16)
-	{
-		fprintf(stderr, "File %s Line %d: WARNING PCM fmt not detected.\n", __FILE__,  __LINE__);
-		iRet = 4;
-	}
-	
-	if(m_ps_wave_header->audio_format != 1)
-	{
-		fprintf(stderr, "File %s Line %d: WARNING PCM fmt not detected.\n", __FILE__,  __LINE__);
-		iRet = 5;
-	}
-
-	if(strncmp(m_ps_wave_header->chunk2_id, "data", 4))
-	{
-		fprintf(stderr, "File %s Line %d: WARNING data fmt not detected.\n", __FILE__,  __LINE__);
-		iRet = 6;
-	}
-
-	if(ps_wave_header->bitrate != ((ps_wave_header->num_channels * ps_wave_header->sample_rate * 
-		ps_wave_header->bits_per_sample) >> 3)) 
-	{
-		fprintf(stderr, "File %s Line %d: WARNING byte_rate != num_channels * sample_rate * \
-			bytes_per_sample.\n", __FILE__,  __LINE__);
-		iRet = 7;
-	}
-
-	if(ps_wave_header->block_align != ((ps_wave_header->num_channels * ps_wave_header->bits_per_sample) >> 3))
-	{
-		fprintf(stderr, "File %s Line %d: WARNING block_align != num_channels *	bytes_per_sample.\n", __FILE__,  __LINE__);
-		iRet = 8;
-	}
-	
-	if(ps_wave_header->num_channels > 2)
-	{
-		fprintf(stderr, "File %s Line %d: WARNING More than two channels.\n", __FILE__,  __LINE__);
-		iRet = 9;
-	}
-
-	if(iRet != 0)
-		m_i_sanity_pass = 0;
-
-	return iRet;
-}
-
-void wave_read::display_wave_info()
-{
-	fprintf(stdout,"file:                 %s\n", m_pc_file_name);
-	fprintf(stdout,"group_id:             %.4s\n", m_ps_wave_header->group_id);
-	fprintf(stdout,"file_size:            %d\n", m_ps_wave_header->file_size);
-	fprintf(stdout,"wave:                 %.4s\n", m_ps_wave_header->wave);
-	fprintf(stdout,"subchunk1_id:         %.4s\n", m_ps_wave_header->subchunk1_id);
-	fprintf(stdout,"subchunk1_size:       %d\n", m_ps_wave_header->subchunk1_size);
-	fprintf(stdout,"audio_format:         %d\n", m_ps_wave_header->audio_format);
-	fprintf(stdout,"num_channels:         %d\n", m_ps_wave_header->num_channels);
-	fprintf(stdout,"sample_rate:          %d\n", m_ps_wave_header->sample_rate);
-	fprintf(stdout,"bitrate:              %d\n", m_ps_wave_header->bitrate);
-	fprintf(stdout,"block_align:          %d\n", m_ps_wave_header->block_align);
-	fprintf(stdout,"bits_per_sample:      %d\n", m_ps_wave_header->bits_per_sample);
-	fprintf(stdout,"chunk2_id:            %.4s\n", m_ps_wave_header->chunk2_id);
-	fprintf(stdout,"chunk2_size:          %d\n", m_ps_wave_header->chunk2_size);
-	fprintf(stdout,"Sanity check:         %s\n", (m_i_sanity_pass? "PASSED": "FAILED"));
-	fprintf(stdout,"\n\n");
-}
-
-int	wave_read::fill_wave_buffer(short **ppi_pcm_buffer, int i_samples)
-{
-	if(m_pc_buffer == NULL)
-	{
-		fprintf(stderr, "File %s Line %d: ERROR Call init function before using fill_wave_buffer function.\n", 
-			__FILE__,  __LINE__);
-		exit(1);	
-	}
-
-	const int i_max_int = (1 << (m_ps_wave_header->bits_per_sample-1)) - 1;
-	
-	int i_bytes_to_read = m_ps_wave_header->num_channels * m_ps_wave_header->bits_per_sample/8 * i_samples;
-	if(i_bytes_to_read > m_i_buff_size_in_bytes)
-	{
-		fprintf(stderr, "File %s Line %d: ERROR Bytes to read %d more than internal buffer size %d.\n", 
-			__FILE__,  __LINE__, i_bytes_to_read, m_i_buff_size_in_bytes);
-		exit(1);	
-	}
-
-	int i_read_chars = fread(m_pc_buffer, sizeof(unsigned char), i_bytes_to_read, m_f_wave_file);
-	int i_read_samples = i_read_chars/(m_ps_wave_header->num_channels * m_ps_wave_header->bits_per_sample/8);
-	i_read_samples = min(i_read_samples, i_samples);
-
-	unsigned int i_tmp;
-	unsigned char *pc_buffer_ptr = m_pc_buffer;
-
-	for(int i=0;i<i_read_samples;i++)
-	{
-		for(int j=0;j<m_ps_wave_header->num_channels;j++)
-		{
-			i_tmp = 0;
-			for(int k=0;k<m_ps_wave_header->bits_per_sample;k+=8)
-			{
-				i_tmp += (*pc_buffer_ptr << k);
-				pc_buffer_ptr++;
-			}
-			ppi_pcm_buffer[j][i] = (int(i_tmp) > i_max_int ? int(i_tmp) - (i_max_int<<1) : int(i_tmp));
-		}
-	}
-
-	int i_bytes_read = pc_buffer_ptr - m_pc_buffer;
-
-	return i_bytes_read;
-}
-
-int	wave_read::fill_wave_buffer(int **ppi_pcm_buffer, int i_samples)
-{
-	if(m_pc_buffer == NULL)
-	{
-		fprintf(stderr, "File %s Line %d: ERROR Call init function before using fill_wave_buffer function.\n", 
-			__FILE__,  __LINE__);
-		exit(1);	
-	}
-
-	const int i_max_int = (1 << (m_ps_wave_header->bits_per_sample-1)) - 1;
-	
-	int i_bytes_to_read = m_ps_wave_header->num_channels * m_ps_wave_header->bits_per_sample/8 * i_samples;
-	if(i_bytes_to_read > m_i_buff_size_in_bytes)
-	{
-		fprintf(stderr, "File %s Line %d: ERROR Bytes to read %d more than internal buffer size %d.\n", 
-			__FILE__,  __LINE__, i_bytes_to_read, m_i_buff_size_in_bytes);
-		exit(1);	
-	}
-
-	int i_read_chars = fread(m_pc_buffer, sizeof(unsigned char), i_bytes_to_read, m_f_wave_file);
-	int i_read_samples = i_read_chars/(m_ps_wave_header->num_channels * m_ps_wave_header->bits_per_sample/8);
-	i_read_samples = min(i_read_samples, i_samples);
-
-	unsigned int i_tmp;
-	unsigned char *pc_buffer_ptr = m_pc_buffer;
-
-	for(int i=0;i<i_read_samples;i++)
-	{
-		for(int j=0;j<m_ps_wave_header->num_channels;j++)
-		{
-			i_tmp = 0;
-			for(int k=0;k<m_ps_wave_header->bits_per_sample;k+=8)
-			{
-				i_tmp += (*pc_buffer_ptr << k);
-				pc_buffer_ptr++;
-			}
-			ppi_pcm_buffer[j][i] = (int(i_tmp) > i_max_int ? int(i_tmp) - (i_max_int<<1) : int(i_tmp));
-		}
-	}
-
-	int i_bytes_read = pc_buffer_ptr - m_pc_buffer;
-
-	return i_bytes_read;
-}
-
-wave_read::~wave_read()
-{
-	delete m_ps_wave_header;
-	delete m_pc_header_buffer;
-	if(m_pc_buffer) delete [] m_pc_buffer;
-	if(m_f_wave_file) fclose(m_f_wave_file);
+/**
+* @file wave_read.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief Read wav class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <wave_read.h>
+#include <trace_log.h>
+#include <perf_counters.h>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define		WAVE_READ_WHOLE_FILE_BYTES	ARENA_BLOCK_BYTES	//!< Files up to this size are read at once instead of being mapped
+#define		WAVE_READ_AHEAD_BYTES		ARENA_BLOCK_BYTES	//!< Size of a part of the file read ahead
+
+using namespace std;
+
+wave_read::wave_read(buffer_arena *pc_arena)
+{
+	m_pc_own_arena = pc_arena ? NULL : new buffer_arena();
+	m_pc_arena = pc_arena ? pc_arena : m_pc_own_arena;
+	m_ps_wave_header = new wave_header;
+	m_pc_header_buffer = new unsigned char[sizeof(wave_header)];
+	m_pc_buffer = NULL;
+	m_i_buff_size_in_bytes = 0;
+	m_f_wave_file = NULL;
+	m_e_read_mode = WAVE_READ_FREAD;
+	m_pc_map = NULL;
+	m_l_map_size = 0;
+	m_pc_file_buffer = NULL;
+	m_pc_file_data = NULL;
+	m_l_file_size = 0;
+	m_l_file_pos = 0;
+	m_p_convert_short = NULL;
+	m_p_convert_int = NULL;
+	m_pc_async_io = NULL;
+	m_i_fd = -1;
+	m_i_read_error = 0;
+	m_pc_hash = NULL;
+	for(int i=0;i<WAVE_READ_AHEAD_BUFFERS;i++)
+	{
+		m_ppc_ahead_buffer[i] = NULL;
+		m_pl_ahead_part[i] = -1;
+		m_pi_ahead_request[i] = -1;
+		m_pi_ahead_bytes[i] = 0;
+	}
+}
+
+int wave_read::open_file(char *pc_wave_file)
+{
+	close_file();
+
+	int i_fd = open(pc_wave_file, O_RDONLY);
+	struct stat s_stat;
+	if(i_fd < 0 || fstat(i_fd, &s_stat))
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot open wave file %s to read.\n",
+			__FILE__, __LINE__, pc_wave_file);
+		if(i_fd >= 0)
+			close(i_fd);
+		return 1;
+	}
+
+	if(S_ISREG(s_stat.st_mode) && s_stat.st_size <= WAVE_READ_WHOLE_FILE_BYTES)
+	{
+		// Small file, a single read is cheaper than setting up a mapping
+		if(m_pc_file_buffer == NULL)
+			m_pc_file_buffer = m_pc_arena->borrow(WAVE_READ_WHOLE_FILE_BYTES);
+
+		long l_read = 0;
+		while(l_read < s_stat.st_size)
+		{
+			ssize_t l_ret = read(i_fd, m_pc_file_buffer + l_read, s_stat.st_size - l_read);
+			if(l_ret < 0 && errno == EINTR)
+				continue;
+			if(l_ret < 0)
+			{
+				fprintf(stderr, "File %s Line %d: ERROR Cannot read wave file %s.\n",
+					__FILE__, __LINE__, pc_wave_file);
+				close(i_fd);
+				return 1;
+			}
+			if(l_ret == 0)	// Cut short since fstat, what is there is encoded as for a truncated file
+			{
+				fprintf(stderr, "File %s Line %d: WARNING Wave file %s has %ld of %ld bytes.\n",
+					__FILE__, __LINE__, pc_wave_file, l_read, (long)s_stat.st_size);
+				break;
+			}
+			l_read += l_ret;
+		}
+		close(i_fd);
+
+		m_e_read_mode = WAVE_READ_WHOLE;
+		m_pc_file_data = m_pc_file_buffer;
+		m_l_file_size = l_read;
+		m_l_file_pos = 0;
+		return 0;
+	}
+
+	if(S_ISREG(s_stat.st_mode) && m_pc_async_io)
+	{
+		// The file stays open, and its first part is read right away
+		for(int i=0;i<WAVE_READ_AHEAD_BUFFERS;i++)
+		{
+			if(m_ppc_ahead_buffer[i] == NULL)
+				m_ppc_ahead_buffer[i] = m_pc_arena->borrow(WAVE_READ_AHEAD_BYTES);
+		}
+		m_i_fd = i_fd;
+		m_e_read_mode = WAVE_READ_ASYNC;
+		m_pc_file_data = NULL;
+		m_l_file_size = s_stat.st_size;
+		m_l_file_pos = 0;
+		submit_read_ahead(0, 0);
+		return 0;
+	}
+
+	if(S_ISREG(s_stat.st_mode))
+	{
+		void *p_map = mmap(NULL, s_stat.st_size, PROT_READ, MAP_PRIVATE, i_fd, 0);
+		if(p_map != MAP_FAILED)
+		{
+			close(i_fd);	// The mapping stays valid
+			madvise(p_map, s_stat.st_size, MADV_SEQUENTIAL);
+
+			m_e_read_mode = WAVE_READ_MMAP;
+			m_pc_map = (unsigned char *)p_map;
+			m_l_map_size = s_stat.st_size;
+			m_pc_file_data = m_pc_map;
+			m_l_file_size = m_l_map_size;
+			m_l_file_pos = 0;
+			return 0;
+		}
+	}
+
+	// Not a regular file (e.g. a pipe) or the mapping failed, so fall back to stdio
+	if(!(m_f_wave_file = fdopen(i_fd, "rb")))
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot open wave file %s to read.\n",
+			__FILE__, __LINE__, pc_wave_file);
+		close(i_fd);
+		return 1;
+	}
+	m_e_read_mode = WAVE_READ_FREAD;
+	m_pc_file_data = NULL;
+	m_l_file_size = 0;
+	m_l_file_pos = 0;
+	return 0;
+}
+
+void wave_read::close_file()
+{
+	if(m_f_wave_file) fclose(m_f_wave_file);
+	m_f_wave_file = NULL;
+
+	if(m_pc_map) munmap(m_pc_map, m_l_map_size);
+	m_pc_map = NULL;
+	m_l_map_size = 0;
+
+	m_pc_file_data = NULL;
+
+	for(int i=0;i<WAVE_READ_AHEAD_BUFFERS;i++)
+	{
+		if(m_pi_ahead_request[i] >= 0)
+			m_pc_async_io->wait(m_pi_ahead_request[i]);
+		m_pi_ahead_request[i] = -1;
+		m_pl_ahead_part[i] = -1;
+	}
+	if(m_i_fd >= 0) close(m_i_fd);
+	m_i_fd = -1;
+}
+
+void wave_read::submit_read_ahead(int i_buffer, long l_part)
+{
+	if(m_pi_ahead_request[i_buffer] >= 0)	// Still reading another part, e.g. after a seek
+		m_pc_async_io->wait(m_pi_ahead_request[i_buffer]);
+
+	m_pl_ahead_part[i_buffer] = l_part;
+	m_pi_ahead_request[i_buffer] = m_pc_async_io->submit(ASYNC_IO_READ, m_i_fd, m_ppc_ahead_buffer[i_buffer],
+		WAVE_READ_AHEAD_BYTES, l_part * WAVE_READ_AHEAD_BYTES);
+}
+
+int wave_read::get_ahead_data(long l_pos, const unsigned char **ppc_data)
+{
+	long l_part = l_pos / WAVE_READ_AHEAD_BYTES;
+	int i_buffer = l_part % WAVE_READ_AHEAD_BUFFERS;
+	if(m_pl_ahead_part[i_buffer] != l_part)		// Not read ahead, e.g. after a seek
+		submit_read_ahead(i_buffer, l_part);
+
+	if(m_pi_ahead_request[i_buffer] >= 0)
+	{
+		int i_result = m_pc_async_io->wait(m_pi_ahead_request[i_buffer]);
+		m_pi_ahead_request[i_buffer] = -1;
+		if(i_result < 0)
+		{
+			fprintf(stderr, "File %s Line %d: ERROR Cannot read wave file %s.\n", 
+				__FILE__, __LINE__, m_pc_file_name);
+			m_i_read_error = 1;
+			i_result = 0;	// No more samples
+		}
+		m_pi_ahead_bytes[i_buffer] = i_result;
+
+		// The next part is read while this one is used
+		int i_next_buffer = (l_part + 1) % WAVE_READ_AHEAD_BUFFERS;
+		if((l_part + 1) * WAVE_READ_AHEAD_BYTES < m_l_file_size && m_pl_ahead_part[i_next_buffer] != l_part + 1)
+			submit_read_ahead(i_next_buffer, l_part + 1);
+	}
+
+	int i_offset = (int)(l_pos - l_part * WAVE_READ_AHEAD_BYTES);
+	*ppc_data = m_ppc_ahead_buffer[i_buffer] + i_offset;
+	return m_pi_ahead_bytes[i_buffer] - i_offset;
+}
+
+int wave_read::read_block_ahead(int i_bytes, const unsigned char **ppc_data)
+{
+	long l_left = m_l_file_size - m_l_file_pos;
+	int i_read = (l_left < i_bytes) ? (int)l_left : i_bytes;
+	*ppc_data = m_pc_buffer;
+
+	// Straight from the buffer read ahead, unless the block is split over two of them
+	int i_copied = 0;
+	while(i_copied < i_read)
+	{
+		const unsigned char *pc_data;
+		int i_avail = get_ahead_data(m_l_file_pos, &pc_data);
+		if(i_avail <= 0)	// The file got shorter
+			break;
+		if(i_copied == 0 && i_avail >= i_read)
+		{
+			*ppc_data = pc_data;
+			m_l_file_pos += i_read;
+			return i_read;
+		}
+
+		int i_copy = (i_avail < i_read - i_copied) ? i_avail : i_read - i_copied;
+		memcpy(m_pc_buffer + i_copied, pc_data, i_copy);
+		i_copied += i_copy;
+		m_l_file_pos += i_copy;
+	}
+	return i_copied;
+}
+
+int wave_read::read_block(int i_bytes, const unsigned char **ppc_data)
+{
+	if(m_e_read_mode == WAVE_READ_FREAD)
+	{
+		*ppc_data = m_pc_buffer;
+		int i_read = fread(m_pc_buffer, sizeof(unsigned char), i_bytes, m_f_wave_file);
+		if(i_read < i_bytes && ferror(m_f_wave_file) && !m_i_read_error)
+		{
+			fprintf(stderr, "File %s Line %d: ERROR Cannot read wave file %s.\n", 
+				__FILE__, __LINE__, m_pc_file_name);
+			m_i_read_error = 1;
+		}
+		if(m_pc_hash)
+			m_pc_hash->add(m_pc_buffer, i_read);
+		return i_read;
+	}
+	if(m_e_read_mode == WAVE_READ_ASYNC)
+	{
+		int i_read = read_block_ahead(i_bytes, ppc_data);
+		if(m_pc_hash)
+			m_pc_hash->add(*ppc_data, i_read);
+		return i_read;
+	}
+
+	long l_left = m_l_file_size - m_l_file_pos;
+	int i_read = (l_left < i_bytes) ? (int)l_left : i_bytes;
+	*ppc_data = m_pc_file_data + m_l_file_pos;
+	m_l_file_pos += i_read;
+	if(m_pc_hash)
+		m_pc_hash->add(*ppc_data, i_read);
+	return i_read;
+}
+
+int wave_read::init(char *pc_wave_file, int i_buff_size_in_bytes)
+{
+	m_pc_file_name = pc_wave_file;
+	m_i_read_error = 0;
+	if(m_pc_hash)
+		m_pc_hash->reset();
+
+	// Only used when reading through stdio or ahead. A buffer of the arena fits any size it takes.
+	if(m_pc_buffer == NULL || m_i_buff_size_in_bytes != i_buff_size_in_bytes)
+	{
+		m_pc_arena->give_back(m_pc_buffer);
+		m_pc_buffer = m_pc_arena->borrow(i_buff_size_in_bytes);
+		m_i_buff_size_in_bytes = i_buff_size_in_bytes;
+	}
+	
+	if(open_file(pc_wave_file))
+		return 1;
+		
+	// @todo Will need to fix this in case there are more chunks in the header
+	long long ll_trace_ns = trace_log::begin();
+	if(m_e_read_mode == WAVE_READ_FREAD)
+	{
+		if(fread(m_pc_header_buffer,sizeof(wave_header),1,m_f_wave_file) <= 0)
+		{
+			fprintf(stderr, "File %s Line %d: ERROR Could not read header.\n", __FILE__,  __LINE__);
+			return 1;
+		}
+		if(m_pc_hash)
+			m_pc_hash->add(m_pc_header_buffer, sizeof(wave_header));
+	}
+	else if(m_e_read_mode == WAVE_READ_ASYNC)
+	{
+		const unsigned char *pc_header;
+		if(read_block(sizeof(wave_header), &pc_header) != sizeof(wave_header))
+		{
+			fprintf(stderr, "File %s Line %d: ERROR Could not read header.\n", __FILE__,  __LINE__);
+			return 1;
+		}
+		memcpy(m_pc_header_buffer, pc_header, sizeof(wave_header));
+	}
+	else
+	{
+		if(m_l_file_size < (long)sizeof(wave_header))
+		{
+			fprintf(stderr, "File %s Line %d: ERROR Could not read header.\n", __FILE__,  __LINE__);
+			return 1;
+		}
+		memcpy(m_pc_header_buffer, m_pc_file_data, sizeof(wave_header));
+		m_l_file_pos = sizeof(wave_header);
+		if(m_pc_hash)
+			m_pc_hash->add(m_pc_header_buffer, sizeof(wave_header));
+	}
+
+	fill_wave_header();
+	if(sanity_check())
+	{
+		fprintf(stderr, "File %s Line %d: WARNING Header not compliant.\n", __FILE__,  __LINE__);
+	}
+	trace_log::end("header", ll_trace_ns);
+
+	m_i_bytes_per_sample = m_ps_wave_header->bits_per_sample/8;
+	if(m_ps_wave_header->num_channels <= 0 || m_i_bytes_per_sample <= 0)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR %d channels of %d bits in %s.\n", __FILE__,  __LINE__,
+			m_ps_wave_header->num_channels, m_ps_wave_header->bits_per_sample, pc_wave_file);
+		return 1;
+	}
+	m_p_convert_short = pcm_get_convert_func(m_i_bytes_per_sample, m_ps_wave_header->num_channels, sizeof(short));
+	m_p_convert_int = pcm_get_convert_func(m_i_bytes_per_sample, m_ps_wave_header->num_channels, sizeof(int));
+	m_i_total_samples =  m_ps_wave_header->chunk2_size / (m_ps_wave_header->num_channels * m_ps_wave_header->bits_per_sample/8);
+	return 0;
+}
+
+void wave_read::fill_wave_header()
+{
+	unsigned char *pcHeaderBuffer = m_pc_header_buffer;
+
+	unsigned char pucBuffer[5];		// Read and compare buffer
+	pucBuffer[4] = '\0';
+
+	//*********************
+	// Header
+	// RIFF Chunk ID
+	memcpy(pucBuffer,pcHeaderBuffer,4);
+	pcHeaderBuffer += 4;
+	strncpy(m_ps_wave_header->group_id,(char *)pucBuffer,4);
+
+	// Chunk size
+	memcpy(pucBuffer,pcHeaderBuffer,4);
+	pcHeaderBuffer += 4;
+	m_ps_wave_header->file_size = pucBuffer[0] + (pucBuffer[1]<<8) + (pucBuffer[2]<<16)
+		+ (pucBuffer[3]<<24);
+
+	// WAVE
+	memcpy(pucBuffer,pcHeaderBuffer,4);
+	pcHeaderBuffer += 4;
+	strncpy(m_ps_wave_header->wave,(char *)pucBuffer,4);
+
+	//***********************
+	// Format chunk
+	// fmt
+	memcpy(pucBuffer,pcHeaderBuffer,4);
+	pcHeaderBuffer += 4;
+	strncpy(m_ps_wave_header->subchunk1_id,(char *)pucBuffer,4);
+
+	// Chunk size
+	memcpy(pucBuffer,pcHeaderBuffer,4);
+	pcHeaderBuffer += 4;
+	m_ps_wave_header->subchunk1_size = pucBuffer[0] + (pucBuffer[1]<<8) + (pucBuffer[2]<<16)
+		+ (pucBuffer[3]<<24);
+
+	// Audio fmt
+	memcpy(pucBuffer,pcHeaderBuffer,2);
+	pcHeaderBuffer += 2;
+	m_ps_wave_header->audio_format = pucBuffer[0] + (pucBuffer[1]<<8);
+
+	// Number of channels
+	memcpy(pucBuffer,pcHeaderBuffer,2);
+	pcHeaderBuffer += 2;
+	m_ps_wave_header->num_channels = pucBuffer[0] + (pucBuffer[1]<<8);
+
+	// Sample rate
+	memcpy(pucBuffer,pcHeaderBuffer,4);
+	pcHeaderBuffer += 4;
+	m_ps_wave_header->sample_rate = pucBuffer[0] + (pucBuffer[1]<<8) + (pucBuffer[2]<<16)
+		+ (pucBuffer[3]<<24);
+
+	// Byte rate = num_channels * sample_rate * bits_per_sample/8
+	memcpy(pucBuffer,pcHeaderBuffer,4);
+	pcHeaderBuffer += 4;
+	m_ps_wave_header->bitrate = pucBuffer[0] + (pucBuffer[1]<<8) + (pucBuffer[2]<<16)
+		+ (pucBuffer[3]<<24);
+
+	// Block align =  num_channels * bits_per_sample/8
+	memcpy(pucBuffer,pcHeaderBuffer,2);
+	pcHeaderBuffer += 2;
+	m_ps_wave_header->block_align = pucBuffer[0] + (pucBuffer[1]<<8);
+
+	// Bits per sample
+	memcpy(pucBuffer,pcHeaderBuffer,2);
+	pcHeaderBuffer += 2;
+	m_ps_wave_header->bits_per_sample = pucBuffer[0] + (pucBuffer[1]<<8);
+
+	//***************************
+	// Data chunck
+	// ID
+	memcpy(pucBuffer,pcHeaderBuffer,4);
+	pcHeaderBuffer += 4;
+	strncpy(m_ps_wave_header->chunk2_id,(char *)pucBuffer,4);
+
+	// Size
+	memcpy(pucBuffer,pcHeaderBuffer,4);
+	pcHeaderBuffer += 4;
+	m_ps_wave_header->chunk2_size = pucBuffer[0] + (pucBuffer[1]<<8) + (pucBuffer[2]<<16)
+		+ (pucBuffer[3]<<24);
+
+}
+
+int	wave_read::sanity_check(wave_header *ps_wave_header)
+{
+	int iRet = 0;
+	m_i_sanity_pass = 1;
+	if(strncmp((char *)ps_wave_header->group_id, "RIFF", 4))
+	{
+		fprintf(stderr, "File %s Line %d: WARNING RIFF fmt not detected.\n", __FILE__,  __LINE__);
+		iRet = 1;
+	}
+	
+	if(strncmp((char *)ps_wave_header->wave, "WAVE", 4))
+	{
+		fprintf(stderr, "File %s Line %d: WARNING WAVE fmt not detected.\n", __FILE__,  __LINE__);
+		iRet = 2;
+	}
+
+	if(strncmp((char *)ps_wave_header->subchunk1_id, "fmt ", 4))
+	{
+		fprintf(stderr, "File %s Line %d: WARNING fmt not detected.\n", __FILE__,  __LINE__);
+		iRet = 3;
+	}
+
+	if(ps_wave_header->subchunk1_size != 16)
+	{
+		fprintf(stderr, "File %s Line %d: WARNING PCM fmt not detected.\n", __FILE__,  __LINE__);
+		iRet = 4;
+	}
+	
+	if(m_ps_wave_header->audio_format != 1)
+	{
+		fprintf(stderr, "File %s Line %d: WARNING PCM fmt not detected.\n", __FILE__,  __LINE__);
+		iRet = 5;
+	}
+
+	if(strncmp(m_ps_wave_header->chunk2_id, "data", 4))
+	{
+		fprintf(stderr, "File %s Line %d: WARNING data fmt not detected.\n", __FILE__,  __LINE__);
+		iRet = 6;
+	}
+
+	if(ps_wave_header->bitrate != ((ps_wave_header->num_channels * ps_wave_header->sample_rate * 
+		ps_wave_header->bits_per_sample) >> 3)) 
+	{
+		fprintf(stderr, "File %s Line %d: WARNING byte_rate != num_channels * sample_rate * \
+			bytes_per_sample.\n", __FILE__,  __LINE__);
+		iRet = 7;
+	}
+
+	if(ps_wave_header->block_align != ((ps_wave_header->num_channels * ps_wave_header->bits_per_sample) >> 3))
+	{
+		fprintf(stderr, "File %s Line %d: WARNING block_align != num_channels *	bytes_per_sample.\n", __FILE__,  __LINE__);
+		iRet = 8;
+	}
+	
+	if(ps_wave_header->num_channels > 2)
+	{
+		fprintf(stderr, "File %s Line %d: WARNING More than two channels.\n", __FILE__,  __LINE__);
+		iRet = 9;
+	}
+
+	if(iRet != 0)
+		m_i_sanity_pass = 0;
+
+	return iRet;
+}
+
+void wave_read::display_wave_info()
+{
+	fprintf(stdout,"file:                 %s\n", m_pc_file_name);
+	fprintf(stdout,"group_id:             %.4s\n", m_ps_wave_header->group_id);
+	fprintf(stdout,"file_size:            %d\n", m_ps_wave_header->file_size);
+	fprintf(stdout,"wave:                 %.4s\n", m_ps_wave_header->wave);
+	fprintf(stdout,"subchunk1_id:         %.4s\n", m_ps_wave_header->subchunk1_id);
+	fprintf(stdout,"subchunk1_size:       %d\n", m_ps_wave_header->subchunk1_size);
+	fprintf(stdout,"audio_format:         %d\n", m_ps_wave_header->audio_format);
+	fprintf(stdout,"num_channels:         %d\n", m_ps_wave_header->num_channels);
+	fprintf(stdout,"sample_rate:          %d\n", m_ps_wave_header->sample_rate);
+	fprintf(stdout,"bitrate:              %d\n", m_ps_wave_header->bitrate);
+	fprintf(stdout,"block_align:          %d\n", m_ps_wave_header->block_align);
+	fprintf(stdout,"bits_per_sample:      %d\n", m_ps_wave_header->bits_per_sample);
+	fprintf(stdout,"chunk2_id:            %.4s\n", m_ps_wave_header->chunk2_id);
+	fprintf(stdout,"chunk2_size:          %d\n", m_ps_wave_header->chunk2_size);
+	fprintf(stdout,"Sanity check:         %s\n", (m_i_sanity_pass? "PASSED": "FAILED"));
+	fprintf(stdout,"\n\n");
+}
+
+int wave_read::seek_to_sample(int i_sample)
+{
+	long l_offset = sizeof(wave_header) + (long)i_sample * m_ps_wave_header->block_align;
+	if(m_e_read_mode == WAVE_READ_FREAD)
+		return fseek(m_f_wave_file, l_offset, SEEK_SET);
+
+	m_l_file_pos = (l_offset < m_l_file_size) ? l_offset : m_l_file_size;
+	return 0;
+}
+
+template <int BYTES, int CHANNELS, typename T>
+int	wave_read::fill_wave_buffer(T **ppt_pcm_buffer, int i_samples)
+{
+	const int i_bytes_to_read = BYTES * CHANNELS * i_samples;
+	if(i_bytes_to_read > m_i_buff_size_in_bytes)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Bytes to read %d more than internal buffer size %d.\n", 
+			__FILE__,  __LINE__, i_bytes_to_read, m_i_buff_size_in_bytes);
+		exit(1);	
+	}
+
+	const unsigned char *pc_data;
+	long long ll_trace_ns = trace_log::begin();
+	int i_read_samples = read_block(i_bytes_to_read, &pc_data) / (BYTES * CHANNELS);
+	trace_log::end("read", ll_trace_ns, i_read_samples * BYTES * CHANNELS);
+
+	// The kernel for the format was picked in init
+	ll_trace_ns = trace_log::begin();
+	long long pll_perf[PERF_READ_VALUES];
+	perf_counters::begin(pll_perf);
+	pcm_convert_func p_convert = (sizeof(T) == sizeof(short)) ? m_p_convert_short : m_p_convert_int;
+	p_convert(pc_data, (void **)ppt_pcm_buffer, i_read_samples);
+	perf_counters::end(PERF_STAGE_CONVERT, pll_perf);
+	trace_log::end("convert", ll_trace_ns);
+
+	return i_read_samples * BYTES * CHANNELS;
+}
+
+int	wave_read::get_raw_block(const unsigned char **ppc_data, int i_samples)
+{
+	int i_bytes_to_read = m_ps_wave_header->block_align * i_samples;
+	if((m_e_read_mode == WAVE_READ_FREAD || m_e_read_mode == WAVE_READ_ASYNC) && i_bytes_to_read > m_i_buff_size_in_bytes)
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Bytes to read %d more than internal buffer size %d.\n", 
+			__FILE__,  __LINE__, i_bytes_to_read, m_i_buff_size_in_bytes);
+		exit(1);	
+	}
+
+	long long ll_trace_ns = trace_log::begin();
+	int i_read_bytes = read_block(i_bytes_to_read, ppc_data);
+	trace_log::end("read", ll_trace_ns, i_read_bytes);
+	return i_read_bytes - i_read_bytes % m_ps_wave_header->block_align;
+}
+
+template int wave_read::fill_wave_buffer<2, 1, short>(short **, int);
+template int wave_read::fill_wave_buffer<2, 2, short>(short **, int);
+template int wave_read::fill_wave_buffer<3, 1, short>(short **, int);
+template int wave_read::fill_wave_buffer<3, 2, short>(short **, int);
+template int wave_read::fill_wave_buffer<4, 1, short>(short **, int);
+template int wave_read::fill_wave_buffer<4, 2, short>(short **, int);
+template int wave_read::fill_wave_buffer<2, 1, int>(int **, int);
+template int wave_read::fill_wave_buffer<2, 2, int>(int **, int);
+template int wave_read::fill_wave_buffer<3, 1, int>(int **, int);
+template int wave_read::fill_wave_buffer<3, 2, int>(int **, int);
+template int wave_read::fill_wave_buffer<4, 1, int>(int **, int);
+template int wave_read::fill_wave_buffer<4, 2, int>(int **, int);
+
+wave_read::~wave_read()
+{
+	delete m_ps_wave_header;
+	delete m_pc_header_buffer;
+	close_file();	// Waits for the reads ahead
+	m_pc_arena->give_back(m_pc_buffer);
+	m_pc_arena->give_back(m_pc_file_buffer);
+	for(int i=0;i<WAVE_READ_AHEAD_BUFFERS;i++)
+		m_pc_arena->give_back(m_ppc_ahead_buffer[i]);
+	if(m_pc_own_arena) delete m_pc_own_arena;
 }
\ No newline at end of file
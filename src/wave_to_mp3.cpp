@@ -1,143 +1,544 @@
-/**
-* @file wave_to_mp3.cpp
-* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
-* @brief Convert wave file to mp3.
-* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
-*/
-
-#include <wave_to_mp3.h>
-#include <wave_read.h>
-#include <lame.h>
-#include <cstdlib>
-
-#define		BUFF_SIZE_BYTES		8192	//!< Change this by testing
-
-using namespace std;
-
-wave_to_mp3::wave_to_mp3()
-{
-	m_f_mp3_file = NULL;
-	m_pc_wave_read = NULL;
-	m_ppi_pcm_buffer = NULL;
-	m_i_vbr_quality = 0;
-	m_pc_wave_read = new wave_read();
-}
-
-void wave_to_mp3::init(char *pc_wave_file, char *pc_mp3_file)
-{
-	if(m_f_mp3_file) fclose(m_f_mp3_file);
-
-	if(!(m_f_mp3_file = fopen(pc_mp3_file, "wb")))
-	{
-		fprintf(stderr, "File %s Line %d: ERROR Cannot open mp3 file to write.", __FILE__, __LINE__);
-		exit(1);
-	}
-	
-	m_pc_wave_read->init(pc_wave_file, BUFF_SIZE_BYTES);
-
-	m_iBytesPerSample = m_pc_wave_read->get_wave_header()->bits_per_sample/8;
-
-	m_i_samples_per_itr = BUFF_SIZE_BYTES/(m_pc_wave_read->get_wave_header()->num_channels * 
-		m_pc_wave_read->get_wave_header()->bits_per_sample/8);
-
-	// @todo For performance, shouldn't be allocating memory all the time. Should do it at one time 
-	// when the object is created.
-	allocate_memory();
-	
-	return;
-}
-
-void wave_to_mp3::free_memory()
-{
-	if(m_ppi_pcm_buffer && m_ppi_pcm_buffer[0]) delete [] m_ppi_pcm_buffer[0];
-	if(m_ppi_pcm_buffer && m_ppi_pcm_buffer[1]) delete [] m_ppi_pcm_buffer[1];
-	if(m_ppi_pcm_buffer) delete [] m_ppi_pcm_buffer;
-}
-
-void wave_to_mp3::allocate_memory()
-{
-	free_memory();
-	
-	m_ppi_pcm_buffer = new int*[2];
-	m_ppi_pcm_buffer[0] = new int[m_i_samples_per_itr];
-
-	if(m_pc_wave_read->get_wave_header()->num_channels == 2)
-		m_ppi_pcm_buffer[1] = new int[m_i_samples_per_itr];
-	else
-		m_ppi_pcm_buffer[1] = NULL;
-
-}
-
-int	wave_to_mp3::sanity_check()
-{
-	return m_pc_wave_read->sanity_check();
-}
-
-void wave_to_mp3::display_wave_info()
-{
-	m_pc_wave_read->display_wave_info();
-}
-
-void wave_to_mp3::encode_wave()
-{
-	int i_read_bytes;
-	int i_write_bytes;
-
-	lame_t lame = lame_init();
-	lame_set_in_samplerate(lame, m_pc_wave_read->get_wave_header()->sample_rate);
-	lame_set_VBR(lame, vbr_default);
-	lame_set_VBR_q(lame, m_i_vbr_quality);
-	lame_init_params(lame);
-	unsigned char *pc_mp3_buffer = new unsigned char[BUFF_SIZE_BYTES];
-
-	do
-	{
-		// Get PCM 
-		switch(m_iBytesPerSample)
-		{
-		case sizeof(short):
-			i_read_bytes = m_pc_wave_read->fill_wave_buffer((short **)m_ppi_pcm_buffer, m_i_samples_per_itr); 
-			break;
-		case sizeof(int):
-			i_read_bytes = m_pc_wave_read->fill_wave_buffer((int **)m_ppi_pcm_buffer, m_i_samples_per_itr); 
-			break;
-		default:
-			fprintf(stderr, "File %s Line %d: ERROR Unhandled bytes per sample.\n", 
-			__FILE__,  __LINE__);
-			exit(1);
-		}
-		
-		// Compress PCM
-		if(i_read_bytes == 0)
-			i_write_bytes = lame_encode_flush(lame, pc_mp3_buffer, BUFF_SIZE_BYTES);
-		else
-		{
-			switch(m_iBytesPerSample)
-			{
-			case sizeof(short):
-				i_write_bytes = lame_encode_buffer(lame, (short *)m_ppi_pcm_buffer[0], (short *)m_ppi_pcm_buffer[1], 
-					m_i_samples_per_itr, pc_mp3_buffer, BUFF_SIZE_BYTES);
-				break;
-			case sizeof(int):
-				i_write_bytes = lame_encode_buffer_int(lame, (int *)m_ppi_pcm_buffer[0], (int *)m_ppi_pcm_buffer[1], 
-					m_i_samples_per_itr, pc_mp3_buffer, BUFF_SIZE_BYTES);
-				break;
-			default:
-				fprintf(stderr, "File %s Line %d: ERROR Unhandled bytes per sample.\n", 
-					__FILE__,  __LINE__);
-				exit(1);
-			}
-		}
-
-		// Write to file
-		fwrite(pc_mp3_buffer, sizeof(unsigned char), i_write_bytes, m_f_mp3_file);
-	}while(i_read_bytes);
-}
-
-wave_to_mp3::~wave_to_mp3()
-{
-	free_memory();
-	delete m_pc_wave_read;
-
-	if(m_f_mp3_file) fclose(m_f_mp3_file);
-}
+/**
+* @file wave_to_mp3.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief Convert wave file to mp3.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <wave_to_mp3.h>
+#include <wave_read.h>
+#include <trace_log.h>
+#include <perf_counters.h>
+#include <lame.h>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define		BUFF_SIZE_BYTES			8192	//!< Change this by testing
+#define		SEGMENT_OVERLAP_FRAMES	8		//!< Frames encoded before a segment to let the encoder settle
+#define		SEGMENT_TAIL_FRAMES		2		//!< Frames encoded after a segment so that its last frames see real data
+#define		MP3_MAX_BITRATE			320000	//!< Highest bit rate lame uses, in bits per second
+#define		PCM_BUFFER_BYTES		((BUFF_SIZE_BYTES/2) * sizeof(int))	//!< Most bytes of a PCM buffer, 16 bit mono as int
+
+/**
+*	Worst case size of the mp3 data lame produces for a number of samples.
+*/
+#define		MP3_BUFF_SIZE(samples)	((samples) + (samples)/4 + 7200)
+
+using namespace std;
+
+wave_to_mp3::wave_to_mp3()
+{
+	m_pc_wave_read = NULL;
+	m_ppv_pcm_buffer[0] = NULL;
+	m_ppv_pcm_buffer[1] = NULL;
+	m_i_pcm_sample_bytes = 0;
+	m_p_encode_block = NULL;
+	m_p_encode_raw = NULL;
+	m_p_convert = NULL;
+	m_lame_stream = NULL;
+	m_pc_lame_pool = new lame_pool();
+	m_i_block_align = 0;
+	m_i_vbr_quality = 0;
+	m_pc_async_io = NULL;
+	m_pc_mp3_writer = new mp3_writer();
+	m_pc_arena = new buffer_arena();
+	m_pc_wave_read = new wave_read(m_pc_arena);
+	m_ps_record = NULL;
+}
+
+void wave_to_mp3::enable_async_io()
+{
+	if(m_pc_async_io)
+		return;
+
+	// Two reads ahead and two writes behind
+	m_pc_async_io = new async_io(WAVE_READ_AHEAD_BUFFERS + MP3_WRITER_BUFFERS);
+	m_pc_wave_read->set_async_io(m_pc_async_io);
+	m_pc_mp3_writer->set_async_io(m_pc_async_io);
+}
+
+int wave_to_mp3::init(char *pc_wave_file, char *pc_mp3_file)
+{
+	long long ll_ns = start_timing();
+	if(m_pc_wave_read->init(pc_wave_file, BUFF_SIZE_BYTES))
+		return WAVE_TO_MP3_ERROR_READ;
+	if(select_format(m_pc_wave_read->get_wave_header()))
+		return WAVE_TO_MP3_ERROR_FORMAT;
+	add_time(JOB_STAGE_READ, &ll_ns);
+	if(m_pc_mp3_writer->open_file(pc_mp3_file, get_max_mp3_bytes(m_pc_wave_read->get_wave_header())))
+		return WAVE_TO_MP3_ERROR_WRITE;
+	add_time(JOB_STAGE_WRITE, &ll_ns);
+	
+	return WAVE_TO_MP3_OK;
+}
+
+const char *wave_to_mp3::get_error_text(int i_error)
+{
+	switch(i_error)
+	{
+	case WAVE_TO_MP3_OK:			return "no error";
+	case WAVE_TO_MP3_ERROR_READ:	return "cannot read wave file";
+	case WAVE_TO_MP3_ERROR_FORMAT:	return "unhandled wave format";
+	case WAVE_TO_MP3_ERROR_WRITE:	return "cannot write mp3 file";
+	case WAVE_TO_MP3_ERROR_ENCODE:	return "lame encoding failed";
+	default:						return "unknown error";
+	}
+}
+
+long wave_to_mp3::get_max_mp3_bytes(wave_header *ps_wave_header)
+{
+	int i_block_align = ps_wave_header->num_channels * (ps_wave_header->bits_per_sample/8);
+	if(i_block_align <= 0 || ps_wave_header->sample_rate <= 0)
+		return 0;
+	if(ps_wave_header->chunk2_size == 0 || ps_wave_header->chunk2_size == -1)	// Placeholders of streaming recorders
+		return 0;
+
+	return get_max_mp3_bytes(ps_wave_header->sample_rate, i_block_align, (unsigned int)ps_wave_header->chunk2_size);
+}
+
+long wave_to_mp3::get_max_mp3_bytes(int i_sample_rate, int i_block_align, long l_pcm_bytes)
+{
+	long l_samples = l_pcm_bytes / i_block_align;
+	return l_samples * (MP3_MAX_BITRATE/8) / i_sample_rate + LAME_POOL_FINISH_BYTES;
+}
+
+int wave_to_mp3::get_read_buffer_size()
+{
+	return BUFF_SIZE_BYTES;
+}
+
+int wave_to_mp3::get_samples_per_itr(wave_header *ps_wave_header)
+{
+	return BUFF_SIZE_BYTES/(ps_wave_header->num_channels * (ps_wave_header->bits_per_sample/8));
+}
+
+int wave_to_mp3::select_format(wave_header *ps_wave_header)
+{
+	int i_format = ps_wave_header->bits_per_sample * 10 + ps_wave_header->num_channels;
+
+	m_iBytesPerSample = ps_wave_header->bits_per_sample/8;
+	m_i_block_align = m_iBytesPerSample * ps_wave_header->num_channels;
+	m_i_samples_per_itr = get_samples_per_itr(ps_wave_header);
+
+	// 16 bit samples are handed to lame as short, deeper ones as int
+	switch(i_format)
+	{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	case 161: m_p_encode_block = &wave_to_mp3::encode_block_s16<1>; m_p_encode_raw = &wave_to_mp3::encode_raw_s16<1>; break;	// Straight from the file
+	case 162: m_p_encode_block = &wave_to_mp3::encode_block_s16<2>; m_p_encode_raw = &wave_to_mp3::encode_raw_s16<2>; break;
+#else
+	case 161: m_p_encode_block = &wave_to_mp3::encode_block<2, 1, short>; m_p_encode_raw = &wave_to_mp3::encode_raw<1, short>; break;
+	case 162: m_p_encode_block = &wave_to_mp3::encode_block<2, 2, short>; m_p_encode_raw = &wave_to_mp3::encode_raw<2, short>; break;
+#endif
+	case 241: m_p_encode_block = &wave_to_mp3::encode_block<3, 1, int>; m_p_encode_raw = &wave_to_mp3::encode_raw<1, int>; break;
+	case 242: m_p_encode_block = &wave_to_mp3::encode_block<3, 2, int>; m_p_encode_raw = &wave_to_mp3::encode_raw<2, int>; break;
+	case 321: m_p_encode_block = &wave_to_mp3::encode_block<4, 1, int>; m_p_encode_raw = &wave_to_mp3::encode_raw<1, int>; break;
+	case 322: m_p_encode_block = &wave_to_mp3::encode_block<4, 2, int>; m_p_encode_raw = &wave_to_mp3::encode_raw<2, int>; break;
+	default:
+		fprintf(stderr, "File %s Line %d: ERROR Unhandled format with %d channels and %d bits per sample.\n", 
+			__FILE__,  __LINE__, ps_wave_header->num_channels, ps_wave_header->bits_per_sample);
+		return 1;
+	}
+	m_i_pcm_sample_bytes = (ps_wave_header->bits_per_sample == 16) ? sizeof(short) : sizeof(int);
+	m_p_convert = pcm_get_convert_func(m_iBytesPerSample, ps_wave_header->num_channels, m_i_pcm_sample_bytes);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	if(ps_wave_header->bits_per_sample == 16)
+		m_i_pcm_sample_bytes = 0;	// No PCM buffers needed
+#endif
+
+	allocate_memory();
+	return 0;
+}
+
+void wave_to_mp3::free_memory()
+{
+	m_pc_arena->give_back((unsigned char *)m_ppv_pcm_buffer[0]);
+	m_pc_arena->give_back((unsigned char *)m_ppv_pcm_buffer[1]);
+	m_ppv_pcm_buffer[0] = NULL;
+	m_ppv_pcm_buffer[1] = NULL;
+}
+
+void wave_to_mp3::allocate_memory()
+{
+	if(m_i_pcm_sample_bytes == 0 || m_ppv_pcm_buffer[0])
+		return;
+
+	// Both channels, for the stereo files that may follow
+	m_ppv_pcm_buffer[0] = m_pc_arena->borrow(PCM_BUFFER_BYTES);
+	m_ppv_pcm_buffer[1] = m_pc_arena->borrow(PCM_BUFFER_BYTES);
+}
+
+int	wave_to_mp3::sanity_check()
+{
+	return m_pc_wave_read->sanity_check();
+}
+
+void wave_to_mp3::display_wave_info()
+{
+	m_pc_wave_read->display_wave_info();
+}
+
+lame_t wave_to_mp3::init_lame(wave_header *ps_wave_header, int i_segment)
+{
+	lame_pool_key s_key = {ps_wave_header->sample_rate, ps_wave_header->num_channels, m_i_vbr_quality, i_segment};
+	return m_pc_lame_pool->get(&s_key);
+}
+
+/**
+*	Hand a block of samples to lame, in the sample type of the block.
+*/
+static inline int encode_pcm(lame_t lame, short **ppi_pcm_buffer, int i_channels, int i_samples,
+	unsigned char *pc_mp3_buffer, int i_mp3_buffer_size)
+{
+	return lame_encode_buffer(lame, ppi_pcm_buffer[0], (i_channels == 2) ? ppi_pcm_buffer[1] : NULL, 
+		i_samples, pc_mp3_buffer, i_mp3_buffer_size);
+}
+
+static inline int encode_pcm(lame_t lame, int **ppi_pcm_buffer, int i_channels, int i_samples,
+	unsigned char *pc_mp3_buffer, int i_mp3_buffer_size)
+{
+	return lame_encode_buffer_int(lame, ppi_pcm_buffer[0], (i_channels == 2) ? ppi_pcm_buffer[1] : NULL, 
+		i_samples, pc_mp3_buffer, i_mp3_buffer_size);
+}
+
+template <int BYTES, int CHANNELS, typename T>
+int wave_to_mp3::encode_block(lame_t lame, int i_samples, unsigned char *pc_mp3_buffer, int i_mp3_buffer_size, 
+	int *pi_read_samples)
+{
+	T **ppt_pcm_buffer = (T **)m_ppv_pcm_buffer;
+
+	// Get PCM 
+	long long ll_ns = start_timing();
+	*pi_read_samples = m_pc_wave_read->fill_wave_buffer<BYTES, CHANNELS, T>(ppt_pcm_buffer, i_samples) / 
+		(BYTES * CHANNELS);
+	add_time(JOB_STAGE_READ, &ll_ns);
+	
+	// Compress PCM
+	if(*pi_read_samples == 0)
+		return 0;
+
+	long long ll_trace_ns = trace_log::begin();
+	long long pll_perf[PERF_READ_VALUES];
+	perf_counters::begin(pll_perf);
+	int i_write_bytes = encode_pcm(lame, ppt_pcm_buffer, CHANNELS, *pi_read_samples, pc_mp3_buffer, i_mp3_buffer_size);
+	perf_counters::end(PERF_STAGE_ENCODE, pll_perf);
+	trace_log::end("lame", ll_trace_ns);
+	add_time(JOB_STAGE_ENCODE, &ll_ns);
+	if(i_write_bytes < 0)
+		fprintf(stderr, "File %s Line %d: ERROR lame encoding failed with %d.\n", 
+			__FILE__,  __LINE__, i_write_bytes);
+	return i_write_bytes;
+}
+
+template <int CHANNELS>
+int wave_to_mp3::encode_block_s16(lame_t lame, int i_samples, unsigned char *pc_mp3_buffer, int i_mp3_buffer_size, 
+	int *pi_read_samples)
+{
+	const unsigned char *pc_data;
+	long long ll_ns = start_timing();
+	*pi_read_samples = m_pc_wave_read->get_raw_block(&pc_data, i_samples) / (2 * CHANNELS);
+	add_time(JOB_STAGE_READ, &ll_ns);
+
+	if(*pi_read_samples == 0)
+		return 0;
+
+	// lame only reads the samples, so they can come straight from the mapping of the file. 
+	// Page faults of the mapping are timed as encoding then.
+	long long ll_trace_ns = trace_log::begin();
+	long long pll_perf[PERF_READ_VALUES];
+	perf_counters::begin(pll_perf);
+	int i_write_bytes = encode_raw_s16<CHANNELS>(lame, pc_data, *pi_read_samples, pc_mp3_buffer, i_mp3_buffer_size);
+	perf_counters::end(PERF_STAGE_ENCODE, pll_perf);
+	trace_log::end("lame", ll_trace_ns);
+	add_time(JOB_STAGE_ENCODE, &ll_ns);
+	return i_write_bytes;
+}
+
+template <int CHANNELS>
+int wave_to_mp3::encode_raw_s16(lame_t lame, const unsigned char *pc_pcm, int i_samples, unsigned char *pc_mp3_buffer, 
+	int i_mp3_buffer_size)
+{
+	short *pi_pcm = (short *)pc_pcm;
+	int i_write_bytes;
+	if(CHANNELS == 2)
+		i_write_bytes = lame_encode_buffer_interleaved(lame, pi_pcm, i_samples, pc_mp3_buffer, i_mp3_buffer_size);
+	else
+		i_write_bytes = lame_encode_buffer(lame, pi_pcm, NULL, i_samples, pc_mp3_buffer, i_mp3_buffer_size);
+
+	if(i_write_bytes < 0)
+		fprintf(stderr, "File %s Line %d: ERROR lame encoding failed with %d.\n", 
+			__FILE__,  __LINE__, i_write_bytes);
+	return i_write_bytes;
+}
+
+template <int CHANNELS, typename T>
+int wave_to_mp3::encode_raw(lame_t lame, const unsigned char *pc_pcm, int i_samples, unsigned char *pc_mp3_buffer, 
+	int i_mp3_buffer_size)
+{
+	m_p_convert(pc_pcm, m_ppv_pcm_buffer, i_samples);
+
+	int i_write_bytes = encode_pcm(lame, (T **)m_ppv_pcm_buffer, CHANNELS, i_samples, pc_mp3_buffer, i_mp3_buffer_size);
+	if(i_write_bytes < 0)
+		fprintf(stderr, "File %s Line %d: ERROR lame encoding failed with %d.\n", 
+			__FILE__,  __LINE__, i_write_bytes);
+	return i_write_bytes;
+}
+
+int wave_to_mp3::begin_stream(wave_header *ps_wave_header)
+{
+	if(select_format(ps_wave_header))
+		return WAVE_TO_MP3_ERROR_FORMAT;
+	m_lame_stream = init_lame(ps_wave_header, 0);
+	return m_lame_stream ? WAVE_TO_MP3_OK : WAVE_TO_MP3_ERROR_ENCODE;
+}
+
+int wave_to_mp3::get_stream_buffer_size(int i_samples)
+{
+	// Every piece of m_i_samples_per_itr samples may come with the worst case
+	int i_itr = (i_samples + m_i_samples_per_itr - 1) / m_i_samples_per_itr;
+	if(i_itr == 0)	// For end_stream
+		return max(MP3_BUFF_SIZE(m_i_samples_per_itr), LAME_POOL_FINISH_BYTES);
+	return i_itr * MP3_BUFF_SIZE(m_i_samples_per_itr);
+}
+
+int wave_to_mp3::encode_stream(const unsigned char *pc_pcm, int i_samples, unsigned char *pc_mp3_buffer, 
+	int i_mp3_buffer_size)
+{
+	// The same pieces as encode_wave hands to lame
+	int i_mp3_bytes = 0;
+	for(int i_sample = 0; i_sample < i_samples; i_sample += m_i_samples_per_itr)
+	{
+		int i_itr_samples = min(m_i_samples_per_itr, i_samples - i_sample);
+		int i_write_bytes = (this->*m_p_encode_raw)(m_lame_stream, pc_pcm + i_sample * m_i_block_align, i_itr_samples,
+			pc_mp3_buffer + i_mp3_bytes, i_mp3_buffer_size - i_mp3_bytes);
+		if(i_write_bytes < 0)
+			return i_write_bytes;
+		i_mp3_bytes += i_write_bytes;
+	}
+	return i_mp3_bytes;
+}
+
+int wave_to_mp3::end_stream(unsigned char *pc_mp3_buffer, int i_mp3_buffer_size)
+{
+	int i_mp3_bytes = m_pc_lame_pool->finish(m_lame_stream, pc_mp3_buffer, i_mp3_buffer_size);
+	m_lame_stream = NULL;
+	return i_mp3_bytes;
+}
+
+int wave_to_mp3::encode_wave()
+{
+	int i_read_samples;
+	int i_write_bytes;
+	int i_error = WAVE_TO_MP3_OK;
+
+	long long ll_trace_file_ns = trace_log::begin();
+	lame_t lame = init_lame(m_pc_wave_read->get_wave_header(), 0);
+	if(lame == NULL)
+	{
+		m_pc_mp3_writer->discard_file();
+		return WAVE_TO_MP3_ERROR_ENCODE;
+	}
+	int i_mp3_buffer_size = max(MP3_BUFF_SIZE(m_i_samples_per_itr), LAME_POOL_FINISH_BYTES);
+
+	long l_samples = 0, l_mp3_bytes = 0;
+	do
+	{
+		// lame writes straight into the buffer of the writer
+		long long ll_ns = start_timing();
+		unsigned char *pc_mp3_buffer = m_pc_mp3_writer->get_space(i_mp3_buffer_size);
+		add_time(JOB_STAGE_WRITE, &ll_ns);
+		i_write_bytes = (this->*m_p_encode_block)(lame, m_i_samples_per_itr, pc_mp3_buffer, i_mp3_buffer_size, 
+			&i_read_samples);
+		if(i_write_bytes < 0)
+		{
+			m_pc_lame_pool->release(lame);
+			i_error = WAVE_TO_MP3_ERROR_ENCODE;
+			break;
+		}
+		if(i_read_samples == 0)
+		{
+			long long ll_trace_ns = trace_log::begin();
+			long long pll_perf[PERF_READ_VALUES];
+			perf_counters::begin(pll_perf);
+			i_write_bytes = m_pc_lame_pool->finish(lame, pc_mp3_buffer, i_mp3_buffer_size);
+			perf_counters::end(PERF_STAGE_ENCODE, pll_perf);
+			trace_log::end("flush", ll_trace_ns);
+			if(i_write_bytes < 0)
+			{
+				i_error = WAVE_TO_MP3_ERROR_ENCODE;
+				break;
+			}
+		}
+		m_pc_mp3_writer->add_bytes(i_write_bytes);
+		l_samples += i_read_samples;
+		l_mp3_bytes += i_write_bytes;
+	}while(i_read_samples);
+
+	// A read error ends the samples like the end of the file, but the mp3 file would miss the rest
+	if(i_error == WAVE_TO_MP3_OK && m_pc_wave_read->get_read_error())
+		i_error = WAVE_TO_MP3_ERROR_READ;
+
+	long long ll_ns = start_timing();
+	long long ll_trace_ns = trace_log::begin();
+	if(i_error)
+		m_pc_mp3_writer->discard_file();
+	else if(m_pc_mp3_writer->close_file())
+		i_error = WAVE_TO_MP3_ERROR_WRITE;
+	trace_log::end("close", ll_trace_ns);
+	add_time(JOB_STAGE_WRITE, &ll_ns);
+	trace_log::end("encode_wave", ll_trace_file_ns);
+	if(m_ps_record)
+	{
+		m_ps_record->l_bytes_in += l_samples * m_i_block_align;
+		m_ps_record->l_bytes_out += l_mp3_bytes;
+		m_ps_record->d_audio_seconds += (double)l_samples / m_pc_wave_read->get_wave_header()->sample_rate;
+	}
+	return i_error;
+}
+
+/**
+*	Get length of the mp3 frame starting at pc_frame.
+*	@return Length in bytes, or 0 if there is no valid layer III frame header.
+*/
+static int mp3_frame_length(const unsigned char *pc_frame)
+{
+	static const int pi_bitrate_mpeg1[16] = {0,32,40,48,56,64,80,96,112,128,160,192,224,256,320,0};
+	static const int pi_bitrate_mpeg2[16] = {0,8,16,24,32,40,48,56,64,80,96,112,128,144,160,0};
+	static const int pi_sample_rate[4] = {44100, 48000, 32000, 0};
+
+	if(pc_frame[0] != 0xFF || (pc_frame[1] & 0xE0) != 0xE0)	// Sync
+		return 0;
+
+	int i_version = (pc_frame[1] >> 3) & 3;		// 3: MPEG1, 2: MPEG2, 0: MPEG2.5
+	int i_layer = (pc_frame[1] >> 1) & 3;		// 1: Layer III
+	int i_bitrate_idx = pc_frame[2] >> 4;
+	int i_sample_rate_idx = (pc_frame[2] >> 2) & 3;
+	int i_padding = (pc_frame[2] >> 1) & 1;
+
+	if(i_version == 1 || i_layer != 1 || pi_sample_rate[i_sample_rate_idx] == 0)
+		return 0;
+
+	int i_bitrate = (i_version == 3 ? pi_bitrate_mpeg1 : pi_bitrate_mpeg2)[i_bitrate_idx] * 1000;
+	int i_sample_rate = pi_sample_rate[i_sample_rate_idx] >> (i_version == 3 ? 0 : (i_version == 2 ? 1 : 2));
+	if(i_bitrate == 0)
+		return 0;
+
+	return (i_version == 3 ? 144 : 72) * i_bitrate / i_sample_rate + i_padding;
+}
+
+int wave_to_mp3::encode_segment(char *pc_wave_file, int i_first_sample, int i_num_samples, int i_last, 
+	unsigned char **ppc_mp3_buffer)
+{
+	long long ll_ns = start_timing();
+	if(m_pc_wave_read->init(pc_wave_file, BUFF_SIZE_BYTES) || select_format(m_pc_wave_read->get_wave_header()))
+		return -1;
+	add_time(JOB_STAGE_READ, &ll_ns);
+
+	lame_t lame = init_lame(m_pc_wave_read->get_wave_header(), 1);
+	if(lame == NULL)
+		return -1;
+	int i_frame_size = lame_get_framesize(lame);
+	if(i_first_sample % i_frame_size || (!i_last && i_num_samples % i_frame_size))
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Segment is not aligned to mp3 frames of %d samples.\n", 
+			__FILE__,  __LINE__, i_frame_size);
+		m_pc_lame_pool->release(lame);
+		return -1;
+	}
+
+	// Start a few frames early so that the encoder has settled when the segment starts
+	int i_start_sample = max(0, i_first_sample - SEGMENT_OVERLAP_FRAMES * i_frame_size);
+	int i_end_sample = m_pc_wave_read->get_total_samples();
+	if(!i_last)
+		i_end_sample = min(i_end_sample, i_first_sample + i_num_samples + SEGMENT_TAIL_FRAMES * i_frame_size);
+
+	// The whole segment is kept in memory as it must be joined with the other segments
+	int i_size = MP3_BUFF_SIZE(i_end_sample - i_start_sample) + MP3_BUFF_SIZE(m_i_samples_per_itr);
+	unsigned char *pc_mp3_buffer = new unsigned char[i_size];
+	int i_mp3_bytes = 0;
+	int i_read_samples;
+
+	m_pc_wave_read->seek_to_sample(i_start_sample);
+	for(int i_sample = i_start_sample; i_sample < i_end_sample; i_sample += i_read_samples)
+	{
+		int i_write_bytes = (this->*m_p_encode_block)(lame, min(m_i_samples_per_itr, i_end_sample - i_sample), 
+			pc_mp3_buffer + i_mp3_bytes, i_size - i_mp3_bytes, &i_read_samples);
+		if(i_write_bytes < 0)
+		{
+			m_pc_lame_pool->release(lame);
+			delete [] pc_mp3_buffer;
+			return -1;
+		}
+		i_mp3_bytes += i_write_bytes;
+		if(i_read_samples == 0)	// Truncated file
+			break;
+	}
+	long long ll_trace_ns = trace_log::begin();
+	long long pll_perf[PERF_READ_VALUES];
+	perf_counters::begin(pll_perf);
+	int i_flush_bytes = m_pc_lame_pool->finish(lame, pc_mp3_buffer + i_mp3_bytes, i_size - i_mp3_bytes);
+	perf_counters::end(PERF_STAGE_ENCODE, pll_perf);
+	trace_log::end("flush", ll_trace_ns);
+	if(i_flush_bytes < 0 || m_pc_wave_read->get_read_error())
+	{
+		delete [] pc_mp3_buffer;
+		return -1;
+	}
+	i_mp3_bytes += i_flush_bytes;
+	if(m_ps_record)	// Only the samples of the segment, the overlap is encoded twice
+	{
+		m_ps_record->l_bytes_in += (long)i_num_samples * m_i_block_align;
+		m_ps_record->d_audio_seconds += (double)i_num_samples / m_pc_wave_read->get_wave_header()->sample_rate;
+	}
+
+	// Output frame n of this encoder holds the same samples as frame i_start_sample/i_frame_size + n 
+	// of an encoder running over the whole file. Drop the frames of the overlap and of the tail.
+	int i_skip_frames = (i_first_sample - i_start_sample) / i_frame_size;
+	int i_keep_frames = i_num_samples / i_frame_size;
+	int i_frame = 0;
+	int i_pos = 0;
+	int i_begin = 0;
+	int i_end = i_mp3_bytes;
+	while(i_pos < i_mp3_bytes)
+	{
+		int i_frame_length = (i_mp3_bytes - i_pos >= 4) ? mp3_frame_length(pc_mp3_buffer + i_pos) : 0;
+		if(i_frame_length == 0)
+		{
+			fprintf(stderr, "File %s Line %d: ERROR Lost mp3 frame sync in segment at sample %d of %s.\n", 
+				__FILE__,  __LINE__, i_first_sample, pc_wave_file);
+			delete [] pc_mp3_buffer;
+			return -1;
+		}
+		if(i_frame == i_skip_frames)
+			i_begin = i_pos;
+		i_pos += i_frame_length;
+		i_frame++;
+		if(!i_last && i_frame == i_skip_frames + i_keep_frames)
+		{
+			i_end = i_pos;
+			break;
+		}
+	}
+	if(i_frame <= i_skip_frames)	// Nothing left of this segment
+		i_begin = i_end;
+
+	memmove(pc_mp3_buffer, pc_mp3_buffer + i_begin, i_end - i_begin);
+	if(m_ps_record)
+		m_ps_record->l_bytes_out += i_end - i_begin;
+	*ppc_mp3_buffer = pc_mp3_buffer;
+	return i_end - i_begin;
+}
+
+wave_to_mp3::~wave_to_mp3()
+{
+	free_memory();
+	delete m_pc_wave_read;		// Waits for its reads ahead
+	if(m_lame_stream) m_pc_lame_pool->release(m_lame_stream);
+	delete m_pc_lame_pool;
+	delete m_pc_mp3_writer;		// Waits for its writes behind
+	if(m_pc_async_io) delete m_pc_async_io;
+	delete m_pc_arena;
+}
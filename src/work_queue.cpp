@@ -1,126 +1,401 @@
-/**
-* @file work_queue.cpp
-* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
-* @brief This file contains the work_queue class.
-* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
-*/
-
-#include <work_queue.h>
-#include <work_item.h>
-#include <stdio.h>
-#include <cstdlib>
-
-work_queue::work_queue(int i_queue_size)
-{
-	m_i_queue_size = i_queue_size;
-	m_i_curr_queue_size = 0;
-	m_i_curr_w_loc = 0;
-	m_i_curr_rd_loc = 0;
-	m_i_pending_jobs = 0;
-	m_ppc_work_item_queue = new work_item*[i_queue_size];
-
-	pthread_mutex_init(&m_t_mutex, NULL);
-	pthread_cond_init(&m_t_job_avail_cond, NULL);
-	pthread_cond_init(&m_t_queue_empty_cond, NULL);
-}
-
-work_queue::~work_queue()
-{
-	delete [] m_ppc_work_item_queue;
-
-	pthread_mutex_destroy(&m_t_mutex);
-	pthread_cond_destroy(&m_t_job_avail_cond);
-	pthread_cond_destroy(&m_t_queue_empty_cond);
-}
-
-int work_queue::add_to_job(work_item *pc_work_item)
-{
-	pthread_mutex_lock(&m_t_mutex);
-	if(m_i_curr_queue_size == m_i_queue_size)	// No space in the queue
-	{
-		pthread_mutex_unlock(&m_t_mutex);
-		return 1;
-	}
-	else	// Space in the queue available
-	{
-		m_ppc_work_item_queue[m_i_curr_w_loc] = pc_work_item;
-		m_i_curr_w_loc = (m_i_curr_w_loc+1) % m_i_queue_size;	// Circular buffer
-		m_i_curr_queue_size++;
-		pthread_cond_signal(&m_t_job_avail_cond);
-		pthread_mutex_unlock(&m_t_mutex);
-		return 0;
-	}
-}
-
-work_item *work_queue::get_next_job()
-{
-	pthread_mutex_lock(&m_t_mutex);
-	work_item *pc_work_item = NULL;
-	while(m_i_curr_queue_size == 0)	// Wait until a job gets available, otherwise, directly process the job
-		pthread_cond_wait(&m_t_job_avail_cond, &m_t_mutex);
-
-	pc_work_item = m_ppc_work_item_queue[m_i_curr_rd_loc];
-	m_i_curr_rd_loc = (m_i_curr_rd_loc+1) % m_i_queue_size;
-	m_i_curr_queue_size--;
-
-	pthread_mutex_unlock(&m_t_mutex);
-	return pc_work_item;
-}
-
-work_item *work_queue::get_next_job_no_wait()
-{
-	work_item *pc_work_item = NULL;
-	pthread_mutex_lock(&m_t_mutex);
-	
-	if(m_i_curr_queue_size > 0)	// Job available
-	{
-		pc_work_item = m_ppc_work_item_queue[m_i_curr_rd_loc];
-		m_i_curr_rd_loc = (m_i_curr_rd_loc+1) % m_i_queue_size;
-		m_i_curr_queue_size--;
-	}
-	
-	pthread_mutex_unlock(&m_t_mutex);
-	return pc_work_item;
-}
-
-int work_queue::get_num_jobs_in_queue()
-{
-	pthread_mutex_lock(&m_t_mutex);
-	int iWrittenItems = m_i_curr_queue_size;
-	pthread_mutex_unlock(&m_t_mutex);
-	return iWrittenItems;
-}
-
-void work_queue::inc_num_jobs_in_process()
-{
-	pthread_mutex_lock(&m_t_mutex);
-	m_i_pending_jobs++;
-	pthread_mutex_unlock(&m_t_mutex);
-}
-
-void work_queue::set_job_done()
-{
-	pthread_mutex_lock(&m_t_mutex);
-	m_i_pending_jobs--;
-	if(m_i_pending_jobs == 0 && m_i_curr_queue_size == 0)
-	{
-		int iRetVal = pthread_cond_signal(&m_t_queue_empty_cond);
-		if(iRetVal != 0)
-		{
-			fprintf(stderr, "File %s Line %d: ERROR Conditional variable not set.\n", 
-					__FILE__,  __LINE__);
-			exit(1);
-		}
-	}
-	pthread_mutex_unlock(&m_t_mutex);
-}
-
-void work_queue::wait_for_queue_empty()
-{
-	// @todo Maybe I can insert a conditional wait statement here and
-	// get rid of too much testing of this function.
-	pthread_mutex_lock(&m_t_mutex);
-	while(m_i_pending_jobs > 0 || m_i_curr_queue_size > 0)	// Wait for job to finish
-		pthread_cond_wait(&m_t_queue_empty_cond,&m_t_mutex);	// Wait should come before signal pthread
-	pthread_mutex_unlock(&m_t_mutex);
+/**
+* @file work_queue.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the work_queue class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <work_queue.h>
+#include <work_item.h>
+#include <stdio.h>
+#include <cstdlib>
+#include <unistd.h>
+
+#define		SPIN_COUNT_MIN		16		//!< Least times to retry before sleeping
+#define		SPIN_COUNT_MAX		4096	//!< Most times to retry before sleeping
+
+/**
+*	Tell the CPU that this is a spin loop.
+*/
+static inline void cpu_relax()
+{
+#if defined __x86_64__ || defined __i386__
+	__builtin_ia32_pause();
+#endif
+}
+
+work_queue::work_queue(int i_queue_size, bool b_lock_free)
+{
+	m_i_queue_size = i_queue_size;
+	m_i_curr_queue_size = 0;
+	m_i_curr_w_loc = 0;
+	m_i_curr_rd_loc = 0;
+	m_i_pending_jobs = 0;
+	m_ppc_work_item_queue = new work_item*[i_queue_size];
+
+	m_b_lock_free = b_lock_free;
+	m_ps_slots = NULL;
+	m_l_enqueue_pos = 0;
+	m_l_dequeue_pos = 0;
+	m_l_jobs = 0;
+	m_i_job_waiters = 0;
+	m_i_space_waiters = 0;
+	m_i_spin_count = SPIN_COUNT_MIN;
+	m_i_spin_count_max = SPIN_COUNT_MAX;
+	if(sysconf(_SC_NPROCESSORS_ONLN) <= 1)	// Spinning only delays the thread which would end the wait
+	{
+		m_i_spin_count = 1;
+		m_i_spin_count_max = 1;
+	}
+	if(m_b_lock_free)
+	{
+		m_ps_slots = new mpmc_slot[i_queue_size];
+		for(int i=0;i<i_queue_size;i++)
+		{
+			m_ps_slots[i].l_seq = i;
+			m_ps_slots[i].pc_work_item = NULL;
+		}
+	}
+
+	pthread_mutex_init(&m_t_mutex, NULL);
+	pthread_cond_init(&m_t_job_avail_cond, NULL);
+	pthread_cond_init(&m_t_queue_empty_cond, NULL);
+	pthread_cond_init(&m_t_space_avail_cond, NULL);
+}
+
+work_queue::~work_queue()
+{
+	delete [] m_ppc_work_item_queue;
+	if(m_ps_slots)
+		delete [] m_ps_slots;
+
+	pthread_mutex_destroy(&m_t_mutex);
+	pthread_cond_destroy(&m_t_job_avail_cond);
+	pthread_cond_destroy(&m_t_queue_empty_cond);
+	pthread_cond_destroy(&m_t_space_avail_cond);
+}
+
+int work_queue::push(work_item *pc_work_item)
+{
+	long l_pos = __atomic_load_n(&m_l_enqueue_pos, __ATOMIC_RELAXED);
+	while(1)
+	{
+		mpmc_slot *ps_slot = &m_ps_slots[l_pos % m_i_queue_size];
+		long l_diff = __atomic_load_n(&ps_slot->l_seq, __ATOMIC_ACQUIRE) - l_pos;
+		if(l_diff == 0)	// Slot is free, claim it
+		{
+			if(__atomic_compare_exchange_n(&m_l_enqueue_pos, &l_pos, l_pos+1, true,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				ps_slot->pc_work_item = pc_work_item;
+				__atomic_store_n(&ps_slot->l_seq, l_pos+1, __ATOMIC_RELEASE);	// Hand the slot to the readers
+				return 0;
+			}
+		}
+		else if(l_diff < 0)	// Slot still holds the job from one round before, i.e. the ring is full
+			return 1;
+		else	// Another writer claimed the slot, try the next one
+			l_pos = __atomic_load_n(&m_l_enqueue_pos, __ATOMIC_RELAXED);
+	}
+}
+
+int work_queue::pop(work_item **ppc_work_item)
+{
+	long l_pos = __atomic_load_n(&m_l_dequeue_pos, __ATOMIC_RELAXED);
+	while(1)
+	{
+		mpmc_slot *ps_slot = &m_ps_slots[l_pos % m_i_queue_size];
+		long l_diff = __atomic_load_n(&ps_slot->l_seq, __ATOMIC_ACQUIRE) - (l_pos+1);
+		if(l_diff == 0)	// Slot holds a job, claim it
+		{
+			if(__atomic_compare_exchange_n(&m_l_dequeue_pos, &l_pos, l_pos+1, true,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				*ppc_work_item = ps_slot->pc_work_item;
+				__atomic_store_n(&ps_slot->l_seq, l_pos+m_i_queue_size, __ATOMIC_RELEASE);	// Hand the slot to the writers of the next round
+				return 0;
+			}
+		}
+		else if(l_diff < 0)	// Slot not written yet, i.e. the ring is empty
+			return 1;
+		else	// Another reader claimed the slot, try the next one
+			l_pos = __atomic_load_n(&m_l_dequeue_pos, __ATOMIC_RELAXED);
+	}
+}
+
+void work_queue::adapt_spin_count(bool b_spin_paid_off)
+{
+	// Racy, but it is only a hint
+	int i_spin_count = __atomic_load_n(&m_i_spin_count, __ATOMIC_RELAXED);
+	if(b_spin_paid_off && i_spin_count < m_i_spin_count_max)
+		__atomic_store_n(&m_i_spin_count, i_spin_count*2, __ATOMIC_RELAXED);
+	else if(!b_spin_paid_off && i_spin_count > SPIN_COUNT_MIN)
+		__atomic_store_n(&m_i_spin_count, i_spin_count/2, __ATOMIC_RELAXED);
+}
+
+int work_queue::spin_pop(work_item **ppc_work_item)
+{
+	int i_spin_count = __atomic_load_n(&m_i_spin_count, __ATOMIC_RELAXED);
+	for(int i=0;i<i_spin_count;i++)
+	{
+		if(pop(ppc_work_item) == 0)
+		{
+			if(i > 0)
+				adapt_spin_count(true);
+			return 0;
+		}
+		cpu_relax();
+	}
+	adapt_spin_count(false);
+	return 1;
+}
+
+int work_queue::spin_push(work_item *pc_work_item)
+{
+	int i_spin_count = __atomic_load_n(&m_i_spin_count, __ATOMIC_RELAXED);
+	for(int i=0;i<i_spin_count;i++)
+	{
+		if(push(pc_work_item) == 0)
+		{
+			if(i > 0)
+				adapt_spin_count(true);
+			return 0;
+		}
+		cpu_relax();
+	}
+	adapt_spin_count(false);
+	return 1;
+}
+
+void work_queue::wake_job_waiter()
+{
+	// The sleeper counts itself before it looks at the ring for the last time, so either
+	// it sees the new job or this sees the sleeper
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&m_i_job_waiters, __ATOMIC_RELAXED) > 0)
+	{
+		pthread_mutex_lock(&m_t_mutex);
+		pthread_cond_signal(&m_t_job_avail_cond);
+		pthread_mutex_unlock(&m_t_mutex);
+	}
+}
+
+void work_queue::wake_space_waiter()
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&m_i_space_waiters, __ATOMIC_RELAXED) > 0)
+	{
+		pthread_mutex_lock(&m_t_mutex);
+		pthread_cond_signal(&m_t_space_avail_cond);
+		pthread_mutex_unlock(&m_t_mutex);
+	}
+}
+
+int work_queue::add_to_job(work_item *pc_work_item)
+{
+	if(m_b_lock_free)
+	{
+		// Count the job before it can be popped, so the queue never looks empty while it is in flight
+		__atomic_add_fetch(&m_l_jobs, 1, __ATOMIC_SEQ_CST);
+		if(push(pc_work_item) != 0)
+		{
+			set_job_done();	// Not added after all
+			return 1;
+		}
+		wake_job_waiter();
+		return 0;
+	}
+
+	pthread_mutex_lock(&m_t_mutex);
+	if(m_i_curr_queue_size == m_i_queue_size)	// No space in the queue
+	{
+		pthread_mutex_unlock(&m_t_mutex);
+		return 1;
+	}
+	else	// Space in the queue available
+	{
+		m_ppc_work_item_queue[m_i_curr_w_loc] = pc_work_item;
+		m_i_curr_w_loc = (m_i_curr_w_loc+1) % m_i_queue_size;	// Circular buffer
+		m_i_curr_queue_size++;
+		pthread_cond_signal(&m_t_job_avail_cond);
+		pthread_mutex_unlock(&m_t_mutex);
+		return 0;
+	}
+}
+
+void work_queue::add_to_job_wait(work_item *pc_work_item)
+{
+	if(m_b_lock_free)
+	{
+		__atomic_add_fetch(&m_l_jobs, 1, __ATOMIC_SEQ_CST);
+		if(spin_push(pc_work_item) != 0)
+		{
+			// Still full, sleep until a thread pops a job
+			pthread_mutex_lock(&m_t_mutex);
+			__atomic_add_fetch(&m_i_space_waiters, 1, __ATOMIC_SEQ_CST);
+			while(push(pc_work_item) != 0)
+				pthread_cond_wait(&m_t_space_avail_cond, &m_t_mutex);
+			__atomic_sub_fetch(&m_i_space_waiters, 1, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&m_t_mutex);
+		}
+		wake_job_waiter();
+		return;
+	}
+
+	pthread_mutex_lock(&m_t_mutex);
+	while(m_i_curr_queue_size == m_i_queue_size)	// Wait until a thread pops a job
+		pthread_cond_wait(&m_t_space_avail_cond, &m_t_mutex);
+
+	m_ppc_work_item_queue[m_i_curr_w_loc] = pc_work_item;
+	m_i_curr_w_loc = (m_i_curr_w_loc+1) % m_i_queue_size;	// Circular buffer
+	m_i_curr_queue_size++;
+	pthread_cond_signal(&m_t_job_avail_cond);
+	pthread_mutex_unlock(&m_t_mutex);
+}
+
+work_item *work_queue::remove_job(bool b_count)
+{
+	if(m_b_lock_free)
+	{
+		work_item *pc_work_item = NULL;
+		if(spin_pop(&pc_work_item) != 0)
+		{
+			// Still empty, sleep until a job is added
+			pthread_mutex_lock(&m_t_mutex);
+			__atomic_add_fetch(&m_i_job_waiters, 1, __ATOMIC_SEQ_CST);
+			while(pop(&pc_work_item) != 0)
+				pthread_cond_wait(&m_t_job_avail_cond, &m_t_mutex);
+			__atomic_sub_fetch(&m_i_job_waiters, 1, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&m_t_mutex);
+		}
+		if(!b_count)	// Counted when it was added
+			__atomic_sub_fetch(&m_l_jobs, 1, __ATOMIC_SEQ_CST);
+		wake_space_waiter();
+		return pc_work_item;
+	}
+
+	pthread_mutex_lock(&m_t_mutex);
+	work_item *pc_work_item = NULL;
+	while(m_i_curr_queue_size == 0)	// Wait until a job gets available, otherwise, directly process the job
+		pthread_cond_wait(&m_t_job_avail_cond, &m_t_mutex);
+
+	pc_work_item = m_ppc_work_item_queue[m_i_curr_rd_loc];
+	m_i_curr_rd_loc = (m_i_curr_rd_loc+1) % m_i_queue_size;
+	m_i_curr_queue_size--;
+	if(b_count)
+		m_i_pending_jobs++;	// Counted under the same lock, so the queue never looks empty while a job is in flight
+	pthread_cond_signal(&m_t_space_avail_cond);
+
+	pthread_mutex_unlock(&m_t_mutex);
+	return pc_work_item;
+}
+
+work_item *work_queue::get_next_job()
+{
+	return remove_job(true);
+}
+
+work_item *work_queue::take()
+{
+	return remove_job(false);
+}
+
+work_item *work_queue::get_next_job_no_wait()
+{
+	work_item *pc_work_item = NULL;
+	if(m_b_lock_free)
+	{
+		if(pop(&pc_work_item) == 0)
+			wake_space_waiter();
+		return pc_work_item;
+	}
+
+	pthread_mutex_lock(&m_t_mutex);
+	
+	if(m_i_curr_queue_size > 0)	// Job available
+	{
+		pc_work_item = m_ppc_work_item_queue[m_i_curr_rd_loc];
+		m_i_curr_rd_loc = (m_i_curr_rd_loc+1) % m_i_queue_size;
+		m_i_curr_queue_size--;
+		m_i_pending_jobs++;
+		pthread_cond_signal(&m_t_space_avail_cond);
+	}
+	
+	pthread_mutex_unlock(&m_t_mutex);
+	return pc_work_item;
+}
+
+int work_queue::get_num_jobs_in_queue()
+{
+	if(m_b_lock_free)
+	{
+		// Only a snapshot, the readers and writers may be half way
+		long l_jobs = __atomic_load_n(&m_l_enqueue_pos, __ATOMIC_ACQUIRE) - 
+			__atomic_load_n(&m_l_dequeue_pos, __ATOMIC_ACQUIRE);
+		if(l_jobs < 0)
+			l_jobs = 0;
+		else if(l_jobs > m_i_queue_size)
+			l_jobs = m_i_queue_size;
+		return (int)l_jobs;
+	}
+
+	pthread_mutex_lock(&m_t_mutex);
+	int iWrittenItems = m_i_curr_queue_size;
+	pthread_mutex_unlock(&m_t_mutex);
+	return iWrittenItems;
+}
+
+void work_queue::set_job_done()
+{
+	if(m_b_lock_free)
+	{
+		// Without a lock, unless this might be the last job
+		long l_jobs = __atomic_load_n(&m_l_jobs, __ATOMIC_RELAXED);
+		while(l_jobs > 1)
+		{
+			if(__atomic_compare_exchange_n(&m_l_jobs, &l_jobs, l_jobs-1, false,
+				__ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+				return;
+		}
+
+		// The last job is counted down under the lock, so that a waiting thread cannot return
+		// (and maybe delete this queue) before the signal is sent
+		pthread_mutex_lock(&m_t_mutex);
+		if(__atomic_sub_fetch(&m_l_jobs, 1, __ATOMIC_SEQ_CST) == 0)
+			pthread_cond_broadcast(&m_t_queue_empty_cond);
+		pthread_mutex_unlock(&m_t_mutex);
+		return;
+	}
+
+	pthread_mutex_lock(&m_t_mutex);
+	m_i_pending_jobs--;
+	if(m_i_pending_jobs == 0 && m_i_curr_queue_size == 0)
+	{
+		int iRetVal = pthread_cond_broadcast(&m_t_queue_empty_cond);	// Wake all the waiting threads
+		if(iRetVal != 0)
+		{
+			fprintf(stderr, "File %s Line %d: ERROR Conditional variable not set.\n", 
+					__FILE__,  __LINE__);
+			exit(1);
+		}
+	}
+	pthread_mutex_unlock(&m_t_mutex);
+}
+
+void work_queue::wait_for_queue_empty()
+{
+	// @todo Maybe I can insert a conditional wait statement here and
+	// get rid of too much testing of this function.
+	pthread_mutex_lock(&m_t_mutex);
+	if(m_b_lock_free)
+	{
+		while(__atomic_load_n(&m_l_jobs, __ATOMIC_SEQ_CST) > 0)
+			pthread_cond_wait(&m_t_queue_empty_cond,&m_t_mutex);
+		pthread_mutex_unlock(&m_t_mutex);
+		return;
+	}
+
+	while(m_i_pending_jobs > 0 || m_i_curr_queue_size > 0)	// Wait for job to finish
+		pthread_cond_wait(&m_t_queue_empty_cond,&m_t_mutex);	// Wait should come before signal pthread
+	pthread_mutex_unlock(&m_t_mutex);
 }
\ No newline at end of file
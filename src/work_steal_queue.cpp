@@ -0,0 +1,211 @@
+/**
+* @file work_steal_queue.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief This file contains the work_steal_queue class.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <work_steal_queue.h>
+#include <work_item.h>
+#include <stdio.h>
+#include <cstdlib>
+
+#define		SPIN_COUNT		128		//!< Times to look for work before going to sleep
+
+work_steal_queue::work_steal_queue(int i_num_threads, int i_queue_size)
+{
+	m_i_num_threads = i_num_threads;
+
+	// Every deque can hold all the work items, so adding a job never fails
+	long l_ring_size = 1;
+	while(l_ring_size < i_queue_size)
+		l_ring_size <<= 1;
+	m_l_ring_mask = l_ring_size - 1;
+
+	m_ps_deque = new steal_deque[m_i_num_threads];
+	for(int i=0;i<m_i_num_threads;i++)
+	{
+		m_ps_deque[i].l_head = 0;
+		m_ps_deque[i].l_tail = 0;
+		m_ps_deque[i].ppc_ring = new work_item*[l_ring_size];
+	}
+
+	m_i_next_deque = 0;
+	m_pc_free_items = NULL;
+	m_l_pending_jobs = 0;
+	m_i_sleeping_threads = 0;
+	m_i_producer_waiting = 0;
+	m_i_shut_down = 0;
+
+	pthread_mutex_init(&m_t_mutex, NULL);
+	pthread_cond_init(&m_t_job_avail_cond, NULL);
+	pthread_cond_init(&m_t_item_free_cond, NULL);
+	pthread_cond_init(&m_t_queue_empty_cond, NULL);
+}
+
+work_steal_queue::~work_steal_queue()
+{
+	for(int i=0;i<m_i_num_threads;i++)
+		delete [] m_ps_deque[i].ppc_ring;
+	delete [] m_ps_deque;
+
+	pthread_mutex_destroy(&m_t_mutex);
+	pthread_cond_destroy(&m_t_job_avail_cond);
+	pthread_cond_destroy(&m_t_item_free_cond);
+	pthread_cond_destroy(&m_t_queue_empty_cond);
+}
+
+void work_steal_queue::add_free_item(work_item *pc_work_item)
+{
+	// Push on the free list
+	work_item *pc_head = __atomic_load_n(&m_pc_free_items, __ATOMIC_RELAXED);
+	do
+	{
+		pc_work_item->m_pc_next = pc_head;
+	}while(!__atomic_compare_exchange_n(&m_pc_free_items, &pc_head, pc_work_item, false,
+		__ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+	if(__atomic_load_n(&m_i_producer_waiting, __ATOMIC_SEQ_CST))
+	{
+		pthread_mutex_lock(&m_t_mutex);
+		pthread_cond_signal(&m_t_item_free_cond);
+		pthread_mutex_unlock(&m_t_mutex);
+	}
+}
+
+work_item *work_steal_queue::get_free_item()
+{
+	// Pop from the free list. There is a single popper, so the head cannot be popped and
+	// pushed again between reading it and the compare and swap.
+	work_item *pc_head = __atomic_load_n(&m_pc_free_items, __ATOMIC_ACQUIRE);
+	while(pc_head && !__atomic_compare_exchange_n(&m_pc_free_items, &pc_head, pc_head->m_pc_next, false,
+		__ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+	if(pc_head)
+		return pc_head;
+
+	// Wait until a thread finishes a job
+	pthread_mutex_lock(&m_t_mutex);
+	__atomic_store_n(&m_i_producer_waiting, 1, __ATOMIC_SEQ_CST);
+	while(!(pc_head = __atomic_load_n(&m_pc_free_items, __ATOMIC_SEQ_CST)))
+		pthread_cond_wait(&m_t_item_free_cond, &m_t_mutex);
+	__atomic_store_n(&m_i_producer_waiting, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&m_t_mutex);
+
+	while(pc_head && !__atomic_compare_exchange_n(&m_pc_free_items, &pc_head, pc_head->m_pc_next, false,
+		__ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+	return pc_head;
+}
+
+void work_steal_queue::add_to_job(work_item *pc_work_item)
+{
+	__atomic_add_fetch(&m_l_pending_jobs, 1, __ATOMIC_SEQ_CST);
+
+	// Round robin over the threads, so that they start with a fair share
+	steal_deque *ps_deque = &m_ps_deque[m_i_next_deque];
+	m_i_next_deque = (m_i_next_deque+1) % m_i_num_threads;
+
+	long l_tail = ps_deque->l_tail;
+	ps_deque->ppc_ring[l_tail & m_l_ring_mask] = pc_work_item;
+	__atomic_store_n(&ps_deque->l_tail, l_tail+1, __ATOMIC_SEQ_CST);
+
+	if(__atomic_load_n(&m_i_sleeping_threads, __ATOMIC_SEQ_CST) > 0)
+	{
+		pthread_mutex_lock(&m_t_mutex);
+		pthread_cond_signal(&m_t_job_avail_cond);
+		pthread_mutex_unlock(&m_t_mutex);
+	}
+}
+
+work_item *work_steal_queue::pop(steal_deque *ps_deque)
+{
+	long l_head = __atomic_load_n(&ps_deque->l_head, __ATOMIC_ACQUIRE);
+	while(1)
+	{
+		long l_tail = __atomic_load_n(&ps_deque->l_tail, __ATOMIC_ACQUIRE);
+		if(l_head >= l_tail)
+			return NULL;
+
+		// The slot is not reused before the head moves past it, as a ring holds all the work items
+		work_item *pc_work_item = ps_deque->ppc_ring[l_head & m_l_ring_mask];
+		if(__atomic_compare_exchange_n(&ps_deque->l_head, &l_head, l_head+1, false,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return pc_work_item;
+	}
+}
+
+int work_steal_queue::job_available()
+{
+	for(int i=0;i<m_i_num_threads;i++)
+		if(__atomic_load_n(&m_ps_deque[i].l_head, __ATOMIC_SEQ_CST) <
+			__atomic_load_n(&m_ps_deque[i].l_tail, __ATOMIC_SEQ_CST))
+			return 1;
+	return 0;
+}
+
+work_item *work_steal_queue::get_next_job(int i_thread_num)
+{
+	while(1)
+	{
+		for(int i_spin=0;i_spin<SPIN_COUNT;i_spin++)
+		{
+			if(__atomic_load_n(&m_i_shut_down, __ATOMIC_ACQUIRE))
+				return NULL;
+
+			// Own deque first, then steal from the others
+			for(int i=0;i<m_i_num_threads;i++)
+			{
+				work_item *pc_work_item = pop(&m_ps_deque[(i_thread_num+i) % m_i_num_threads]);
+				if(pc_work_item)
+					return pc_work_item;
+			}
+#if defined __x86_64__ || defined __i386__
+			__builtin_ia32_pause();
+#endif
+		}
+
+		// Nothing to do, sleep until the producer adds a job
+		pthread_mutex_lock(&m_t_mutex);
+		__atomic_add_fetch(&m_i_sleeping_threads, 1, __ATOMIC_SEQ_CST);
+		while(!job_available() && !m_i_shut_down)
+			pthread_cond_wait(&m_t_job_avail_cond, &m_t_mutex);
+		__atomic_sub_fetch(&m_i_sleeping_threads, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&m_t_mutex);
+	}
+}
+
+void work_steal_queue::set_job_done(work_item *pc_work_item)
+{
+	add_free_item(pc_work_item);
+
+	// Without a lock, unless this might be the last job
+	long l_pending = __atomic_load_n(&m_l_pending_jobs, __ATOMIC_RELAXED);
+	while(l_pending > 1)
+	{
+		if(__atomic_compare_exchange_n(&m_l_pending_jobs, &l_pending, l_pending-1, false,
+			__ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			return;
+	}
+
+	// The last job is counted down under the lock, so that a waiting thread cannot return
+	// (and maybe delete this queue) before the signal is sent
+	pthread_mutex_lock(&m_t_mutex);
+	if(__atomic_sub_fetch(&m_l_pending_jobs, 1, __ATOMIC_SEQ_CST) == 0)
+		pthread_cond_broadcast(&m_t_queue_empty_cond);
+	pthread_mutex_unlock(&m_t_mutex);
+}
+
+void work_steal_queue::wait_for_queue_empty()
+{
+	pthread_mutex_lock(&m_t_mutex);
+	while(__atomic_load_n(&m_l_pending_jobs, __ATOMIC_SEQ_CST) > 0)
+		pthread_cond_wait(&m_t_queue_empty_cond, &m_t_mutex);
+	pthread_mutex_unlock(&m_t_mutex);
+}
+
+void work_steal_queue::shut_down()
+{
+	pthread_mutex_lock(&m_t_mutex);
+	__atomic_store_n(&m_i_shut_down, 1, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&m_t_job_avail_cond);
+	pthread_mutex_unlock(&m_t_mutex);
+}
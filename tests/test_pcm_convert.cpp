@@ -0,0 +1,154 @@
+/**
+* @file test_pcm_convert.cpp
+* @author Muhammad Usman Karim Khan, karim.usman@yahoo.com
+* @brief Test that every PCM conversion kernel writes the same samples as the scalar one.
+* Copyright 2017, Muhammad Usman Karim Khan, All rights reserved.
+*/
+
+#include <pcm_convert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define		VECTOR_SAMPLES		32			//!< Most samples a kernel converts per step (AVX2, 16 bit)
+#define		MAX_SAMPLES			(2*VECTOR_SAMPLES+1)	//!< Every length from 0 to this is tested
+#define		MAX_SRC_OFFSET		31			//!< Input starts at every byte offset up to this
+#define		MAX_DST_OFFSET		7			//!< Output starts at every sample offset up to this
+#define		GUARD_BYTES			64			//!< Bytes before and after every output, which no kernel may touch
+#define		GUARD_VALUE			0xA5		//!< Value of the guard bytes
+
+/**
+*	Input buffer ending right before a page that cannot be read, so that a kernel reading past
+*	the end of its input crashes instead of passing.
+*/
+typedef struct _guarded_src
+{
+	unsigned char	*pc_map;		//!< Mapping of the data pages and the guard page
+	size_t			l_map_bytes;	//!< Size of the mapping
+	unsigned char	*pc_end;		//!< First byte of the guard page
+} guarded_src;
+
+int alloc_guarded_src(guarded_src *ps_src, size_t l_bytes)
+{
+	size_t l_page = sysconf(_SC_PAGESIZE);
+	size_t l_data = (l_bytes + l_page - 1) / l_page * l_page;
+	ps_src->l_map_bytes = l_data + l_page;
+	ps_src->pc_map = (unsigned char *)mmap(NULL, ps_src->l_map_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(ps_src->pc_map == MAP_FAILED)
+		return 1;
+	ps_src->pc_end = ps_src->pc_map + l_data;
+	return mprotect(ps_src->pc_end, l_page, PROT_NONE);
+}
+
+/**
+*	Check that the guard bytes around an output are untouched.
+*	@return 0: untouched, otherwise: a kernel wrote outside its output.
+*/
+int check_guards(const unsigned char *pc_dst, int i_out_bytes, int i_dst_offset, int i_samples)
+{
+	const unsigned char *pc_data = pc_dst + GUARD_BYTES + i_dst_offset * i_out_bytes;
+	for(const unsigned char *p = pc_dst; p < pc_data; p++)
+		if(*p != GUARD_VALUE)
+			return 1;
+	for(const unsigned char *p = pc_data + i_samples * i_out_bytes; p < pc_data + i_samples * i_out_bytes + GUARD_BYTES; p++)
+		if(*p != GUARD_VALUE)
+			return 1;
+	return 0;
+}
+
+/**
+*	Test one kernel against the scalar one for every length, input offset and output offset.
+*	@return Number of failed cases.
+*/
+int test_kernel(int i_bytes, int i_channels, int i_out_bytes, pcm_isa e_isa, guarded_src *ps_src)
+{
+	pcm_convert_func p_convert = pcm_get_convert_func(i_bytes, i_channels, i_out_bytes, e_isa);
+	pcm_convert_func p_scalar = pcm_get_convert_func(i_bytes, i_channels, i_out_bytes, PCM_ISA_SCALAR);
+	const char *pc_out = (i_out_bytes == sizeof(short)) ? "short" : "int";
+
+	int i_dst_bytes = GUARD_BYTES + (MAX_DST_OFFSET + MAX_SAMPLES) * i_out_bytes + GUARD_BYTES;
+	unsigned char *ppc_dst[2], *ppc_ref[2];
+	for(int c=0;c<2;c++)
+	{
+		ppc_dst[c] = new unsigned char[i_dst_bytes];
+		ppc_ref[c] = new unsigned char[i_dst_bytes];
+	}
+
+	int i_failed = 0;
+	unsigned int ui_random = i_bytes * 131 + i_channels * 17 + i_out_bytes;
+	for(int i_samples=0;i_samples<=MAX_SAMPLES;i_samples++)
+	{
+		int i_src_bytes = i_samples * i_bytes * i_channels;
+		for(int i_src_offset=0;i_src_offset<=MAX_SRC_OFFSET;i_src_offset++)
+		{
+			// The input ends at the guard page, its start moves with the offset
+			unsigned char *pc_src = ps_src->pc_end - i_src_bytes - (MAX_SRC_OFFSET - i_src_offset);
+			for(int i=0;i<i_src_bytes;i++)
+			{
+				ui_random = ui_random * 1664525 + 1013904223;
+				pc_src[i] = ui_random >> 24;
+			}
+
+			for(int i_dst_offset=0;i_dst_offset<=MAX_DST_OFFSET;i_dst_offset++)
+			{
+				void *ppv_dst[2], *ppv_ref[2];
+				for(int c=0;c<2;c++)
+				{
+					memset(ppc_dst[c], GUARD_VALUE, i_dst_bytes);
+					memset(ppc_ref[c], GUARD_VALUE, i_dst_bytes);
+					ppv_dst[c] = ppc_dst[c] + GUARD_BYTES + i_dst_offset * i_out_bytes;
+					ppv_ref[c] = ppc_ref[c] + GUARD_BYTES + i_dst_offset * i_out_bytes;
+				}
+
+				p_scalar(pc_src, ppv_ref, i_samples);
+				p_convert(pc_src, ppv_dst, i_samples);
+
+				int i_error = 0;
+				for(int c=0;c<i_channels;c++)
+				{
+					i_error |= memcmp(ppv_dst[c], ppv_ref[c], i_samples * i_out_bytes) != 0;
+					i_error |= check_guards(ppc_dst[c], i_out_bytes, i_dst_offset, i_samples) << 1;
+				}
+				if(i_error)
+				{
+					fprintf(stderr, "FAILED %2d bit %d ch to %-5s %-7s samples %d src offset %d dst offset %d:%s%s\n",
+						i_bytes*8, i_channels, pc_out, pcm_get_isa_name(e_isa), i_samples, i_src_offset, i_dst_offset,
+						(i_error & 1) ? " samples differ from scalar" : "", (i_error & 2) ? " wrote outside its output" : "");
+					i_failed++;
+				}
+			}
+		}
+	}
+
+	for(int c=0;c<2;c++)
+	{
+		delete [] ppc_dst[c];
+		delete [] ppc_ref[c];
+	}
+	printf("%2d bit %d ch to %-5s %-7s %s\n", i_bytes*8, i_channels, pc_out, pcm_get_isa_name(e_isa), i_failed ? "FAILED" : "ok");
+	return i_failed;
+}
+
+int main(int argc, char **argv)
+{
+	guarded_src s_src;
+	if(alloc_guarded_src(&s_src, MAX_SAMPLES * 4 * 2 + MAX_SRC_OFFSET))
+	{
+		fprintf(stderr, "File %s Line %d: ERROR Cannot map the input buffer.\n", __FILE__, __LINE__);
+		return 1;
+	}
+
+	int i_failed = 0;
+	for(int i_bytes=2;i_bytes<=4;i_bytes++)
+		for(int i_channels=1;i_channels<=2;i_channels++)
+			for(int i_out_bytes=sizeof(short);i_out_bytes<=(int)sizeof(int);i_out_bytes+=sizeof(int)-sizeof(short))
+				for(int i_isa=PCM_ISA_SCALAR+1;i_isa<=pcm_get_best_isa();i_isa++)
+					i_failed += test_kernel(i_bytes, i_channels, i_out_bytes, (pcm_isa)i_isa, &s_src);
+
+	munmap(s_src.pc_map, s_src.l_map_bytes);
+	if(pcm_get_best_isa() == PCM_ISA_SCALAR)
+		printf("Only the scalar kernels run on this CPU, nothing to compare\n");
+	return i_failed ? 1 : 0;
+}